@@ -4,6 +4,7 @@
 #include <cstddef>
 #include <memory>
 #include <cassert>
+#include <algorithm>
 
 namespace
 {
@@ -17,41 +18,53 @@ struct FreeDeleter
     }
 };
 
-bool in_range(const void* ptr, const void* begin, uint32_t size) noexcept
-{
-    const uintptr_t p = reinterpret_cast<uintptr_t>(ptr);
-    const uintptr_t b = reinterpret_cast<uintptr_t>(begin);
-    return (p >= b) && (p < (b + size));
-}
-
 } // anonymous namespace
 
 struct BumpAlloc::Block
-  : public std::unique_ptr<char[], FreeDeleter>
 {
-    Block(void* ptr) noexcept
-      : std::unique_ptr<char[], FreeDeleter>{static_cast<char*>(ptr)}
-    {}
+    std::unique_ptr<char[], FreeDeleter> memory;
+    uint32_t size;
+
+    Block(const uint32_t requested_size)
+      : memory{}
+      , size{requested_size}
+    {
+        // aligned_alloc wants a multiple of the alignment
+        constexpr uint32_t alignment = alignof(std::max_align_t);
+        const std::size_t bytes = (std::size_t{requested_size} + (alignment - 1)) & -std::size_t{alignment};
+        memory.reset(static_cast<char*>(std::aligned_alloc(alignment, bytes)));
+        if (!memory) {
+            throw std::bad_alloc{};
+        }
+    }
+
+    char* get() const noexcept
+    {
+        return memory.get();
+    }
 };
 
-BumpAlloc::BumpAlloc()
-  : m_state{0, -1u}
+BumpAlloc::BumpAlloc(const uint32_t initial_block_size)
+  : m_state{0, -1u, 0}
+  , m_block_size{0}
+  , m_initial_block_size{std::max(initial_block_size, 1u)}
   , m_blocks{}
-  , m_deleter{nullptr}
+  , m_large{}
 {}
 
-BumpAlloc::~BumpAlloc()
-{
-    reset();
-}
+BumpAlloc::~BumpAlloc() = default;
 
 BumpAlloc::BumpAlloc(BumpAlloc&& other) noexcept
   : m_state{other.m_state}
+  , m_block_size{other.m_block_size}
+  , m_initial_block_size{other.m_initial_block_size}
   , m_blocks{std::move(other.m_blocks)}
-  , m_deleter{other.m_deleter}
+  , m_large{std::move(other.m_large)}
 {
-    other.m_state = State{0, -1u};
-    other.m_deleter = nullptr;
+    other.m_state = State{0, -1u, 0};
+    other.m_block_size = 0;
+    other.m_blocks.clear();
+    other.m_large.clear();
 }
 
 BumpAlloc& BumpAlloc::operator=(BumpAlloc&& other) noexcept
@@ -63,56 +76,49 @@ BumpAlloc& BumpAlloc::operator=(BumpAlloc&& other) noexcept
 
 void BumpAlloc::reset() noexcept
 {
-    Deleter* deleter = m_deleter;
-    while (deleter) {
-        Deleter* const next = deleter->next;
-        deleter->dtor(deleter);
-        deleter = next;
-    }
-
-    m_deleter = nullptr;
+    // regular blocks are recycled, oversized ones are returned to the system
+    m_large.clear();
+    m_state.large = 0;
     if (m_blocks.empty()) {
         m_state.block = -1u;
         m_state.offset = 0;
+        m_block_size = 0;
     } else {
         m_state.block = 0;
-        m_state.offset = BLOCK_SIZE;
+        m_state.offset = m_blocks.front().size;
+        m_block_size = m_blocks.front().size;
     }
 }
 
 void BumpAlloc::reset(const State state) noexcept
 {
-    assert((state.block < m_state.block && state.offset <= BLOCK_SIZE) ||
-           (state.block == m_state.block && state.offset <= m_state.offset));
-
-    Deleter* deleter = m_deleter;
-    uint32_t block_idx = m_state.block;
-    while (block_idx > state.block) {
-        const char* const block = m_blocks[block_idx].get();
-        while (deleter && in_range(deleter, block, BLOCK_SIZE)) {
-            Deleter* const next = deleter->next;
-            deleter->dtor(deleter);
-            deleter = next;
-        }
-        --block_idx;
-    }
+    assert(state.large <= m_state.large);
+    assert(state.block == -1u ||
+           (state.block + 1 < m_state.block + 1 && state.offset <= m_blocks[state.block].size) ||
+           (state.block == m_state.block && state.offset >= m_state.offset));
 
-    assert(block_idx == state.block);
-    const char* const block = m_blocks[block_idx].get();
-    while (deleter && in_range(deleter, block, state.offset)) {
-        Deleter* const next = deleter->next;
-        deleter->dtor(deleter);
-        deleter = next;
-    }
-    m_deleter = deleter;
+    m_large.erase(m_large.begin() + state.large, m_large.end());
     m_state = state;
+    m_block_size = (state.block == -1u) ? 0 : m_blocks[state.block].size;
 }
 
 void BumpAlloc::swap(BumpAlloc& other) noexcept
 {
     std::swap(m_state, other.m_state);
+    std::swap(m_block_size, other.m_block_size);
+    std::swap(m_initial_block_size, other.m_initial_block_size);
     m_blocks.swap(other.m_blocks);
-    std::swap(m_deleter, other.m_deleter);
+    m_large.swap(other.m_large);
+}
+
+uint32_t BumpAlloc::block_size(const uint32_t idx) const noexcept
+{
+    return m_blocks[idx].size;
+}
+
+std::size_t BumpAlloc::num_blocks() const noexcept
+{
+    return m_blocks.size();
 }
 
 
@@ -123,23 +129,39 @@ void* BumpAlloc::raw_allocate(const uint32_t initial_size,
     assert(alignment <= alignof(std::max_align_t));
 
     const uint32_t size = std::max(initial_size, 1u);
-    if (size > BLOCK_SIZE) {
-        std::abort();
+    if (size > m_initial_block_size) {
+        return allocate_large(size);
     }
 
-    uint32_t new_offset = (m_state.offset - size) & -alignment;
-    if (new_offset < BLOCK_SIZE) {
+    const uint32_t new_offset = (m_state.offset - size) & -alignment;
+    if (new_offset < m_block_size) {
         m_state.offset = new_offset;
         return m_blocks[m_state.block].get() + new_offset;
     }
+    return allocate_from_next_block(size, alignment);
+}
 
-    if (m_state.block + 1 == m_blocks.size()) {
-        m_blocks.emplace_back(std::aligned_alloc(alignof(std::max_align_t), BLOCK_SIZE));
+void* BumpAlloc::allocate_large(const uint32_t size)
+{
+    m_large.emplace_back(size);
+    m_state.large = m_large.size();
+    return m_large.back().get();
+}
+
+void* BumpAlloc::allocate_from_next_block(const uint32_t size,
+                                          const uint32_t alignment)
+{
+    const uint32_t next = m_state.block + 1;
+    if (next == m_blocks.size()) {
+        const uint32_t max_size = std::max(MAX_BLOCK_SIZE, m_initial_block_size);
+        const uint64_t grown = uint64_t{m_initial_block_size} << std::min(next, 32u);
+        m_blocks.emplace_back(static_cast<uint32_t>(std::min<uint64_t>(grown, max_size)));
     }
-    m_state.block++;
-    m_state.offset = (BLOCK_SIZE - size) & -alignment;
-    assert(m_state.offset < BLOCK_SIZE);
-    return m_blocks[m_state.block].get() + m_state.offset;
+    m_state.block = next;
+    m_block_size = m_blocks[next].size;
+    m_state.offset = (m_block_size - size) & -alignment;
+    assert(m_state.offset < m_block_size);
+    return m_blocks[next].get() + m_state.offset;
 }
 
 
@@ -147,65 +169,96 @@ void* BumpAlloc::raw_allocate(const uint32_t initial_size,
 //
 #include <doctest/doctest.h>
 
+#include <array>
+
 namespace
 {
 
-class Signal
+struct Item
 {
-public:
-    Signal() = default;
-
-    constexpr explicit
-    Signal(int32_t* signal) noexcept
-      : m_signal{signal}
-    {}
-
-    ~Signal()
-    {
-        if (m_signal) {
-            ++*m_signal;
-        }
-    }
-
-    Signal(const Signal&) = delete;
-    Signal(Signal&&) = delete;
-    Signal& operator=(const Signal&) = delete;
-    Signal& operator=(Signal&&) = delete;
-private:
-    int32_t* m_signal{nullptr};
+    int64_t a;
+    int64_t b;
+    int64_t c;
 };
 
 TEST_CASE("Bump allocator tests")
 {
-    static constexpr int32_t SIGNAL_SIZE = 24; // m_signal + deleter (2x pointer)
-    static constexpr int32_t SIGNALS_PER_BLOCK = BumpAlloc::BLOCK_SIZE / SIGNAL_SIZE;
+    static constexpr int32_t ITEM_SIZE = sizeof(Item);
+    static constexpr int32_t ITEMS_PER_BLOCK = BumpAlloc::DEFAULT_BLOCK_SIZE / ITEM_SIZE;
 
     BumpAlloc alloc;
-    int32_t counter{0};
 
-    for (int32_t i = 0; i < SIGNALS_PER_BLOCK + 5; ++i) {
-        alloc.allocate<Signal>(&counter);
+    const Item* item{nullptr};
+    for (int32_t i = 0; i < ITEMS_PER_BLOCK + 5; ++i) {
+        item = alloc.allocate<Item>(i, 0, 0);
     }
+    CHECK(item->a == ITEMS_PER_BLOCK + 4);
 
     {
         BumpAlloc::State state = alloc.get_state();
 
         CHECK(state.block == 1);
-        CHECK(state.offset == BumpAlloc::BLOCK_SIZE - 5 * SIGNAL_SIZE);
+        CHECK(alloc.block_size(1) == 2 * BumpAlloc::DEFAULT_BLOCK_SIZE);
+        CHECK(state.offset == 2 * BumpAlloc::DEFAULT_BLOCK_SIZE - 5 * ITEM_SIZE);
+    }
+
+    {
+        BumpAlloc::State state{10 * ITEM_SIZE, 0};
+        alloc.reset(state);
+        alloc.allocate<Item>();
+
+        CHECK(alloc.get_state().block == 0);
+        CHECK(alloc.get_state().offset == 9 * ITEM_SIZE);
     }
 
+    alloc.reset();
+    CHECK(alloc.get_state().block == 0);
+    CHECK(alloc.get_state().offset == BumpAlloc::DEFAULT_BLOCK_SIZE);
+
+    const std::array<int32_t, 3> source{1, 2, 3};
+    const std::span<int32_t> copy = alloc.allocate_span<int32_t>(source);
+    REQUIRE(copy.size() == 3);
+    CHECK(copy.data() != source.data());
+    CHECK(copy[2] == 3);
+    CHECK(alloc.allocate_span<int32_t>({}).empty());
+}
 
+TEST_CASE("Bump allocator growth and oversized allocations")
+{
+    struct Big
     {
-        CHECK(counter == 0);
+        std::array<char, 64 * 1024> data;
+    };
 
-        BumpAlloc::State state{10 * SIGNAL_SIZE, 0};
-        alloc.reset(state);
+    BumpAlloc alloc{1024};
 
-        CHECK(counter == 15);
+    // 1 + 2 + 4 + 8 KiB hold 638 items, the fifth block the rest
+    for (int32_t i = 0; i < 1000; ++i) {
+        alloc.allocate<Item>();
     }
+    REQUIRE(alloc.num_blocks() == 5);
+    CHECK(alloc.block_size(0) == 1024);
+    CHECK(alloc.block_size(4) == 16 * 1024);
+
+    const BumpAlloc::State state = alloc.get_state();
+    CHECK(state.large == 0);
 
+    Big* const big = alloc.allocate<Big>();
+    CHECK(alloc.get_state().large == 1);
+    CHECK(reinterpret_cast<uintptr_t>(big) % alignof(Big) == 0);
+    alloc.allocate<Item>();
+
+    alloc.reset(state);
+    CHECK(alloc.get_state().large == 0);
+    CHECK(alloc.get_state().offset == state.offset);
+
+    // blocks are recycled
     alloc.reset();
-    CHECK(counter == SIGNALS_PER_BLOCK + 5);
+    for (int32_t i = 0; i < 1000; ++i) {
+        alloc.allocate<Item>();
+    }
+    CHECK(alloc.num_blocks() == 5);
+    CHECK(alloc.get_state().block == 4);
 }
 
 } // anonymous namespace
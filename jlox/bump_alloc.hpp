@@ -1,6 +1,10 @@
 #pragma once
 
+#include <cassert>
+#include <cstddef>
 #include <cstdint>
+#include <memory>
+#include <span>
 #include <vector>
 #include <type_traits>
 #include <new>
@@ -8,17 +12,28 @@
 class BumpAlloc
 {
 public:
-    inline static constexpr int32_t BLOCK_SIZE = 16 * 1024;
+    inline static constexpr uint32_t DEFAULT_BLOCK_SIZE = 16 * 1024;
+    //! Blocks double in size up to this limit (or the initial size if larger).
+    inline static constexpr uint32_t MAX_BLOCK_SIZE = 1024 * 1024;
+
     struct State {
         uint32_t offset;
         uint32_t block;
+        //! number of dedicated allocations for oversized requests
+        uint32_t large{0};
     };
 
-    BumpAlloc();
+    /**
+     * Requests larger than `initial_block_size` get a dedicated allocation,
+     * everything else is carved from blocks of geometrically growing size.
+     */
+    explicit
+    BumpAlloc(uint32_t initial_block_size = DEFAULT_BLOCK_SIZE);
     ~BumpAlloc();
     BumpAlloc(BumpAlloc&&) noexcept;
     BumpAlloc& operator=(BumpAlloc&&) noexcept;
 
+    //! Rewind the arena, allocated objects are never destroyed.
     void reset() noexcept;
     void reset(State state) noexcept;
 
@@ -26,63 +41,43 @@ public:
         return m_state;
     }
 
+    //! Size of block `idx`, blocks are kept across reset().
+    uint32_t block_size(uint32_t idx) const noexcept;
+
+    std::size_t num_blocks() const noexcept;
+
     template <typename T, typename... Args>
     T* allocate(Args&&... args)
     {
-        if constexpr (std::is_trivially_destructible_v<T>) {
-            if constexpr (noexcept(T{std::forward<Args>(args)...})) {
-                return new(raw_allocate(sizeof(T), alignof(T))) T{std::forward<Args>(args)...};
-            } else {
-                AllocationHelper helper{*this, sizeof(T), alignof(T)};
-                new (helper.ptr()) T{std::forward<Args>(args)...};
-                return helper.release<T>();
-            }
+        static_assert(std::is_trivially_destructible_v<T>,
+                      "BumpAlloc never runs destructors");
+        if constexpr (noexcept(T{std::forward<Args>(args)...})) {
+            return new(raw_allocate(sizeof(T), alignof(T))) T{std::forward<Args>(args)...};
         } else {
-            using VWD = ValueWithDeleter<T>;
-            if constexpr (noexcept(VWD{&m_deleter, std::forward<Args>(args)...})) {
-                VWD* result = new(raw_allocate(sizeof(VWD), alignof(VWD))) VWD{&m_deleter, std::forward<Args>(args)...};
-                return std::addressof(result->value);
-            } else {
-                AllocationHelper helper{*this, sizeof(VWD), alignof(VWD)};
-                VWD* result = new (helper.ptr()) VWD{&m_deleter, std::forward<Args>(args)...};
-                static_cast<void>(result);
-                return std::addressof(helper.release<VWD>()->value);
-            }
+            AllocationHelper helper{*this, sizeof(T), alignof(T)};
+            new (helper.ptr()) T{std::forward<Args>(args)...};
+            return helper.release<T>();
         }
     }
 
-    void swap(BumpAlloc&) noexcept;
-
-private:
-    struct Block;
-
-    struct Deleter
-    {
-        void (*dtor)(Deleter*) noexcept;
-        Deleter* next;
-    };
-
+    //! Copy `items` into one contiguous allocation.
     template <typename T>
-    struct ValueWithDeleter : Deleter
+    std::span<T> allocate_span(std::span<const T> items)
     {
-        T value;
-
-        template <typename... Args>
-        constexpr
-        ValueWithDeleter(Deleter** head, Args&&... args) noexcept(noexcept(T{std::forward<Args>(args)...}))
-          : Deleter{&ValueWithDeleter::destroy, *head}
-          , value{std::forward<Args>(args)...}
-        {
-            *head = this;
+        static_assert(std::is_trivially_copyable_v<T> && std::is_trivially_destructible_v<T>);
+        if (items.empty()) {
+            return {};
         }
+        assert(items.size() <= UINT32_MAX / sizeof(T));
+        T* const result = static_cast<T*>(raw_allocate(static_cast<uint32_t>(sizeof(T) * items.size()), alignof(T)));
+        std::uninitialized_copy(items.begin(), items.end(), result);
+        return {result, items.size()};
+    }
 
-        static constexpr
-        void destroy(Deleter* const deleter) noexcept
-        {
-            ValueWithDeleter* const this_ptr = static_cast<ValueWithDeleter*>(deleter);
-            this_ptr->~ValueWithDeleter();
-        }
-    };
+    void swap(BumpAlloc&) noexcept;
+
+private:
+    struct Block;
 
     class AllocationHelper {
     public:
@@ -120,8 +115,12 @@ private:
     friend class AllocationHelper;
 
     void* raw_allocate(uint32_t size, uint32_t alignment);
+    void* allocate_large(uint32_t size);
+    void* allocate_from_next_block(uint32_t size, uint32_t alignment);
 
     State m_state;
+    uint32_t m_block_size;
+    uint32_t m_initial_block_size;
     std::vector<Block> m_blocks;
-    Deleter* m_deleter;
+    std::vector<Block> m_large;
 };
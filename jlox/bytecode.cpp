@@ -0,0 +1,633 @@
+#include "bytecode.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+#include <stdexcept>
+
+#include <absl/container/flat_hash_map.h>
+#include <doctest/doctest.h>
+
+#include "expr.hpp"
+#include "log.hpp"
+#include "resolver.hpp"
+#include "scanner.hpp"
+#include "stmt.hpp"
+
+namespace bytecode
+{
+
+const ErrorSite& Function::error_site(const int32_t end) const noexcept
+{
+    const auto it = std::lower_bound(error_sites.begin(), error_sites.end(), end,
+                                     [] (const ErrorSite& site, const int32_t e) { return site.end < e; });
+    assert(it != error_sites.end() && it->end == end);
+    return *it;
+}
+
+namespace
+{
+
+class CompileError final : public std::runtime_error
+{
+public:
+    CompileError() : std::runtime_error{""} {}
+};
+
+constexpr
+int32_t stack_effect(const OpCode op, const int32_t operand) noexcept
+{
+    switch (op) {
+    using enum OpCode;
+    case CONSTANT:
+    case NIL:
+    case TRUE:
+    case FALSE:
+    case GET_LOCAL:
+    case GET_CAPTURED:
+    case GET_GLOBAL:
+    case CLOSURE:
+        return 1;
+
+    case SET_LOCAL:
+    case SET_CAPTURED:
+    case SET_GLOBAL:
+    case NOT:
+    case NEGATE:
+    case TO_BOOL:
+    case JUMP:
+    case LOOP:
+    case OPEN_SCOPE:
+    case CLOSE_SCOPE:
+        return 0;
+
+    case POP:
+    case DEFINE_CAPTURED:
+    case DEFINE_GLOBAL:
+    case EQUAL:
+    case NOT_EQUAL:
+    case GREATER:
+    case GREATER_EQUAL:
+    case LESS:
+    case LESS_EQUAL:
+    case ADD:
+    case SUBTRACT:
+    case MULTIPLY:
+    case DIVIDE:
+    case PRINT:
+    case JUMP_IF_FALSE:
+    case RETURN:
+        return -1;
+
+    case POP_N:
+        return -operand;
+
+    case CALL:
+        // the callee and the arguments become the result
+        return -operand;
+    }
+    std::abort();
+}
+
+class Compiler final : public ExprVisitor
+                     , public StmtVisitor
+{
+public:
+    Compiler(const ScannerResult& scanner_result, Program& program, CapturedSlots&& captured)
+      : m_scanner_result{scanner_result}
+      , m_program{program}
+      , m_captured{std::move(captured)}
+    {}
+
+    void compile_statement(Stmt& stmt)
+    {
+        Function& function = m_program.functions.emplace_back();
+        m_functions.push_back({&function});
+        static_cast<void>(stmt.accept(*this));
+        emit(OpCode::NIL);
+        emit(OpCode::RETURN);
+        finish_function();
+        m_program.statements.push_back(&function);
+    }
+
+    void visit(BinaryExpr& binary_expr) override
+    {
+        binary_expr.left->accept(*this);
+        binary_expr.right->accept(*this);
+
+        const Token* const left = binary_expr.left->get_main_token();
+        const Token* const right = binary_expr.right->get_main_token();
+        switch (binary_expr.op->type()) {
+        using enum TokenType;
+        case PLUS:
+            emit(OpCode::ADD);
+            // both operands are fine on their own, blame the operator
+            add_error_site(binary_expr.op);
+            return;
+        case EQUAL_EQUAL:
+            emit(OpCode::EQUAL);
+            return;
+        case BANG_EQUAL:
+            emit(OpCode::NOT_EQUAL);
+            return;
+        case MINUS:
+            emit(OpCode::SUBTRACT);
+            break;
+        case SLASH:
+            emit(OpCode::DIVIDE);
+            break;
+        case STAR:
+            emit(OpCode::MULTIPLY);
+            break;
+        case GREATER:
+            emit(OpCode::GREATER);
+            break;
+        case GREATER_EQUAL:
+            emit(OpCode::GREATER_EQUAL);
+            break;
+        case LESS:
+            emit(OpCode::LESS);
+            break;
+        case LESS_EQUAL:
+            emit(OpCode::LESS_EQUAL);
+            break;
+        default:
+            std::abort();
+        }
+        add_error_site(left, right);
+    }
+
+    void visit(GroupingExpr& grouping_expr) override
+    {
+        grouping_expr.expr->accept(*this);
+    }
+
+    void visit(LiteralExpr& literal_expr) override
+    {
+        const Value& value = *literal_expr.constant;
+        if (std::get_if<Nil>(&value)) {
+            emit(OpCode::NIL);
+        } else if (const bool* const b = std::get_if<bool>(&value)) {
+            emit(*b ? OpCode::TRUE : OpCode::FALSE);
+        } else {
+            emit(OpCode::CONSTANT, constant(literal_expr));
+        }
+    }
+
+    void visit(UnaryExpr& unary_expr) override
+    {
+        unary_expr.right->accept(*this);
+        switch (unary_expr.op->type()) {
+        using enum TokenType;
+        case MINUS:
+            emit(OpCode::NEGATE);
+            add_error_site(unary_expr.right->get_main_token());
+            break;
+        case BANG:
+            emit(OpCode::NOT);
+            break;
+        default:
+            std::abort();
+        }
+    }
+
+    void visit(VarExpr& var_expr) override
+    {
+        const Resolution resolution = var_expr.resolution;
+        if (resolution.depth == GLOBAL_DEPTH) {
+            emit(OpCode::GET_GLOBAL, symbol(var_expr.symbol, var_expr.identifier));
+            add_error_site(var_expr.identifier);
+            return;
+        }
+        const Location location = find(resolution);
+        if (location.kind == Location::STACK) {
+            emit(OpCode::GET_LOCAL, location.index);
+        } else {
+            emit(OpCode::GET_CAPTURED, environment_depth(resolution, var_expr.identifier), location.index);
+        }
+    }
+
+    void visit(AssignExpr& assign_expr) override
+    {
+        assign_expr.value->accept(*this);
+
+        const Resolution resolution = assign_expr.resolution;
+        if (resolution.depth == GLOBAL_DEPTH) {
+            emit(OpCode::SET_GLOBAL, symbol(assign_expr.symbol, assign_expr.identifier));
+            add_error_site(assign_expr.identifier);
+            return;
+        }
+        const Location location = find(resolution);
+        if (location.kind == Location::STACK) {
+            emit(OpCode::SET_LOCAL, location.index);
+        } else {
+            emit(OpCode::SET_CAPTURED, environment_depth(resolution, assign_expr.identifier), location.index);
+        }
+    }
+
+    void visit(LogicalExpr& logical_expr) override
+    {
+        // Like the Interpreter, the result is a boolean, not an operand.
+        logical_expr.left->accept(*this);
+        const int32_t short_circuit = emit_jump(OpCode::JUMP_IF_FALSE);
+        const bool is_and = logical_expr.token->type() == TokenType::AND;
+        if (is_and) {
+            logical_expr.right->accept(*this);
+            emit(OpCode::TO_BOOL);
+        } else {
+            emit(OpCode::TRUE);
+        }
+        const int32_t end = emit_jump(OpCode::JUMP);
+        patch_jump(short_circuit, logical_expr.token);
+        // only one of the branches pushes its result
+        --current().stack_depth;
+        if (is_and) {
+            emit(OpCode::FALSE);
+        } else {
+            logical_expr.right->accept(*this);
+            emit(OpCode::TO_BOOL);
+        }
+        patch_jump(end, logical_expr.token);
+    }
+
+    void visit(CallExpr& call_expr) override
+    {
+        call_expr.callee->accept(*this);
+        for (Expr* const arg : call_expr.args) {
+            arg->accept(*this);
+        }
+        emit(OpCode::CALL, static_cast<uint16_t>(call_expr.args.size()));
+        add_error_site(call_expr.callee->get_main_token());
+    }
+
+    void unkown_expr(Expr& /*expr*/) override
+    {
+        std::abort();
+    }
+
+    bool visit(ExprStmt& expr_stmt) override
+    {
+        expr_stmt.expr->accept(*this);
+        emit(OpCode::POP);
+        return false;
+    }
+
+    bool visit(PrintStmt& print_stmt) override
+    {
+        print_stmt.expr->accept(*this);
+        emit(OpCode::PRINT);
+        return false;
+    }
+
+    bool visit(VarStmt& var_stmt) override
+    {
+        if (var_stmt.initializer) {
+            var_stmt.initializer->accept(*this);
+        } else {
+            emit(OpCode::NIL);
+        }
+        define(var_stmt.slot, var_stmt.symbol, var_stmt.identifier);
+        return false;
+    }
+
+    bool visit(BlockStmt& block_stmt) override
+    {
+        open_scope(&block_stmt, block_stmt.num_slots);
+        for (Stmt* const stmt : block_stmt.statements) {
+            static_cast<void>(stmt->accept(*this));
+        }
+        const Scope& scope = m_scopes.back();
+        if (scope.num_locals == 1) {
+            emit(OpCode::POP);
+        } else if (scope.num_locals > 1) {
+            emit(OpCode::POP_N, static_cast<uint16_t>(scope.num_locals));
+        }
+        if (scope.has_environment) {
+            emit(OpCode::CLOSE_SCOPE);
+        }
+        m_scopes.pop_back();
+        return false;
+    }
+
+    bool visit(IfStmt& if_stmt) override
+    {
+        const Token* const token = if_stmt.condition->get_main_token();
+        if_stmt.condition->accept(*this);
+        const int32_t skip_then = emit_jump(OpCode::JUMP_IF_FALSE);
+        static_cast<void>(if_stmt.then_branch->accept(*this));
+        if (if_stmt.else_branch) {
+            const int32_t skip_else = emit_jump(OpCode::JUMP);
+            patch_jump(skip_then, token);
+            static_cast<void>(if_stmt.else_branch->accept(*this));
+            patch_jump(skip_else, token);
+        } else {
+            patch_jump(skip_then, token);
+        }
+        return false;
+    }
+
+    bool visit(WhileStmt& while_stmt) override
+    {
+        const Token* const token = while_stmt.condition->get_main_token();
+        const int32_t start = code_size();
+        while_stmt.condition->accept(*this);
+        const int32_t exit = emit_jump(OpCode::JUMP_IF_FALSE);
+        static_cast<void>(while_stmt.body->accept(*this));
+
+        emit(OpCode::LOOP);
+        emit_operand(to_operand(code_size() + 2 - start, token, "Loop body too large."));
+        patch_jump(exit, token);
+        return false;
+    }
+
+    bool visit(FunStmt& fun_stmt) override
+    {
+        Function& function = m_program.functions.emplace_back();
+        function.arity = static_cast<int32_t>(fun_stmt.params.size());
+        m_functions.push_back({&function});
+        current().stack_depth = function.arity;
+        current().max_stack_depth = function.arity;
+
+        open_scope(&fun_stmt, fun_stmt.num_slots);
+        Scope& scope = m_scopes.back();
+        // the arguments are on the stack, move those that are captured
+        for (int32_t i = 0; i < function.arity; ++i) {
+            Location& location = scope.slots[static_cast<std::size_t>(i)];
+            if (location.kind == Location::CAPTURED) {
+                emit(OpCode::GET_LOCAL, static_cast<uint16_t>(i));
+                emit(OpCode::DEFINE_CAPTURED, location.index, symbol(fun_stmt.param_symbols[i], fun_stmt.params[i]));
+            } else {
+                location = {Location::STACK, static_cast<uint16_t>(i)};
+            }
+        }
+        for (Stmt* const stmt : fun_stmt.body) {
+            static_cast<void>(stmt->accept(*this));
+        }
+        emit(OpCode::NIL);
+        emit(OpCode::RETURN);
+        m_scopes.pop_back();
+        finish_function();
+
+        Function& enclosing = *current().function;
+        enclosing.functions.push_back(&function);
+        emit(OpCode::CLOSURE, to_operand(static_cast<int64_t>(enclosing.functions.size()) - 1, fun_stmt.name,
+                                         "Too many functions in one function."));
+        define(fun_stmt.slot, fun_stmt.symbol, fun_stmt.name);
+        return false;
+    }
+
+    bool visit(ReturnStmt& return_stmt) override
+    {
+        if (return_stmt.expr) {
+            return_stmt.expr->accept(*this);
+        } else {
+            emit(OpCode::NIL);
+        }
+        emit(OpCode::RETURN);
+        return false;
+    }
+
+    void unkown_stmt(Stmt& /*stmt*/) override
+    {
+        std::abort();
+    }
+
+private:
+    struct Location
+    {
+        enum Kind : uint8_t
+        {
+            UNDECLARED,
+            STACK,
+            CAPTURED,
+        };
+
+        Kind kind{UNDECLARED};
+        //! The stack slot in the frame or the slot in the scope's Environment
+        uint16_t index{0};
+    };
+
+    struct Scope
+    {
+        std::vector<Location> slots;
+        //! Index into m_functions of the function the scope belongs to
+        std::size_t function;
+        int32_t num_locals{0};
+        bool has_environment{false};
+    };
+
+    struct FunctionState
+    {
+        Function* function;
+        int32_t stack_depth{0};
+        int32_t max_stack_depth{0};
+        absl::flat_hash_map<const Value*, uint16_t> constants{};
+        absl::flat_hash_map<SymbolId, uint16_t> symbols{};
+    };
+
+    FunctionState& current() noexcept
+    {
+        return m_functions.back();
+    }
+
+    int32_t code_size() noexcept
+    {
+        return static_cast<int32_t>(current().function->code.size());
+    }
+
+    void finish_function()
+    {
+        current().function->max_stack = current().max_stack_depth;
+        m_functions.pop_back();
+    }
+
+    [[noreturn]]
+    void error(const Token* token, const std::string_view message)
+    {
+        report_error(m_scanner_result, *token, "{}", message);
+        throw CompileError{};
+    }
+
+    uint16_t to_operand(const int64_t value, const Token* token, const std::string_view message)
+    {
+        if (value < 0 || value > UINT16_MAX) {
+            error(token, message);
+        }
+        return static_cast<uint16_t>(value);
+    }
+
+    void emit_operand(const uint16_t operand)
+    {
+        std::vector<uint8_t>& code = current().function->code;
+        code.push_back(static_cast<uint8_t>(operand & 0xff));
+        code.push_back(static_cast<uint8_t>(operand >> 8));
+    }
+
+    void emit_opcode(const OpCode op, const int32_t operand)
+    {
+        FunctionState& function = current();
+        function.function->code.push_back(static_cast<uint8_t>(op));
+        function.stack_depth += stack_effect(op, operand);
+        assert(function.stack_depth >= 0);
+        function.max_stack_depth = std::max(function.max_stack_depth, function.stack_depth);
+    }
+
+    void emit(const OpCode op)
+    {
+        emit_opcode(op, 0);
+    }
+
+    void emit(const OpCode op, const uint16_t operand)
+    {
+        emit_opcode(op, operand);
+        emit_operand(operand);
+    }
+
+    void emit(const OpCode op, const uint16_t first, const uint16_t second)
+    {
+        emit_opcode(op, 0);
+        emit_operand(first);
+        emit_operand(second);
+    }
+
+    //! Returns where to patch_jump() the offset
+    int32_t emit_jump(const OpCode op)
+    {
+        emit(op);
+        emit_operand(0);
+        return code_size() - 2;
+    }
+
+    void patch_jump(const int32_t operand, const Token* token)
+    {
+        const uint16_t offset = to_operand(code_size() - operand - 2, token, "Too much code to jump over.");
+        std::vector<uint8_t>& code = current().function->code;
+        code[static_cast<std::size_t>(operand)] = static_cast<uint8_t>(offset & 0xff);
+        code[static_cast<std::size_t>(operand) + 1] = static_cast<uint8_t>(offset >> 8);
+    }
+
+    void add_error_site(const Token* token, const Token* right = nullptr)
+    {
+        current().function->error_sites.push_back({code_size(), token, right});
+    }
+
+    uint16_t constant(const LiteralExpr& literal_expr)
+    {
+        FunctionState& function = current();
+        const auto [it, inserted] = function.constants.try_emplace(literal_expr.constant, 0);
+        if (inserted) {
+            it->second = to_operand(static_cast<int64_t>(function.function->constants.size()), literal_expr.value,
+                                    "Too many constants in one function.");
+            function.function->constants.push_back(*literal_expr.constant);
+        }
+        return it->second;
+    }
+
+    uint16_t symbol(const SymbolId symbol, const Token* token)
+    {
+        FunctionState& function = current();
+        const auto [it, inserted] = function.symbols.try_emplace(symbol, 0);
+        if (inserted) {
+            it->second = to_operand(static_cast<int64_t>(function.function->symbols.size()), token,
+                                    "Too many variable names in one function.");
+            function.function->symbols.push_back(symbol);
+        }
+        return it->second;
+    }
+
+    //! Gives the captured slots of the scope an Environment slot each
+    void open_scope(const void* owner, const int32_t num_slots)
+    {
+        Scope& scope = m_scopes.emplace_back();
+        scope.slots.resize(static_cast<std::size_t>(num_slots));
+        scope.function = m_functions.size() - 1;
+        const auto it = m_captured.find(owner);
+        if (it == m_captured.end()) {
+            return;
+        }
+        const std::vector<bool>& captured = it->second;
+        uint16_t num_captured{0};
+        for (std::size_t slot = 0; slot < captured.size(); ++slot) {
+            if (captured[slot]) {
+                scope.slots[slot] = {Location::CAPTURED, num_captured++};
+            }
+        }
+        scope.has_environment = true;
+        emit(OpCode::OPEN_SCOPE, num_captured);
+    }
+
+    //! Stores the value on top of the stack in a new variable
+    void define(const int32_t slot, const SymbolId symbol, const Token* token)
+    {
+        if (slot < 0) {
+            emit(OpCode::DEFINE_GLOBAL, this->symbol(symbol, token));
+            return;
+        }
+        Scope& scope = m_scopes.back();
+        Location& location = scope.slots[static_cast<std::size_t>(slot)];
+        switch (location.kind) {
+        case Location::UNDECLARED:
+            // the value stays where it is
+            location = {Location::STACK, to_operand(current().stack_depth - 1, token, "Too many local variables in one function.")};
+            ++scope.num_locals;
+            break;
+        case Location::STACK:
+            // declared again
+            emit(OpCode::SET_LOCAL, location.index);
+            emit(OpCode::POP);
+            break;
+        case Location::CAPTURED:
+            emit(OpCode::DEFINE_CAPTURED, location.index, this->symbol(symbol, token));
+            break;
+        }
+    }
+
+    const Scope& target_scope(const Resolution resolution) const noexcept
+    {
+        assert(resolution.depth >= 0 && static_cast<std::size_t>(resolution.depth) < m_scopes.size());
+        return m_scopes[m_scopes.size() - 1 - static_cast<std::size_t>(resolution.depth)];
+    }
+
+    Location find(const Resolution resolution) const noexcept
+    {
+        const Scope& scope = target_scope(resolution);
+        const Location location = scope.slots[static_cast<std::size_t>(resolution.slot)];
+        assert(location.kind != Location::UNDECLARED);
+        // stack slots are only visible to their own function
+        assert(location.kind == Location::CAPTURED || scope.function == m_functions.size() - 1);
+        return location;
+    }
+
+    //! How many Environments are between the current one and that of the variable
+    uint16_t environment_depth(const Resolution resolution, const Token* token)
+    {
+        const std::size_t target = m_scopes.size() - 1 - static_cast<std::size_t>(resolution.depth);
+        const auto depth = std::count_if(m_scopes.begin() + static_cast<std::ptrdiff_t>(target) + 1, m_scopes.end(),
+                                         [] (const Scope& scope) { return scope.has_environment; });
+        return to_operand(depth, token, "Variable nested too deeply.");
+    }
+
+    const ScannerResult& m_scanner_result;
+    Program& m_program;
+    const CapturedSlots m_captured;
+    std::vector<FunctionState> m_functions;
+    std::vector<Scope> m_scopes;
+};
+
+} // anonymous namespace
+
+std::optional<Program> compile(const ScannerResult& scanner_result, std::span<Stmt* const> statements)
+{
+    Program program;
+    Compiler compiler{scanner_result, program, find_captured(statements)};
+    try {
+        for (Stmt* const stmt : statements) {
+            compiler.compile_statement(*stmt);
+        }
+    } catch (const CompileError&) {
+        return std::nullopt;
+    }
+    return program;
+}
+
+} // namespace bytecode
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <optional>
+#include <span>
+#include <vector>
+
+#include "symbols.hpp"
+#include "value.hpp"
+
+class Stmt;
+class Token;
+struct ScannerResult;
+
+namespace bytecode
+{
+
+/*
+ * Opcodes with their operands, all of which are 16 bit little endian.
+ * "Captured" variables are those a nested function refers to; they live
+ * in an Environment, all others on the stack of the Vm.
+ */
+#define JLOX_OPCODES(X) \
+    X(CONSTANT)         /* constant index */ \
+    X(NIL) \
+    X(TRUE) \
+    X(FALSE) \
+    X(POP) \
+    X(POP_N)            /* count */ \
+    X(GET_LOCAL)        /* stack slot in the frame */ \
+    X(SET_LOCAL)        /* stack slot in the frame */ \
+    X(GET_CAPTURED)     /* scope depth, environment slot */ \
+    X(SET_CAPTURED)     /* scope depth, environment slot */ \
+    X(DEFINE_CAPTURED)  /* environment slot, symbol index */ \
+    X(GET_GLOBAL)       /* symbol index */ \
+    X(SET_GLOBAL)       /* symbol index */ \
+    X(DEFINE_GLOBAL)    /* symbol index */ \
+    X(EQUAL) \
+    X(NOT_EQUAL) \
+    X(GREATER) \
+    X(GREATER_EQUAL) \
+    X(LESS) \
+    X(LESS_EQUAL) \
+    X(ADD) \
+    X(SUBTRACT) \
+    X(MULTIPLY) \
+    X(DIVIDE) \
+    X(NOT) \
+    X(NEGATE) \
+    X(TO_BOOL) \
+    X(PRINT) \
+    X(JUMP)             /* forward offset */ \
+    X(JUMP_IF_FALSE)    /* forward offset, pops the condition */ \
+    X(LOOP)             /* backward offset */ \
+    X(CALL)             /* number of arguments */ \
+    X(CLOSURE)          /* function index */ \
+    X(OPEN_SCOPE)       /* number of environment slots */ \
+    X(CLOSE_SCOPE) \
+    X(RETURN)
+
+enum class OpCode : uint8_t
+{
+#define JLOX_OPCODE_ENUM(name) name,
+    JLOX_OPCODES(JLOX_OPCODE_ENUM)
+#undef JLOX_OPCODE_ENUM
+};
+
+//! The tokens to blame if the instruction ending at `end` fails
+struct ErrorSite
+{
+    int32_t end;
+    //! The operator, the left operand or the variable
+    const Token* token;
+    //! The right operand of a binary operator
+    const Token* right;
+};
+
+struct Function
+{
+    std::vector<uint8_t> code;
+    std::vector<Value> constants;
+    std::vector<SymbolId> symbols;
+    std::vector<const Function*> functions;
+    //! Sorted by `end`
+    std::vector<ErrorSite> error_sites;
+    int32_t arity{0};
+    //! Most values the function has on the stack at once, its arguments included
+    int32_t max_stack{0};
+
+    //! Where the instruction ending at `end` came from
+    const ErrorSite& error_site(int32_t end) const noexcept;
+};
+
+struct Program
+{
+    // a deque never moves its elements, which refer to each other
+    std::deque<Function> functions;
+    //! One function without parameters per top level statement
+    std::vector<const Function*> statements;
+};
+
+/**
+ * Compiles resolved `statements` for the Vm. Returns nullopt after
+ * reporting an error if the program exceeds a limit of the bytecode, e.g.
+ * a jump over more than 64 KiB of code.
+ */
+std::optional<Program> compile(const ScannerResult& scanner_result, std::span<Stmt* const> statements);
+
+} // namespace bytecode
@@ -0,0 +1,733 @@
+#include "closure_engine.hpp"
+
+#include <cassert>
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+#include <fmt/format.h>
+
+#include "expr.hpp"
+#include "log.hpp"
+#include "resolver.hpp"
+#include "scanner.hpp"
+#include "stmt.hpp"
+
+struct ClosureEngine::Frame
+{
+    //! The arguments, followed by the other local variables
+    Value* locals;
+    //! Of the innermost scope with captured variables
+    HeapPtr<Environment> environment;
+    Value return_value{nil};
+};
+
+struct ClosureEngine::FunctionCode
+{
+    struct CapturedParam
+    {
+        int32_t local;
+        int32_t slot;
+        SymbolId symbol;
+    };
+
+    ClosureEngine* engine;
+    const Token* name;
+    std::vector<StmtCode> body;
+    std::vector<CapturedParam> captured_params;
+    int32_t arity{0};
+    int32_t num_locals{0};
+    //! Slots of the Environment of the function's scope, -1 if it has none
+    int32_t num_captured{-1};
+};
+
+namespace
+{
+
+class RuntimeError final : public std::runtime_error
+{
+public:
+    RuntimeError() : std::runtime_error{""} {}
+};
+
+template <typename Fmt, typename... Args>
+[[noreturn]]
+void fail(const ScannerResult& scanner_result, const Token* token, Fmt&& format_str, Args&&... args)
+{
+    report_error(scanner_result, *token, std::forward<Fmt>(format_str), std::forward<Args>(args)...);
+    throw RuntimeError{};
+}
+
+double number_operand(const Value& value, const Token* token, const ScannerResult& scanner_result)
+{
+    const double* const number = std::get_if<double>(&value);
+    if (!number) [[unlikely]] {
+        fail(scanner_result, token, "Expected operand of type {}, got {}.", type_name<double>(), type_name(value));
+    }
+    return *number;
+}
+
+void open_environment(ClosureEngine::Frame& frame, const int32_t num_slots)
+{
+    HeapPtr<Environment> environment = Heap::allocate<Environment>(frame.environment);
+    // not in the constructor, the heap can't allocate while it constructs
+    environment->reserve(num_slots);
+    frame.environment = std::move(environment);
+}
+
+} // anonymous namespace
+
+class ClosureEngine::Compiler final : public ExprVisitor
+                                    , public StmtVisitor
+{
+public:
+    Compiler(ClosureEngine& engine, CapturedSlots&& captured)
+      : m_engine{engine}
+      , m_captured{std::move(captured)}
+    {}
+
+    Statement compile_statement(Stmt& stmt)
+    {
+        m_functions.emplace_back();
+        StmtCode code = compile(stmt);
+        const int32_t num_locals = m_functions.back().num_locals;
+        m_functions.pop_back();
+        return {std::move(code), num_locals};
+    }
+
+    void visit(BinaryExpr& binary_expr) override
+    {
+        ExprCode left = compile(*binary_expr.left);
+        ExprCode right = compile(*binary_expr.right);
+        const Token* const left_token = binary_expr.left->get_main_token();
+        const Token* const right_token = binary_expr.right->get_main_token();
+
+        switch (binary_expr.op->type()) {
+        using enum TokenType;
+        case PLUS:
+            m_expr = [left=std::move(left), right=std::move(right), op=binary_expr.op, scanned=scanner_result()] (Frame& frame) -> Value {
+                Value lhs = left(frame);
+                const Value rhs = right(frame);
+                if (const double* const l = std::get_if<double>(&lhs), * const r = std::get_if<double>(&rhs); l && r) {
+                    return *l + *r;
+                }
+                if (std::string* const l = std::get_if<std::string>(&lhs); l) {
+                    if (const std::string* const r = std::get_if<std::string>(&rhs)) {
+                        *l += *r;
+                        return lhs;
+                    }
+                }
+                fail(*scanned, op, "Operands to (+) must be two numbers or two strings. Got {} and {}.",
+                     type_name(lhs), type_name(rhs));
+            };
+            return;
+        case EQUAL_EQUAL:
+            m_expr = [left=std::move(left), right=std::move(right)] (Frame& frame) -> Value {
+                const Value lhs = left(frame);
+                return is_equal(lhs, right(frame));
+            };
+            return;
+        case BANG_EQUAL:
+            m_expr = [left=std::move(left), right=std::move(right)] (Frame& frame) -> Value {
+                const Value lhs = left(frame);
+                return !is_equal(lhs, right(frame));
+            };
+            return;
+        case MINUS:
+            m_expr = number_operator<std::minus<>>(std::move(left), std::move(right), left_token, right_token);
+            return;
+        case SLASH:
+            m_expr = number_operator<std::divides<>>(std::move(left), std::move(right), left_token, right_token);
+            return;
+        case STAR:
+            m_expr = number_operator<std::multiplies<>>(std::move(left), std::move(right), left_token, right_token);
+            return;
+        case GREATER:
+            m_expr = number_operator<std::greater<>>(std::move(left), std::move(right), left_token, right_token);
+            return;
+        case GREATER_EQUAL:
+            m_expr = number_operator<std::greater_equal<>>(std::move(left), std::move(right), left_token, right_token);
+            return;
+        case LESS:
+            m_expr = number_operator<std::less<>>(std::move(left), std::move(right), left_token, right_token);
+            return;
+        case LESS_EQUAL:
+            m_expr = number_operator<std::less_equal<>>(std::move(left), std::move(right), left_token, right_token);
+            return;
+        default:
+            std::abort();
+        }
+    }
+
+    void visit(GroupingExpr& grouping_expr) override
+    {
+        grouping_expr.expr->accept(*this);
+    }
+
+    void visit(LiteralExpr& literal_expr) override
+    {
+        m_expr = [value=*literal_expr.constant] (Frame&) -> Value {
+            return value;
+        };
+    }
+
+    void visit(UnaryExpr& unary_expr) override
+    {
+        ExprCode right = compile(*unary_expr.right);
+        switch (unary_expr.op->type()) {
+        using enum TokenType;
+        case MINUS:
+            m_expr = [right=std::move(right), token=unary_expr.right->get_main_token(), scanned=scanner_result()] (Frame& frame) -> Value {
+                return -number_operand(right(frame), token, *scanned);
+            };
+            return;
+        case BANG:
+            m_expr = [right=std::move(right)] (Frame& frame) -> Value {
+                return !is_truthy(right(frame));
+            };
+            return;
+        default:
+            std::abort();
+        }
+    }
+
+    void visit(VarExpr& var_expr) override
+    {
+        const Resolution resolution = var_expr.resolution;
+        if (resolution.depth == GLOBAL_DEPTH) {
+            m_expr = [symbol=var_expr.symbol, token=var_expr.identifier, globals=&m_engine.m_globals, scanned=scanner_result()] (Frame&) -> Value {
+                const Value* const value = globals->global_environment()->get(symbol);
+                if (!value) {
+                    fail(*scanned, token, "Identifier not found");
+                }
+                return *value;
+            };
+            return;
+        }
+        const Location location = find(resolution);
+        if (location.kind == Location::LOCAL) {
+            m_expr = [index=location.index] (Frame& frame) -> Value {
+                return frame.locals[index];
+            };
+        } else {
+            m_expr = [depth=environment_depth(resolution), index=location.index] (Frame& frame) -> Value {
+                return frame.environment->slot(depth, index);
+            };
+        }
+    }
+
+    void visit(AssignExpr& assign_expr) override
+    {
+        ExprCode value = compile(*assign_expr.value);
+        const Resolution resolution = assign_expr.resolution;
+        if (resolution.depth == GLOBAL_DEPTH) {
+            m_expr = [value=std::move(value), symbol=assign_expr.symbol, token=assign_expr.identifier,
+                      globals=&m_engine.m_globals, scanned=scanner_result()] (Frame& frame) -> Value {
+                Value result = value(frame);
+                if (!globals->global_environment()->assign(symbol, result)) {
+                    fail(*scanned, token, "Undefined variable '{}'.", token->lexeme(scanned->source));
+                }
+                return result;
+            };
+            return;
+        }
+        const Location location = find(resolution);
+        if (location.kind == Location::LOCAL) {
+            m_expr = [value=std::move(value), index=location.index] (Frame& frame) -> Value {
+                Value result = value(frame);
+                frame.locals[index] = result;
+                return result;
+            };
+        } else {
+            m_expr = [value=std::move(value), depth=environment_depth(resolution), index=location.index] (Frame& frame) -> Value {
+                Value result = value(frame);
+                frame.environment->slot(depth, index) = result;
+                return result;
+            };
+        }
+    }
+
+    void visit(LogicalExpr& logical_expr) override
+    {
+        // Like the Interpreter, the result is a boolean, not an operand.
+        ExprCode left = compile(*logical_expr.left);
+        ExprCode right = compile(*logical_expr.right);
+        if (logical_expr.token->type() == TokenType::AND) {
+            m_expr = [left=std::move(left), right=std::move(right)] (Frame& frame) -> Value {
+                return is_truthy(left(frame)) && is_truthy(right(frame));
+            };
+        } else {
+            m_expr = [left=std::move(left), right=std::move(right)] (Frame& frame) -> Value {
+                return is_truthy(left(frame)) || is_truthy(right(frame));
+            };
+        }
+    }
+
+    void visit(CallExpr& call_expr) override
+    {
+        ExprCode callee = compile(*call_expr.callee);
+        std::vector<ExprCode> args;
+        args.reserve(call_expr.args.size());
+        for (Expr* const arg : call_expr.args) {
+            args.push_back(compile(*arg));
+        }
+        m_expr = [callee=std::move(callee), args=std::move(args), token=call_expr.callee->get_main_token(), engine=&m_engine] (Frame& frame) -> Value {
+            Value callee_value = callee(frame);
+            Callable* const callable = std::get_if<Callable>(&callee_value);
+            if (!callable) {
+                fail(engine->m_scanner_result, token, "Value not callable");
+            }
+            if (static_cast<int32_t>(args.size()) != callable->arity()) {
+                fail(engine->m_scanner_result, token, "Expected {} arguments but got {}.", callable->arity(), args.size());
+            }
+            if (engine->m_stack.get() + STACK_SIZE - engine->m_top < static_cast<std::ptrdiff_t>(args.size())) {
+                fail(engine->m_scanner_result, token, "Stack overflow.");
+            }
+            // the arguments go on the stack, where call() finds its locals
+            Value* const first = engine->m_top;
+            for (const ExprCode& arg : args) {
+                Value value = arg(frame);
+                std::construct_at(engine->m_top++, std::move(value));
+            }
+            Value result = callable->call(nullptr, std::span<const Value>{first, args.size()});
+            std::destroy(first, engine->m_top);
+            engine->m_top = first;
+            return result;
+        };
+    }
+
+    void unkown_expr(Expr& /*expr*/) override
+    {
+        std::abort();
+    }
+
+    bool visit(ExprStmt& expr_stmt) override
+    {
+        m_stmt = [expr=compile(*expr_stmt.expr)] (Frame& frame) {
+            static_cast<void>(expr(frame));
+            return false;
+        };
+        return false;
+    }
+
+    bool visit(PrintStmt& print_stmt) override
+    {
+        m_stmt = [expr=compile(*print_stmt.expr)] (Frame& frame) {
+            const Value value = expr(frame);
+            if (const std::string* const s = std::get_if<std::string>(&value)) {
+                fmt::print(" :: {}\n", *s);
+            } else {
+                fmt::print(" :: {}\n", stringify(value));
+            }
+            return false;
+        };
+        return false;
+    }
+
+    bool visit(VarStmt& var_stmt) override
+    {
+        ExprCode value;
+        if (var_stmt.initializer) {
+            value = compile(*var_stmt.initializer);
+        } else {
+            value = [] (Frame&) -> Value { return nil; };
+        }
+        m_stmt = define(var_stmt.slot, var_stmt.symbol, std::move(value));
+        return false;
+    }
+
+    bool visit(BlockStmt& block_stmt) override
+    {
+        const int32_t num_captured = open_scope(&block_stmt, block_stmt.num_slots);
+        std::vector<StmtCode> statements;
+        statements.reserve(block_stmt.statements.size());
+        for (Stmt* const stmt : block_stmt.statements) {
+            statements.push_back(compile(*stmt));
+        }
+        m_scopes.pop_back();
+
+        if (num_captured < 0) {
+            m_stmt = [statements=std::move(statements)] (Frame& frame) {
+                for (const StmtCode& stmt : statements) {
+                    if (stmt(frame)) {
+                        return true;
+                    }
+                }
+                return false;
+            };
+            return false;
+        }
+        m_stmt = [statements=std::move(statements), num_captured] (Frame& frame) {
+            HeapPtr<Environment> outer = frame.environment;
+            open_environment(frame, num_captured);
+            for (const StmtCode& stmt : statements) {
+                // the frame ends with the return, its environment with it
+                if (stmt(frame)) {
+                    return true;
+                }
+            }
+            frame.environment = std::move(outer);
+            return false;
+        };
+        return false;
+    }
+
+    bool visit(IfStmt& if_stmt) override
+    {
+        ExprCode condition = compile(*if_stmt.condition);
+        StmtCode then_branch = compile(*if_stmt.then_branch);
+        if (!if_stmt.else_branch) {
+            m_stmt = [condition=std::move(condition), then_branch=std::move(then_branch)] (Frame& frame) {
+                return is_truthy(condition(frame)) && then_branch(frame);
+            };
+            return false;
+        }
+        m_stmt = [condition=std::move(condition), then_branch=std::move(then_branch),
+                  else_branch=compile(*if_stmt.else_branch)] (Frame& frame) {
+            return is_truthy(condition(frame)) ? then_branch(frame) : else_branch(frame);
+        };
+        return false;
+    }
+
+    bool visit(WhileStmt& while_stmt) override
+    {
+        m_stmt = [condition=compile(*while_stmt.condition), body=compile(*while_stmt.body)] (Frame& frame) {
+            while (is_truthy(condition(frame))) {
+                if (body(frame)) {
+                    return true;
+                }
+            }
+            return false;
+        };
+        return false;
+    }
+
+    bool visit(FunStmt& fun_stmt) override
+    {
+        auto function = std::make_unique<FunctionCode>();
+        function->engine = &m_engine;
+        function->name = fun_stmt.name;
+        function->arity = static_cast<int32_t>(fun_stmt.params.size());
+
+        m_functions.push_back({function->arity});
+        function->num_captured = open_scope(&fun_stmt, fun_stmt.num_slots);
+        Scope& scope = m_scopes.back();
+        for (int32_t i = 0; i < function->arity; ++i) {
+            Location& location = scope.slots[static_cast<std::size_t>(i)];
+            if (location.kind == Location::CAPTURED) {
+                function->captured_params.push_back({i, location.index, fun_stmt.param_symbols[i]});
+            } else {
+                location = {Location::LOCAL, i};
+            }
+        }
+        function->body.reserve(fun_stmt.body.size());
+        for (Stmt* const stmt : fun_stmt.body) {
+            function->body.push_back(compile(*stmt));
+        }
+        m_scopes.pop_back();
+        function->num_locals = m_functions.back().num_locals;
+        m_functions.pop_back();
+
+        const FunctionCode* const code = function.get();
+        m_engine.m_functions.push_back(std::move(function));
+        m_stmt = define(fun_stmt.slot, fun_stmt.symbol, [code] (Frame& frame) -> Value {
+            // one pointer, small enough for std::function to not allocate
+            auto call = [code] (Interpreter*, const HeapPtr<Environment>& closure, std::span<const Value> args) {
+                return code->engine->call(*code, closure, args);
+            };
+            return Callable{std::move(call), code->arity, frame.environment};
+        });
+        return false;
+    }
+
+    bool visit(ReturnStmt& return_stmt) override
+    {
+        if (!return_stmt.expr) {
+            m_stmt = [] (Frame& frame) {
+                frame.return_value = nil;
+                return true;
+            };
+            return false;
+        }
+        m_stmt = [expr=compile(*return_stmt.expr)] (Frame& frame) {
+            frame.return_value = expr(frame);
+            return true;
+        };
+        return false;
+    }
+
+    void unkown_stmt(Stmt& /*stmt*/) override
+    {
+        std::abort();
+    }
+
+private:
+    struct Location
+    {
+        enum Kind : uint8_t
+        {
+            UNDECLARED,
+            LOCAL,
+            CAPTURED,
+        };
+
+        Kind kind{UNDECLARED};
+        //! In the frame's locals or in the scope's Environment
+        int32_t index{0};
+    };
+
+    struct Scope
+    {
+        std::vector<Location> slots;
+        //! Index into m_functions of the function the scope belongs to
+        std::size_t function;
+        bool has_environment{false};
+    };
+
+    struct FunctionState
+    {
+        int32_t num_locals{0};
+    };
+
+    const ScannerResult* scanner_result() const noexcept
+    {
+        return &m_engine.m_scanner_result;
+    }
+
+    ExprCode compile(Expr& expr)
+    {
+        expr.accept(*this);
+        return std::move(m_expr);
+    }
+
+    StmtCode compile(Stmt& stmt)
+    {
+        static_cast<void>(stmt.accept(*this));
+        return std::move(m_stmt);
+    }
+
+    template <typename Operator>
+    ExprCode number_operator(ExprCode&& left, ExprCode&& right, const Token* left_token, const Token* right_token)
+    {
+        return [left=std::move(left), right=std::move(right), left_token, right_token, scanned=scanner_result()] (Frame& frame) -> Value {
+            const Value lhs = left(frame);
+            const Value rhs = right(frame);
+            const double l = number_operand(lhs, left_token, *scanned);
+            const double r = number_operand(rhs, right_token, *scanned);
+            return Operator{}(l, r);
+        };
+    }
+
+    //! Returns the number of captured slots, which get an Environment, or -1
+    int32_t open_scope(const void* owner, const int32_t num_slots)
+    {
+        Scope& scope = m_scopes.emplace_back();
+        scope.slots.resize(static_cast<std::size_t>(num_slots));
+        scope.function = m_functions.size() - 1;
+        const auto it = m_captured.find(owner);
+        if (it == m_captured.end()) {
+            return -1;
+        }
+        int32_t num_captured{0};
+        for (std::size_t slot = 0; slot < it->second.size(); ++slot) {
+            if (it->second[slot]) {
+                scope.slots[slot] = {Location::CAPTURED, num_captured++};
+            }
+        }
+        scope.has_environment = true;
+        return num_captured;
+    }
+
+    StmtCode define(const int32_t slot, const SymbolId symbol, ExprCode&& value)
+    {
+        if (slot < 0) {
+            return [value=std::move(value), symbol, globals=&m_engine.m_globals] (Frame& frame) {
+                globals->global_environment()->define(symbol, value(frame));
+                return false;
+            };
+        }
+        Location& location = m_scopes.back().slots[static_cast<std::size_t>(slot)];
+        if (location.kind == Location::UNDECLARED) {
+            location = {Location::LOCAL, m_functions.back().num_locals++};
+        }
+        if (location.kind == Location::LOCAL) {
+            return [value=std::move(value), index=location.index] (Frame& frame) {
+                frame.locals[index] = value(frame);
+                return false;
+            };
+        }
+        return [value=std::move(value), index=location.index, symbol] (Frame& frame) {
+            Value result = value(frame);
+            frame.environment->define_slot(index, symbol, std::move(result));
+            return false;
+        };
+    }
+
+    Location find(const Resolution resolution) const noexcept
+    {
+        assert(resolution.depth >= 0 && static_cast<std::size_t>(resolution.depth) < m_scopes.size());
+        const Scope& scope = m_scopes[m_scopes.size() - 1 - static_cast<std::size_t>(resolution.depth)];
+        const Location location = scope.slots[static_cast<std::size_t>(resolution.slot)];
+        assert(location.kind != Location::UNDECLARED);
+        // locals are only visible to their own function
+        assert(location.kind == Location::CAPTURED || scope.function == m_functions.size() - 1);
+        return location;
+    }
+
+    //! How many Environments are between the current one and that of the variable
+    int32_t environment_depth(const Resolution resolution) const noexcept
+    {
+        const std::size_t target = m_scopes.size() - 1 - static_cast<std::size_t>(resolution.depth);
+        return static_cast<int32_t>(std::count_if(m_scopes.begin() + static_cast<std::ptrdiff_t>(target) + 1, m_scopes.end(),
+                                                  [] (const Scope& scope) { return scope.has_environment; }));
+    }
+
+    ClosureEngine& m_engine;
+    const CapturedSlots m_captured;
+    std::vector<Scope> m_scopes;
+    std::vector<FunctionState> m_functions;
+    ExprCode m_expr;
+    StmtCode m_stmt;
+};
+
+
+void ClosureEngine::StackDeleter::operator()(Value* const stack) const noexcept
+{
+    std::allocator<Value>{}.deallocate(stack, STACK_SIZE);
+}
+
+ClosureEngine::~ClosureEngine() = default;
+
+ClosureEngine::ClosureEngine(const ScannerResult& scanner_result, Globals& globals)
+  : m_stack{std::allocator<Value>{}.allocate(STACK_SIZE)}
+  , m_top{m_stack.get()}
+  , m_functions{}
+  , m_scanner_result{scanner_result}
+  , m_globals{globals}
+{
+    define_natives(*m_globals.global_environment());
+}
+
+ClosureEngine::Statement ClosureEngine::compile(Stmt& stmt)
+{
+    Stmt* const statements[]{&stmt};
+    Compiler compiler{*this, find_captured(statements)};
+    return compiler.compile_statement(stmt);
+}
+
+bool ClosureEngine::execute(const Statement& statement)
+{
+    assert(m_top == m_stack.get() && statement.num_locals < STACK_SIZE);
+    m_top = std::uninitialized_fill_n(m_top, statement.num_locals, Value{nil});
+    bool ok{true};
+    try {
+        Frame frame{m_stack.get(), nullptr};
+        static_cast<void>(statement.code(frame));
+    } catch (const RuntimeError&) {
+        ok = false;
+    } catch (...) {
+        std::destroy(m_stack.get(), m_top);
+        m_top = m_stack.get();
+        throw;
+    }
+    std::destroy(m_stack.get(), m_top);
+    m_top = m_stack.get();
+    return ok;
+}
+
+Value ClosureEngine::call(const FunctionCode& function, const HeapPtr<Environment>& closure, std::span<const Value> args)
+{
+    assert(static_cast<int32_t>(args.size()) == function.arity && args.data() + args.size() == m_top);
+    Value* const locals = m_top - args.size();
+    const int32_t num_declared = function.num_locals - function.arity;
+    if (m_stack.get() + STACK_SIZE - m_top < num_declared) {
+        fail(m_scanner_result, function.name, "Stack overflow.");
+    }
+    m_top = std::uninitialized_fill_n(m_top, num_declared, Value{nil});
+
+    Frame frame{locals, closure};
+    if (function.num_captured >= 0) {
+        open_environment(frame, function.num_captured);
+        for (const FunctionCode::CapturedParam& param : function.captured_params) {
+            frame.environment->define_slot(param.slot, param.symbol, Value{locals[param.local]});
+        }
+    }
+    bool has_return_value{false};
+    for (const StmtCode& stmt : function.body) {
+        if (stmt(frame)) {
+            has_return_value = true;
+            break;
+        }
+    }
+    // the caller pops the arguments
+    std::destroy(locals + function.arity, m_top);
+    m_top = locals + function.arity;
+    return has_return_value ? std::move(frame.return_value) : Value{nil};
+}
+
+
+#include <doctest/doctest.h>
+
+#include "bump_alloc.hpp"
+#include "constant_pool.hpp"
+#include "parser.hpp"
+
+TEST_CASE("Closure engine")
+{
+    const ScannerResult scanned = scan_tokens(
+        "fun fib(n) { if (n < 2) return n; return fib(n - 1) + fib(n - 2); }\n"
+        "var ce_fib = fib(15);\n"
+        "fun make_counter() { var i = 0; fun count() { i = i + 1; return i; } return count; }\n"
+        "var counter = make_counter();\n"
+        "counter();\n"
+        "var ce_count = counter();\n"
+        "var ce_sum = 0;\n"
+        "{\n"
+        "    var a = 1;\n"
+        "    var a = 2;\n"
+        "    for (var i = 0; i < 4; i = i + 1) { var half = i / 2; ce_sum = ce_sum + half + a; }\n"
+        "}\n"
+        "var ce_first;\n"
+        "var ce_second;\n"
+        "for (var i = 1; i < 3; i = i + 1) {\n"
+        "    var j = i;\n"
+        "    fun get() { return j; }\n"
+        "    if (j == 1) ce_first = get; else ce_second = get;\n"
+        "}\n"
+        "var ce_captured = ce_first() * 10 + ce_second();\n"
+        "fun concat(s, t) { fun add() { s = s + t; } add(); return s; }\n"
+        "var ce_string = concat(\"x\", \"y\") + \"z\";\n"
+        "var ce_logic = (1 and nil) or \"yes\";\n"
+        "ce_missing;\n"
+        "var ce_after_error = -ce_fib;\n");
+    REQUIRE(scanned.num_errors == 0);
+    BumpAlloc alloc;
+    ConstantPool constants;
+    const std::vector<Stmt*> statements = parse(alloc, constants, scanned);
+    REQUIRE(statements.empty() == false);
+    resolve(statements);
+
+    Globals globals;
+    ClosureEngine engine{scanned, globals};
+    int32_t num_errors{0};
+    for (Stmt* const stmt : statements) {
+        num_errors += !engine.execute(engine.compile(*stmt));
+    }
+    CHECK(num_errors == 1);
+
+    const Environment& env = *globals.global_environment();
+    const auto global = [&] (std::string_view name) {
+        const Value* const value = env.get(intern_symbol(name));
+        REQUIRE(value != nullptr);
+        return *value;
+    };
+    CHECK(std::get<double>(global("ce_fib")) == 610.);
+    CHECK(std::get<double>(global("ce_count")) == 2.);
+    CHECK(std::get<double>(global("ce_sum")) == 11.);
+    CHECK(std::get<double>(global("ce_captured")) == 12.);
+    CHECK(std::get<std::string>(global("ce_string")) == "xyz");
+    CHECK(std::get<bool>(global("ce_logic")) == true);
+    CHECK(std::get<double>(global("ce_after_error")) == -610.);
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <span>
+#include <vector>
+
+#include "environment.hpp"
+#include "value.hpp"
+
+class Stmt;
+struct ScannerResult;
+
+/**
+ * Runs a tree by first turning every node into a C++ callable that has
+ * its children, operator and variable location bound, "closure
+ * compilation". Evaluating a node is then one indirect call, without the
+ * visitor's double dispatch or decoding the operator again. Locals are
+ * kept like in the Vm: on a stack, unless a nested function refers to
+ * them.
+ */
+class ClosureEngine
+{
+public:
+    struct Frame;
+    using ExprCode = std::function<Value(Frame&)>;
+    //! Returns true after a return statement, which leaves its value in the frame
+    using StmtCode = std::function<bool(Frame&)>;
+
+    //! A compiled top level statement
+    struct Statement
+    {
+        StmtCode code;
+        int32_t num_locals{0};
+    };
+
+    ClosureEngine(const ScannerResult& scanner_result, Globals& globals);
+    ~ClosureEngine();
+
+    ClosureEngine(const ClosureEngine&) = delete;
+    ClosureEngine& operator=(const ClosureEngine&) = delete;
+
+    //! `stmt` must be resolved and outlive the engine
+    Statement compile(Stmt& stmt);
+
+    //! False after a runtime error
+    [[nodiscard]]
+    bool execute(const Statement& statement);
+
+private:
+    class Compiler;
+    struct FunctionCode;
+
+    //! Values on the stack, for all calls together
+    inline static constexpr std::ptrdiff_t STACK_SIZE = 1 << 16;
+
+    struct StackDeleter
+    {
+        void operator()(Value* stack) const noexcept;
+    };
+
+    //! `args` are on top of the stack and become the first local variables
+    Value call(const FunctionCode& function, const HeapPtr<Environment>& closure, std::span<const Value> args);
+
+    // uninitialized from m_top on
+    std::unique_ptr<Value, StackDeleter> m_stack;
+    Value* m_top;
+    std::vector<std::unique_ptr<FunctionCode>> m_functions;
+    const ScannerResult& m_scanner_result;
+    Globals& m_globals;
+};
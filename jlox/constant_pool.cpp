@@ -0,0 +1,194 @@
+#include "constant_pool.hpp"
+
+#include <cassert>
+#include <charconv>
+#include <cstdint>
+#include <cstdlib>
+#include <iterator>
+#include <limits>
+#include <string>
+
+#include <doctest/doctest.h>
+
+#include "tokens.hpp"
+
+namespace
+{
+
+std::optional<double> parse_integer(std::string_view digits, const int base) noexcept
+{
+    uint64_t value{0};
+    const auto [end, error] = std::from_chars(digits.data(), digits.data() + digits.size(), value, base);
+    if (error != std::errc{} || end != digits.data() + digits.size()) {
+        return std::nullopt;
+    }
+    return static_cast<double>(value);
+}
+
+/**
+ * Clinger's fast path: with at most 2^53 as the digits and at most 22
+ * decimals, both the digits and the power of ten are exact doubles, and
+ * one division rounds correctly. Covers nearly every literal in practice.
+ */
+std::optional<double> parse_short_decimal(std::string_view lexeme) noexcept
+{
+    constexpr double POWERS_OF_TEN[]{
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+    };
+    constexpr int32_t MAX_DIGITS = 19; // can't overflow 64 bits
+    if (lexeme.empty() || lexeme.size() > MAX_DIGITS + 1) {
+        return std::nullopt;
+    }
+    uint64_t digits{0};
+    int32_t num_decimals{0};
+    bool seen_dot{false};
+    for (const char c : lexeme) {
+        if (c == '.' && !seen_dot) {
+            seen_dot = true;
+        } else if (c >= '0' && c <= '9') {
+            digits = digits * 10 + static_cast<uint64_t>(c - '0');
+            num_decimals += seen_dot;
+        } else {
+            return std::nullopt;
+        }
+    }
+    if (digits > (uint64_t{1} << 53) || num_decimals >= static_cast<int32_t>(std::size(POWERS_OF_TEN))) {
+        return std::nullopt;
+    }
+    return static_cast<double>(digits) / POWERS_OF_TEN[num_decimals];
+}
+
+} // anonymous namespace
+
+std::optional<double> parse_number_literal(std::string_view lexeme) noexcept
+{
+    if (lexeme.size() > 2 && lexeme[0] == '0') {
+        switch (lexeme[1]) {
+        case 'x':
+        case 'X':
+            return parse_integer(lexeme.substr(2), 16);
+        case 'b':
+        case 'B':
+            return parse_integer(lexeme.substr(2), 2);
+        default:
+            break;
+        }
+    }
+    if (const std::optional<double> value = parse_short_decimal(lexeme)) {
+        return value;
+    }
+    // libstdc++ implements this with the Eisel-Lemire algorithm, no locale
+    // and no copy to a terminated string like strtod.
+    double value{0.};
+    const auto [end, error] = std::from_chars(lexeme.data(), lexeme.data() + lexeme.size(), value);
+    if (error != std::errc{} || end != lexeme.data() + lexeme.size()) {
+        return std::nullopt;
+    }
+    return value;
+}
+
+ConstantPool::ConstantPool()
+  : m_nil{add(Value{Nil{}})}
+  , m_true{add(Value{true})}
+  , m_false{add(Value{false})}
+{}
+
+const Value* ConstantPool::add(const Token& token, std::string_view source)
+{
+    switch (token.type()) {
+    using enum TokenType;
+    case STRING:
+        {
+            const std::string_view lexeme = token.lexeme(source);
+            assert(lexeme.size() >= 2);
+            const std::string_view contents = lexeme.substr(1, lexeme.size() - 2);
+            if (const auto it = m_strings.find(contents); it != m_strings.end()) {
+                return it->second;
+            }
+            const Value* const value = add(Value{std::in_place_type<std::string>, contents});
+            m_strings.emplace(std::get<std::string>(*value), value);
+            return value;
+        }
+
+    case NUMBER:
+        {
+            const std::optional<double> number = parse_number_literal(token.lexeme(source));
+            if (!number) {
+                return nullptr;
+            }
+            if (const auto it = m_numbers.find(*number); it != m_numbers.end()) {
+                return it->second;
+            }
+            const Value* const value = add(Value{*number});
+            m_numbers.emplace(*number, value);
+            return value;
+        }
+
+    case TRUE:
+        return m_true;
+
+    case FALSE:
+        return m_false;
+
+    case NIL:
+        return m_nil;
+
+    default:
+        break;
+    }
+    std::abort();
+}
+
+const Value* ConstantPool::add(Value&& value)
+{
+    return &m_values.emplace_back(std::move(value));
+}
+
+
+TEST_CASE("Number literals")
+{
+    CHECK(parse_number_literal("0") == 0.);
+    CHECK(parse_number_literal("092.25") == 92.25);
+    CHECK(parse_number_literal("0.1") == 0.1);
+    CHECK(parse_number_literal("1234567.875") == 1234567.875);
+    CHECK(parse_number_literal("0.0000000000000000000001") == 1e-22);
+    CHECK(parse_number_literal("0.00000000000000000000001") == 1e-23);
+    // past the fast path, still correctly rounded
+    CHECK(parse_number_literal("9007199254740993") == 9007199254740992.);
+    CHECK(parse_number_literal("123456789012345678901.5") == 123456789012345678901.5);
+    CHECK(parse_number_literal("0xff") == 255.);
+    CHECK(parse_number_literal("0XaBc") == 0xabc);
+    CHECK(parse_number_literal("0b101") == 5.);
+    CHECK(parse_number_literal("0xffffffffffffffff") == static_cast<double>(std::numeric_limits<uint64_t>::max()));
+
+    CHECK(parse_number_literal("0x10000000000000000").has_value() == false);
+    CHECK(parse_number_literal("0b102").has_value() == false);
+    CHECK(parse_number_literal(std::string(400, '9')).has_value() == false);
+}
+
+TEST_CASE("Constant pool")
+{
+    constexpr std::string_view source{"\"a\" 16 0x10 \"a\" true nil"};
+    const Token string{TokenType::STRING, 0, 3};
+    const Token decimal{TokenType::NUMBER, 4, 2};
+    const Token hex{TokenType::NUMBER, 7, 4};
+    const Token same_string{TokenType::STRING, 12, 3};
+
+    ConstantPool pool;
+    const Value* const a = pool.add(string, source);
+    REQUIRE(a != nullptr);
+    CHECK(std::get<std::string>(*a) == "a");
+    CHECK(pool.add(same_string, source) == a);
+
+    const Value* const sixteen = pool.add(decimal, source);
+    REQUIRE(sixteen != nullptr);
+    CHECK(std::get<double>(*sixteen) == 16.);
+    CHECK(pool.add(hex, source) == sixteen);
+
+    CHECK(std::get<bool>(*pool.add(TRUE_TOKEN, source)) == true);
+    CHECK(std::get<bool>(*pool.add(FALSE_TOKEN, source)) == false);
+    CHECK(pool.add(Token{TokenType::NIL, 21, 3}, source) == pool.add(Token{TokenType::NIL, 21, 3}, source));
+    // nil, true, false, "a" and 16
+    CHECK(pool.size() == 5);
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <deque>
+#include <optional>
+#include <string_view>
+
+#include <absl/container/flat_hash_map.h>
+
+#include "value.hpp"
+
+class Token;
+
+/**
+ * Decode a NUMBER lexeme: decimal with an optional fraction, or an integer
+ * with a 0x/0X or 0b/0B prefix. Returns nullopt if it doesn't fit a double
+ * (hexadecimal and binary literals must fit 64 bits).
+ */
+std::optional<double> parse_number_literal(std::string_view lexeme) noexcept;
+
+/**
+ * The values of the literals of a program, decoded once while parsing.
+ * LiteralExpr points into the pool, evaluating one is a copy of a
+ * prebuilt Value. Equal literals share one entry.
+ */
+class ConstantPool
+{
+public:
+    ConstantPool();
+
+    ConstantPool(const ConstantPool&) = delete;
+    ConstantPool& operator=(const ConstantPool&) = delete;
+
+    /**
+     * The value of literal `token`, which is part of `source`. Returns
+     * nullptr if it is a number out of range. Values stay where they are
+     * until the pool is destroyed.
+     */
+    const Value* add(const Token& token, std::string_view source);
+
+    std::size_t size() const noexcept
+    {
+        return m_values.size();
+    }
+
+private:
+    const Value* add(Value&& value);
+
+    // a deque never moves its elements
+    std::deque<Value> m_values;
+    absl::flat_hash_map<double, const Value*> m_numbers;
+    // views into the strings of m_values
+    absl::flat_hash_map<std::string_view, const Value*> m_strings;
+    const Value* m_nil;
+    const Value* m_true;
+    const Value* m_false;
+};
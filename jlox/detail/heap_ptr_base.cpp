@@ -47,6 +47,30 @@ TEST_CASE("HeapPtrBase")
         REQUIRE(ptr2.ptr() == &tmp);
     }
 
+    SUBCASE("Move assign a neighbour") {
+        int tmp{7};
+        int tmp2{8};
+        ptr.link(head, &tmp);
+        HeapPtrBaseNode ptr2;
+        ptr2.link(head, &tmp2);
+        HeapPtrBaseNode ptr3;
+        ptr3.link(head, &tmp);
+        REQUIRE(ptr3.next() == &ptr2);
+        REQUIRE(ptr2.next() == &ptr);
+
+        ptr2 = std::move(ptr);
+        REQUIRE(ptr.ptr() == nullptr);
+        REQUIRE(ptr2.ptr() == &tmp);
+        REQUIRE(head.first() == &ptr3);
+        REQUIRE(ptr3.next() == &ptr2);
+        REQUIRE(ptr2.next() == nullptr);
+
+        ptr2 = std::move(ptr3);
+        REQUIRE(head.first() == &ptr2);
+        REQUIRE(ptr2.next() == nullptr);
+        REQUIRE(ptr3.ptr() == nullptr);
+    }
+
     SUBCASE("Drop all from head") {
         int tmp{45};
         ptr.link(head, &tmp);
@@ -3,11 +3,50 @@
 #include <cstddef>
 #include <cassert>
 #include <utility>
+#include <type_traits>
 
 namespace detail
 {
 
 class HeapPtrHead;
+class HeapPtrBaseNode;
+
+/**
+ * Observer for every change of the reference graph. The hooks are only
+ * compiled in with JLOX_GC_TRACE, see GcTraceRecorder.
+ */
+class HeapPtrTracer
+{
+public:
+    virtual void on_link(const HeapPtrBaseNode* node, const void* ptr) noexcept = 0;
+    virtual void on_unlink(const HeapPtrBaseNode* node) noexcept = 0;
+
+protected:
+    ~HeapPtrTracer() = default;
+};
+
+inline HeapPtrTracer* heap_ptr_tracer{nullptr};
+
+constexpr
+void trace_link([[maybe_unused]] const HeapPtrBaseNode* node,
+                [[maybe_unused]] const void* ptr) noexcept
+{
+#ifdef JLOX_GC_TRACE
+    if (!std::is_constant_evaluated() && heap_ptr_tracer) {
+        heap_ptr_tracer->on_link(node, ptr);
+    }
+#endif
+}
+
+constexpr
+void trace_unlink([[maybe_unused]] const HeapPtrBaseNode* node) noexcept
+{
+#ifdef JLOX_GC_TRACE
+    if (!std::is_constant_evaluated() && heap_ptr_tracer) {
+        heap_ptr_tracer->on_unlink(node);
+    }
+#endif
+}
 
 class HeapPtrBaseNode
 {
@@ -38,6 +77,8 @@ public:
             *m_pprev = this;
             if (m_next)
                 m_next->m_pprev = &m_next;
+            trace_unlink(&other);
+            trace_link(this, m_ptr);
         }
     }
 
@@ -75,12 +116,14 @@ public:
         if (node.m_next)
             node.m_next->m_pprev = &node.m_next;
         m_next = &node;
+        trace_link(&node, ptr);
     }
 
     constexpr
     void unlink() noexcept
     {
         if (m_pprev) {
+            trace_unlink(this);
             *m_pprev = m_next;
             if (m_next) {
                 m_next->m_pprev = m_pprev;
@@ -94,9 +137,21 @@ public:
     constexpr
     void swap(HeapPtrBaseNode& other) noexcept
     {
+        if (m_pprev)
+            trace_unlink(this);
+        if (other.m_pprev)
+            trace_unlink(&other);
         std::swap(m_pprev, other.m_pprev);
         std::swap(m_next, other.m_next);
         std::swap(m_ptr, other.m_ptr);
+        // Neighbours in a list now point at themselves, not each other
+        if (m_pprev == &m_next) {
+            m_pprev = &other.m_next;
+            other.m_next = this;
+        } else if (other.m_pprev == &other.m_next) {
+            other.m_pprev = &m_next;
+            m_next = &other;
+        }
         if (m_pprev) {
             *m_pprev = this;
             if (m_next)
@@ -107,6 +162,10 @@ public:
             if (other.m_next)
                 other.m_next->m_pprev = &other.m_next;
         }
+        if (m_pprev)
+            trace_link(this, m_ptr);
+        if (other.m_pprev)
+            trace_link(&other, other.m_ptr);
     }
 
     HeapPtrBaseNode(const HeapPtrBaseNode&) = delete;
@@ -196,6 +255,7 @@ void HeapPtrBaseNode::link(HeapPtrHead& head, void* ptr) noexcept
     head.m_first = this;
     m_pprev = &head.m_first;
     m_ptr = ptr;
+    trace_link(this, ptr);
 }
 
 } // namespace detail
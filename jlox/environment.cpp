@@ -1,60 +1,101 @@
 #include "environment.hpp"
 
+#include <algorithm>
+#include <chrono>
+
 
 Environment::~Environment() = default;
 
 Environment::Environment(HeapPtr<Environment> parent)
-  : m_env{}
+  : m_symbols{}
+  , m_values{}
+  , m_index{}
   , m_parent{std::move(parent)}
 {}
 
-void Environment::define(std::string_view name, Value&& value)
+void Environment::reserve(const int32_t num_slots)
 {
-    m_env.insert_or_assign(std::string{name}, std::move(value));
+    m_symbols.reserve(num_slots);
+    m_values.reserve(num_slots);
 }
 
-void Environment::define(std::string_view name, const Value& value)
+Value* Environment::find(const SymbolId symbol) const noexcept
 {
-    m_env.insert_or_assign(std::string{name}, std::move(value));
+    if (!m_index.empty()) {
+        const auto it = m_index.find(symbol);
+        return it != m_index.end() ? &m_values[it->second] : nullptr;
+    }
+    const auto it = std::find(m_symbols.begin(), m_symbols.end(), symbol);
+    return it != m_symbols.end() ? &m_values[static_cast<int32_t>(it - m_symbols.begin())] : nullptr;
 }
 
-bool Environment::assign(std::string_view name, Value&& value)
+void Environment::define(const SymbolId symbol, Value&& value)
 {
-    Environment* env = this;
-    while (env) {
-        const auto it = env->m_env.find(name);
-        if (it != env->m_env.end()) {
-            it->second = std::move(value);
-            return true;
+    if (Value* const existing = find(symbol)) {
+        *existing = std::move(value);
+        return;
+    }
+    append(symbol, std::move(value));
+    if (m_symbols.size() > MAX_LINEAR_SEARCH) {
+        if (m_index.empty()) {
+            for (std::size_t i = 0; i < m_symbols.size(); ++i) {
+                m_index.emplace(m_symbols[i], static_cast<int32_t>(i));
+            }
+        } else {
+            m_index.emplace(symbol, static_cast<int32_t>(m_symbols.size() - 1));
         }
-        env = env->parent().get();
     }
-    return false;
 }
 
-bool Environment::assign(std::string_view name, const Value& value)
+void Environment::define(const SymbolId symbol, const Value& value)
 {
-    Environment* env = this;
-    while (env) {
-        const auto it = env->m_env.find(name);
-        if (it != env->m_env.end()) {
-            it->second = std::move(value);
+    define(symbol, Value{value});
+}
+
+void Environment::define_slot(const int32_t slot, const SymbolId symbol, Value&& value)
+{
+    // Scopes of slots are read by slot, so they get no index and lookups
+    // by name stay linear.
+    assert(slot >= 0 && m_index.empty());
+    if (slot < m_values.size()) {
+        m_values[slot] = std::move(value);
+        return;
+    }
+    while (m_values.size() < slot) {
+        m_values.emplace_back(nil);
+        m_symbols.push_back(NO_SYMBOL);
+    }
+    append(symbol, std::move(value));
+}
+
+void Environment::append(const SymbolId symbol, Value&& value)
+{
+    m_values.emplace_back(std::move(value));
+    m_symbols.push_back(symbol);
+}
+
+bool Environment::assign(const SymbolId symbol, Value&& value)
+{
+    for (const Environment* env = this; env; env = env->parent().get()) {
+        if (Value* const existing = env->find(symbol)) {
+            *existing = std::move(value);
             return true;
         }
-        env = env->parent().get();
     }
     return false;
 }
 
-const Value* Environment::get(std::string_view name) const noexcept
+bool Environment::assign(const SymbolId symbol, const Value& value)
+{
+    return assign(symbol, Value{value});
+}
+
+const Value* Environment::get(const SymbolId symbol) const noexcept
 {
-    const Environment* env = this;
-    while (env) {
-        const auto it = env->m_env.find(name);
-        if (it != env->m_env.end()) {
-            return &it->second;
+    for (const Environment* env = this; env; env = env->parent().get()) {
+        if (const Value* const value = env->find(symbol)) {
+            return value;
         }
-        env = env->parent().get();
     }
     return nullptr;
 }
@@ -64,12 +105,17 @@ const Value* Environment::get(std::string_view name) const noexcept
 Globals::~Globals() = default;
 
 Globals::Globals()
-  : m_env{Heap::allocate<Environment>(nullptr)}
+  : m_global_env{Heap::allocate<Environment>(nullptr)}
+  , m_env{m_global_env}
 {}
 
-void Globals::open_scope()
+void Globals::open_scope(const int32_t num_slots)
 {
     HeapPtr<Environment> new_env = Heap::allocate<Environment>(m_env);
+    // not in the constructor, the heap can't allocate while it constructs
+    if (num_slots > 0) {
+        new_env->reserve(num_slots);
+    }
     m_env = std::move(new_env);
 }
 
@@ -78,3 +124,54 @@ void Globals::close_scope()
     m_env = m_env->parent();
     assert(m_env.get() != nullptr);
 }
+
+namespace
+{
+
+double clock_impl()
+{
+    const auto now = std::chrono::steady_clock::now();
+    const int64_t now_us = std::chrono::duration_cast<std::chrono::microseconds>(now.time_since_epoch()).count();
+    return static_cast<double>(now_us) / 1000000.0;
+}
+
+} // anonymous namespace
+
+void define_natives(Environment& env)
+{
+    env.define(intern_symbol("clock"), Callable{&clock_impl, {}});
+}
+
+
+#include <doctest/doctest.h>
+#include <fmt/format.h>
+
+TEST_CASE("Environment")
+{
+    Globals globals;
+    // enough names for the outer scope to switch to its hash index
+    std::vector<SymbolId> symbols;
+    for (int32_t i = 0; i < 12; ++i) {
+        symbols.push_back(intern_symbol(fmt::format("environment_test_{}", i)));
+        globals.environment()->define(symbols.back(), Value{static_cast<double>(i)});
+    }
+    {
+        const NewScope scope{globals};
+        const Environment& env = *globals.environment();
+        globals.environment()->define(symbols[3], Value{true});
+        CHECK(std::get<bool>(*env.get(symbols[3])) == true);
+        CHECK(std::get<double>(*env.get(symbols[11])) == 11.);
+        CHECK(globals.environment()->assign(symbols[9], Value{-9.}));
+        CHECK(env.get(intern_symbol("environment_test_missing")) == nullptr);
+        CHECK(globals.environment()->assign(intern_symbol("environment_test_missing"), Value{nil}) == false);
+    }
+    const Environment& env = *globals.environment();
+    CHECK(std::get<double>(*env.get(symbols[3])) == 3.);
+    CHECK(std::get<double>(*env.get(symbols[9])) == -9.);
+    int32_t mismatches{0};
+    for (int32_t i = 0; i < 12; ++i) {
+        const Value* const value = env.get(symbols[i]);
+        mismatches += !value || std::get<double>(*value) != (i == 9 ? -9. : i);
+    }
+    CHECK(mismatches == 0);
+}
@@ -1,40 +1,44 @@
 #pragma once
 
-#include <string>
 #include <vector>
 #include <memory>
-#include <unordered_map>
-#include <absl/hash/hash.h>
+#include <absl/container/flat_hash_map.h>
 
+#include "symbols.hpp"
 #include "value.hpp"
 #include "garbage_collected_heap.hpp"
 
-struct StringHash {
-    using is_transparent = void;
-    [[nodiscard]] size_t operator()(const char *txt) const {
-        return std::hash<std::string_view>{}(txt);
-    }
-    [[nodiscard]] size_t operator()(std::string_view txt) const {
-        return std::hash<std::string_view>{}(txt);
-    }
-    [[nodiscard]] size_t operator()(const std::string &txt) const {
-        return std::hash<std::string>{}(txt);
-    }
-};
-
 class Environment
 {
 public:
     Environment(HeapPtr<Environment> parent);
     ~Environment();
 
-    void define(std::string_view name, Value&& value);
-    void define(std::string_view name, const Value& value);
+    //! Allocates room for `num_slots` variables up front
+    void reserve(int32_t num_slots);
+
+    void define(SymbolId symbol, Value&& value);
+    void define(SymbolId symbol, const Value& value);
+
+    bool assign(SymbolId symbol, Value&& value);
+    bool assign(SymbolId symbol, const Value& value);
+
+    const Value* get(SymbolId symbol) const noexcept;
 
-    bool assign(std::string_view name, Value&& value);
-    bool assign(std::string_view name, const Value& value);
+    /**
+     * The variables of local scopes, numbered by resolve(). Slots are
+     * defined in order, a skipped one is nil. No name is looked up.
+     */
+    void define_slot(int32_t slot, SymbolId symbol, Value&& value);
 
-    const Value* get(std::string_view name) const noexcept;
+    Value& slot(int32_t depth, int32_t slot) const noexcept
+    {
+        const Environment* env = this;
+        for (int32_t i = 0; i < depth; ++i) {
+            env = env->m_parent.get();
+        }
+        return env->m_values[slot];
+    }
 
     const HeapPtr<Environment>& parent() const noexcept
     {
@@ -42,28 +46,30 @@ public:
     }
 
 private:
-    using Map = std::unordered_map<std::string, Value,
-            StringHash,
-            std::equal_to<>,
-            GarbageCollectedAllocator<std::pair<const std::string, Value>>>;
-    /*
-    using Map = absl::flat_hash_map<std::string, Value,
-          absl::container_internal::hash_default_hash<std::string>,
-          absl::container_internal::hash_default_eq<std::string>,
-          GarbageCollectedAllocator<std::pair<const std::string, Value>>>;
-    */
-
-    Map m_env;
+    //! Scopes defined by name with more names than this get a hash index
+    inline static constexpr std::size_t MAX_LINEAR_SEARCH = 8;
+
+    Value* find(SymbolId symbol) const noexcept;
+    void append(SymbolId symbol, Value&& value);
+
+    // m_values[i] is the value of m_symbols[i]. The values are in the heap,
+    // so the closures in them don't count as roots.
+    std::vector<SymbolId> m_symbols;
+    HeapVector<Value> m_values;
+    absl::flat_hash_map<SymbolId, int32_t> m_index;
     HeapPtr<Environment> m_parent;
 };
 
+//! Defines the functions implemented in C++, like clock(), in `env`
+void define_natives(Environment& env);
+
 class Globals
 {
 public:
     Globals();
     ~Globals();
 
-    void open_scope();
+    void open_scope(int32_t num_slots = 0);
     void close_scope();
 
     const HeapPtr<Environment>& environment() const noexcept
@@ -71,6 +77,12 @@ public:
         return m_env;
     }
 
+    //! The outermost scope, where the globals are
+    const HeapPtr<Environment>& global_environment() const noexcept
+    {
+        return m_global_env;
+    }
+
     HeapPtr<Environment> exchange(HeapPtr<Environment> new_env)
     {
         HeapPtr<Environment> prev{std::move(m_env)};
@@ -79,6 +91,7 @@ public:
     }
 
 private:
+    HeapPtr<Environment> m_global_env;
     HeapPtr<Environment> m_env;
 };
 
@@ -87,10 +100,10 @@ class NewScope
 {
 public:
     [[nodiscard]]
-    NewScope(Globals& globals) noexcept
+    NewScope(Globals& globals, int32_t num_slots = 0)
       : m_globals{globals}
     {
-        m_globals.open_scope();
+        m_globals.open_scope(num_slots);
     }
 
     ~NewScope()
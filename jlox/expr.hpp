@@ -1,8 +1,12 @@
 #pragma once
 
 #include <cassert>
-#include <vector>
+#include <cstdint>
+#include <span>
+#include <variant>
+#include "symbols.hpp"
 #include "tokens.hpp"
+#include "value.hpp"
 
 class Expr;
 struct BinaryExpr;
@@ -29,6 +33,25 @@ public:
     virtual void visit(CallExpr& call_expr) = 0;
     virtual void unkown_expr(Expr& expr) = 0;
 
+    /*
+     * Nodes whose operands were all of one type call these instead of
+     * visit(), see TypeProfile. A visitor that doesn't specialize gets
+     * visit() anyway.
+     */
+    virtual void visit_numbers(BinaryExpr& binar_expr) { visit(binar_expr); }
+    virtual void visit_strings(BinaryExpr& binar_expr) { visit(binar_expr); }
+    virtual void visit_number(UnaryExpr& unary_expr) { visit(unary_expr); }
+    virtual void visit_boolean(UnaryExpr& unary_expr) { visit(unary_expr); }
+    virtual void visit_booleans(LogicalExpr& logical_expr) { visit(logical_expr); }
+
+    // Nodes that fuse() marked as one superinstruction call these instead
+    virtual void visit_fused(BinaryExpr& binar_expr) { visit(binar_expr); }
+    virtual void visit_fused(AssignExpr& assign_expr) { visit(assign_expr); }
+
+    // Nodes whose operands infer_types() proved to be numbers call these instead
+    virtual void visit_check_free(BinaryExpr& binar_expr) { visit(binar_expr); }
+    virtual void visit_check_free(UnaryExpr& unary_expr) { visit(unary_expr); }
+
     void visit(Expr& expr) {
         unkown_expr(expr);
     }
@@ -55,8 +78,9 @@ public:
     template <typename T>
     bool is_type() const noexcept
     {
+        // m_get_main_token, since specialized nodes swap m_accept
         using TBase = ExprCRTC<T>;
-        return m_accept == &TBase::accept_impl;
+        return m_get_main_token == &TBase::get_main_token_impl;
     }
 
 
@@ -73,6 +97,11 @@ protected:
         assert(m_accept);
     }
 
+    void set_accept(void (*accept)(Expr&, ExprVisitor&)) noexcept
+    {
+        m_accept = accept;
+    }
+
 private:
     void (*m_accept)(Expr&, ExprVisitor&);
     const Token* (*m_get_main_token)(const Expr&) noexcept;
@@ -87,9 +116,28 @@ protected:
       : Expr{&ExprCRTC::accept_impl, &ExprCRTC::get_main_token_impl}
     {}
 
+    //! Makes accept() call `Visit` instead of visit()
+    template <void (ExprVisitor::*Visit)(T&)>
+    void specialize() noexcept
+    {
+        set_accept(&ExprCRTC::specialized_accept_impl<Visit>);
+    }
+
+    void unspecialize() noexcept
+    {
+        set_accept(&ExprCRTC::accept_impl);
+    }
+
 private:
     friend class Expr;
 
+    template <void (ExprVisitor::*Visit)(T&)>
+    static
+    void specialized_accept_impl(Expr& e, ExprVisitor& visitor)
+    {
+        (visitor.*Visit)(static_cast<T&>(e));
+    }
+
     static
     void accept_impl(Expr& e, ExprVisitor& visitor)
     {
@@ -108,6 +156,36 @@ private:
     }
 };
 
+/**
+ * The types of Value that the operands of a node had so far, one bit per
+ * alternative. Nodes observe() their operands with it, and specialize
+ * accept() while they have seen only one type. A miss makes the type mixed,
+ * and the node generic for good.
+ */
+class TypeProfile
+{
+public:
+    //! True if the type of `value` is new
+    bool add(const Value& value) noexcept
+    {
+        const uint8_t bit = static_cast<uint8_t>(1u << value.index());
+        const bool is_new = (m_seen & bit) == 0;
+        m_seen |= bit;
+        return is_new;
+    }
+
+    template <typename T>
+    [[nodiscard]]
+    bool is_only() const noexcept
+    {
+        static_assert(std::variant_size_v<Value> <= 8);
+        return m_seen == (1u << value_index<T>);
+    }
+
+private:
+    uint8_t m_seen{0};
+};
+
 struct BinaryExpr : ExprCRTC<BinaryExpr>
 {
     constexpr
@@ -129,9 +207,45 @@ struct BinaryExpr : ExprCRTC<BinaryExpr>
                 op->type() == TokenType::SLASH));
     }
 
+    /**
+     * Specializes accept() to ExprVisitor::visit_numbers() while the
+     * operands were numbers, and to visit_strings() while they were strings
+     * and `op` is (+), (==) or (!=).
+     */
+    void observe(const Value& lhs, const Value& rhs) noexcept
+    {
+        if (!(operand_types.add(lhs) | operand_types.add(rhs))) {
+            return;
+        }
+        const TokenType type = op->type();
+        if (operand_types.is_only<double>()) {
+            specialize<&ExprVisitor::visit_numbers>();
+        } else if (operand_types.is_only<std::string>() && (
+                type == TokenType::PLUS ||
+                type == TokenType::EQUAL_EQUAL ||
+                type == TokenType::BANG_EQUAL)) {
+            specialize<&ExprVisitor::visit_strings>();
+        } else {
+            unspecialize();
+        }
+    }
+
+    //! Makes accept() call ExprVisitor::visit_fused(), for good. Both operands must be a VarExpr or LiteralExpr
+    void fuse() noexcept
+    {
+        specialize<&ExprVisitor::visit_fused>();
+    }
+
+    //! Makes accept() call ExprVisitor::visit_check_free(), for good. Both operands must be numbers
+    void mark_check_free() noexcept
+    {
+        specialize<&ExprVisitor::visit_check_free>();
+    }
+
     Expr* left;
     const Token* op;
     Expr* right;
+    TypeProfile operand_types;
 
     static constexpr auto main_token = &BinaryExpr::op;
 };
@@ -158,11 +272,13 @@ struct GroupingExpr : ExprCRTC<GroupingExpr>
 
 struct LiteralExpr : ExprCRTC<LiteralExpr>
 {
+    //! `constant` is the decoded value, see ConstantPool.
     constexpr
-    LiteralExpr(const Token* value) noexcept
+    LiteralExpr(const Token* value, const Value* constant) noexcept
       : value{value}
+      , constant{constant}
     {
-        assert(value && (
+        assert(value && constant && (
                 value->type() == TokenType::NUMBER ||
                 value->type() == TokenType::STRING ||
                 value->type() == TokenType::TRUE ||
@@ -171,6 +287,7 @@ struct LiteralExpr : ExprCRTC<LiteralExpr>
     }
 
     const Token* value;
+    const Value* constant;
     static constexpr auto main_token = &LiteralExpr::value;
 };
 
@@ -186,37 +303,86 @@ struct UnaryExpr : ExprCRTC<UnaryExpr>
                 op->type() == TokenType::BANG));
     }
 
+    //! Specializes accept() to ExprVisitor::visit_number() for (-) on numbers, visit_boolean() for (!) on booleans
+    void observe(const Value& operand) noexcept
+    {
+        if (!operand_types.add(operand)) {
+            return;
+        }
+        if (op->type() == TokenType::MINUS && operand_types.is_only<double>()) {
+            specialize<&ExprVisitor::visit_number>();
+        } else if (op->type() == TokenType::BANG && operand_types.is_only<bool>()) {
+            specialize<&ExprVisitor::visit_boolean>();
+        } else {
+            unspecialize();
+        }
+    }
+
+    //! Makes accept() call ExprVisitor::visit_check_free(), for good. Only for (-) on a number
+    void mark_check_free() noexcept
+    {
+        specialize<&ExprVisitor::visit_check_free>();
+    }
+
     const Token* op;
     Expr* right;
+    TypeProfile operand_types;
     static constexpr auto main_token = &UnaryExpr::op;
 };
 
+//! Variables that resolve() found in no enclosing scope, looked up by name
+inline constexpr int32_t GLOBAL_DEPTH = -1;
+
+//! Where resolve() found a variable: `slot` in the scope `depth` levels up
+struct Resolution
+{
+    int32_t depth{GLOBAL_DEPTH};
+    int32_t slot{-1};
+};
+
 struct VarExpr : ExprCRTC<VarExpr>
 {
     constexpr
-    VarExpr(const Token* identifier) noexcept
+    VarExpr(const Token* identifier, SymbolId symbol) noexcept
       : identifier{identifier}
+      , symbol{symbol}
     {
         assert(identifier && identifier->type() == TokenType::IDENTIFIER);
+        assert(symbol != NO_SYMBOL);
     }
 
     const Token* identifier;
+    SymbolId symbol;
+    Resolution resolution{};
     static constexpr auto main_token = &VarExpr::identifier;
 };
 
 struct AssignExpr : ExprCRTC<AssignExpr>
 {
     constexpr
-    AssignExpr(const Token* identifier, Expr* value) noexcept
+    AssignExpr(const Token* identifier, SymbolId symbol, Expr* value) noexcept
       : identifier{identifier}
+      , symbol{symbol}
       , value{value}
     {
         assert(identifier && identifier->type() == TokenType::IDENTIFIER);
+        assert(symbol != NO_SYMBOL);
         assert(value);
     }
 
+    /**
+     * Makes accept() call ExprVisitor::visit_fused(). `value` must be an
+     * arithmetic BinaryExpr of this variable and a VarExpr or LiteralExpr.
+     */
+    void fuse() noexcept
+    {
+        specialize<&ExprVisitor::visit_fused>();
+    }
+
     const Token* identifier;
+    SymbolId symbol;
     Expr* value;
+    Resolution resolution{};
     static constexpr auto main_token = &AssignExpr::identifier;
 };
 
@@ -233,9 +399,23 @@ struct LogicalExpr : ExprCRTC<LogicalExpr>
                token->type() == TokenType::OR);
     }
 
+    //! Specializes accept() to ExprVisitor::visit_booleans() while the operands evaluated were booleans
+    void observe(const Value& operand) noexcept
+    {
+        if (!operand_types.add(operand)) {
+            return;
+        }
+        if (operand_types.is_only<bool>()) {
+            specialize<&ExprVisitor::visit_booleans>();
+        } else {
+            unspecialize();
+        }
+    }
+
     Expr* left;
     const Token* token;
     Expr* right;
+    TypeProfile operand_types;
 
     static constexpr auto main_token = &LogicalExpr::token;
 };
@@ -243,17 +423,18 @@ struct LogicalExpr : ExprCRTC<LogicalExpr>
 
 struct CallExpr : ExprCRTC<CallExpr>
 {
-    CallExpr(Expr* callee, const Token* paren, const std::vector<Expr*>& args)
+    constexpr
+    CallExpr(Expr* callee, const Token* paren, std::span<Expr*> args) noexcept
       : callee{callee}
       , paren{paren}
-      , args{std::move(args)}
+      , args{args}
     {
         assert(callee && paren);
     }
 
     Expr* callee;
     const Token* paren;
-    std::vector<Expr*> args;
+    std::span<Expr*> args;
 
     static constexpr auto main_token = &CallExpr::paren;
 };
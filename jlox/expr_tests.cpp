@@ -3,6 +3,7 @@
 #include "expr.hpp"
 #include "scanner.hpp"
 #include "bump_alloc.hpp"
+#include "constant_pool.hpp"
 #include "print_visitor.hpp"
 
 #include <doctest/doctest.h>
@@ -15,10 +16,11 @@ TEST_CASE("Expr/Visitor")
     CHECK(result.num_errors == 0);
     CHECK(result.tokens.size() == 7);
 
-    LiteralExpr v123{&result.tokens[1]};
+    ConstantPool constants;
+    LiteralExpr v123{&result.tokens[1], constants.add(result.tokens[1], source)};
     UnaryExpr minus{&result.tokens[0], &v123};
 
-    LiteralExpr v4567{&result.tokens[4]};
+    LiteralExpr v4567{&result.tokens[4], constants.add(result.tokens[4], source)};
     GroupingExpr group{&result.tokens[3], &v4567, &result.tokens[5]};
 
     BinaryExpr binary{&minus, &result.tokens[2], &group};
@@ -28,3 +30,61 @@ TEST_CASE("Expr/Visitor")
 
     CHECK(visitor.get() == "(* (-123) (group 45.67))");
 }
+
+TEST_CASE("Expr/Specialization")
+{
+    struct Visitor final : ExprVisitor
+    {
+        void visit(BinaryExpr&) override { visited = "visit"; }
+        void visit(GroupingExpr&) override {}
+        void visit(LiteralExpr&) override {}
+        void visit(UnaryExpr&) override { visited = "visit"; }
+        void visit(VarExpr&) override {}
+        void visit(AssignExpr&) override {}
+        void visit(LogicalExpr&) override {}
+        void visit(CallExpr&) override {}
+        void unkown_expr(Expr&) override {}
+        void visit_numbers(BinaryExpr&) override { visited = "visit_numbers"; }
+        void visit_boolean(UnaryExpr&) override { visited = "visit_boolean"; }
+
+        std::string_view visited;
+    };
+
+    std::string_view source{"1 + 2 !true"};
+    auto result = scan_tokens(source);
+    REQUIRE(result.num_errors == 0);
+
+    ConstantPool constants;
+    LiteralExpr one{&result.tokens[0], constants.add(result.tokens[0], source)};
+    LiteralExpr two{&result.tokens[2], constants.add(result.tokens[2], source)};
+    BinaryExpr plus{&one, &result.tokens[1], &two};
+
+    Visitor visitor;
+    plus.accept(visitor);
+    CHECK(visitor.visited == "visit");
+
+    plus.observe(Value{1.}, Value{2.});
+    plus.accept(visitor);
+    CHECK(visitor.visited == "visit_numbers");
+    CHECK(plus.is_type<BinaryExpr>());
+
+    PrintVisitor printer{source};
+    plus.accept(printer);
+    CHECK(printer.get() == "(+ 1 2)");
+
+    plus.observe(Value{std::string{"a"}}, Value{2.});
+    plus.accept(visitor);
+    CHECK(visitor.visited == "visit");
+    plus.observe(Value{1.}, Value{2.});
+    plus.accept(visitor);
+    CHECK(visitor.visited == "visit");
+
+    LiteralExpr yes{&result.tokens[4], constants.add(result.tokens[4], source)};
+    UnaryExpr bang{&result.tokens[3], &yes};
+    bang.observe(Value{true});
+    bang.accept(visitor);
+    CHECK(visitor.visited == "visit_boolean");
+    bang.observe(Value{Nil{}});
+    bang.accept(visitor);
+    CHECK(visitor.visited == "visit");
+}
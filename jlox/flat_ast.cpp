@@ -0,0 +1,626 @@
+#include "flat_ast.hpp"
+
+#include <cstring>
+#include <type_traits>
+
+#include "bump_alloc.hpp"
+#include "constant_pool.hpp"
+#include "expr.hpp"
+#include "scanner.hpp"
+#include "stmt.hpp"
+
+namespace flat
+{
+
+namespace
+{
+
+constexpr std::string_view MAGIC{"JLOXAST1"};
+
+constexpr
+bool is_expression(const NodeKind kind) noexcept
+{
+    return kind <= NodeKind::CALL;
+}
+
+class Flattener final : public ExprVisitor, public StmtVisitor
+{
+public:
+    Flattener(FlatAst& ast, const ScannerResult& scanner_result) noexcept
+      : m_ast{ast}
+      , m_tokens{scanner_result.tokens}
+      , m_result{}
+    {}
+
+    NodeRef flatten(Expr* const expr)
+    {
+        if (!expr) {
+            return NodeRef{};
+        }
+        expr->accept(*this);
+        return m_result;
+    }
+
+    NodeRef flatten(Stmt* const stmt)
+    {
+        if (!stmt) {
+            return NodeRef{};
+        }
+        static_cast<void>(stmt->accept(*this));
+        return m_result;
+    }
+
+    void visit(BinaryExpr& e) override
+    {
+        m_result = m_ast.add(Binary{flatten(e.left), index(e.op), flatten(e.right)});
+    }
+
+    void visit(GroupingExpr& e) override
+    {
+        m_result = m_ast.add(Grouping{index(e.begin), flatten(e.expr), index(e.end)});
+    }
+
+    void visit(LiteralExpr& e) override
+    {
+        m_result = m_ast.add(Literal{index(e.value)});
+    }
+
+    void visit(UnaryExpr& e) override
+    {
+        m_result = m_ast.add(Unary{index(e.op), flatten(e.right)});
+    }
+
+    void visit(VarExpr& e) override
+    {
+        m_result = m_ast.add(Var{index(e.identifier)});
+    }
+
+    void visit(AssignExpr& e) override
+    {
+        m_result = m_ast.add(Assign{index(e.identifier), flatten(e.value)});
+    }
+
+    void visit(LogicalExpr& e) override
+    {
+        m_result = m_ast.add(Logical{flatten(e.left), index(e.token), flatten(e.right)});
+    }
+
+    void visit(CallExpr& e) override
+    {
+        const NodeRef callee = flatten(e.callee);
+        const ListRange args = flatten_list(e.args);
+        m_result = m_ast.add(Call{callee, index(e.paren), args});
+    }
+
+    void unkown_expr(Expr& /*expr*/) override
+    {
+        assert(false);
+        m_result = NodeRef{};
+    }
+
+    bool visit(::ExprStmt& s) override
+    {
+        m_result = m_ast.add(ExprStmt{flatten(s.expr)});
+        return false;
+    }
+
+    bool visit(PrintStmt& s) override
+    {
+        m_result = m_ast.add(Print{flatten(s.expr)});
+        return false;
+    }
+
+    bool visit(::VarStmt& s) override
+    {
+        m_result = m_ast.add(VarStmt{index(s.identifier), flatten(s.initializer)});
+        return false;
+    }
+
+    bool visit(BlockStmt& s) override
+    {
+        m_result = m_ast.add(Block{flatten_list(s.statements)});
+        return false;
+    }
+
+    bool visit(IfStmt& s) override
+    {
+        m_result = m_ast.add(If{flatten(s.condition), flatten(s.then_branch), flatten(s.else_branch)});
+        return false;
+    }
+
+    bool visit(WhileStmt& s) override
+    {
+        m_result = m_ast.add(While{flatten(s.condition), flatten(s.body)});
+        return false;
+    }
+
+    bool visit(FunStmt& s) override
+    {
+        std::vector<TokenIndex> params;
+        params.reserve(s.params.size());
+        for (const Token* const param : s.params) {
+            params.push_back(index(param));
+        }
+        const ListRange param_range = m_ast.add_token_list(params);
+        const ListRange body = flatten_list(s.body);
+        m_result = m_ast.add(Fun{index(s.name), param_range, body});
+        return false;
+    }
+
+    bool visit(ReturnStmt& s) override
+    {
+        m_result = m_ast.add(Return{index(s.token), flatten(s.expr)});
+        return false;
+    }
+
+    void unkown_stmt(Stmt& /*stmt*/) override
+    {
+        assert(false);
+        m_result = NodeRef{};
+    }
+
+private:
+    template <typename T>
+    ListRange flatten_list(const std::span<T*> children)
+    {
+        // children first, so that the list itself is contiguous
+        std::vector<NodeRef> refs;
+        refs.reserve(children.size());
+        for (T* const child : children) {
+            refs.push_back(flatten(child));
+        }
+        return m_ast.add_list(refs);
+    }
+
+    TokenIndex index(const Token* const token) const noexcept
+    {
+        if (token == &TRUE_TOKEN) {
+            return TRUE_TOKEN_INDEX;
+        }
+        if (token == &FALSE_TOKEN) {
+            return FALSE_TOKEN_INDEX;
+        }
+        assert(token >= m_tokens.data() && token < m_tokens.data() + m_tokens.size());
+        return static_cast<TokenIndex>(token - m_tokens.data());
+    }
+
+    FlatAst& m_ast;
+    const std::vector<Token>& m_tokens;
+    NodeRef m_result;
+};
+
+class Inflater
+{
+public:
+    Inflater(const FlatAst& ast, BumpAlloc& alloc, ConstantPool& constants, const ScannerResult& scanner_result) noexcept
+      : m_ast{ast}
+      , m_alloc{alloc}
+      , m_constants{constants}
+      , m_scanner_result{scanner_result}
+    {}
+
+    Expr* expr(const NodeRef ref)
+    {
+        if (ref.is_null()) {
+            return nullptr;
+        }
+        switch (ref.kind()) {
+        using enum NodeKind;
+        case BINARY:
+            {
+                const Binary& n = m_ast.get<Binary>(ref);
+                return m_alloc.allocate<BinaryExpr>(expr(n.left), token(n.op), expr(n.right));
+            }
+        case GROUPING:
+            {
+                const Grouping& n = m_ast.get<Grouping>(ref);
+                return m_alloc.allocate<GroupingExpr>(token(n.begin), expr(n.expr), token(n.end));
+            }
+        case LITERAL:
+            {
+                // the tree was parsed from this source, so the literal decodes
+                const Token* const value = token(m_ast.get<Literal>(ref).value);
+                return m_alloc.allocate<LiteralExpr>(value, m_constants.add(*value, m_scanner_result.source));
+            }
+        case UNARY:
+            {
+                const Unary& n = m_ast.get<Unary>(ref);
+                return m_alloc.allocate<UnaryExpr>(token(n.op), expr(n.right));
+            }
+        case VAR:
+            {
+                const Var& n = m_ast.get<Var>(ref);
+                return m_alloc.allocate<VarExpr>(token(n.identifier), symbol(n.identifier));
+            }
+        case ASSIGN:
+            {
+                const Assign& n = m_ast.get<Assign>(ref);
+                return m_alloc.allocate<AssignExpr>(token(n.identifier), symbol(n.identifier), expr(n.value));
+            }
+        case LOGICAL:
+            {
+                const Logical& n = m_ast.get<Logical>(ref);
+                return m_alloc.allocate<LogicalExpr>(expr(n.left), token(n.op), expr(n.right));
+            }
+        case CALL:
+            {
+                const Call& n = m_ast.get<Call>(ref);
+                Expr* const callee = expr(n.callee);
+                std::vector<Expr*> args;
+                for (const NodeRef arg : m_ast.list(n.args)) {
+                    args.push_back(expr(arg));
+                }
+                return m_alloc.allocate<CallExpr>(callee, token(n.paren), m_alloc.allocate_span<Expr*>(args));
+            }
+        default:
+            break;
+        }
+        assert(false);
+        return nullptr;
+    }
+
+    Stmt* stmt(const NodeRef ref)
+    {
+        if (ref.is_null()) {
+            return nullptr;
+        }
+        switch (ref.kind()) {
+        using enum NodeKind;
+        case EXPR_STMT:
+            return m_alloc.allocate<::ExprStmt>(expr(m_ast.get<ExprStmt>(ref).expr));
+        case PRINT:
+            return m_alloc.allocate<PrintStmt>(expr(m_ast.get<Print>(ref).expr));
+        case VAR_STMT:
+            {
+                const VarStmt& n = m_ast.get<VarStmt>(ref);
+                return m_alloc.allocate<::VarStmt>(token(n.identifier), symbol(n.identifier), expr(n.initializer));
+            }
+        case BLOCK:
+            return m_alloc.allocate<BlockStmt>(stmts(m_ast.get<Block>(ref).statements));
+        case IF:
+            {
+                const If& n = m_ast.get<If>(ref);
+                return m_alloc.allocate<IfStmt>(expr(n.condition), stmt(n.then_branch), stmt(n.else_branch));
+            }
+        case WHILE:
+            {
+                const While& n = m_ast.get<While>(ref);
+                return m_alloc.allocate<WhileStmt>(expr(n.condition), stmt(n.body));
+            }
+        case FUN:
+            {
+                const Fun& n = m_ast.get<Fun>(ref);
+                std::vector<const Token*> params;
+                std::vector<SymbolId> param_symbols;
+                for (const TokenIndex param : m_ast.token_list(n.params)) {
+                    params.push_back(token(param));
+                    param_symbols.push_back(symbol(param));
+                }
+                return m_alloc.allocate<FunStmt>(token(n.name), symbol(n.name),
+                                                 m_alloc.allocate_span<const Token*>(params),
+                                                 m_alloc.allocate_span<SymbolId>(param_symbols),
+                                                 stmts(n.body));
+            }
+        case RETURN:
+            {
+                const Return& n = m_ast.get<Return>(ref);
+                return m_alloc.allocate<ReturnStmt>(token(n.token), expr(n.value));
+            }
+        default:
+            break;
+        }
+        assert(false);
+        return nullptr;
+    }
+
+    std::span<Stmt*> stmts(const ListRange range)
+    {
+        std::vector<Stmt*> result;
+        for (const NodeRef ref : m_ast.list(range)) {
+            result.push_back(stmt(ref));
+        }
+        return m_alloc.allocate_span<Stmt*>(result);
+    }
+
+private:
+    const Token* token(const TokenIndex index) const noexcept
+    {
+        return get_token(m_scanner_result, index);
+    }
+
+    //! Interning the name again gives the ID the scanner got
+    SymbolId symbol(const TokenIndex index) const
+    {
+        return intern_symbol(token(index)->lexeme(m_scanner_result.source));
+    }
+
+    const FlatAst& m_ast;
+    BumpAlloc& m_alloc;
+    ConstantPool& m_constants;
+    const ScannerResult& m_scanner_result;
+};
+
+//
+
+void write_u32(std::string& out, const uint32_t value)
+{
+    char bytes[sizeof(value)];
+    std::memcpy(bytes, &value, sizeof(value));
+    out.append(bytes, sizeof(value));
+}
+
+bool read_u32(std::string_view& in, uint32_t& value) noexcept
+{
+    if (in.size() < sizeof(value)) {
+        return false;
+    }
+    std::memcpy(&value, in.data(), sizeof(value));
+    in.remove_prefix(sizeof(value));
+    return true;
+}
+
+// Nodes are arrays of 32-bit words and are written in host byte order.
+template <typename T>
+void write_array(std::string& out, const std::vector<T>& items)
+{
+    static_assert(std::is_trivially_copyable_v<T> && sizeof(T) % sizeof(uint32_t) == 0);
+    write_u32(out, static_cast<uint32_t>(items.size()));
+    out.append(reinterpret_cast<const char*>(items.data()), items.size() * sizeof(T));
+}
+
+template <typename T>
+bool read_array(std::string_view& in, std::vector<T>& items)
+{
+    uint32_t size{0};
+    if (!read_u32(in, size) || in.size() / sizeof(T) < size) {
+        return false;
+    }
+    items.resize(size);
+    std::memcpy(items.data(), in.data(), size * sizeof(T));
+    in.remove_prefix(size * sizeof(T));
+    return true;
+}
+
+} // anonymous namespace
+
+const Token* get_token(const ScannerResult& scanner_result, const TokenIndex index) noexcept
+{
+    if (index == TRUE_TOKEN_INDEX) {
+        return &TRUE_TOKEN;
+    }
+    if (index == FALSE_TOKEN_INDEX) {
+        return &FALSE_TOKEN;
+    }
+    assert(index < scanner_result.tokens.size());
+    return &scanner_result.tokens[index];
+}
+
+ListRange FlatAst::add_list(const std::span<const NodeRef> refs)
+{
+    const ListRange range{static_cast<uint32_t>(m_lists.size()), static_cast<uint32_t>(refs.size())};
+    m_lists.insert(m_lists.end(), refs.begin(), refs.end());
+    return range;
+}
+
+ListRange FlatAst::add_token_list(const std::span<const TokenIndex> tokens)
+{
+    const ListRange range{static_cast<uint32_t>(m_token_lists.size()), static_cast<uint32_t>(tokens.size())};
+    m_token_lists.insert(m_token_lists.end(), tokens.begin(), tokens.end());
+    return range;
+}
+
+std::size_t FlatAst::num_nodes() const noexcept
+{
+    return std::apply([] (const auto&... pools) {
+        return (pools.size() + ...);
+    }, m_pools);
+}
+
+std::size_t FlatAst::size_in_bytes() const noexcept
+{
+    const std::size_t nodes = std::apply([] (const auto&... pools) {
+        return ((pools.size() * sizeof(pools[0])) + ...);
+    }, m_pools);
+    return nodes + (m_lists.size() + m_roots.size()) * sizeof(NodeRef) +
+           m_token_lists.size() * sizeof(TokenIndex);
+}
+
+std::string FlatAst::serialize() const
+{
+    std::string result{MAGIC};
+    write_u32(result, m_num_tokens);
+    std::apply([&result] (const auto&... pools) {
+        (write_array(result, pools), ...);
+    }, m_pools);
+    write_array(result, m_lists);
+    write_array(result, m_token_lists);
+    write_array(result, m_roots);
+    return result;
+}
+
+std::optional<FlatAst> FlatAst::deserialize(std::string_view data)
+{
+    if (!data.starts_with(MAGIC)) {
+        return std::nullopt;
+    }
+    data.remove_prefix(MAGIC.size());
+
+    FlatAst ast;
+    bool ok = read_u32(data, ast.m_num_tokens);
+    std::apply([&] (auto&... pools) {
+        ok = ok && (read_array(data, pools) && ...);
+    }, ast.m_pools);
+    ok = ok &&
+         read_array(data, ast.m_lists) &&
+         read_array(data, ast.m_token_lists) &&
+         read_array(data, ast.m_roots) &&
+         data.empty() &&
+         ast.is_valid();
+    if (!ok) {
+        return std::nullopt;
+    }
+    return ast;
+}
+
+bool FlatAst::is_valid() const noexcept
+{
+    const auto exists = [this] (const NodeRef ref) {
+        if (ref.is_null() || ref.kind() > NodeKind::RETURN) {
+            return false;
+        }
+        return std::apply([ref] (const auto&... pools) {
+            std::size_t sizes[] = {pools.size()...};
+            return ref.index() < sizes[static_cast<int32_t>(ref.kind())];
+        }, m_pools);
+    };
+    const auto is_expr = [&] (const NodeRef ref) {
+        return exists(ref) && is_expression(ref.kind());
+    };
+    const auto is_stmt = [&] (const NodeRef ref) {
+        return exists(ref) && !is_expression(ref.kind());
+    };
+    const auto is_token = [this] (const TokenIndex index) {
+        return index < m_num_tokens;
+    };
+    const auto is_range = [] (const ListRange range, const std::size_t size) {
+        return range.begin <= size && range.size <= size - range.begin;
+    };
+    const auto all_of = [] (const auto& items, const auto& pred) {
+        for (const auto& item : items) {
+            if (!pred(item)) {
+                return false;
+            }
+        }
+        return true;
+    };
+
+    return all_of(pool<Binary>(), [&] (const Binary& n) { return is_expr(n.left) && is_token(n.op) && is_expr(n.right); }) &&
+           all_of(pool<Grouping>(), [&] (const Grouping& n) { return is_token(n.begin) && is_expr(n.expr) && is_token(n.end); }) &&
+           all_of(pool<Literal>(), [&] (const Literal& n) {
+               return is_token(n.value) || n.value == TRUE_TOKEN_INDEX || n.value == FALSE_TOKEN_INDEX;
+           }) &&
+           all_of(pool<Unary>(), [&] (const Unary& n) { return is_token(n.op) && is_expr(n.right); }) &&
+           all_of(pool<Var>(), [&] (const Var& n) { return is_token(n.identifier); }) &&
+           all_of(pool<Assign>(), [&] (const Assign& n) { return is_token(n.identifier) && is_expr(n.value); }) &&
+           all_of(pool<Logical>(), [&] (const Logical& n) { return is_expr(n.left) && is_token(n.op) && is_expr(n.right); }) &&
+           all_of(pool<Call>(), [&] (const Call& n) {
+               return is_expr(n.callee) && is_token(n.paren) && is_range(n.args, m_lists.size()) &&
+                      all_of(list(n.args), is_expr);
+           }) &&
+           all_of(pool<ExprStmt>(), [&] (const ExprStmt& n) { return is_expr(n.expr); }) &&
+           all_of(pool<Print>(), [&] (const Print& n) { return is_expr(n.expr); }) &&
+           all_of(pool<VarStmt>(), [&] (const VarStmt& n) {
+               return is_token(n.identifier) && (n.initializer.is_null() || is_expr(n.initializer));
+           }) &&
+           all_of(pool<Block>(), [&] (const Block& n) {
+               return is_range(n.statements, m_lists.size()) && all_of(list(n.statements), is_stmt);
+           }) &&
+           all_of(pool<If>(), [&] (const If& n) {
+               return is_expr(n.condition) && is_stmt(n.then_branch) &&
+                      (n.else_branch.is_null() || is_stmt(n.else_branch));
+           }) &&
+           all_of(pool<While>(), [&] (const While& n) { return is_expr(n.condition) && is_stmt(n.body); }) &&
+           all_of(pool<Fun>(), [&] (const Fun& n) {
+               return is_token(n.name) &&
+                      is_range(n.params, m_token_lists.size()) && all_of(token_list(n.params), is_token) &&
+                      is_range(n.body, m_lists.size()) && all_of(list(n.body), is_stmt);
+           }) &&
+           all_of(pool<Return>(), [&] (const Return& n) {
+               return is_token(n.token) && (n.value.is_null() || is_expr(n.value));
+           }) &&
+           all_of(m_roots, is_stmt);
+}
+
+FlatAst flatten(const std::span<Stmt* const> statements, const ScannerResult& scanner_result)
+{
+    FlatAst ast;
+    ast.m_num_tokens = static_cast<uint32_t>(scanner_result.tokens.size());
+    Flattener flattener{ast, scanner_result};
+    for (Stmt* const stmt : statements) {
+        ast.roots().push_back(flattener.flatten(stmt));
+    }
+    return ast;
+}
+
+std::vector<Stmt*> inflate(const FlatAst& ast,
+                           BumpAlloc& alloc,
+                           ConstantPool& constants,
+                           const ScannerResult& scanner_result)
+{
+    assert(ast.num_tokens() == scanner_result.tokens.size());
+    Inflater inflater{ast, alloc, constants, scanner_result};
+    std::vector<Stmt*> result;
+    result.reserve(ast.roots().size());
+    for (const NodeRef root : ast.roots()) {
+        result.push_back(inflater.stmt(root));
+    }
+    return result;
+}
+
+} // namespace flat
+
+///////////////////////////////////////////////////////////////
+#include <doctest/doctest.h>
+
+#include "parser.hpp"
+#include "print_visitor.hpp"
+
+TEST_CASE("Flat AST")
+{
+    static_assert(sizeof(flat::NodeRef) == 4);
+    static_assert(sizeof(flat::Binary) == 12);
+    CHECK(sizeof(flat::Binary) * 2 <= sizeof(BinaryExpr));
+
+    constexpr std::string_view source{
+        "fun f(a, b) { if (a < b) return a; else return -b; }\n"
+        "var x = 1;\n"
+        "for (var i = 0; i < 3; i = i + 1) { x = f(x, i) * (2 + x); }\n"
+        "print x or nil;\n"};
+    const ScannerResult result = scan_tokens(source);
+    REQUIRE(result.num_errors == 0);
+
+    BumpAlloc alloc;
+    ConstantPool constants;
+    const std::vector<Stmt*> statements = parse(alloc, constants, result);
+    REQUIRE(statements.size() == 4);
+
+    const flat::FlatAst ast = flat::flatten(statements, result);
+    CHECK(ast.roots().size() == 4);
+    CHECK(ast.roots()[0].kind() == flat::NodeKind::FUN);
+    CHECK(ast.roots()[3].kind() == flat::NodeKind::PRINT);
+
+    const std::string serialized = ast.serialize();
+    const std::optional<flat::FlatAst> loaded = flat::FlatAst::deserialize(serialized);
+    REQUIRE(loaded.has_value());
+    CHECK(loaded->num_nodes() == ast.num_nodes());
+    CHECK(loaded->serialize() == serialized);
+
+    // the for loop desugars into a block with a synthesized condition-less while
+    const flat::Block& loop = loaded->get<flat::Block>(loaded->roots()[2]);
+    REQUIRE(loop.statements.size == 2);
+    CHECK(loaded->list(loop.statements)[1].kind() == flat::NodeKind::WHILE);
+
+    const std::vector<Stmt*> inflated = flat::inflate(*loaded, alloc, constants, result);
+    REQUIRE(inflated.size() == 4);
+    REQUIRE(inflated[3]->is_type<PrintStmt>());
+    PrintVisitor original{source};
+    static_cast<PrintStmt*>(statements[3])->expr->accept(original);
+    PrintVisitor printer{source};
+    static_cast<PrintStmt*>(inflated[3])->expr->accept(printer);
+    CHECK(printer.get() == original.get());
+
+    const int32_t kind_count = flat::visit(*loaded, loaded->roots()[0], [] (const auto& node) {
+        return static_cast<int32_t>(std::decay_t<decltype(node)>::KIND);
+    });
+    CHECK(kind_count == static_cast<int32_t>(flat::NodeKind::FUN));
+
+    std::string truncated = serialized;
+    truncated.pop_back();
+    CHECK(flat::FlatAst::deserialize(truncated).has_value() == false);
+
+    // a reference to a node that does not exist
+    std::string corrupt = serialized;
+    const uint32_t bad = flat::NodeRef{flat::NodeKind::FUN, 1000}.bits();
+    std::memcpy(corrupt.data() + corrupt.size() - sizeof(bad), &bad, sizeof(bad));
+    CHECK(flat::FlatAst::deserialize(corrupt).has_value() == false);
+}
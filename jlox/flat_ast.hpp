@@ -0,0 +1,250 @@
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <vector>
+
+class BumpAlloc;
+class ConstantPool;
+class Stmt;
+class Token;
+struct ScannerResult;
+
+/**
+ * An alternative AST store: nodes live in one contiguous array per kind
+ * and refer to each other by 32-bit kind-tagged indices, tokens by their
+ * index into ScannerResult::tokens. Nodes hold no pointers, so the whole
+ * tree can be written out and read back as is.
+ */
+namespace flat
+{
+
+enum class NodeKind : uint8_t
+{
+    // expressions
+    BINARY, GROUPING, LITERAL, UNARY, VAR, ASSIGN, LOGICAL, CALL,
+    // statements
+    EXPR_STMT, PRINT, VAR_STMT, BLOCK, IF, WHILE, FUN, RETURN,
+};
+
+inline constexpr int32_t NUM_NODE_KINDS = static_cast<int32_t>(NodeKind::RETURN) + 1;
+
+class NodeRef
+{
+public:
+    inline static constexpr int32_t KIND_BITS = 5;
+    inline static constexpr uint32_t MAX_INDEX = (uint32_t{1} << (32 - KIND_BITS)) - 1;
+
+    //! The null reference, e.g. a missing else branch.
+    constexpr
+    NodeRef() noexcept = default;
+
+    constexpr
+    NodeRef(NodeKind kind, uint32_t index) noexcept
+      : m_bits{(static_cast<uint32_t>(kind) << (32 - KIND_BITS)) | index}
+    {
+        assert(index <= MAX_INDEX);
+    }
+
+    constexpr
+    NodeKind kind() const noexcept
+    {
+        assert(!is_null());
+        return static_cast<NodeKind>(m_bits >> (32 - KIND_BITS));
+    }
+
+    constexpr
+    uint32_t index() const noexcept
+    {
+        return m_bits & MAX_INDEX;
+    }
+
+    constexpr
+    bool is_null() const noexcept
+    {
+        return m_bits == NULL_BITS;
+    }
+
+    constexpr
+    uint32_t bits() const noexcept
+    {
+        return m_bits;
+    }
+
+    constexpr
+    bool operator==(const NodeRef&) const noexcept = default;
+
+private:
+    inline static constexpr uint32_t NULL_BITS = UINT32_MAX;
+
+    uint32_t m_bits{NULL_BITS};
+};
+
+//! Index into ScannerResult::tokens, or one of the synthesized tokens.
+using TokenIndex = uint32_t;
+inline constexpr TokenIndex TRUE_TOKEN_INDEX = UINT32_MAX;
+inline constexpr TokenIndex FALSE_TOKEN_INDEX = UINT32_MAX - 1;
+
+//! A slice of FlatAst's shared child lists.
+struct ListRange
+{
+    uint32_t begin{0};
+    uint32_t size{0};
+};
+
+struct Binary     { static constexpr NodeKind KIND = NodeKind::BINARY;    NodeRef left; TokenIndex op; NodeRef right; };
+struct Grouping   { static constexpr NodeKind KIND = NodeKind::GROUPING;  TokenIndex begin; NodeRef expr; TokenIndex end; };
+struct Literal    { static constexpr NodeKind KIND = NodeKind::LITERAL;   TokenIndex value; };
+struct Unary      { static constexpr NodeKind KIND = NodeKind::UNARY;     TokenIndex op; NodeRef right; };
+struct Var        { static constexpr NodeKind KIND = NodeKind::VAR;       TokenIndex identifier; };
+struct Assign     { static constexpr NodeKind KIND = NodeKind::ASSIGN;    TokenIndex identifier; NodeRef value; };
+struct Logical    { static constexpr NodeKind KIND = NodeKind::LOGICAL;   NodeRef left; TokenIndex op; NodeRef right; };
+struct Call       { static constexpr NodeKind KIND = NodeKind::CALL;      NodeRef callee; TokenIndex paren; ListRange args; };
+
+struct ExprStmt   { static constexpr NodeKind KIND = NodeKind::EXPR_STMT; NodeRef expr; };
+struct Print      { static constexpr NodeKind KIND = NodeKind::PRINT;     NodeRef expr; };
+struct VarStmt    { static constexpr NodeKind KIND = NodeKind::VAR_STMT;  TokenIndex identifier; NodeRef initializer; };
+struct Block      { static constexpr NodeKind KIND = NodeKind::BLOCK;     ListRange statements; };
+struct If         { static constexpr NodeKind KIND = NodeKind::IF;        NodeRef condition; NodeRef then_branch; NodeRef else_branch; };
+struct While      { static constexpr NodeKind KIND = NodeKind::WHILE;     NodeRef condition; NodeRef body; };
+struct Fun        { static constexpr NodeKind KIND = NodeKind::FUN;       TokenIndex name; ListRange params; ListRange body; };
+struct Return     { static constexpr NodeKind KIND = NodeKind::RETURN;    TokenIndex token; NodeRef value; };
+
+class FlatAst
+{
+public:
+    template <typename T>
+    NodeRef add(const T& node)
+    {
+        std::vector<T>& nodes = pool<T>();
+        const NodeRef ref{T::KIND, static_cast<uint32_t>(nodes.size())};
+        nodes.push_back(node);
+        return ref;
+    }
+
+    template <typename T>
+    const T& get(const NodeRef ref) const noexcept
+    {
+        assert(ref.kind() == T::KIND);
+        return pool<T>()[ref.index()];
+    }
+
+    ListRange add_list(std::span<const NodeRef> refs);
+    ListRange add_token_list(std::span<const TokenIndex> tokens);
+
+    std::span<const NodeRef> list(const ListRange range) const noexcept
+    {
+        return std::span<const NodeRef>{m_lists}.subspan(range.begin, range.size);
+    }
+
+    std::span<const TokenIndex> token_list(const ListRange range) const noexcept
+    {
+        return std::span<const TokenIndex>{m_token_lists}.subspan(range.begin, range.size);
+    }
+
+    //! Top level statements in program order
+    std::vector<NodeRef>& roots() noexcept
+    {
+        return m_roots;
+    }
+
+    const std::vector<NodeRef>& roots() const noexcept
+    {
+        return m_roots;
+    }
+
+    std::size_t num_nodes() const noexcept;
+
+    //! Size of the token array the indices refer to
+    std::size_t num_tokens() const noexcept
+    {
+        return m_num_tokens;
+    }
+
+    //! Bytes used by the node arrays and lists
+    std::size_t size_in_bytes() const noexcept;
+
+    std::string serialize() const;
+
+    //! Fails on malformed input, including references that are out of range.
+    static std::optional<FlatAst> deserialize(std::string_view data);
+
+private:
+    using Pools = std::tuple<
+        std::vector<Binary>, std::vector<Grouping>, std::vector<Literal>, std::vector<Unary>,
+        std::vector<Var>, std::vector<Assign>, std::vector<Logical>, std::vector<Call>,
+        std::vector<ExprStmt>, std::vector<Print>, std::vector<VarStmt>, std::vector<Block>,
+        std::vector<If>, std::vector<While>, std::vector<Fun>, std::vector<Return>>;
+
+    template <typename T>
+    std::vector<T>& pool() noexcept
+    {
+        return std::get<std::vector<T>>(m_pools);
+    }
+
+    template <typename T>
+    const std::vector<T>& pool() const noexcept
+    {
+        return std::get<std::vector<T>>(m_pools);
+    }
+
+    bool is_valid() const noexcept;
+
+    Pools m_pools;
+    std::vector<NodeRef> m_lists;
+    std::vector<TokenIndex> m_token_lists;
+    std::vector<NodeRef> m_roots;
+    uint32_t m_num_tokens{0};
+
+    friend FlatAst flatten(std::span<Stmt* const>, const ScannerResult&);
+};
+
+/**
+ * Call `f` with the node `ref` points to, converted to its concrete type.
+ */
+template <typename F>
+decltype(auto) visit(const FlatAst& ast, const NodeRef ref, F&& f)
+{
+    switch (ref.kind()) {
+    using enum NodeKind;
+    case BINARY:    return f(ast.get<Binary>(ref));
+    case GROUPING:  return f(ast.get<Grouping>(ref));
+    case LITERAL:   return f(ast.get<Literal>(ref));
+    case UNARY:     return f(ast.get<Unary>(ref));
+    case VAR:       return f(ast.get<Var>(ref));
+    case ASSIGN:    return f(ast.get<Assign>(ref));
+    case LOGICAL:   return f(ast.get<Logical>(ref));
+    case CALL:      return f(ast.get<Call>(ref));
+    case EXPR_STMT: return f(ast.get<ExprStmt>(ref));
+    case PRINT:     return f(ast.get<Print>(ref));
+    case VAR_STMT:  return f(ast.get<VarStmt>(ref));
+    case BLOCK:     return f(ast.get<Block>(ref));
+    case IF:        return f(ast.get<If>(ref));
+    case WHILE:     return f(ast.get<While>(ref));
+    case FUN:       return f(ast.get<Fun>(ref));
+    case RETURN:    return f(ast.get<Return>(ref));
+    }
+    assert(false);
+    return f(ast.get<Return>(ref));
+}
+
+//! Token referenced by `index`, handles the synthesized tokens.
+const Token* get_token(const ScannerResult& scanner_result, TokenIndex index) noexcept;
+
+FlatAst flatten(std::span<Stmt* const> statements, const ScannerResult& scanner_result);
+
+/**
+ * Rebuild the pointer AST in `alloc`, with literals decoded into
+ * `constants`, e.g. to run a deserialized tree with the Interpreter.
+ */
+std::vector<Stmt*> inflate(const FlatAst& ast,
+                           BumpAlloc& alloc,
+                           ConstantPool& constants,
+                           const ScannerResult& scanner_result);
+
+} // namespace flat
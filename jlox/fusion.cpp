@@ -0,0 +1,230 @@
+#include "fusion.hpp"
+
+#include <cassert>
+
+#include <doctest/doctest.h>
+
+#include "expr.hpp"
+#include "stmt.hpp"
+
+namespace
+{
+
+bool is_leaf(const Expr& expr) noexcept
+{
+    return expr.is_type<VarExpr>() || expr.is_type<LiteralExpr>();
+}
+
+bool is_arithmetic(const TokenType type) noexcept
+{
+    return type == TokenType::PLUS ||
+           type == TokenType::MINUS ||
+           type == TokenType::STAR ||
+           type == TokenType::SLASH;
+}
+
+class Fusion final : public ExprVisitor
+                   , public StmtVisitor
+{
+public:
+    void fuse(std::span<Stmt* const> statements)
+    {
+        for (Stmt* const stmt : statements) {
+            static_cast<void>(stmt->accept(*this));
+        }
+    }
+
+    void visit(BinaryExpr& binary_expr) override
+    {
+        binary_expr.left->accept(*this);
+        binary_expr.right->accept(*this);
+        if (is_leaf(*binary_expr.left) && is_leaf(*binary_expr.right)) {
+            binary_expr.fuse();
+        }
+    }
+
+    void visit(GroupingExpr& grouping_expr) override
+    {
+        grouping_expr.expr->accept(*this);
+    }
+
+    void visit(LiteralExpr& /*literal_expr*/) override
+    {}
+
+    void visit(UnaryExpr& unary_expr) override
+    {
+        unary_expr.right->accept(*this);
+    }
+
+    void visit(VarExpr& /*var_expr*/) override
+    {}
+
+    void visit(AssignExpr& assign_expr) override
+    {
+        assign_expr.value->accept(*this);
+        if (assign_expr.resolution.depth == GLOBAL_DEPTH || !assign_expr.value->is_type<BinaryExpr>()) {
+            return;
+        }
+        const BinaryExpr& value = static_cast<const BinaryExpr&>(*assign_expr.value);
+        if (!is_arithmetic(value.op->type()) || !value.left->is_type<VarExpr>() || !is_leaf(*value.right)) {
+            return;
+        }
+        const VarExpr& self = static_cast<const VarExpr&>(*value.left);
+        if (self.resolution.depth == assign_expr.resolution.depth &&
+            self.resolution.slot == assign_expr.resolution.slot)
+        {
+            assign_expr.fuse();
+        }
+    }
+
+    void visit(LogicalExpr& logical_expr) override
+    {
+        logical_expr.left->accept(*this);
+        logical_expr.right->accept(*this);
+    }
+
+    void visit(CallExpr& call_expr) override
+    {
+        call_expr.callee->accept(*this);
+        for (Expr* const arg : call_expr.args) {
+            arg->accept(*this);
+        }
+    }
+
+    void unkown_expr(Expr& /*expr*/) override
+    {
+        assert(false);
+    }
+
+    bool visit(ExprStmt& expr_stmt) override
+    {
+        expr_stmt.expr->accept(*this);
+        return false;
+    }
+
+    bool visit(PrintStmt& print_stmt) override
+    {
+        print_stmt.expr->accept(*this);
+        return false;
+    }
+
+    bool visit(VarStmt& var_stmt) override
+    {
+        if (var_stmt.initializer) {
+            var_stmt.initializer->accept(*this);
+        }
+        return false;
+    }
+
+    bool visit(BlockStmt& block_stmt) override
+    {
+        fuse(block_stmt.statements);
+        return false;
+    }
+
+    bool visit(IfStmt& if_stmt) override
+    {
+        if_stmt.condition->accept(*this);
+        static_cast<void>(if_stmt.then_branch->accept(*this));
+        if (if_stmt.else_branch) {
+            static_cast<void>(if_stmt.else_branch->accept(*this));
+        }
+        return false;
+    }
+
+    bool visit(WhileStmt& while_stmt) override
+    {
+        while_stmt.condition->accept(*this);
+        static_cast<void>(while_stmt.body->accept(*this));
+        return false;
+    }
+
+    bool visit(FunStmt& fun_stmt) override
+    {
+        fuse(fun_stmt.body);
+        return false;
+    }
+
+    bool visit(ReturnStmt& return_stmt) override
+    {
+        if (return_stmt.expr) {
+            return_stmt.expr->accept(*this);
+        }
+        return false;
+    }
+
+    void unkown_stmt(Stmt& /*stmt*/) override
+    {
+        assert(false);
+    }
+};
+
+} // anonymous namespace
+
+
+void fuse(std::span<Stmt* const> statements)
+{
+    Fusion{}.fuse(statements);
+}
+
+
+#include "bump_alloc.hpp"
+#include "constant_pool.hpp"
+#include "environment.hpp"
+#include "interpreter.hpp"
+#include "parser.hpp"
+#include "print_visitor.hpp"
+#include "resolver.hpp"
+#include "scanner.hpp"
+
+TEST_CASE("Fusion")
+{
+    const ScannerResult scanned = scan_tokens(
+        "var fused_sum = 0;\n"
+        "var fused_text = \"\";\n"
+        "var fused_is_nil = 0;\n"
+        "for (var i = 0; i < 10; i = i + 1) fused_sum = fused_sum + i;\n"
+        "{\n"
+        "    var s = \"a\";\n"
+        "    s = s + \"b\";\n"
+        "    var n = nil;\n"
+        "    fused_is_nil = n == nil;\n"
+        "    fused_text = s;\n"
+        "}\n"
+        "{ var x = 1; x = x * 3; }\n");
+    REQUIRE(scanned.num_errors == 0);
+    BumpAlloc alloc;
+    ConstantPool constants;
+    const std::vector<Stmt*> statements = parse(alloc, constants, scanned);
+    REQUIRE(statements.size() == 6);
+    resolve(statements);
+    fuse(statements);
+
+    {
+        Globals globals;
+        Interpreter interpreter{scanned, globals};
+        for (Stmt* const stmt : statements) {
+            CHECK(interpreter.execute(*stmt));
+        }
+        const Environment& env = *globals.global_environment();
+        const auto global = [&] (std::string_view name) {
+            const Value* const value = env.get(intern_symbol(name));
+            REQUIRE(value != nullptr);
+            return *value;
+        };
+        CHECK(std::get<double>(global("fused_sum")) == 45.);
+        CHECK(std::get<std::string>(global("fused_text")) == "ab");
+        CHECK(std::get<bool>(global("fused_is_nil")) == true);
+    }
+    // The environments of the blocks, for the tests that expect an empty heap
+    Heap::run_gc();
+
+    // Other visitors see the tree as it was
+    const BlockStmt& block = *static_cast<BlockStmt*>(statements[5]);
+    REQUIRE(block.statements.size() == 2);
+    Expr& assign = *static_cast<ExprStmt*>(block.statements[1])->expr;
+    CHECK(assign.is_type<AssignExpr>());
+    PrintVisitor printer{scanned.source};
+    assign.accept(printer);
+    CHECK(printer.get() == "(var x = (* (var x) 3))");
+}
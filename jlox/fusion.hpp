@@ -0,0 +1,14 @@
+#pragma once
+
+#include <span>
+
+class Stmt;
+
+/**
+ * Marks the subtrees of resolved `statements` that the Interpreter runs
+ * as one superinstruction: a binary operation on two variables or literals,
+ * such as `i < n`, and an arithmetic assignment of a local to itself and a
+ * variable or literal, such as `i = i + 1`. The tree stays the same for
+ * every other visitor.
+ */
+void fuse(std::span<Stmt* const> statements);
@@ -1,4 +1,5 @@
 #include "garbage_collected_heap.hpp"
+#include "gc_trace.hpp"
 
 #include <sys/mman.h>
 #include <cstdlib>
@@ -12,6 +13,10 @@
 #define DBG(...) static_cast<void>(0)
 #endif
 
+#ifndef JLOX_HEAP_CAPACITY
+#define JLOX_HEAP_CAPACITY (2 * 1024)
+#endif
+
 static
 constexpr std::size_t PAGE_SIZE = 4 * 1024;
 
@@ -38,6 +43,7 @@ GarbageCollectedHeap::GarbageCollectedHeap(std::size_t capacity)
 GarbageCollectedHeap::~GarbageCollectedHeap()
 {
     run_gc();
+    m_recorder.reset();
     if (m_allocated.empty() == false) {
         std::fputs("Stuff is still allocated.", stderr);
         std::abort();
@@ -50,6 +56,26 @@ GarbageCollectedHeap::~GarbageCollectedHeap()
 
 void GarbageCollectedHeap::run_gc() noexcept
 {
+    collect(GcReason::EXPLICIT);
+}
+
+void GarbageCollectedHeap::start_trace(std::FILE* const file)
+{
+    m_recorder.reset();
+    m_recorder = std::make_unique<GcTraceRecorder>(file, m_memory, m_capacity);
+}
+
+void GarbageCollectedHeap::stop_trace() noexcept
+{
+    m_recorder.reset();
+}
+
+void GarbageCollectedHeap::collect(const GcReason reason) noexcept
+{
+    if (m_recorder) {
+        m_recorder->on_collect(reason);
+    }
+
     // - mark all nodes as dead
     // - remove all edges between nodes
     for (auto& b : m_allocated) {
@@ -104,6 +130,8 @@ void GarbageCollectedHeap::run_gc() noexcept
             if (!block.alive) {
                 if (block.dtor)
                     block.dtor(m_memory + block.offset);
+                if (m_recorder)
+                    m_recorder->on_free(block.offset);
                 freed_something = true;
                 DBG("Destroyed block. offset=%lu, size=%lu\n", block.offset, block.size);
                 m_free.push_back(FreeBlock{block.offset, block.size});
@@ -153,13 +181,14 @@ GarbageCollectedHeap::allocate_raw(const std::size_t size)
         while (it != m_free.end()) {
             if (it->size >= size)
                 break;
+            ++it;
         }
         return it;
     };
 
     auto free_block = find_next_best_block();
     if (free_block == m_free.end()) {
-        run_gc();
+        collect(GcReason::ALLOCATION_FAILURE);
         free_block = find_next_best_block();
     }
     if (free_block == m_free.end())
@@ -184,6 +213,9 @@ GarbageCollectedHeap::allocate_raw(const std::size_t size)
     }
 
     DBG("Allocated raw block. offset=%lu, size=%lu\n", new_block_on_the_block->offset, new_block_on_the_block->size);
+    if (m_recorder) {
+        m_recorder->on_allocate(new_block_on_the_block->offset, size);
+    }
 
     return new_block_on_the_block;
 }
@@ -191,6 +223,9 @@ GarbageCollectedHeap::allocate_raw(const std::size_t size)
 void GarbageCollectedHeap::undo_raw_allocation(std::vector<GarbageCollectedHeap::AllocatedBlock>::iterator undo_alloc) noexcept
 {
     DBG("Deallocated raw block. offset=%lu, size=%lu\n", undo_alloc->offset, undo_alloc->size);
+    if (m_recorder) {
+        m_recorder->on_undo_allocate(undo_alloc->offset);
+    }
     // A previous raw allocation could either have split the original free block or completely removed it
     const std::size_t free_block_offset = undo_alloc->offset + undo_alloc->size;
     const auto free_block = std::lower_bound(
@@ -236,7 +271,7 @@ std::size_t GarbageCollectedHeap::num_free_bytes() const noexcept
 
 GarbageCollectedHeap& GarbageCollectedHeap::get_heap() noexcept
 {
-    static GarbageCollectedHeap heap{2 * 1024};
+    static GarbageCollectedHeap heap{JLOX_HEAP_CAPACITY};
     return heap;
 }
 
@@ -396,6 +431,29 @@ TEST_CASE("GarbageCollectedHeap")
         REQUIRE(heap.num_free_bytes() == heap.capacity());
     }
 
+    SUBCASE("HeapVector") {
+        struct Owner {
+            HeapVector<HeapPtr<int>> items;
+        };
+
+        {
+            const HeapPtr<Owner> owner = heap.allocate<Owner>();
+            for (int i = 0; i < 10; ++i) {
+                owner->items.emplace_back(heap.allocate<int>(i));
+            }
+            // the storage and the ints are only referenced from inside the heap
+            heap.run_gc();
+            int sum{0};
+            for (const HeapPtr<int>& item : owner->items.items()) {
+                sum += *item;
+            }
+            REQUIRE(sum == 45);
+        }
+
+        heap.run_gc();
+        REQUIRE(heap.num_free_bytes() == heap.capacity());
+    }
+
     SUBCASE("unordered_map") {
         using Key = int32_t;
         using Value = int32_t;
@@ -1,12 +1,18 @@
 #pragma once
 
 #include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <span>
 #include <vector>
 #include <new>
 
 #include "detail/heap_ptr_base.hpp"
 
 class GarbageCollectedHeap;
+class GcTraceRecorder;
+enum class GcReason : uint8_t;
 
 template <typename T>
 class HeapPtr : private detail::HeapPtrBaseNode
@@ -210,6 +216,15 @@ public:
         return m_capacity;
     }
 
+    /**
+     * Record all heap activity to `file` (see gc_trace.hpp) until
+     * stop_trace() is called. Should be started before the first allocation.
+     * Reference link/unlink events are only available when built with
+     * JLOX_GC_TRACE.
+     */
+    void start_trace(std::FILE* file);
+    void stop_trace() noexcept;
+
     [[nodiscard]] static
     GarbageCollectedHeap& get_heap() noexcept;
 
@@ -242,6 +257,7 @@ private:
 
     std::vector<AllocatedBlock>::iterator allocate_raw(std::size_t size);
     void undo_raw_allocation(std::vector<AllocatedBlock>::iterator it) noexcept;
+    void collect(GcReason reason) noexcept;
     void propagate_aliveness(AllocatedBlock& to) noexcept;
     HeapPtr<void> reference_to_allocation_impl(const void* ptr) noexcept;
 
@@ -250,6 +266,8 @@ private:
 
     char* m_memory;
     std::size_t m_capacity;
+
+    std::unique_ptr<GcTraceRecorder> m_recorder;
 };
 
 struct Heap
@@ -332,3 +350,83 @@ public:
     {
     }
 };
+
+
+/**
+ * A growable array with its elements in the heap, so HeapPtrs in them
+ * are references of whatever owns the vector instead of roots. Unlike a
+ * std container with GarbageCollectedAllocator, it holds its storage
+ * through a HeapPtr the collector can see; libstdc++'s node based
+ * containers only keep raw pointers to their nodes, which were then
+ * collected while still in use.
+ */
+template <typename T>
+class HeapVector
+{
+public:
+    HeapVector() noexcept = default;
+
+    ~HeapVector()
+    {
+        // If the owner is being collected, the storage may have been freed
+        // by the same collection already, which drops m_storage but leaves
+        // the memory untouched until the next allocation.
+        std::destroy_n(m_items, m_size);
+    }
+
+    HeapVector(const HeapVector&) = delete;
+    HeapVector& operator=(const HeapVector&) = delete;
+
+    int32_t size() const noexcept
+    {
+        return m_size;
+    }
+
+    T& operator[](const int32_t index) const noexcept
+    {
+        assert(index >= 0 && index < m_size);
+        return m_items[index];
+    }
+
+    std::span<T> items() const noexcept
+    {
+        return {m_items, static_cast<std::size_t>(m_size)};
+    }
+
+    template <typename... Args>
+    T& emplace_back(Args&&... args)
+    {
+        if (m_size == m_capacity) {
+            // `args` may refer to an element
+            T item(std::forward<Args>(args)...);
+            grow(m_capacity ? 2 * m_capacity : 4);
+            return *new (m_items + m_size++) T(std::move(item));
+        }
+        return *new (m_items + m_size++) T(std::forward<Args>(args)...);
+    }
+
+    void reserve(const int32_t capacity)
+    {
+        if (capacity > m_capacity) {
+            grow(capacity);
+        }
+    }
+
+private:
+    void grow(const int32_t capacity)
+    {
+        static_assert(std::is_nothrow_move_constructible_v<T>);
+        HeapPtr<void> storage = Heap::allocate_bytes(static_cast<std::size_t>(capacity) * sizeof(T));
+        T* const items = static_cast<T*>(storage.get());
+        std::uninitialized_move_n(m_items, m_size, items);
+        std::destroy_n(m_items, m_size);
+        m_storage = std::move(storage);
+        m_items = items;
+        m_capacity = capacity;
+    }
+
+    HeapPtr<void> m_storage;
+    T* m_items{nullptr};
+    int32_t m_size{0};
+    int32_t m_capacity{0};
+};
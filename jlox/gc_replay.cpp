@@ -0,0 +1,386 @@
+#include "gc_replay.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <limits>
+#include <vector>
+
+#include <absl/container/flat_hash_map.h>
+
+namespace
+{
+
+constexpr std::size_t NOT_PLACED = std::numeric_limits<std::size_t>::max();
+
+class HeapModel
+{
+public:
+    explicit
+    HeapModel(const ReplayConfig& config)
+      : m_config{config}
+    {
+        if (m_config.capacity > 0) {
+            m_free.push_back(FreeBlock{0, m_config.capacity});
+        }
+    }
+
+    void replay(const GcTraceEvent& event)
+    {
+        switch (event.tag) {
+        using enum GcTraceTag;
+        case ALLOCATE:
+            allocate(event.a);
+            break;
+
+        case UNDO_ALLOCATE:
+            if (event.a < m_blocks.size() && !m_blocks[event.a].freed) {
+                free_block(m_blocks[event.a]);
+            }
+            break;
+
+        case LINK:
+            if (event.c < m_blocks.size() && !m_blocks[event.c].freed) {
+                m_edges.insert_or_assign(event.a, Edge{event.b, event.c});
+            }
+            break;
+
+        case UNLINK:
+            m_edges.erase(event.a);
+            break;
+
+        case COLLECT:
+            // Collections caused by a full heap depend on the heap
+            // configuration, the model triggers its own.
+            if (event.a == static_cast<uint32_t>(GcReason::EXPLICIT) &&
+                m_config.explicit_collections)
+            {
+                collect();
+            }
+            break;
+        }
+    }
+
+    ReplayReport finish()
+    {
+        m_report.final_fragmentation = fragmentation();
+        return m_report;
+    }
+
+private:
+    struct Block
+    {
+        std::size_t offset{NOT_PLACED};
+        std::size_t size{0};
+        bool freed{false};
+        bool marked{false};
+    };
+
+    struct FreeBlock
+    {
+        std::size_t offset;
+        std::size_t size;
+    };
+
+    struct Edge
+    {
+        uint32_t source;
+        uint32_t target;
+    };
+
+    void allocate(const std::size_t size)
+    {
+        ++m_report.num_allocations;
+
+        auto free_block = find_free_block(size);
+        if (free_block == m_free.end()) {
+            collect();
+            free_block = find_free_block(size);
+        }
+
+        Block& block = m_blocks.emplace_back();
+        block.size = size;
+        if (free_block == m_free.end()) {
+            ++m_report.num_failed_allocations;
+            return;
+        }
+
+        block.offset = free_block->offset;
+        if (free_block->size > size) {
+            free_block->offset += size;
+            free_block->size -= size;
+        } else {
+            m_free.erase(free_block);
+        }
+        m_rover = block.offset + size;
+
+        m_live_bytes += size;
+        m_report.peak_live_bytes = std::max(m_report.peak_live_bytes, m_live_bytes);
+        m_report.peak_extent = std::max(m_report.peak_extent, block.offset + size);
+    }
+
+    std::vector<FreeBlock>::iterator find_free_block(const std::size_t size)
+    {
+        const auto fits = [size] (const FreeBlock& b) {
+            return b.size >= size;
+        };
+
+        switch (m_config.policy) {
+        using enum AllocationPolicy;
+        case FIRST_FIT:
+            return std::find_if(m_free.begin(), m_free.end(), fits);
+
+        case BEST_FIT:
+            {
+                auto best = m_free.end();
+                for (auto it = m_free.begin(); it != m_free.end(); ++it) {
+                    if (fits(*it) && (best == m_free.end() || it->size < best->size)) {
+                        best = it;
+                    }
+                }
+                return best;
+            }
+
+        case NEXT_FIT:
+            {
+                const auto start = std::lower_bound(m_free.begin(), m_free.end(), m_rover,
+                        [] (const FreeBlock& b, std::size_t rover) {
+                            return b.offset + b.size <= rover;
+                        });
+                const auto it = std::find_if(start, m_free.end(), fits);
+                if (it != m_free.end()) {
+                    return it;
+                }
+                const auto wrapped = std::find_if(m_free.begin(), start, fits);
+                return (wrapped != start) ? wrapped : m_free.end();
+            }
+        }
+        return m_free.end();
+    }
+
+    void free_block(Block& block)
+    {
+        block.freed = true;
+        if (block.offset == NOT_PLACED) {
+            return;
+        }
+        m_live_bytes -= block.size;
+
+        auto it = std::lower_bound(m_free.begin(), m_free.end(), block.offset,
+                [] (const FreeBlock& b, std::size_t offset) {
+                    return b.offset < offset;
+                });
+        it = m_free.insert(it, FreeBlock{block.offset, block.size});
+        if (std::next(it) != m_free.end() && it->offset + it->size == std::next(it)->offset) {
+            it->size += std::next(it)->size;
+            m_free.erase(std::next(it));
+        }
+        if (it != m_free.begin() && std::prev(it)->offset + std::prev(it)->size == it->offset) {
+            std::prev(it)->size += it->size;
+            m_free.erase(it);
+        }
+    }
+
+    void collect()
+    {
+        const auto start = std::chrono::steady_clock::now();
+        ++m_report.num_collections;
+
+        // adjacency in CSR form, row 0 are the roots
+        std::vector<uint32_t> first(m_blocks.size() + 2, 0);
+        for (const auto& [node, edge] : m_edges) {
+            ++first[edge.source + 1];
+        }
+        for (std::size_t i = 1; i < first.size(); ++i) {
+            first[i] += first[i - 1];
+        }
+        std::vector<uint32_t> targets(m_edges.size());
+        {
+            std::vector<uint32_t> pos(first.begin(), first.end() - 1);
+            for (const auto& [node, edge] : m_edges) {
+                targets[pos[edge.source]++] = edge.target;
+            }
+        }
+
+        std::size_t work{0};
+        std::vector<uint32_t> stack;
+        const auto visit_row = [&] (uint32_t row) {
+            for (uint32_t i = first[row]; i != first[row + 1]; ++i) {
+                ++work;
+                Block& target = m_blocks[targets[i]];
+                if (!target.marked) {
+                    target.marked = true;
+                    stack.push_back(targets[i]);
+                }
+            }
+        };
+        visit_row(GcTraceEvent::ROOT);
+        while (!stack.empty()) {
+            const uint32_t id = stack.back();
+            stack.pop_back();
+            ++work;
+            visit_row(id + 1);
+        }
+
+        for (Block& block : m_blocks) {
+            if (!block.freed && !block.marked) {
+                ++work;
+                free_block(block);
+            }
+            block.marked = false;
+        }
+        for (auto it = m_edges.begin(); it != m_edges.end(); ) {
+            const Edge& edge = it->second;
+            if (m_blocks[edge.target].freed ||
+                (edge.source != GcTraceEvent::ROOT && m_blocks[edge.source - 1].freed))
+            {
+                m_edges.erase(it++);
+            } else {
+                ++it;
+            }
+        }
+
+        m_report.pause_work += work;
+        m_report.pause_time += std::chrono::steady_clock::now() - start;
+        m_report.max_fragmentation = std::max(m_report.max_fragmentation, fragmentation());
+    }
+
+    double fragmentation() const noexcept
+    {
+        std::size_t total{0};
+        std::size_t largest{0};
+        for (const FreeBlock& b : m_free) {
+            total += b.size;
+            largest = std::max(largest, b.size);
+        }
+        if (total == 0) {
+            return 0.;
+        }
+        return 1. - static_cast<double>(largest) / static_cast<double>(total);
+    }
+
+    const ReplayConfig& m_config;
+    ReplayReport m_report;
+    std::vector<Block> m_blocks;
+    std::vector<FreeBlock> m_free;
+    absl::flat_hash_map<uint32_t, Edge> m_edges;
+    std::size_t m_live_bytes{0};
+    std::size_t m_rover{0};
+};
+
+} // anonymous namespace
+
+std::string_view policy_to_string(const AllocationPolicy policy) noexcept
+{
+    switch (policy) {
+    using enum AllocationPolicy;
+    case FIRST_FIT:
+        return "first-fit";
+    case BEST_FIT:
+        return "best-fit";
+    case NEXT_FIT:
+        return "next-fit";
+    }
+    return "<unkown>";
+}
+
+std::optional<AllocationPolicy> policy_from_string(const std::string_view name) noexcept
+{
+    for (AllocationPolicy p : {AllocationPolicy::FIRST_FIT,
+                               AllocationPolicy::BEST_FIT,
+                               AllocationPolicy::NEXT_FIT})
+    {
+        if (policy_to_string(p) == name) {
+            return p;
+        }
+    }
+    return std::nullopt;
+}
+
+ReplayReport replay_gc_trace(const GcTrace& trace, const ReplayConfig& config)
+{
+    HeapModel model{config};
+    for (const GcTraceEvent& event : trace.events) {
+        model.replay(event);
+    }
+    return model.finish();
+}
+
+///////////////////////////////////////////////////////////////
+#include <doctest/doctest.h>
+
+TEST_CASE("GC trace replay")
+{
+    using enum GcTraceTag;
+    constexpr uint32_t EXPLICIT = static_cast<uint32_t>(GcReason::EXPLICIT);
+
+    SUBCASE("Unreachable chain is collected") {
+        GcTrace trace{256, {
+            {ALLOCATE, 64},
+            {ALLOCATE, 64},
+            {ALLOCATE, 64},
+            {LINK, 0, GcTraceEvent::ROOT, 0},
+            {LINK, 1, 1, 1},     // 0 -> 1
+            {LINK, 2, 2, 2},     // 1 -> 2
+            {COLLECT, EXPLICIT},
+            {UNLINK, 0},
+            {COLLECT, EXPLICIT},
+        }};
+
+        const ReplayReport report = replay_gc_trace(trace, ReplayConfig{256});
+        CHECK(report.num_allocations == 3);
+        CHECK(report.num_failed_allocations == 0);
+        CHECK(report.num_collections == 2);
+        CHECK(report.peak_live_bytes == 192);
+        CHECK(report.peak_extent == 192);
+        // first: 3 marked + 3 edges, second: 3 swept
+        CHECK(report.pause_work == 9);
+        CHECK(report.final_fragmentation == 0.);
+
+        ReplayConfig no_explicit{256};
+        no_explicit.explicit_collections = false;
+        CHECK(replay_gc_trace(trace, no_explicit).num_collections == 0);
+    }
+
+    SUBCASE("Small heap collects on demand") {
+        GcTrace trace{1024, {
+            {ALLOCATE, 64},
+            {ALLOCATE, 64},
+            {LINK, 0, GcTraceEvent::ROOT, 1},
+            {ALLOCATE, 64},
+            {ALLOCATE, 128},
+        }};
+
+        const ReplayReport roomy = replay_gc_trace(trace, ReplayConfig{1024});
+        CHECK(roomy.num_collections == 0);
+        CHECK(roomy.peak_live_bytes == 320);
+
+        // blocks 0 and 2 die, leaving two 64 byte holes for a 128 byte request
+        const ReplayReport tight = replay_gc_trace(trace, ReplayConfig{192});
+        CHECK(tight.num_collections == 1);
+        CHECK(tight.num_failed_allocations == 1);
+        CHECK(tight.peak_extent == 192);
+        CHECK(tight.max_fragmentation == 0.5);
+    }
+
+    SUBCASE("Allocation policies") {
+        GcTrace trace{256, {
+            {ALLOCATE, 128},
+            {ALLOCATE, 64},
+            {LINK, 0, GcTraceEvent::ROOT, 1},
+            {ALLOCATE, 64},
+            {COLLECT, EXPLICIT}, // free: [0, 128), [192, 256)
+            {ALLOCATE, 64},
+            {LINK, 1, GcTraceEvent::ROOT, 3},
+            {ALLOCATE, 128},
+        }};
+
+        const ReplayReport first = replay_gc_trace(trace, ReplayConfig{256, AllocationPolicy::FIRST_FIT});
+        CHECK(first.num_failed_allocations == 1);
+        CHECK(first.num_collections == 2);
+
+        const ReplayReport best = replay_gc_trace(trace, ReplayConfig{256, AllocationPolicy::BEST_FIT});
+        CHECK(best.num_failed_allocations == 0);
+        CHECK(best.num_collections == 1);
+        CHECK(best.peak_live_bytes == 256);
+    }
+}
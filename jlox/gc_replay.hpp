@@ -0,0 +1,49 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+
+#include "gc_trace.hpp"
+
+enum class AllocationPolicy : uint8_t
+{
+    FIRST_FIT,
+    BEST_FIT,
+    NEXT_FIT,
+};
+
+std::string_view policy_to_string(AllocationPolicy policy) noexcept;
+
+std::optional<AllocationPolicy> policy_from_string(std::string_view name) noexcept;
+
+struct ReplayConfig
+{
+    std::size_t capacity{0};
+    AllocationPolicy policy{AllocationPolicy::FIRST_FIT};
+    //! Also collect where the recorded program called run_gc() explicitly.
+    bool explicit_collections{true};
+};
+
+struct ReplayReport
+{
+    std::size_t num_allocations{0};
+    std::size_t num_failed_allocations{0};
+    std::size_t num_collections{0};
+    //! Deterministic pause cost: blocks marked + edges traversed + blocks swept
+    std::size_t pause_work{0};
+    std::chrono::nanoseconds pause_time{0};
+    std::size_t peak_live_bytes{0};
+    //! Highest address ever handed out, i.e. the touched part of the heap
+    std::size_t peak_extent{0};
+    //! 1 - largest free block / free bytes, sampled after every collection
+    double max_fragmentation{0.};
+    double final_fragmentation{0.};
+};
+
+/**
+ * Replay a recorded trace against a simulated heap. Everything except
+ * `pause_time` only depends on the trace and `config`.
+ */
+ReplayReport replay_gc_trace(const GcTrace& trace, const ReplayConfig& config);
@@ -0,0 +1,129 @@
+#include <charconv>
+#include <string_view>
+#include <vector>
+
+#include "log.hpp"
+#include "gc_trace.hpp"
+#include "gc_replay.hpp"
+
+static
+bool parse_size(std::string_view str, std::size_t& size)
+{
+    std::size_t multiplier = 1;
+    if (str.ends_with('K') || str.ends_with('k')) {
+        multiplier = 1024;
+        str.remove_suffix(1);
+    } else if (str.ends_with('M') || str.ends_with('m')) {
+        multiplier = 1024 * 1024;
+        str.remove_suffix(1);
+    }
+    const auto [end, ec] = std::from_chars(str.data(), str.data() + str.size(), size);
+    if (ec != std::errc{} || end != str.data() + str.size() || size == 0) {
+        return false;
+    }
+    size *= multiplier;
+    return true;
+}
+
+template <typename F>
+static
+bool for_each_item(std::string_view list, F&& f)
+{
+    while (!list.empty()) {
+        const std::size_t comma = list.find(',');
+        if (!f(list.substr(0, comma))) {
+            return false;
+        }
+        if (comma == std::string_view::npos) {
+            break;
+        }
+        list.remove_prefix(comma + 1);
+    }
+    return true;
+}
+
+static
+int usage()
+{
+    LOG_ERROR("Usage: jlox_gc_replay [--capacity=SIZE[,SIZE...]] "
+              "[--policy=first-fit|best-fit|next-fit[,...]] [--ignore-explicit-gc] trace");
+    return 1;
+}
+
+int main(int argc, char** argv)
+{
+    std::vector<std::size_t> capacities;
+    std::vector<AllocationPolicy> policies;
+    bool explicit_collections = true;
+    const char* path = nullptr;
+
+    for (int i = 1; i < argc; ++i) {
+        const std::string_view arg{argv[i]};
+        if (arg.starts_with("--capacity=")) {
+            const bool ok = for_each_item(arg.substr(11), [&] (std::string_view item) {
+                std::size_t size{0};
+                if (!parse_size(item, size)) {
+                    return false;
+                }
+                capacities.push_back(size);
+                return true;
+            });
+            if (!ok) {
+                return usage();
+            }
+        } else if (arg.starts_with("--policy=")) {
+            const bool ok = for_each_item(arg.substr(9), [&] (std::string_view item) {
+                const std::optional<AllocationPolicy> policy = policy_from_string(item);
+                if (policy) {
+                    policies.push_back(*policy);
+                }
+                return policy.has_value();
+            });
+            if (!ok) {
+                return usage();
+            }
+        } else if (arg == "--ignore-explicit-gc") {
+            explicit_collections = false;
+        } else if (!path && !arg.starts_with("--")) {
+            path = argv[i];
+        } else {
+            return usage();
+        }
+    }
+    if (!path) {
+        return usage();
+    }
+
+    const std::optional<GcTrace> trace = read_gc_trace_file(path);
+    if (!trace) {
+        LOG_ERROR("Failed to read trace \"{}\".", path);
+        return 1;
+    }
+
+    if (capacities.empty()) {
+        capacities.push_back(trace->capacity);
+    }
+    if (policies.empty()) {
+        policies = {AllocationPolicy::FIRST_FIT,
+                    AllocationPolicy::BEST_FIT,
+                    AllocationPolicy::NEXT_FIT};
+    }
+
+    fmt::print("{} events, recorded with a capacity of {} bytes\n\n",
+               trace->events.size(), trace->capacity);
+    fmt::print("{:>10} {:>10} {:>9} {:>7} {:>6} {:>11} {:>10} {:>10} {:>11} {:>9} {:>9}\n",
+               "capacity", "policy", "allocs", "failed", "gcs", "pause_work",
+               "pause_ms", "peak_live", "peak_extent", "frag_max", "frag_end");
+    for (const std::size_t capacity : capacities) {
+        for (const AllocationPolicy policy : policies) {
+            const ReplayReport r = replay_gc_trace(*trace, ReplayConfig{capacity, policy, explicit_collections});
+            fmt::print("{:>10} {:>10} {:>9} {:>7} {:>6} {:>11} {:>10.3f} {:>10} {:>11} {:>9.3f} {:>9.3f}\n",
+                       capacity, policy_to_string(policy), r.num_allocations,
+                       r.num_failed_allocations, r.num_collections, r.pause_work,
+                       static_cast<double>(r.pause_time.count()) / 1e6,
+                       r.peak_live_bytes, r.peak_extent,
+                       r.max_fragmentation, r.final_fragmentation);
+        }
+    }
+    return 0;
+}
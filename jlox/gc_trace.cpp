@@ -0,0 +1,287 @@
+#include "gc_trace.hpp"
+
+#include <cassert>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+namespace
+{
+
+constexpr std::string_view MAGIC{"JLOXGCT1"};
+
+class TraceReader
+{
+public:
+    explicit
+    TraceReader(std::string_view data) noexcept
+      : m_data{data}
+    {}
+
+    bool eof() const noexcept
+    {
+        return m_data.empty();
+    }
+
+    bool read_tag(GcTraceTag& tag) noexcept
+    {
+        if (m_data.empty()) {
+            return false;
+        }
+        const uint8_t t = static_cast<uint8_t>(m_data.front());
+        m_data.remove_prefix(1);
+        if (t < static_cast<uint8_t>(GcTraceTag::ALLOCATE) ||
+            t > static_cast<uint8_t>(GcTraceTag::COLLECT))
+        {
+            return false;
+        }
+        tag = static_cast<GcTraceTag>(t);
+        return true;
+    }
+
+    template <typename T>
+    bool read_uint(T& value) noexcept
+    {
+        uint64_t result{0};
+        for (int shift = 0; shift < 64; shift += 7) {
+            if (m_data.empty()) {
+                return false;
+            }
+            const uint8_t byte = static_cast<uint8_t>(m_data.front());
+            m_data.remove_prefix(1);
+            result |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            if ((byte & 0x80) == 0) {
+                value = static_cast<T>(result);
+                return static_cast<uint64_t>(value) == result;
+            }
+        }
+        return false;
+    }
+
+private:
+    std::string_view m_data;
+};
+
+} // anonymous namespace
+
+
+GcTraceWriter::GcTraceWriter(const std::size_t capacity)
+  : m_buffer{MAGIC}
+{
+    write_uint(capacity);
+}
+
+void GcTraceWriter::write(const GcTraceEvent& event)
+{
+    m_buffer.push_back(static_cast<char>(event.tag));
+    switch (event.tag) {
+    using enum GcTraceTag;
+    case ALLOCATE:
+    case UNDO_ALLOCATE:
+    case UNLINK:
+    case COLLECT:
+        write_uint(event.a);
+        break;
+
+    case LINK:
+        write_uint(event.a);
+        write_uint(event.b);
+        write_uint(event.c);
+        break;
+    }
+}
+
+bool GcTraceWriter::flush(std::FILE* const file)
+{
+    const bool ok = m_buffer.empty() ||
+        std::fwrite(m_buffer.data(), m_buffer.size(), 1, file) == 1;
+    m_buffer.clear();
+    return ok;
+}
+
+void GcTraceWriter::write_uint(uint64_t value)
+{
+    do {
+        const uint8_t byte = value & 0x7f;
+        value >>= 7;
+        m_buffer.push_back(static_cast<char>(byte | (value ? 0x80 : 0)));
+    } while (value);
+}
+
+
+std::optional<GcTrace> read_gc_trace(std::string_view data)
+{
+    if (!data.starts_with(MAGIC)) {
+        return std::nullopt;
+    }
+    data.remove_prefix(MAGIC.size());
+
+    TraceReader reader{data};
+    GcTrace trace;
+    if (!reader.read_uint(trace.capacity)) {
+        return std::nullopt;
+    }
+
+    while (!reader.eof()) {
+        GcTraceEvent event{};
+        if (!reader.read_tag(event.tag) || !reader.read_uint(event.a)) {
+            return std::nullopt;
+        }
+        if (event.tag == GcTraceTag::LINK) {
+            if (!reader.read_uint(event.b) || !reader.read_uint(event.c)) {
+                return std::nullopt;
+            }
+        }
+        trace.events.push_back(event);
+    }
+    return trace;
+}
+
+std::optional<GcTrace> read_gc_trace_file(const char* const path)
+{
+    std::ifstream input{path, std::ios::binary};
+    if (!input) {
+        return std::nullopt;
+    }
+    const std::string content{std::istreambuf_iterator<char>{input},
+                              std::istreambuf_iterator<char>{}};
+    return read_gc_trace(content);
+}
+
+//
+
+GcTraceRecorder::GcTraceRecorder(std::FILE* const file,
+                                 const void* const memory,
+                                 const std::size_t capacity)
+  : m_writer{capacity}
+  , m_file{file}
+  , m_memory{static_cast<const char*>(memory)}
+  , m_capacity{capacity}
+{
+    assert(detail::heap_ptr_tracer == nullptr);
+    detail::heap_ptr_tracer = this;
+}
+
+GcTraceRecorder::~GcTraceRecorder()
+{
+    detail::heap_ptr_tracer = nullptr;
+    flush();
+}
+
+void GcTraceRecorder::on_allocate(const std::size_t offset, const std::size_t size)
+{
+    m_allocations.insert_or_assign(offset, Allocation{size, m_next_allocation++});
+    write(GcTraceEvent{GcTraceTag::ALLOCATE, static_cast<uint32_t>(size)});
+}
+
+void GcTraceRecorder::on_undo_allocate(const std::size_t offset)
+{
+    const auto it = m_allocations.find(offset);
+    if (it == m_allocations.end()) {
+        return;
+    }
+    write(GcTraceEvent{GcTraceTag::UNDO_ALLOCATE, it->second.id});
+    m_allocations.erase(it);
+}
+
+void GcTraceRecorder::on_free(const std::size_t offset)
+{
+    m_allocations.erase(offset);
+}
+
+void GcTraceRecorder::on_collect(const GcReason reason)
+{
+    write(GcTraceEvent{GcTraceTag::COLLECT, static_cast<uint32_t>(reason)});
+}
+
+bool GcTraceRecorder::flush()
+{
+    if (!m_file) {
+        return false;
+    }
+    return m_writer.flush(m_file) && std::fflush(m_file) == 0;
+}
+
+void GcTraceRecorder::on_link(const detail::HeapPtrBaseNode* const node, const void* const ptr) noexcept
+{
+    const uint32_t target = lookup(ptr);
+    if (target == GcTraceEvent::ROOT) {
+        // allocated before recording started
+        return;
+    }
+    const uint32_t id = m_next_node++;
+    m_nodes.insert_or_assign(node, id);
+    write(GcTraceEvent{GcTraceTag::LINK, id, lookup(node), target - 1});
+}
+
+void GcTraceRecorder::on_unlink(const detail::HeapPtrBaseNode* const node) noexcept
+{
+    const auto it = m_nodes.find(node);
+    if (it == m_nodes.end()) {
+        return;
+    }
+    write(GcTraceEvent{GcTraceTag::UNLINK, it->second});
+    m_nodes.erase(it);
+}
+
+void GcTraceRecorder::write(const GcTraceEvent& event) noexcept
+{
+    try {
+        m_writer.write(event);
+        if (m_writer.buffer().size() >= FLUSH_THRESHOLD) {
+            flush();
+        }
+    } catch (...) {
+        // A truncated trace is still better than terminating the interpreter.
+        m_file = nullptr;
+    }
+}
+
+uint32_t GcTraceRecorder::lookup(const void* const ptr) const noexcept
+{
+    const char* const cptr = static_cast<const char*>(ptr);
+    if (cptr < m_memory || (m_memory + m_capacity) <= cptr) {
+        return GcTraceEvent::ROOT;
+    }
+    const std::size_t offset = cptr - m_memory;
+    auto it = m_allocations.upper_bound(offset);
+    if (it == m_allocations.begin()) {
+        return GcTraceEvent::ROOT;
+    }
+    --it;
+    if (offset >= it->first + it->second.size) {
+        return GcTraceEvent::ROOT;
+    }
+    return it->second.id + 1;
+}
+
+///////////////////////////////////////////////////////////////
+#include <doctest/doctest.h>
+
+TEST_CASE("GC trace encoding")
+{
+    const std::vector<GcTraceEvent> events{
+        {GcTraceTag::ALLOCATE, 32},
+        {GcTraceTag::ALLOCATE, 4096},
+        {GcTraceTag::LINK, 0, GcTraceEvent::ROOT, 0},
+        {GcTraceTag::LINK, 1, 1, 1},
+        {GcTraceTag::UNLINK, 0},
+        {GcTraceTag::COLLECT, static_cast<uint32_t>(GcReason::ALLOCATION_FAILURE)},
+        {GcTraceTag::UNDO_ALLOCATE, 1},
+    };
+
+    GcTraceWriter writer{2 * 1024};
+    for (const GcTraceEvent& e : events) {
+        writer.write(e);
+    }
+
+    const std::optional<GcTrace> trace = read_gc_trace(writer.buffer());
+    REQUIRE(trace.has_value());
+    CHECK(trace->capacity == 2 * 1024);
+    CHECK(trace->events == events);
+
+    std::string truncated = writer.buffer();
+    truncated.pop_back();
+    CHECK(read_gc_trace(truncated).has_value() == false);
+    CHECK(read_gc_trace("JLOXGCT0").has_value() == false);
+}
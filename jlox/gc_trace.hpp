@@ -0,0 +1,139 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <absl/container/flat_hash_map.h>
+
+#include "detail/heap_ptr_base.hpp"
+
+/**
+ * Binary trace of everything the GarbageCollectedHeap does.
+ *
+ * Layout: the 8 byte magic "JLOXGCT1", the heap capacity as LEB128 and then a
+ * sequence of events, each a tag byte followed by LEB128 operands:
+ *
+ *   ALLOCATE size              allocation ids are implicit (0, 1, 2, ...)
+ *   UNDO_ALLOCATE id           constructor threw, allocation was rolled back
+ *   LINK node source target    source is 0 for roots, otherwise id + 1
+ *   UNLINK node
+ *   COLLECT reason             see GcReason
+ *
+ * Node ids are handed out per LINK and are never reused.
+ */
+enum class GcTraceTag : uint8_t
+{
+    ALLOCATE = 1,
+    UNDO_ALLOCATE,
+    LINK,
+    UNLINK,
+    COLLECT,
+};
+
+enum class GcReason : uint8_t
+{
+    EXPLICIT = 0,
+    ALLOCATION_FAILURE = 1,
+};
+
+struct GcTraceEvent
+{
+    static constexpr uint32_t ROOT = 0;
+
+    GcTraceTag tag;
+    uint32_t a{0}; // ALLOCATE: size, UNDO_ALLOCATE: id, (UN)LINK: node, COLLECT: reason
+    uint32_t b{0}; // LINK: source (ROOT or id + 1)
+    uint32_t c{0}; // LINK: target id
+
+    bool operator==(const GcTraceEvent&) const = default;
+};
+
+struct GcTrace
+{
+    std::size_t capacity{0};
+    std::vector<GcTraceEvent> events;
+};
+
+class GcTraceWriter
+{
+public:
+    explicit
+    GcTraceWriter(std::size_t capacity);
+
+    void write(const GcTraceEvent& event);
+
+    //! Move everything written so far to `file`. Returns false on I/O errors.
+    bool flush(std::FILE* file);
+
+    const std::string& buffer() const noexcept
+    {
+        return m_buffer;
+    }
+
+private:
+    void write_uint(uint64_t value);
+
+    std::string m_buffer;
+};
+
+/**
+ * Decode a trace. Returns std::nullopt on malformed input.
+ */
+std::optional<GcTrace> read_gc_trace(std::string_view data);
+
+std::optional<GcTrace> read_gc_trace_file(const char* path);
+
+/**
+ * Records heap activity while installed as the global HeapPtr tracer.
+ * Without JLOX_GC_TRACE only allocation and collection events are recorded,
+ * which is not enough for a replay.
+ */
+class GcTraceRecorder : private detail::HeapPtrTracer
+{
+public:
+    GcTraceRecorder(std::FILE* file, const void* memory, std::size_t capacity);
+    ~GcTraceRecorder();
+
+    void on_allocate(std::size_t offset, std::size_t size);
+    void on_undo_allocate(std::size_t offset);
+    void on_free(std::size_t offset);
+    void on_collect(GcReason reason);
+
+    bool flush();
+
+    GcTraceRecorder(const GcTraceRecorder&) = delete;
+    GcTraceRecorder(GcTraceRecorder&&) = delete;
+    GcTraceRecorder& operator=(const GcTraceRecorder&) = delete;
+    GcTraceRecorder& operator=(GcTraceRecorder&&) = delete;
+
+private:
+    static constexpr std::size_t FLUSH_THRESHOLD = 64 * 1024;
+
+    void on_link(const detail::HeapPtrBaseNode* node, const void* ptr) noexcept override;
+    void on_unlink(const detail::HeapPtrBaseNode* node) noexcept override;
+
+    void write(const GcTraceEvent& event) noexcept;
+
+    //! GcTraceEvent::ROOT or id + 1 of the allocation containing `ptr`
+    uint32_t lookup(const void* ptr) const noexcept;
+
+    struct Allocation
+    {
+        std::size_t size;
+        uint32_t id;
+    };
+
+    GcTraceWriter m_writer;
+    std::FILE* m_file;
+    const char* m_memory;
+    std::size_t m_capacity;
+    std::map<std::size_t, Allocation> m_allocations;
+    absl::flat_hash_map<const void*, uint32_t> m_nodes;
+    uint32_t m_next_allocation{0};
+    uint32_t m_next_node{0};
+};
@@ -2,7 +2,6 @@
 
 #include <cassert>
 #include <cstdlib>
-#include <chrono>
 #include <stdexcept>
 
 #include "log.hpp"
@@ -11,98 +10,6 @@
 namespace
 {
 
-bool is_truthy(const Value& value) noexcept
-{
-    if (const bool* const b = std::get_if<bool>(&value)) {
-        return *b;
-    }
-    if (const std::string* const s = std::get_if<std::string>(&value)) {
-        return s->empty() == false;
-    }
-    if (const double* const d = std::get_if<double>(&value)) {
-        return *d != 0.;
-    }
-    if (std::get_if<Nil>(&value)) {
-        return false;
-    }
-    std::abort();
-}
-
-template <typename T>
-bool is_equal_impl(const Value& lhs, const Value& rhs) noexcept
-{
-    const T* const l = std::get_if<T>(&lhs);
-    if (!l) {
-        return false;
-    }
-    const T* const r = std::get_if<T>(&rhs);
-    if (!r) {
-        return false;
-    }
-    return *l == *r;
-}
-
-bool is_equal(const Value& lhs, const Value& rhs) noexcept
-{
-#define CHECK(Type) if (const Type* const l = std::get_if<Type>(&lhs), * const r = std::get_if<Type>(&rhs); l && r) { return *l == *r; }
-    CHECK(Nil)
-    CHECK(bool)
-    CHECK(std::string)
-    CHECK(double)
-#undef CHECK
-    return false;
-}
-
-template <typename T>
-constexpr
-std::string_view type_name() noexcept;
-
-template <>
-constexpr
-std::string_view type_name<double>() noexcept
-{
-    return "number";
-}
-
-template <>
-constexpr
-std::string_view type_name<std::string>() noexcept
-{
-    return "string";
-}
-
-template <>
-constexpr
-std::string_view type_name<Nil>() noexcept
-{
-    return "nil";
-}
-
-template <>
-constexpr
-std::string_view type_name<bool>() noexcept
-{
-    return "boolean";
-}
-
-constexpr
-std::string_view type_name(const Value& value) noexcept
-{
-    if (std::get_if<std::string>(&value)) {
-        return type_name<std::string>();
-    }
-    if (std::get_if<double>(&value)) {
-        return type_name<double>();
-    }
-    if (std::get_if<bool>(&value)) {
-        return type_name<bool>();
-    }
-    if (std::get_if<Nil>(&value)) {
-        return type_name<Nil>();
-    }
-    std::abort();
-}
-
 class InterpreterError final : public std::runtime_error
 {
 public:
@@ -125,27 +32,30 @@ void check_operand_type(const Value& value,
     }
 }
 
-
-std::string stringify(const Value& value)
+Value number_operation(const TokenType type, const double lhs, const double rhs)
 {
-    if (std::get_if<Nil>(&value)) {
-        return "nil";
-    } else if (const double* const d = std::get_if<double>(&value)) {
-        return fmt::to_string(*d);
-    } else if (const std::string* const s = std::get_if<std::string>(&value)) {
-        return *s;
-    } else if (const bool* const b = std::get_if<bool>(&value)) {
-        return (*b ? "true\n" : "false\n");
-    } else {
+    switch (type) {
+    using enum TokenType;
+    case PLUS:          return lhs + rhs;
+    case MINUS:         return lhs - rhs;
+    case SLASH:         return lhs / rhs;
+    case STAR:          return lhs * rhs;
+    case EQUAL_EQUAL:   return lhs == rhs;
+    case BANG_EQUAL:    return lhs != rhs;
+    case GREATER:       return lhs > rhs;
+    case GREATER_EQUAL: return lhs >= rhs;
+    case LESS:          return lhs < rhs;
+    case LESS_EQUAL:    return lhs <= rhs;
+    default:
         std::abort();
     }
 }
 
-double clock_impl()
+//! An operand that infer_types() proved to be a number, checked only in Debug builds
+double proven_number(const Value& value) noexcept
 {
-    const auto now = std::chrono::steady_clock::now();
-    const int64_t now_us = std::chrono::duration_cast<std::chrono::microseconds>(now.time_since_epoch()).count();
-    return static_cast<double>(now_us) / 1000000.0;
+    assert(std::holds_alternative<double>(value) && "infer_types() got the type wrong");
+    return *std::get_if<double>(&value);
 }
 
 } // anonymous namespace
@@ -157,7 +67,7 @@ Interpreter::Interpreter(const ScannerResult& scanner_result, Globals& globals)
   : m_scanner_result{scanner_result}
   , m_globals{globals}
 {
-    m_globals.environment()->define("clock", Callable{&clock_impl, {}});
+    define_natives(*m_globals.environment());
 }
 
 bool Interpreter::execute(Stmt& stmt)
@@ -200,7 +110,69 @@ void Interpreter::visit(BinaryExpr& binar_expr)
 {
     Value lhs = evaluate_impl(*binar_expr.left);
     Value rhs = evaluate_impl(*binar_expr.right);
+    binar_expr.observe(lhs, rhs);
+    binary_operation(binar_expr, lhs, rhs);
+}
+
+void Interpreter::visit_numbers(BinaryExpr& binar_expr)
+{
+    Value lhs = evaluate_impl(*binar_expr.left);
+    Value rhs = evaluate_impl(*binar_expr.right);
+    const double* const ld = std::get_if<double>(&lhs);
+    const double* const rd = std::get_if<double>(&rhs);
+    if (!ld || !rd) [[unlikely]] {
+        binar_expr.observe(lhs, rhs);
+        binary_operation(binar_expr, lhs, rhs);
+        return;
+    }
+
+    m_stack.push_back(number_operation(binar_expr.op->type(), *ld, *rd));
+}
+
+void Interpreter::visit_strings(BinaryExpr& binar_expr)
+{
+    Value lhs = evaluate_impl(*binar_expr.left);
+    Value rhs = evaluate_impl(*binar_expr.right);
+    const std::string* const ls = std::get_if<std::string>(&lhs);
+    const std::string* const rs = std::get_if<std::string>(&rhs);
+    if (!ls || !rs) [[unlikely]] {
+        binar_expr.observe(lhs, rhs);
+        binary_operation(binar_expr, lhs, rhs);
+        return;
+    }
 
+    switch (binar_expr.op->type()) {
+    using enum TokenType;
+    case PLUS:          m_stack.emplace_back(*ls + *rs); break;
+    case EQUAL_EQUAL:   m_stack.emplace_back(*ls == *rs); break;
+    case BANG_EQUAL:    m_stack.emplace_back(*ls != *rs); break;
+    default:
+        std::abort();
+    }
+}
+
+void Interpreter::visit_fused(BinaryExpr& binar_expr)
+{
+    const Value& lhs = leaf(*binar_expr.left);
+    const Value& rhs = leaf(*binar_expr.right);
+    const double* const ld = std::get_if<double>(&lhs);
+    const double* const rd = std::get_if<double>(&rhs);
+    if (ld && rd) {
+        m_stack.push_back(number_operation(binar_expr.op->type(), *ld, *rd));
+    } else {
+        binary_operation(binar_expr, lhs, rhs);
+    }
+}
+
+void Interpreter::visit_check_free(BinaryExpr& binar_expr)
+{
+    const Value lhs = evaluate_impl(*binar_expr.left);
+    const Value rhs = evaluate_impl(*binar_expr.right);
+    m_stack.push_back(number_operation(binar_expr.op->type(), proven_number(lhs), proven_number(rhs)));
+}
+
+void Interpreter::binary_operation(const BinaryExpr& binar_expr, const Value& lhs, const Value& rhs)
+{
     switch (binar_expr.op->type()) {
     using enum TokenType;
     case PLUS:
@@ -276,44 +248,49 @@ void Interpreter::visit(GroupingExpr& grouping_expr)
 
 void Interpreter::visit(LiteralExpr& literal_expr)
 {
-    assert(literal_expr.value != nullptr);
-
-    std::string_view lexeme = literal_expr.value->lexeme(m_scanner_result.source);
-
-    switch (literal_expr.value->type()) {
-    using enum TokenType;
-    case STRING:
-        assert(lexeme.size() >= 2);
-        m_stack.emplace_back(std::in_place_type_t<std::string>{}, lexeme.substr(1, lexeme.size() - 2));
-        break;
-
-    case NUMBER:
-        assert(lexeme.size() >= 1);
-        // TODO: Handle 0xafd, 0b111, 0777...
-        m_stack.emplace_back(std::strtod(lexeme.data(), nullptr));
-        break;
-
-    case TRUE:
-        m_stack.emplace_back(true);
-        break;
+    assert(literal_expr.constant != nullptr);
+    m_stack.push_back(*literal_expr.constant);
+}
 
-    case FALSE:
-        m_stack.emplace_back(false);
-        break;
+void Interpreter::visit(UnaryExpr& unary_expr)
+{
+    const Value val = evaluate_impl(*unary_expr.right);
+    unary_expr.observe(val);
+    unary_operation(unary_expr, val);
+}
 
-    case NIL:
-        m_stack.emplace_back(Nil{});
-        break;
+void Interpreter::visit_number(UnaryExpr& unary_expr)
+{
+    const Value val = evaluate_impl(*unary_expr.right);
+    const double* const number = std::get_if<double>(&val);
+    if (!number) [[unlikely]] {
+        unary_expr.observe(val);
+        unary_operation(unary_expr, val);
+        return;
+    }
+    m_stack.emplace_back(-*number);
+}
 
-    default:
-        std::abort();
+void Interpreter::visit_boolean(UnaryExpr& unary_expr)
+{
+    const Value val = evaluate_impl(*unary_expr.right);
+    const bool* const boolean = std::get_if<bool>(&val);
+    if (!boolean) [[unlikely]] {
+        unary_expr.observe(val);
+        unary_operation(unary_expr, val);
+        return;
     }
+    m_stack.emplace_back(!*boolean);
 }
 
-void Interpreter::visit(UnaryExpr& unary_expr)
+void Interpreter::visit_check_free(UnaryExpr& unary_expr)
 {
-    Value val = evaluate_impl(*unary_expr.right);
+    const Value val = evaluate_impl(*unary_expr.right);
+    m_stack.emplace_back(-proven_number(val));
+}
 
+void Interpreter::unary_operation(const UnaryExpr& unary_expr, const Value& val)
+{
     switch (unary_expr.op->type()) {
     using enum TokenType;
     case MINUS:
@@ -333,33 +310,88 @@ void Interpreter::visit(UnaryExpr& unary_expr)
 
 void Interpreter::visit(VarExpr& var_expr)
 {
-    const Value* const value = m_globals.environment()->get(var_expr.identifier->lexeme(m_scanner_result.source));
+    m_stack.push_back(variable(var_expr));
+}
+
+const Value& Interpreter::variable(const VarExpr& var_expr) const
+{
+    const Resolution resolution = var_expr.resolution;
+    const Value* const value = resolution.depth == GLOBAL_DEPTH
+        ? m_globals.global_environment()->get(var_expr.symbol)
+        : &m_globals.environment()->slot(resolution.depth, resolution.slot);
     if (!value) {
         report_error(m_scanner_result, *var_expr.identifier, "Identifier not found");
         throw InterpreterError{};
     }
-    m_stack.push_back(*value);
+    return *value;
 }
 
-void Interpreter::visit(AssignExpr& assign_expr)
+const Value& Interpreter::leaf(const Expr& expr) const
 {
-    const std::string_view name = assign_expr.identifier->lexeme(m_scanner_result.source);
+    if (expr.is_type<LiteralExpr>()) {
+        return *static_cast<const LiteralExpr&>(expr).constant;
+    }
+    assert(expr.is_type<VarExpr>());
+    return variable(static_cast<const VarExpr&>(expr));
+}
 
+void Interpreter::visit(AssignExpr& assign_expr)
+{
     evaluate_impl_nopop(*assign_expr.value);
 
-    const bool result = m_globals.environment()->assign(name, std::move(m_stack.back()));
+    const Resolution resolution = assign_expr.resolution;
+    bool result{true};
+    if (resolution.depth == GLOBAL_DEPTH) {
+        result = m_globals.global_environment()->assign(assign_expr.symbol, std::move(m_stack.back()));
+    } else {
+        m_globals.environment()->slot(resolution.depth, resolution.slot) = std::move(m_stack.back());
+    }
     m_stack.pop_back();
 
     if (!result) {
-        report_error(m_scanner_result, *assign_expr.identifier, "Undefined variable '{}'.", name);
+        report_error(m_scanner_result, *assign_expr.identifier, "Undefined variable '{}'.",
+                     assign_expr.identifier->lexeme(m_scanner_result.source));
         throw InterpreterError{};
     }
 
 }
 
+void Interpreter::visit_fused(AssignExpr& assign_expr)
+{
+    const BinaryExpr& value = static_cast<const BinaryExpr&>(*assign_expr.value);
+    const Resolution resolution = assign_expr.resolution;
+    Value& target = m_globals.environment()->slot(resolution.depth, resolution.slot);
+    const Value& rhs = leaf(*value.right);
+    const double* const ld = std::get_if<double>(&target);
+    const double* const rd = std::get_if<double>(&rhs);
+    if (!ld || !rd) {
+        visit(assign_expr);
+        return;
+    }
+    target = number_operation(value.op->type(), *ld, *rd);
+}
+
 void Interpreter::visit(LogicalExpr& logical_expr)
 {
-    const bool left = is_truthy(evaluate_impl(*logical_expr.left));
+    const Value left = evaluate_impl(*logical_expr.left);
+    logical_expr.observe(left);
+    logical_operation(logical_expr, is_truthy(left));
+}
+
+void Interpreter::visit_booleans(LogicalExpr& logical_expr)
+{
+    const Value left = evaluate_impl(*logical_expr.left);
+    const bool* const boolean = std::get_if<bool>(&left);
+    if (!boolean) [[unlikely]] {
+        logical_expr.observe(left);
+        logical_operation(logical_expr, is_truthy(left));
+        return;
+    }
+    logical_operation(logical_expr, *boolean);
+}
+
+void Interpreter::logical_operation(LogicalExpr& logical_expr, const bool left)
+{
     const bool is_and = logical_expr.token->type() == TokenType::AND;
     if (is_and && !left) {
         m_stack.push_back(false);
@@ -369,8 +401,9 @@ void Interpreter::visit(LogicalExpr& logical_expr)
         return;
     }
 
-    const bool right = is_truthy(evaluate_impl(*logical_expr.right));
-    m_stack.push_back(right);
+    const Value right = evaluate_impl(*logical_expr.right);
+    logical_expr.observe(right);
+    m_stack.push_back(is_truthy(right));
 }
 
 void Interpreter::visit(CallExpr& call_expr)
@@ -397,7 +430,7 @@ void Interpreter::visit(CallExpr& call_expr)
         args.push_back(evaluate_impl(*arg));
     }
 
-    m_stack.push_back(callable_callee->call(*this, args));
+    m_stack.push_back(callable_callee->call(this, args));
 }
 
 void Interpreter::unkown_expr(Expr& expr)
@@ -443,15 +476,18 @@ bool Interpreter::visit(VarStmt& var_stmt)
     if (var_stmt.initializer) {
         val = evaluate_impl(*var_stmt.initializer);
     }
-    m_globals.environment()->define(var_stmt.identifier->lexeme(m_scanner_result.source),
-                                    std::move(val));
+    if (var_stmt.slot < 0) {
+        m_globals.environment()->define(var_stmt.symbol, std::move(val));
+    } else {
+        m_globals.environment()->define_slot(var_stmt.slot, var_stmt.symbol, std::move(val));
+    }
 
     return false;
 }
 
 bool Interpreter::visit(BlockStmt& block_stmt)
 {
-    NewScope new_scope(m_globals);
+    NewScope new_scope(m_globals, block_stmt.num_slots);
 
     for (Stmt* stmt : block_stmt.statements) {
         const bool do_return = stmt->accept(*this);
@@ -474,27 +510,54 @@ bool Interpreter::visit(IfStmt& if_stmt)
 
 bool Interpreter::visit(WhileStmt& while_stmt)
 {
-    while (is_truthy(evaluate_impl(*while_stmt.condition))) {
+    jit::HotSpot& hot_spot = m_hot_spots[&while_stmt];
+    bool use_compiled{true};
+    while (true) {
+        if (use_compiled) {
+            const jit::Region* const region = hot_spot.tick([&] {
+                return jit::compile(while_stmt, m_scanner_result);
+            });
+            if (region) {
+                // continues with the current values of the variables
+                Value ignored;
+                if (region->run(*m_globals.environment(), *m_globals.global_environment(), {}, ignored)) {
+                    return false;
+                }
+                use_compiled = false;
+            }
+        }
+        if (!is_truthy(evaluate_impl(*while_stmt.condition))) {
+            return false;
+        }
         const bool do_return = while_stmt.body->accept(*this);
         if (do_return) {
             return true;
         }
     }
-    return false;
 }
 
 bool Interpreter::visit(FunStmt& fun_stmt)
 {
     const int32_t arity = static_cast<int32_t>(fun_stmt.params.size());
-    auto f = [params=std::move(fun_stmt.params), body=std::move(fun_stmt.body)] (Interpreter& interpreter, const HeapPtr<Environment>& closure, std::span<const Value> args) -> Value {
-        assert(params.size() == args.size());
+    auto f = [param_symbols=fun_stmt.param_symbols, body=fun_stmt.body, num_slots=fun_stmt.num_slots,
+              fun_stmt=&fun_stmt, hot_spot=&m_hot_spots[&fun_stmt]] (Interpreter* const caller, const HeapPtr<Environment>& closure, std::span<const Value> args) -> Value {
+        assert(caller);
+        Interpreter& interpreter = *caller;
+        assert(param_symbols.size() == args.size());
+
+        const jit::Region* const region = hot_spot->tick([&] {
+            return jit::compile(*fun_stmt, interpreter.m_scanner_result);
+        });
+        if (Value result; region && region->run(*closure, *interpreter.m_globals.global_environment(), args, result)) {
+            return result;
+        }
 
         const AdjustedEnvironment adjusted_env{interpreter.m_globals, closure};
 
-        NewScope new_scope(interpreter.m_globals);
+        NewScope new_scope(interpreter.m_globals, num_slots);
         Environment* env = interpreter.m_globals.environment().get();
-        for (size_t i = 0, count = params.size(); i != count; ++i) {
-            env->define(params[i]->lexeme(interpreter.m_scanner_result.source), args[i]);
+        for (size_t i = 0, count = param_symbols.size(); i != count; ++i) {
+            env->define_slot(static_cast<int32_t>(i), param_symbols[i], Value{args[i]});
         }
         bool has_return_value = false;
         for (Stmt* stmt : body) {
@@ -513,7 +576,12 @@ bool Interpreter::visit(FunStmt& fun_stmt)
     };
 
     HeapPtr<Environment> env = m_globals.environment();
-    m_globals.environment()->define(fun_stmt.name->lexeme(m_scanner_result.source), Callable{std::move(f), arity, std::move(env)});
+    Callable callable{std::move(f), arity, std::move(env)};
+    if (fun_stmt.slot < 0) {
+        m_globals.environment()->define(fun_stmt.symbol, std::move(callable));
+    } else {
+        m_globals.environment()->define_slot(fun_stmt.slot, fun_stmt.symbol, std::move(callable));
+    }
 
     return false;
 }
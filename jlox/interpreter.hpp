@@ -1,6 +1,7 @@
 #pragma once
 
 #include <optional>
+#include <unordered_map>
 #include <vector>
 #include <string>
 
@@ -8,6 +9,7 @@
 #include "stmt.hpp"
 #include "value.hpp"
 #include "environment.hpp"
+#include "jit.hpp"
 
 struct ScannerResult;
 
@@ -31,6 +33,16 @@ public:
     void visit(CallExpr& call_expr) override;
     void unkown_expr(Expr& expr) override;
 
+    void visit_numbers(BinaryExpr& binar_expr) override;
+    void visit_strings(BinaryExpr& binar_expr) override;
+    void visit_number(UnaryExpr& unary_expr) override;
+    void visit_boolean(UnaryExpr& unary_expr) override;
+    void visit_booleans(LogicalExpr& logical_expr) override;
+    void visit_fused(BinaryExpr& binar_expr) override;
+    void visit_fused(AssignExpr& assign_expr) override;
+    void visit_check_free(BinaryExpr& binar_expr) override;
+    void visit_check_free(UnaryExpr& unary_expr) override;
+
     bool visit(ExprStmt& expr_stmt) override;
     bool visit(PrintStmt& expr_stmt) override;
     bool visit(VarStmt& var_stmt) override;
@@ -47,6 +59,20 @@ private:
 
     void evaluate_impl_nopop(Expr& expr);
 
+    // What visit() does once the operands are evaluated, which is also
+    // where a specialized visit goes when an operand has another type
+    void binary_operation(const BinaryExpr& binar_expr, const Value& lhs, const Value& rhs);
+    void unary_operation(const UnaryExpr& unary_expr, const Value& val);
+    void logical_operation(LogicalExpr& logical_expr, bool left);
+
+    //! The value of a variable, without going through m_stack
+    [[nodiscard]]
+    const Value& variable(const VarExpr& var_expr) const;
+
+    //! The value of a VarExpr or LiteralExpr operand of a fused node
+    [[nodiscard]]
+    const Value& leaf(const Expr& expr) const;
+
     template <typename T>
     void check_operand_type(const Value&, const Expr*) const;
 
@@ -54,6 +80,8 @@ private:
     void check_operand_type(const Value&, const Value&, const BinaryExpr*) const;
 
     std::vector<Value> m_stack;
+    //! Of the loops and functions, which stay where they are for the closures
+    std::unordered_map<const Stmt*, jit::HotSpot> m_hot_spots;
     const ScannerResult& m_scanner_result;
     Globals& m_globals;
 };
@@ -0,0 +1,767 @@
+#include "jit.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <fmt/format.h>
+
+#include "environment.hpp"
+#include "expr.hpp"
+#include "scanner.hpp"
+#include "stmt.hpp"
+
+namespace jit
+{
+
+namespace
+{
+
+//! Doubles in a frame, so that run() can keep it on the stack. The
+//! arguments come first, the return value is the last.
+inline constexpr int32_t MAX_FRAME_SIZE = 256;
+inline constexpr int32_t RETURN_VALUE = MAX_FRAME_SIZE - 1;
+
+//! The code uses xmm0 to xmm15 as a stack for the operands of expressions
+inline constexpr int32_t NUM_REGISTERS = 16;
+
+//! Thrown for code outside of the subset the JIT compiles
+class Unsupported final : public std::runtime_error
+{
+public:
+    Unsupported() : std::runtime_error{""} {}
+};
+
+std::FILE* perf_map = nullptr;
+
+/**
+ * Emits the few SSE2 and jump instructions the compiler needs. Variables
+ * are doubles at [rdi + 8 * index], constants follow the code and are
+ * addressed relative to rip.
+ */
+class Assembler
+{
+public:
+    struct Label
+    {
+        int32_t position{-1};
+        //! Offsets of rel32 operands to patch once bound
+        std::vector<int32_t> uses;
+    };
+
+    //! The condition codes of jcc, as they are after ucomisd
+    enum Condition : uint8_t
+    {
+        BELOW = 0x2,
+        ABOVE_EQUAL = 0x3,
+        EQUAL = 0x4,
+        NOT_EQUAL = 0x5,
+        BELOW_EQUAL = 0x6,
+        ABOVE = 0x7,
+        PARITY = 0xA,
+    };
+
+    enum Arithmetic : uint8_t
+    {
+        ADDSD = 0x58,
+        MULSD = 0x59,
+        SUBSD = 0x5C,
+        DIVSD = 0x5E,
+    };
+
+    //! movsd xmm, [rdi + 8 * index]
+    void load(const int32_t xmm, const int32_t index)
+    {
+        sse_memory(0xF2, 0x10, xmm, index);
+    }
+
+    //! movsd [rdi + 8 * index], xmm
+    void store(const int32_t index, const int32_t xmm)
+    {
+        sse_memory(0xF2, 0x11, xmm, index);
+    }
+
+    //! movsd xmm, [rip + constant]
+    void load_constant(const int32_t xmm, const double value)
+    {
+        uint64_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        auto it = std::find(m_constants.begin(), m_constants.end(), bits);
+        if (it == m_constants.end()) {
+            it = m_constants.insert(it, bits);
+        }
+        m_code.push_back(0xF2);
+        rex(xmm, 0);
+        m_code.insert(m_code.end(), {0x0F, 0x10, static_cast<uint8_t>(((xmm & 7) << 3) | 0x05)});
+        m_constant_uses.push_back({static_cast<int32_t>(m_code.size()), static_cast<int32_t>(it - m_constants.begin())});
+        emit32(0);
+    }
+
+    void arithmetic(const Arithmetic op, const int32_t dst, const int32_t src)
+    {
+        sse_register(0xF2, op, dst, src);
+    }
+
+    void xorpd(const int32_t dst, const int32_t src)
+    {
+        sse_register(0x66, 0x57, dst, src);
+    }
+
+    void ucomisd(const int32_t lhs, const int32_t rhs)
+    {
+        sse_register(0x66, 0x2E, lhs, rhs);
+    }
+
+    void jump(Label& label)
+    {
+        m_code.push_back(0xE9);
+        emit_target(label);
+    }
+
+    void jump_if(const Condition condition, Label& label)
+    {
+        m_code.insert(m_code.end(), {0x0F, static_cast<uint8_t>(0x80 | condition)});
+        emit_target(label);
+    }
+
+    void bind(Label& label)
+    {
+        assert(label.position < 0);
+        label.position = static_cast<int32_t>(m_code.size());
+        for (const int32_t use : label.uses) {
+            patch32(use, label.position - (use + 4));
+        }
+        label.uses.clear();
+    }
+
+    //! mov eax, `value`; ret
+    void return_with(const int32_t value)
+    {
+        m_code.push_back(0xB8);
+        emit32(value);
+        m_code.push_back(0xC3);
+    }
+
+    //! The code followed by its constants
+    std::vector<uint8_t> finish()
+    {
+        // int3 up to the aligned constants
+        while (m_code.size() % sizeof(double) != 0) {
+            m_code.push_back(0xCC);
+        }
+        const int32_t constants = static_cast<int32_t>(m_code.size());
+        for (const auto& [use, index] : m_constant_uses) {
+            patch32(use, constants + index * static_cast<int32_t>(sizeof(double)) - (use + 4));
+        }
+        for (const uint64_t bits : m_constants) {
+            for (int32_t i = 0; i < 8; ++i) {
+                m_code.push_back(static_cast<uint8_t>(bits >> (8 * i)));
+            }
+        }
+        return std::move(m_code);
+    }
+
+private:
+    void rex(const int32_t reg, const int32_t rm)
+    {
+        if ((reg | rm) & 8) {
+            m_code.push_back(static_cast<uint8_t>(0x40 | ((reg & 8) >> 1) | ((rm & 8) >> 3)));
+        }
+    }
+
+    void sse_register(const uint8_t prefix, const uint8_t opcode, const int32_t reg, const int32_t rm)
+    {
+        m_code.push_back(prefix);
+        rex(reg, rm);
+        m_code.insert(m_code.end(), {0x0F, opcode, static_cast<uint8_t>(0xC0 | ((reg & 7) << 3) | (rm & 7))});
+    }
+
+    void sse_memory(const uint8_t prefix, const uint8_t opcode, const int32_t reg, const int32_t index)
+    {
+        m_code.push_back(prefix);
+        rex(reg, 0);
+        // mod 10: [rdi + disp32]
+        m_code.insert(m_code.end(), {0x0F, opcode, static_cast<uint8_t>(0x80 | ((reg & 7) << 3) | 7)});
+        emit32(index * static_cast<int32_t>(sizeof(double)));
+    }
+
+    void emit_target(Label& label)
+    {
+        const int32_t use = static_cast<int32_t>(m_code.size());
+        if (label.position >= 0) {
+            emit32(label.position - (use + 4));
+        } else {
+            label.uses.push_back(use);
+            emit32(0);
+        }
+    }
+
+    void emit32(const int32_t value)
+    {
+        for (int32_t i = 0; i < 4; ++i) {
+            m_code.push_back(static_cast<uint8_t>(static_cast<uint32_t>(value) >> (8 * i)));
+        }
+    }
+
+    void patch32(const int32_t offset, const int32_t value)
+    {
+        for (int32_t i = 0; i < 4; ++i) {
+            m_code[offset + i] = static_cast<uint8_t>(static_cast<uint32_t>(value) >> (8 * i));
+        }
+    }
+
+    std::vector<uint8_t> m_code;
+    std::vector<uint64_t> m_constants;
+    //! rel32 offset and constant index
+    std::vector<std::pair<int32_t, int32_t>> m_constant_uses;
+};
+
+/**
+ * Compiles one loop or function. Values are only ever numbers: every
+ * expression that could be something else, and every statement that
+ * could call or print, throws Unsupported.
+ */
+class Compiler final : public ExprVisitor
+                     , public StmtVisitor
+{
+public:
+    std::unique_ptr<Region> compile(WhileStmt& while_stmt, std::string_view name)
+    {
+        static_cast<void>(visit(while_stmt));
+        m_asm.return_with(0);
+        return finish(0, name);
+    }
+
+    std::unique_ptr<Region> compile(FunStmt& fun_stmt, std::string_view name)
+    {
+        m_is_function = true;
+        const int32_t arity = static_cast<int32_t>(fun_stmt.params.size());
+        Scope& scope = m_scopes.emplace_back(static_cast<std::size_t>(fun_stmt.num_slots), -1);
+        for (int32_t i = 0; i < arity; ++i) {
+            scope[static_cast<std::size_t>(i)] = i;
+        }
+        m_frame_size = arity;
+        for (Stmt* const stmt : fun_stmt.body) {
+            static_cast<void>(stmt->accept(*this));
+        }
+        m_asm.return_with(0);
+        return finish(arity, name);
+    }
+
+    void visit(BinaryExpr& binary_expr) override
+    {
+        Assembler::Arithmetic op;
+        switch (binary_expr.op->type()) {
+        using enum TokenType;
+        case PLUS: op = Assembler::ADDSD; break;
+        case MINUS: op = Assembler::SUBSD; break;
+        case STAR: op = Assembler::MULSD; break;
+        case SLASH: op = Assembler::DIVSD; break;
+        default:
+            // a boolean
+            throw Unsupported{};
+        }
+        const int32_t reg = m_register;
+        number(*binary_expr.left, reg);
+        number(*binary_expr.right, reg + 1);
+        m_asm.arithmetic(op, reg, reg + 1);
+    }
+
+    void visit(GroupingExpr& grouping_expr) override
+    {
+        grouping_expr.expr->accept(*this);
+    }
+
+    void visit(LiteralExpr& literal_expr) override
+    {
+        const double* const value = std::get_if<double>(literal_expr.constant);
+        if (!value) {
+            throw Unsupported{};
+        }
+        m_asm.load_constant(m_register, *value);
+    }
+
+    void visit(UnaryExpr& unary_expr) override
+    {
+        if (unary_expr.op->type() != TokenType::MINUS) {
+            throw Unsupported{};
+        }
+        const int32_t reg = m_register;
+        number(*unary_expr.right, reg);
+        check_register(reg + 1);
+        // flips the sign bit, like the Interpreter's -x does for zero
+        m_asm.load_constant(reg + 1, -0.0);
+        m_asm.xorpd(reg, reg + 1);
+    }
+
+    void visit(VarExpr& var_expr) override
+    {
+        m_asm.load(m_register, variable(var_expr.resolution, var_expr.symbol, false));
+    }
+
+    void visit(AssignExpr& assign_expr) override
+    {
+        const int32_t reg = m_register;
+        number(*assign_expr.value, reg);
+        m_asm.store(variable(assign_expr.resolution, assign_expr.symbol, true), reg);
+    }
+
+    void visit(LogicalExpr& /*logical_expr*/) override
+    {
+        // a boolean
+        throw Unsupported{};
+    }
+
+    void visit(CallExpr& /*call_expr*/) override
+    {
+        throw Unsupported{};
+    }
+
+    void unkown_expr(Expr& /*expr*/) override
+    {
+        throw Unsupported{};
+    }
+
+    bool visit(ExprStmt& expr_stmt) override
+    {
+        number(*expr_stmt.expr, 0);
+        return false;
+    }
+
+    bool visit(PrintStmt& /*print_stmt*/) override
+    {
+        throw Unsupported{};
+    }
+
+    bool visit(VarStmt& var_stmt) override
+    {
+        if (m_scopes.empty() || var_stmt.slot < 0 || !var_stmt.initializer) {
+            throw Unsupported{};
+        }
+        number(*var_stmt.initializer, 0);
+        int32_t& index = m_scopes.back()[static_cast<std::size_t>(var_stmt.slot)];
+        if (index < 0) {
+            index = allocate();
+        }
+        m_asm.store(index, 0);
+        return false;
+    }
+
+    bool visit(BlockStmt& block_stmt) override
+    {
+        m_scopes.emplace_back(static_cast<std::size_t>(block_stmt.num_slots), -1);
+        for (Stmt* const stmt : block_stmt.statements) {
+            static_cast<void>(stmt->accept(*this));
+        }
+        m_scopes.pop_back();
+        return false;
+    }
+
+    bool visit(IfStmt& if_stmt) override
+    {
+        Assembler::Label otherwise;
+        condition(*if_stmt.condition, false, otherwise);
+        static_cast<void>(if_stmt.then_branch->accept(*this));
+        if (!if_stmt.else_branch) {
+            m_asm.bind(otherwise);
+            return false;
+        }
+        Assembler::Label end;
+        m_asm.jump(end);
+        m_asm.bind(otherwise);
+        static_cast<void>(if_stmt.else_branch->accept(*this));
+        m_asm.bind(end);
+        return false;
+    }
+
+    bool visit(WhileStmt& while_stmt) override
+    {
+        Assembler::Label loop;
+        Assembler::Label end;
+        m_asm.bind(loop);
+        condition(*while_stmt.condition, false, end);
+        static_cast<void>(while_stmt.body->accept(*this));
+        m_asm.jump(loop);
+        m_asm.bind(end);
+        return false;
+    }
+
+    bool visit(FunStmt& /*fun_stmt*/) override
+    {
+        throw Unsupported{};
+    }
+
+    bool visit(ReturnStmt& return_stmt) override
+    {
+        if (!m_is_function) {
+            throw Unsupported{};
+        }
+        if (!return_stmt.expr) {
+            m_asm.return_with(0);
+            return false;
+        }
+        number(*return_stmt.expr, 0);
+        m_asm.store(RETURN_VALUE, 0);
+        m_asm.return_with(1);
+        return false;
+    }
+
+    void unkown_stmt(Stmt& /*stmt*/) override
+    {
+        throw Unsupported{};
+    }
+
+private:
+    //! Frame index of each slot of a scope inside the compiled code, -1 before its declaration
+    using Scope = std::vector<int32_t>;
+
+    void check_register(const int32_t reg) const
+    {
+        if (reg >= NUM_REGISTERS) {
+            throw Unsupported{};
+        }
+    }
+
+    //! Evaluates `expr` into xmm`reg`
+    void number(Expr& expr, const int32_t reg)
+    {
+        check_register(reg);
+        m_register = reg;
+        expr.accept(*this);
+    }
+
+    //! Jumps to `target` if `expr` is truthy, or falsey for `!jump_if`
+    void condition(Expr& expr, const bool jump_if, Assembler::Label& target)
+    {
+        if (expr.is_type<GroupingExpr>()) {
+            condition(*static_cast<GroupingExpr&>(expr).expr, jump_if, target);
+            return;
+        }
+        if (expr.is_type<LiteralExpr>()) {
+            if (is_truthy(*static_cast<LiteralExpr&>(expr).constant) == jump_if) {
+                m_asm.jump(target);
+            }
+            return;
+        }
+        if (expr.is_type<UnaryExpr>()) {
+            const UnaryExpr& unary_expr = static_cast<UnaryExpr&>(expr);
+            if (unary_expr.op->type() == TokenType::BANG) {
+                condition(*unary_expr.right, !jump_if, target);
+                return;
+            }
+        }
+        if (expr.is_type<LogicalExpr>()) {
+            const LogicalExpr& logical_expr = static_cast<LogicalExpr&>(expr);
+            // jumps on the left operand alone if that decides the result
+            const bool decides = logical_expr.token->type() == TokenType::OR;
+            if (decides == jump_if) {
+                condition(*logical_expr.left, jump_if, target);
+                condition(*logical_expr.right, jump_if, target);
+            } else {
+                Assembler::Label skip;
+                condition(*logical_expr.left, decides, skip);
+                condition(*logical_expr.right, jump_if, target);
+                m_asm.bind(skip);
+            }
+            return;
+        }
+        if (expr.is_type<BinaryExpr>() && comparison(static_cast<BinaryExpr&>(expr), jump_if, target)) {
+            return;
+        }
+        // a number, which is always true
+        number(expr, 0);
+        if (jump_if) {
+            m_asm.jump(target);
+        }
+    }
+
+    //! False if `binary_expr` is arithmetic rather than a comparison
+    bool comparison(BinaryExpr& binary_expr, const bool jump_if, Assembler::Label& target)
+    {
+        const TokenType op = binary_expr.op->type();
+        switch (op) {
+        using enum TokenType;
+        case GREATER:
+        case GREATER_EQUAL:
+        case LESS:
+        case LESS_EQUAL:
+        case EQUAL_EQUAL:
+        case BANG_EQUAL:
+            break;
+        default:
+            return false;
+        }
+        number(*binary_expr.left, 0);
+        number(*binary_expr.right, 1);
+
+        // ucomisd sets ZF, PF and CF for unordered operands, so that
+        // "above" and "above or equal" are false for NaN.
+        switch (op) {
+        using enum TokenType;
+        case GREATER:
+            m_asm.ucomisd(0, 1);
+            m_asm.jump_if(jump_if ? Assembler::ABOVE : Assembler::BELOW_EQUAL, target);
+            break;
+        case GREATER_EQUAL:
+            m_asm.ucomisd(0, 1);
+            m_asm.jump_if(jump_if ? Assembler::ABOVE_EQUAL : Assembler::BELOW, target);
+            break;
+        case LESS:
+            m_asm.ucomisd(1, 0);
+            m_asm.jump_if(jump_if ? Assembler::ABOVE : Assembler::BELOW_EQUAL, target);
+            break;
+        case LESS_EQUAL:
+            m_asm.ucomisd(1, 0);
+            m_asm.jump_if(jump_if ? Assembler::ABOVE_EQUAL : Assembler::BELOW, target);
+            break;
+        default: {
+            // equal is ZF without PF
+            m_asm.ucomisd(0, 1);
+            if (jump_if == (op == EQUAL_EQUAL)) {
+                Assembler::Label skip;
+                m_asm.jump_if(Assembler::PARITY, skip);
+                m_asm.jump_if(Assembler::EQUAL, target);
+                m_asm.bind(skip);
+            } else {
+                m_asm.jump_if(Assembler::PARITY, target);
+                m_asm.jump_if(Assembler::NOT_EQUAL, target);
+            }
+        }
+        }
+        return true;
+    }
+
+    //! The frame index of a variable
+    int32_t variable(const Resolution resolution, const SymbolId symbol, const bool is_assigned)
+    {
+        const int32_t num_scopes = static_cast<int32_t>(m_scopes.size());
+        if (resolution.depth != GLOBAL_DEPTH && resolution.depth < num_scopes) {
+            const int32_t index = m_scopes[static_cast<std::size_t>(num_scopes - 1 - resolution.depth)][static_cast<std::size_t>(resolution.slot)];
+            if (index < 0) {
+                throw Unsupported{};
+            }
+            return index;
+        }
+        const int32_t depth = resolution.depth == GLOBAL_DEPTH ? GLOBAL_DEPTH : resolution.depth - num_scopes;
+        for (Binding& binding : m_bindings) {
+            if (binding.depth == depth && (depth == GLOBAL_DEPTH ? binding.symbol == symbol : binding.slot == resolution.slot)) {
+                binding.is_assigned |= is_assigned;
+                return binding.index;
+            }
+        }
+        const int32_t index = allocate();
+        m_bindings.push_back({depth, resolution.slot, symbol, index, is_assigned});
+        return index;
+    }
+
+    int32_t allocate()
+    {
+        if (m_frame_size == RETURN_VALUE) {
+            throw Unsupported{};
+        }
+        return m_frame_size++;
+    }
+
+    std::unique_ptr<Region> finish(const int32_t arity, const std::string_view name)
+    {
+        const std::vector<uint8_t> code = m_asm.finish();
+        const std::size_t size = code.size();
+        void* const memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (memory == MAP_FAILED) {
+            return nullptr;
+        }
+        std::memcpy(memory, code.data(), size);
+        // never writable and executable at the same time
+        if (mprotect(memory, size, PROT_READ | PROT_EXEC) != 0) {
+            munmap(memory, size);
+            return nullptr;
+        }
+        if (perf_map) {
+            fmt::print(perf_map, "{:x} {:x} {}\n", reinterpret_cast<uintptr_t>(memory), size, name);
+            std::fflush(perf_map);
+        }
+        return std::make_unique<Region>(std::move(m_bindings), arity, memory, size);
+    }
+
+    Assembler m_asm;
+    std::vector<Scope> m_scopes;
+    std::vector<Binding> m_bindings;
+    int32_t m_frame_size{0};
+    //! Where the expression being compiled goes
+    int32_t m_register{0};
+    bool m_is_function{false};
+};
+
+} // anonymous namespace
+
+
+Region::Region(std::vector<Binding>&& bindings, const int32_t arity, void* const code, const std::size_t code_size)
+  : m_bindings{std::move(bindings)}
+  , m_arity{arity}
+  , m_code{code}
+  , m_code_size{code_size}
+{}
+
+Region::~Region()
+{
+    munmap(m_code, m_code_size);
+}
+
+bool Region::run(const Environment& env, Environment& globals, const std::span<const Value> args, Value& result) const
+{
+    assert(static_cast<int32_t>(args.size()) == m_arity);
+    std::array<double, MAX_FRAME_SIZE> frame;
+    for (std::size_t i = 0; i < args.size(); ++i) {
+        const double* const number = std::get_if<double>(&args[i]);
+        if (!number) {
+            return false;
+        }
+        frame[i] = *number;
+    }
+    for (const Binding& binding : m_bindings) {
+        const Value* const value = binding.depth == GLOBAL_DEPTH
+            ? globals.get(binding.symbol)
+            : &env.slot(binding.depth, binding.slot);
+        const double* const number = value ? std::get_if<double>(value) : nullptr;
+        if (!number) {
+            return false;
+        }
+        frame[static_cast<std::size_t>(binding.index)] = *number;
+    }
+
+    const bool has_return_value = reinterpret_cast<Entry>(m_code)(frame.data()) != 0;
+
+    for (const Binding& binding : m_bindings) {
+        if (!binding.is_assigned) {
+            continue;
+        }
+        const double value = frame[static_cast<std::size_t>(binding.index)];
+        if (binding.depth == GLOBAL_DEPTH) {
+            globals.assign(binding.symbol, Value{value});
+        } else {
+            env.slot(binding.depth, binding.slot) = value;
+        }
+    }
+    result = has_return_value ? Value{frame[RETURN_VALUE]} : Value{nil};
+    return true;
+}
+
+std::unique_ptr<Region> compile(WhileStmt& while_stmt, const ScannerResult& scanner_result)
+{
+#if defined(__x86_64__)
+    const Position position = scanner_result.offsets.get_position(while_stmt.condition->get_main_token()->offset());
+    try {
+        return Compiler{}.compile(while_stmt, fmt::format("lox::loop@{}:{}", position.line, position.column));
+    } catch (const Unsupported&) {
+        return nullptr;
+    }
+#else
+    static_cast<void>(while_stmt);
+    static_cast<void>(scanner_result);
+    return nullptr;
+#endif
+}
+
+std::unique_ptr<Region> compile(FunStmt& fun_stmt, const ScannerResult& scanner_result)
+{
+#if defined(__x86_64__)
+    try {
+        return Compiler{}.compile(fun_stmt, fmt::format("lox::{}", fun_stmt.name->lexeme(scanner_result.source)));
+    } catch (const Unsupported&) {
+        return nullptr;
+    }
+#else
+    static_cast<void>(fun_stmt);
+    static_cast<void>(scanner_result);
+    return nullptr;
+#endif
+}
+
+void enable_perf_map()
+{
+    if (!perf_map) {
+        perf_map = std::fopen(fmt::format("/tmp/perf-{}.map", getpid()).c_str(), "w");
+    }
+}
+
+} // namespace jit
+
+
+#include <doctest/doctest.h>
+
+#include "bump_alloc.hpp"
+#include "constant_pool.hpp"
+#include "interpreter.hpp"
+#include "parser.hpp"
+#include "resolver.hpp"
+
+TEST_CASE("JIT")
+{
+    const ScannerResult scanned = scan_tokens(
+        "var jit_sum = 0;\n"
+        "{\n"
+        "    var i = 0;\n"
+        "    while (i < 1000) { var half = i / 2; jit_sum = jit_sum + half; i = i + 1; }\n"
+        "}\n"
+        "fun square(x) { if (x < 0 or !(x == x)) return -x * -x; return x * x; }\n"
+        "var jit_squares = 0;\n"
+        "for (var k = 0; k < 300; k = k + 1) jit_squares = jit_squares + square(k);\n"
+        "fun add(a, b) { return a + b; }\n"
+        "for (var k = 0; k < 300; k = k + 1) add(k, k);\n"
+        "var jit_string = add(\"a\", \"b\");\n"
+        "var jit_count = 0;\n"
+        "while (jit_count < 500) { jit_count = jit_count + 1; if (jit_count == 250) clock(); }\n"
+        "fun sign(x) { if (x > 0) return 1; if (x < 0) return -1; }\n");
+    REQUIRE(scanned.num_errors == 0);
+    BumpAlloc alloc;
+    ConstantPool constants;
+    const std::vector<Stmt*> statements = parse(alloc, constants, scanned);
+    REQUIRE(statements.empty() == false);
+    resolve(statements);
+
+    Globals globals;
+    {
+        Interpreter interpreter{scanned, globals};
+        for (Stmt* const stmt : statements) {
+            CHECK(interpreter.execute(*stmt));
+        }
+    }
+
+    const Environment& env = *globals.global_environment();
+    const auto global = [&] (std::string_view name) {
+        const Value* const value = env.get(intern_symbol(name));
+        REQUIRE(value != nullptr);
+        return *value;
+    };
+    CHECK(std::get<double>(global("jit_sum")) == 249750.);
+    CHECK(std::get<double>(global("jit_squares")) == 8955050.);
+    CHECK(std::get<std::string>(global("jit_string")) == "ab");
+    CHECK(std::get<double>(global("jit_count")) == 500.);
+
+    REQUIRE(statements[2]->is_type<FunStmt>());
+    const std::unique_ptr<jit::Region> square = jit::compile(static_cast<FunStmt&>(*statements[2]), scanned);
+    REQUIRE(square != nullptr);
+    Value result;
+    const std::array<Value, 1> args{Value{-3.}};
+    CHECK(square->run(env, *globals.global_environment(), args, result));
+    CHECK(std::get<double>(result) == 9.);
+    const std::array<Value, 1> not_a_number{Value{std::string{"x"}}};
+    CHECK(square->run(env, *globals.global_environment(), not_a_number, result) == false);
+
+    REQUIRE(statements[10]->is_type<FunStmt>());
+    const std::unique_ptr<jit::Region> sign = jit::compile(static_cast<FunStmt&>(*statements[10]), scanned);
+    REQUIRE(sign != nullptr);
+    const std::array<Value, 1> zero{Value{0.}};
+    CHECK(sign->run(env, *globals.global_environment(), zero, result));
+    CHECK(std::holds_alternative<Nil>(result));
+
+    REQUIRE(statements[9]->is_type<WhileStmt>());
+    CHECK(jit::compile(static_cast<WhileStmt&>(*statements[9]), scanned) == nullptr);
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <vector>
+
+#include "symbols.hpp"
+#include "value.hpp"
+
+class Environment;
+struct FunStmt;
+struct WhileStmt;
+struct ScannerResult;
+
+/*
+ * A baseline JIT for the Interpreter. Loops and functions that only
+ * compute with numbers, no calls, prints or closures, become x86-64 code
+ * once hot. Their variables are copied into a frame of doubles on entry,
+ * which is the type guard: if one of them holds something else, the
+ * Interpreter runs the code instead. They are written back on exit.
+ */
+namespace jit
+{
+
+//! Loop iterations or calls before a HotSpot is compiled
+inline constexpr int32_t HOT_THRESHOLD = 100;
+
+//! A variable the compiled code uses but doesn't declare
+struct Binding
+{
+    //! Of the scope, counted from the environment run() gets; GLOBAL_DEPTH for a global
+    int32_t depth;
+    int32_t slot;
+    SymbolId symbol;
+    //! In the frame of doubles the code works on
+    int32_t index;
+    bool is_assigned;
+};
+
+class Region
+{
+public:
+    using Entry = int64_t (*)(double* frame);
+
+    Region(std::vector<Binding>&& bindings, int32_t arity, void* code, std::size_t code_size);
+    ~Region();
+
+    Region(const Region&) = delete;
+    Region& operator=(const Region&) = delete;
+
+    /**
+     * Runs the code on the variables of `env` and the globals, with `args`
+     * for a function. Returns false without running anything if a variable
+     * or argument isn't a number. Otherwise `result` is what the function
+     * returned, or nil.
+     */
+    [[nodiscard]]
+    bool run(const Environment& env, Environment& globals, std::span<const Value> args, Value& result) const;
+
+private:
+    std::vector<Binding> m_bindings;
+    int32_t m_arity;
+    void* m_code;
+    std::size_t m_code_size;
+};
+
+//! Counts how often a loop iterates or a function is called
+class HotSpot
+{
+public:
+    //! Counts one more, and compiles with `compile` once hot; the Region if there is one
+    template <typename Compile>
+    const Region* tick(Compile&& compile)
+    {
+        if (m_count < HOT_THRESHOLD && ++m_count == HOT_THRESHOLD) {
+            m_region = compile();
+        }
+        return m_region.get();
+    }
+
+private:
+    int32_t m_count{0};
+    //! Stays null if the code isn't in the subset the JIT compiles
+    std::unique_ptr<Region> m_region;
+};
+
+//! Null if the loop isn't in the compiled subset. run() continues it from the condition
+std::unique_ptr<Region> compile(WhileStmt& while_stmt, const ScannerResult& scanner_result);
+
+//! Null if the function isn't in the compiled subset. run() gets the closure's Environment
+std::unique_ptr<Region> compile(FunStmt& fun_stmt, const ScannerResult& scanner_result);
+
+//! Lists compiled code in /tmp/perf-<pid>.map, for perf to name it
+void enable_perf_map();
+
+} // namespace jit
@@ -5,33 +5,76 @@
 #include <string_view>
 
 #include "log.hpp"
+#include "mapped_file.hpp"
 #include "scanner.hpp"
 #include "parser.hpp"
+#include "resolver.hpp"
+#include "fusion.hpp"
+#include "type_inference.hpp"
 #include "bump_alloc.hpp"
+#include "constant_pool.hpp"
 
 #include "print_visitor.hpp"
 #include "interpreter.hpp"
+#include "jit.hpp"
+#include "bytecode.hpp"
+#include "closure_engine.hpp"
+#include "vm.hpp"
 #include "environment.hpp"
+#include "garbage_collected_heap.hpp"
+
+enum class Engine
+{
+    TREE_WALKER,
+    VM,
+    CLOSURE,
+};
 
 static
-int run(std::string_view source, Globals& globals)
+int run(const ScannerResult& scan_result, Globals& globals, const Engine engine)
 {
-    const auto scan_result = scan_tokens(source);
     if (scan_result.num_errors != 0) {
         std::cerr << "Lexing failed.\n";
         return 1;
     }
     BumpAlloc alloc;
-    std::vector<Stmt*> statements = parse(alloc, scan_result);
+    ConstantPool constants;
+    std::vector<Stmt*> statements = parse(alloc, constants, scan_result);
     if (statements.empty()) {
         return 0; // TODO: Error?
     }
+    resolve(statements);
+
+    if (engine == Engine::VM) {
+        const std::optional<bytecode::Program> program = bytecode::compile(scan_result, statements);
+        if (!program) {
+            return 1;
+        }
+        Vm vm{scan_result, globals};
+        for (const bytecode::Function* statement : program->statements) {
+            if (!vm.execute(*statement)) {
+                std::cerr << "Interpreter error.\n";
+            }
+        }
+        return 0;
+    }
+
+    if (engine == Engine::CLOSURE) {
+        ClosureEngine closure_engine{scan_result, globals};
+        for (Stmt* stmt : statements) {
+            if (!closure_engine.execute(closure_engine.compile(*stmt))) {
+                std::cerr << "Interpreter error.\n";
+            }
+        }
+        return 0;
+    }
 
+    infer_types(statements);
+    fuse(statements);
     Interpreter interpreter{scan_result, globals};
 
     for (Stmt* stmt : statements) {
-        const std::optional<Value> result = interpreter.execute(*stmt);
-        if (!result) {
+        if (!interpreter.execute(*stmt)) {
             std::cerr << "Interpreter error.\n";
         }
     }
@@ -41,40 +84,45 @@ int run(std::string_view source, Globals& globals)
 
 
 static
-int run_file(const char* path)
+int run_file(const char* path, const Engine engine)
 {
-    std::string content;
-    {
-        std::ifstream input_file{path, std::ios::binary};
-        if (!input_file) {
-            LOG_ERROR("Failed to open file \"{}\".", path);
-            return 1;
-        }
+    if (std::shared_ptr<const MappedFile> file = MappedFile::open(path)) {
+        ScannerResult scan_result = scan_tokens(file->contents());
+        scan_result.source_storage = std::move(file);
+        Globals globals{};
+        return run(scan_result, globals, engine);
+    }
 
-        input_file.seekg(0, std::ios::end);
-        const ssize_t len = input_file.tellg();
-        if (len < 0) {
-            LOG_ERROR("Failed to get size of \"{}\"", path);
-            return 1;
-        }
-        input_file.seekg(0, std::ios::beg);
+    std::ifstream input_file{path, std::ios::binary};
+    if (!input_file) {
+        LOG_ERROR("Failed to open file \"{}\".", path);
+        return 1;
+    }
 
-        content.resize(static_cast<size_t>(len));
-        input_file.read(&content.front(), len);
+    // Pipes and other files that can't be mapped, scan while reading.
+    StreamingScanner scanner;
+    std::string chunk(64 * 1024, '\0');
+    while (input_file) {
+        input_file.read(chunk.data(), static_cast<std::streamsize>(chunk.size()));
+        scanner.feed(std::string_view{chunk}.substr(0, static_cast<size_t>(input_file.gcount())));
+    }
+    if (!input_file.eof()) {
+        LOG_ERROR("Failed to read \"{}\".", path);
+        return 1;
     }
 
     Globals globals{};
-    return run(content, globals);
+    return run(std::move(scanner).finish(), globals, engine);
 }
 
 
 static
-int run_prompt()
+int run_prompt(const Engine engine)
 {
     Globals globals{};
     std::cout << "> ";
     for (std::string line; std::getline(std::cin, line); ) {
-        const int result = run(line, globals);
+        const int result = run(scan_tokens(line), globals, engine);
         if (result) {
             std::cerr << "Error [" << result << ']';
         }
@@ -84,14 +132,75 @@ int run_prompt()
 }
 
 
+class GcTraceSession
+{
+public:
+    explicit
+    GcTraceSession(const char* path)
+      : m_file{path ? std::fopen(path, "wb") : nullptr}
+    {
+        if (m_file) {
+#ifndef JLOX_GC_TRACE
+            LOG_ERROR("Built without WITH_GC_TRACE, \"{}\" will not contain references.", path);
+#endif
+            GarbageCollectedHeap::get_heap().start_trace(m_file);
+        }
+    }
+
+    ~GcTraceSession()
+    {
+        if (m_file) {
+            GarbageCollectedHeap::get_heap().stop_trace();
+            std::fclose(m_file);
+        }
+    }
+
+    bool failed(const char* path) const noexcept
+    {
+        return path && !m_file;
+    }
+
+    GcTraceSession(const GcTraceSession&) = delete;
+    GcTraceSession& operator=(const GcTraceSession&) = delete;
+private:
+    std::FILE* m_file;
+};
+
+
 int main(int argc, char** argv)
 {
-    if (argc > 2) {
-        LOG_ERROR("Usage: jlox [script]");
-        return 0;
-    } else if (argc == 2) {
-        return run_file(argv[1]);
+    const char* script = nullptr;
+    const char* gc_trace = nullptr;
+    Engine engine = Engine::TREE_WALKER;
+    for (int i = 1; i < argc; ++i) {
+        const std::string_view arg{argv[i]};
+        if (arg.starts_with("--gc-trace=")) {
+            gc_trace = argv[i] + 11;
+        } else if (arg == "--perf-map") {
+            jit::enable_perf_map();
+        } else if (arg == "--engine=tree") {
+            engine = Engine::TREE_WALKER;
+        } else if (arg == "--engine=vm") {
+            engine = Engine::VM;
+        } else if (arg == "--engine=closure") {
+            engine = Engine::CLOSURE;
+        } else if (!script && !arg.starts_with("--")) {
+            script = argv[i];
+        } else {
+            LOG_ERROR("Usage: jlox [--engine=tree|closure|vm] [--gc-trace=file] [--perf-map] [script]");
+            return 0;
+        }
+    }
+
+    const GcTraceSession trace_session{gc_trace};
+    if (trace_session.failed(gc_trace)) {
+        LOG_ERROR("Failed to open \"{}\".", gc_trace);
+        return 1;
+    }
+
+    if (script) {
+        return run_file(script, engine);
     } else {
-        return run_prompt();
+        return run_prompt(engine);
     }
 }
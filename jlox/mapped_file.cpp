@@ -0,0 +1,79 @@
+#include "mapped_file.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <doctest/doctest.h>
+
+std::shared_ptr<const MappedFile> MappedFile::open(const char* path)
+{
+    const int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return nullptr;
+    }
+
+    struct stat info{};
+    if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode)) {
+        close(fd);
+        return nullptr;
+    }
+
+    const std::size_t size = static_cast<std::size_t>(info.st_size);
+    void* data = nullptr;
+    // mmap doesn't do empty mappings
+    if (size > 0) {
+        data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    // the mapping keeps its own reference to the file
+    close(fd);
+    if (data == MAP_FAILED) {
+        return nullptr;
+    }
+
+    if (data) {
+        // the scanner reads front to back exactly once
+        madvise(data, size, MADV_SEQUENTIAL);
+    }
+    return std::shared_ptr<const MappedFile>{new MappedFile{data, size}};
+}
+
+MappedFile::~MappedFile()
+{
+    if (m_data) {
+        munmap(m_data, m_size);
+    }
+}
+
+///////////////////////////////////////////////////////////////
+#include <cstdio>
+#include <string>
+
+TEST_CASE("Mapped file")
+{
+    char path[] = "/tmp/jlox_mapped_file_XXXXXX";
+    const int fd = mkstemp(path);
+    REQUIRE(fd >= 0);
+
+    const std::string content = "print \"mapped\";\n";
+    CHECK(write(fd, content.data(), content.size()) == static_cast<ssize_t>(content.size()));
+    close(fd);
+
+    {
+        const std::shared_ptr<const MappedFile> file = MappedFile::open(path);
+        REQUIRE(file);
+        CHECK(file->contents() == content);
+    }
+
+    CHECK(truncate(path, 0) == 0);
+    {
+        const std::shared_ptr<const MappedFile> file = MappedFile::open(path);
+        REQUIRE(file);
+        CHECK(file->contents().empty());
+    }
+    std::remove(path);
+
+    CHECK(MappedFile::open(path) == nullptr);
+    CHECK(MappedFile::open("/tmp") == nullptr);
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string_view>
+
+/**
+ * A read-only memory mapping of a whole file. Scripts are scanned straight
+ * out of the page cache instead of being copied into a string first.
+ */
+class MappedFile
+{
+public:
+    /**
+     * Map the regular file at `path`. Returns nullptr if it can't be opened
+     * or isn't something mmap handles, e.g. a pipe or a terminal; read
+     * those instead.
+     */
+    static std::shared_ptr<const MappedFile> open(const char* path);
+
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    std::string_view contents() const noexcept
+    {
+        return {static_cast<const char*>(m_data), m_size};
+    }
+
+private:
+    MappedFile(void* data, std::size_t size) noexcept
+      : m_data{data}
+      , m_size{size}
+    {}
+
+    void* m_data;
+    std::size_t m_size;
+};
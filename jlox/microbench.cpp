@@ -0,0 +1,766 @@
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "log.hpp"
+#include "bump_alloc.hpp"
+#include "bytecode.hpp"
+#include "closure_engine.hpp"
+#include "constant_pool.hpp"
+#include "garbage_collected_heap.hpp"
+#include "environment.hpp"
+#include "interpreter.hpp"
+#include "parser.hpp"
+#include "resolver.hpp"
+#include "fusion.hpp"
+#include "type_inference.hpp"
+#include "scanner.hpp"
+#include "scan_kernels.hpp"
+#include "vm.hpp"
+
+namespace
+{
+
+using Clock = std::chrono::steady_clock;
+using Nanoseconds = std::chrono::nanoseconds;
+
+constexpr int32_t REPETITIONS = 5;
+constexpr int64_t BATCH = 1024;
+
+template <typename T>
+inline
+void do_not_optimize(const T& value) noexcept
+{
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+/**
+ * A benchmark runs `iterations` operations and returns the time spent in
+ * them, so that setup and teardown can be excluded.
+ */
+struct Benchmark
+{
+    std::string name;
+    std::function<Nanoseconds(int64_t iterations)> run;
+    //! Input size of one operation, reported as throughput if set
+    std::size_t bytes_per_op{0};
+};
+
+struct Result
+{
+    std::string name;
+    int64_t iterations;
+    double ns_per_op;
+    double min_ns_per_op;
+    std::size_t bytes_per_op;
+
+    double mb_per_s() const noexcept
+    {
+        return static_cast<double>(bytes_per_op) * 1e3 / ns_per_op;
+    }
+};
+
+Result measure(const Benchmark& benchmark, const Nanoseconds min_time)
+{
+    // Calibrate on the measured time, but also bound the wall time, as
+    // some benchmarks exclude expensive setup from the measurement.
+    int64_t iterations = 1;
+    while (true) {
+        const auto start = Clock::now();
+        const Nanoseconds t = benchmark.run(iterations);
+        const Nanoseconds wall = Clock::now() - start;
+        if (t >= min_time / 10 || wall >= min_time / 10 || iterations >= (int64_t{1} << 40)) {
+            const double scale = static_cast<double>(min_time.count()) /
+                                 static_cast<double>(std::max<int64_t>(std::max(t, wall / 4).count(), 1));
+            iterations = std::max<int64_t>(1, static_cast<int64_t>(static_cast<double>(iterations) * scale));
+            break;
+        }
+        iterations *= 10;
+    }
+
+    std::array<double, REPETITIONS> ns_per_op{};
+    for (double& ns : ns_per_op) {
+        ns = static_cast<double>(benchmark.run(iterations).count()) / static_cast<double>(iterations);
+    }
+    std::sort(ns_per_op.begin(), ns_per_op.end());
+    return Result{benchmark.name, iterations, ns_per_op[REPETITIONS / 2], ns_per_op.front(), benchmark.bytes_per_op};
+}
+
+//
+
+template <std::size_t Size>
+struct Blob
+{
+    std::array<char, Size> data;
+};
+
+template <std::size_t Size>
+Nanoseconds bench_bump_alloc(const int64_t iterations)
+{
+    BumpAlloc alloc;
+    const auto start = Clock::now();
+    for (int64_t i = 0; i < iterations; ++i) {
+        do_not_optimize(alloc.allocate<Blob<Size>>());
+        if ((i % BATCH) == BATCH - 1) {
+            alloc.reset();
+        }
+    }
+    return Clock::now() - start;
+}
+
+template <std::size_t Size>
+Nanoseconds bench_malloc(const int64_t iterations)
+{
+    std::array<void*, BATCH> ptrs{};
+    const auto start = Clock::now();
+    for (int64_t i = 0; i < iterations; ++i) {
+        ptrs[i % BATCH] = std::malloc(Size);
+        do_not_optimize(ptrs[i % BATCH]);
+        if ((i % BATCH) == BATCH - 1) {
+            for (void* ptr : ptrs) {
+                std::free(ptr);
+            }
+        }
+    }
+    for (int64_t i = 0; i < (iterations % BATCH); ++i) {
+        std::free(ptrs[i]);
+    }
+    return Clock::now() - start;
+}
+
+template <std::size_t Size>
+Nanoseconds bench_heap_allocate(int64_t iterations)
+{
+    std::vector<HeapPtr<Blob<Size>>> live;
+    live.reserve(BATCH);
+    Nanoseconds elapsed{0};
+    while (iterations > 0) {
+        const int64_t n = std::min(iterations, BATCH);
+        const auto start = Clock::now();
+        for (int64_t i = 0; i < n; ++i) {
+            live.push_back(Heap::allocate<Blob<Size>>());
+        }
+        elapsed += Clock::now() - start;
+        live.clear();
+        Heap::run_gc();
+        iterations -= n;
+    }
+    return elapsed;
+}
+
+Nanoseconds bench_heap_ptr_copy(int64_t iterations)
+{
+    const HeapPtr<int> src = Heap::allocate<int>(1);
+    std::vector<HeapPtr<int>> dst(BATCH);
+    Nanoseconds elapsed{0};
+    while (iterations > 0) {
+        const int64_t n = std::min(iterations, BATCH);
+        const auto start = Clock::now();
+        for (int64_t i = 0; i < n; ++i) {
+            dst[i] = src;
+        }
+        elapsed += Clock::now() - start;
+        for (HeapPtr<int>& ptr : dst) {
+            ptr.reset();
+        }
+        iterations -= n;
+    }
+    return elapsed;
+}
+
+Nanoseconds bench_heap_ptr_move(const int64_t iterations)
+{
+    HeapPtr<int> a = Heap::allocate<int>(1);
+    HeapPtr<int> b;
+    const auto start = Clock::now();
+    for (int64_t i = 0; i < iterations; ++i) {
+        if (i & 1) {
+            a = std::move(b);
+        } else {
+            b = std::move(a);
+        }
+        do_not_optimize(a);
+    }
+    return Clock::now() - start;
+}
+
+Nanoseconds bench_heap_ptr_destroy(int64_t iterations)
+{
+    const HeapPtr<int> src = Heap::allocate<int>(1);
+    std::vector<HeapPtr<int>> dst(BATCH);
+    Nanoseconds elapsed{0};
+    while (iterations > 0) {
+        const int64_t n = std::min(iterations, BATCH);
+        for (int64_t i = 0; i < n; ++i) {
+            dst[i] = src;
+        }
+        const auto start = Clock::now();
+        for (int64_t i = 0; i < n; ++i) {
+            dst[i].reset();
+        }
+        elapsed += Clock::now() - start;
+        iterations -= n;
+    }
+    return elapsed;
+}
+
+struct GraphNode
+{
+    HeapPtr<GraphNode> left;
+    HeapPtr<GraphNode> right;
+};
+
+enum class GraphShape
+{
+    CHAIN,  // n - 1 internal edges, one root
+    TREE,   // complete binary tree, one root
+    ROOTS,  // no internal edges, every node is a root
+};
+
+std::string_view shape_name(const GraphShape shape) noexcept
+{
+    switch (shape) {
+    case GraphShape::CHAIN:
+        return "chain";
+    case GraphShape::TREE:
+        return "tree";
+    case GraphShape::ROOTS:
+        return "roots";
+    }
+    return "<unkown>";
+}
+
+std::vector<HeapPtr<GraphNode>> build_graph(const GraphShape shape, const int32_t size)
+{
+    std::vector<HeapPtr<GraphNode>> nodes;
+    nodes.reserve(size);
+    for (int32_t i = 0; i < size; ++i) {
+        nodes.push_back(Heap::allocate<GraphNode>());
+    }
+    switch (shape) {
+    case GraphShape::CHAIN:
+        for (int32_t i = 0; i + 1 < size; ++i) {
+            nodes[i]->left = nodes[i + 1];
+        }
+        nodes.resize(1);
+        break;
+
+    case GraphShape::TREE:
+        for (int32_t i = 0; i < size; ++i) {
+            if (2 * i + 1 < size) {
+                nodes[i]->left = nodes[2 * i + 1];
+            }
+            if (2 * i + 2 < size) {
+                nodes[i]->right = nodes[2 * i + 2];
+            }
+        }
+        nodes.resize(1);
+        break;
+
+    case GraphShape::ROOTS:
+        break;
+    }
+    return nodes;
+}
+
+//! run_gc() with the whole graph alive: marking only
+Nanoseconds bench_gc_live(const int64_t iterations, const GraphShape shape, const int32_t size)
+{
+    const std::vector<HeapPtr<GraphNode>> roots = build_graph(shape, size);
+    const auto start = Clock::now();
+    for (int64_t i = 0; i < iterations; ++i) {
+        Heap::run_gc();
+    }
+    return Clock::now() - start;
+}
+
+//! run_gc() after dropping the graph: everything is swept
+Nanoseconds bench_gc_garbage(const int64_t iterations, const GraphShape shape, const int32_t size)
+{
+    Nanoseconds elapsed{0};
+    for (int64_t i = 0; i < iterations; ++i) {
+        build_graph(shape, size);
+        const auto start = Clock::now();
+        Heap::run_gc();
+        elapsed += Clock::now() - start;
+    }
+    return elapsed;
+}
+
+Nanoseconds bench_environment_get(const int64_t iterations, const int32_t depth)
+{
+    const SymbolId needle = intern_symbol("needle");
+    Globals globals;
+    globals.environment()->define(needle, Value{1.});
+    for (int32_t i = 0; i < depth; ++i) {
+        globals.open_scope();
+        globals.environment()->define(intern_symbol("a"), Value{nil});
+        globals.environment()->define(intern_symbol("b"), Value{nil});
+    }
+
+    const Environment& env = *globals.environment();
+    const auto start = Clock::now();
+    for (int64_t i = 0; i < iterations; ++i) {
+        do_not_optimize(env.get(needle));
+    }
+    const Nanoseconds elapsed = Clock::now() - start;
+
+    for (int32_t i = 0; i < depth; ++i) {
+        globals.close_scope();
+    }
+    return elapsed;
+}
+
+//! The same chain as bench_environment_get, with the variable resolved to a slot
+Nanoseconds bench_environment_slot(const int64_t iterations, const int32_t depth)
+{
+    Globals globals;
+    globals.open_scope(1);
+    globals.environment()->define_slot(0, intern_symbol("needle"), Value{1.});
+    for (int32_t i = 0; i < depth; ++i) {
+        globals.open_scope(2);
+        globals.environment()->define_slot(0, intern_symbol("a"), Value{nil});
+        globals.environment()->define_slot(1, intern_symbol("b"), Value{nil});
+    }
+
+    const Environment& env = *globals.environment();
+    const auto start = Clock::now();
+    for (int64_t i = 0; i < iterations; ++i) {
+        do_not_optimize(&env.slot(depth, 0));
+    }
+    const Nanoseconds elapsed = Clock::now() - start;
+
+    for (int32_t i = 0; i <= depth; ++i) {
+        globals.close_scope();
+    }
+    return elapsed;
+}
+
+//! 16 MB of Lox that exercises every kind of token
+const std::string& generated_source()
+{
+    static const std::string source = [] {
+        constexpr std::string_view chunk{
+            "// generated benchmark input\n"
+            "fun fib(n) {\n"
+            "    if (n < 2) return n;\n"
+            "    return fib(n - 1) + fib(n - 2);\n"
+            "}\n"
+            "var greeting = \"hello, world\";\n"
+            "for (var i = 0; i < 100; i = i + 1) {\n"
+            "    print fib(i) * 3.25 + i; // inline comment\n"
+            "}\n\n"};
+        std::string result;
+        // enough for one PARALLEL_SCAN_MIN_CHUNK_SIZE chunk on 16 threads
+        while (result.size() < 16 * 1024 * 1024) {
+            result += chunk;
+        }
+        return result;
+    }();
+    return source;
+}
+
+//! 4 MB of Lox whose strings are mostly non-ASCII
+const std::string& generated_utf8_source()
+{
+    static const std::string source = [] {
+        constexpr std::string_view chunk{
+            "var greeting = \"Γειά σου κόσμε, こんにちは世界 😀\";\n"
+            "print greeting + \"→ été über naïve\";\n"};
+        std::string result;
+        while (result.size() < 4 * 1024 * 1024) {
+            result += chunk;
+        }
+        return result;
+    }();
+    return source;
+}
+
+Nanoseconds bench_scan_tokens(const int64_t iterations, const std::string& source)
+{
+    const auto start = Clock::now();
+    for (int64_t i = 0; i < iterations; ++i) {
+        const ScannerResult result = scan_tokens(source);
+        do_not_optimize(result.tokens.size());
+    }
+    return Clock::now() - start;
+}
+
+Nanoseconds bench_scan_parallel(const int64_t iterations, const int32_t num_threads)
+{
+    const std::string& source = generated_source();
+    const auto start = Clock::now();
+    for (int64_t i = 0; i < iterations; ++i) {
+        const ScannerResult result = scan_tokens(source, num_threads);
+        do_not_optimize(result.tokens.size());
+    }
+    return Clock::now() - start;
+}
+
+Nanoseconds bench_scan_streaming(const int64_t iterations, const std::size_t chunk_size)
+{
+    const std::string_view source = generated_source();
+    const auto start = Clock::now();
+    for (int64_t i = 0; i < iterations; ++i) {
+        StreamingScanner scanner;
+        for (std::size_t offset = 0; offset < source.size(); offset += chunk_size) {
+            do_not_optimize(scanner.feed(source.substr(offset, chunk_size)).size());
+        }
+        const ScannerResult result = std::move(scanner).finish();
+        do_not_optimize(result.tokens.size());
+    }
+    return Clock::now() - start;
+}
+
+Nanoseconds bench_parse(const int64_t iterations)
+{
+    static const ScannerResult scanned = scan_tokens(generated_source());
+    const auto start = Clock::now();
+    for (int64_t i = 0; i < iterations; ++i) {
+        BumpAlloc alloc;
+        ConstantPool constants;
+        do_not_optimize(parse(alloc, constants, scanned).size());
+    }
+    return Clock::now() - start;
+}
+
+//! An expression of nothing but literals, each evaluation decodes them
+Nanoseconds bench_interpret_literals(const int64_t iterations)
+{
+    static const ScannerResult scanned = scan_tokens("1.5 + 16 - 0.25 * 3 + 1234567.875; \"a literal string\" == \"a literal string\";");
+    BumpAlloc alloc;
+    ConstantPool constants;
+    const std::vector<Stmt*> statements = parse(alloc, constants, scanned);
+    resolve(statements);
+    infer_types(statements);
+    fuse(statements);
+    Globals globals;
+    Interpreter interpreter{scanned, globals};
+    const auto start = Clock::now();
+    for (int64_t i = 0; i < iterations; ++i) {
+        for (Stmt* const stmt : statements) {
+            do_not_optimize(interpreter.execute(*stmt));
+        }
+    }
+    return Clock::now() - start;
+}
+
+//! Runs the declarations in `source` once, then times its last statement
+Nanoseconds bench_interpret(const int64_t iterations, const std::string_view source)
+{
+    const ScannerResult scanned = scan_tokens(source);
+    BumpAlloc alloc;
+    ConstantPool constants;
+    const std::vector<Stmt*> statements = parse(alloc, constants, scanned);
+    resolve(statements);
+    infer_types(statements);
+    fuse(statements);
+    Globals globals;
+    Interpreter interpreter{scanned, globals};
+    for (std::size_t i = 0; i + 1 < statements.size(); ++i) {
+        do_not_optimize(interpreter.execute(*statements[i]));
+    }
+    const auto start = Clock::now();
+    for (int64_t i = 0; i < iterations; ++i) {
+        do_not_optimize(interpreter.execute(*statements.back()));
+    }
+    return Clock::now() - start;
+}
+
+//! Like bench_interpret(), on the ClosureEngine
+Nanoseconds bench_closure(const int64_t iterations, const std::string_view source)
+{
+    const ScannerResult scanned = scan_tokens(source);
+    BumpAlloc alloc;
+    ConstantPool constants;
+    const std::vector<Stmt*> statements = parse(alloc, constants, scanned);
+    resolve(statements);
+    Globals globals;
+    ClosureEngine engine{scanned, globals};
+    for (std::size_t i = 0; i + 1 < statements.size(); ++i) {
+        do_not_optimize(engine.execute(engine.compile(*statements[i])));
+    }
+    const ClosureEngine::Statement last = engine.compile(*statements.back());
+    const auto start = Clock::now();
+    for (int64_t i = 0; i < iterations; ++i) {
+        do_not_optimize(engine.execute(last));
+    }
+    return Clock::now() - start;
+}
+
+//! Like bench_interpret(), on the Vm
+Nanoseconds bench_vm(const int64_t iterations, const std::string_view source)
+{
+    const ScannerResult scanned = scan_tokens(source);
+    BumpAlloc alloc;
+    ConstantPool constants;
+    const std::vector<Stmt*> statements = parse(alloc, constants, scanned);
+    resolve(statements);
+    const std::optional<bytecode::Program> program = bytecode::compile(scanned, statements);
+    Globals globals;
+    Vm vm{scanned, globals};
+    for (std::size_t i = 0; i + 1 < program->statements.size(); ++i) {
+        do_not_optimize(vm.execute(*program->statements[i]));
+    }
+    const auto start = Clock::now();
+    for (int64_t i = 0; i < iterations; ++i) {
+        do_not_optimize(vm.execute(*program->statements.back()));
+    }
+    return Clock::now() - start;
+}
+
+//! Function calls, a parameter and a global
+constexpr std::string_view FIB_SOURCE{
+    "fun fib(n) { if (n < 2) return n; return fib(n - 1) + fib(n - 2); }\n"
+    "fib(15);\n"};
+
+//! Local variables in nested blocks
+constexpr std::string_view LOOP_SOURCE{
+    "{\n"
+    "    var sum = 0;\n"
+    "    for (var i = 0; i < 1000; i = i + 1) {\n"
+    "        var half = i / 2;\n"
+    "        sum = sum + half;\n"
+    "    }\n"
+    "}\n"};
+
+Nanoseconds bench_classify(const int64_t iterations, const SimdLevel level)
+{
+    const std::string& source = generated_source();
+    const ClassifyFn classify = get_classifier(level);
+    const auto start = Clock::now();
+    for (int64_t i = 0; i < iterations; ++i) {
+        uint64_t newlines{0};
+        for (std::size_t offset = 0; offset + CLASSIFY_BLOCK_SIZE <= source.size(); offset += CLASSIFY_BLOCK_SIZE) {
+            newlines ^= classify(source.data() + offset).newline;
+        }
+        do_not_optimize(newlines);
+    }
+    return Clock::now() - start;
+}
+
+Nanoseconds bench_count_newlines(const int64_t iterations, const SimdLevel level)
+{
+    const std::string& source = generated_source();
+    const CountNewlinesFn count_newlines = get_newline_counter(level);
+    const auto start = Clock::now();
+    for (int64_t i = 0; i < iterations; ++i) {
+        do_not_optimize(count_newlines(source.data(), source.size()));
+    }
+    return Clock::now() - start;
+}
+
+Nanoseconds bench_validate_utf8(const int64_t iterations, const SimdLevel level, const std::string& source)
+{
+    const ValidateUtf8Fn validate = get_utf8_validator(level);
+    const auto start = Clock::now();
+    for (int64_t i = 0; i < iterations; ++i) {
+        do_not_optimize(validate(source.data(), source.size()));
+    }
+    return Clock::now() - start;
+}
+
+//! The first error message pays for the line index
+Nanoseconds bench_first_position(const int64_t iterations)
+{
+    const std::string& source = generated_source();
+    const auto start = Clock::now();
+    for (int64_t i = 0; i < iterations; ++i) {
+        const OffsetToLine offsets{source};
+        do_not_optimize(offsets.get_position(static_cast<int32_t>(source.size() / 2)));
+    }
+    return Clock::now() - start;
+}
+
+std::vector<Benchmark> all_benchmarks()
+{
+    std::vector<Benchmark> benchmarks;
+
+#define SIZED(prefix, fun) \
+    benchmarks.push_back({prefix "/16", &fun<16>}); \
+    benchmarks.push_back({prefix "/64", &fun<64>}); \
+    benchmarks.push_back({prefix "/256", &fun<256>});
+
+    SIZED("bump_alloc/allocate", bench_bump_alloc)
+    SIZED("malloc", bench_malloc)
+    SIZED("heap/allocate", bench_heap_allocate)
+#undef SIZED
+    benchmarks.push_back({"heap/allocate/1024", &bench_heap_allocate<1024>});
+
+    benchmarks.push_back({"heap_ptr/copy", &bench_heap_ptr_copy});
+    benchmarks.push_back({"heap_ptr/move", &bench_heap_ptr_move});
+    benchmarks.push_back({"heap_ptr/destroy", &bench_heap_ptr_destroy});
+
+    for (const GraphShape shape : {GraphShape::CHAIN, GraphShape::TREE, GraphShape::ROOTS}) {
+        for (const int32_t size : {100, 300, 1000}) {
+            benchmarks.push_back({fmt::format("gc/live/{}/{}", shape_name(shape), size),
+                                  [=] (int64_t n) { return bench_gc_live(n, shape, size); }});
+            benchmarks.push_back({fmt::format("gc/garbage/{}/{}", shape_name(shape), size),
+                                  [=] (int64_t n) { return bench_gc_garbage(n, shape, size); }});
+        }
+    }
+
+    for (const int32_t depth : {0, 4, 16, 64}) {
+        benchmarks.push_back({fmt::format("environment/get/depth/{}", depth),
+                              [=] (int64_t n) { return bench_environment_get(n, depth); }});
+        benchmarks.push_back({fmt::format("environment/slot/depth/{}", depth),
+                              [=] (int64_t n) { return bench_environment_slot(n, depth); }});
+    }
+
+    const std::size_t source_size = generated_source().size();
+    const std::size_t utf8_source_size = generated_utf8_source().size();
+    benchmarks.push_back({"scanner/scan_tokens",
+                          [] (int64_t n) { return bench_scan_tokens(n, generated_source()); },
+                          source_size});
+    benchmarks.push_back({"scanner/scan_tokens/utf8",
+                          [] (int64_t n) { return bench_scan_tokens(n, generated_utf8_source()); },
+                          utf8_source_size});
+    benchmarks.push_back({"scanner/first_position", &bench_first_position, source_size});
+    benchmarks.push_back({"parser/parse", &bench_parse, source_size});
+    benchmarks.push_back({"interpreter/literals", &bench_interpret_literals});
+    benchmarks.push_back({"interpreter/fib", [] (int64_t n) { return bench_interpret(n, FIB_SOURCE); }});
+    benchmarks.push_back({"interpreter/loop", [] (int64_t n) { return bench_interpret(n, LOOP_SOURCE); }});
+    benchmarks.push_back({"closure/fib", [] (int64_t n) { return bench_closure(n, FIB_SOURCE); }});
+    benchmarks.push_back({"closure/loop", [] (int64_t n) { return bench_closure(n, LOOP_SOURCE); }});
+    benchmarks.push_back({"vm/fib", [] (int64_t n) { return bench_vm(n, FIB_SOURCE); }});
+    benchmarks.push_back({"vm/loop", [] (int64_t n) { return bench_vm(n, LOOP_SOURCE); }});
+    for (const int32_t num_threads : {1, 2, 4, 8, 16}) {
+        benchmarks.push_back({fmt::format("scanner/parallel/{}", num_threads),
+                              [=] (int64_t n) { return bench_scan_parallel(n, num_threads); },
+                              source_size});
+    }
+    for (const std::size_t chunk_size : {4 * 1024, 64 * 1024}) {
+        benchmarks.push_back({fmt::format("scanner/streaming/{}k", chunk_size / 1024),
+                              [=] (int64_t n) { return bench_scan_streaming(n, chunk_size); },
+                              source_size});
+    }
+    for (const SimdLevel level : {SimdLevel::SCALAR, SimdLevel::SSE2, SimdLevel::AVX2}) {
+        if (level <= detect_simd_level()) {
+            benchmarks.push_back({fmt::format("scanner/classify/{}", simd_level_to_string(level)),
+                                  [=] (int64_t n) { return bench_classify(n, level); },
+                                  source_size});
+            benchmarks.push_back({fmt::format("scanner/count_newlines/{}", simd_level_to_string(level)),
+                                  [=] (int64_t n) { return bench_count_newlines(n, level); },
+                                  source_size});
+            benchmarks.push_back({fmt::format("utf8/validate/{}/ascii", simd_level_to_string(level)),
+                                  [=] (int64_t n) { return bench_validate_utf8(n, level, generated_source()); },
+                                  source_size});
+            benchmarks.push_back({fmt::format("utf8/validate/{}/utf8", simd_level_to_string(level)),
+                                  [=] (int64_t n) { return bench_validate_utf8(n, level, generated_utf8_source()); },
+                                  utf8_source_size});
+        }
+    }
+
+    return benchmarks;
+}
+
+std::string json_escape(std::string_view str)
+{
+    std::string result;
+    for (const char c : str) {
+        if (c == '"' || c == '\\') {
+            result.push_back('\\');
+        }
+        result.push_back(c);
+    }
+    return result;
+}
+
+std::string current_date()
+{
+    const std::time_t now = std::time(nullptr);
+    char buffer[32];
+    std::strftime(buffer, sizeof(buffer), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+    return buffer;
+}
+
+constexpr
+bool built_with_asan() noexcept
+{
+#if defined(__SANITIZE_ADDRESS__)
+    return true;
+#else
+    return false;
+#endif
+}
+
+void write_json(std::FILE* out, const std::vector<Result>& results)
+{
+    fmt::print(out, "{{\n  \"context\": {{\n");
+    fmt::print(out, "    \"date\": \"{}\",\n", current_date());
+    fmt::print(out, "    \"compiler\": \"{}\",\n", json_escape(__VERSION__));
+    fmt::print(out, "    \"asan\": {},\n", built_with_asan());
+    fmt::print(out, "    \"heap_capacity\": {}\n", Heap::capacity());
+    fmt::print(out, "  }},\n  \"benchmarks\": [\n");
+    for (std::size_t i = 0; i < results.size(); ++i) {
+        const Result& r = results[i];
+        const std::string throughput = r.bytes_per_op ? fmt::format(", \"mb_per_s\": {:.1f}", r.mb_per_s()) : "";
+        fmt::print(out, "    {{\"name\": \"{}\", \"iterations\": {}, \"ns_per_op\": {:.3f}, \"min_ns_per_op\": {:.3f}{}}}{}\n",
+                   json_escape(r.name), r.iterations, r.ns_per_op, r.min_ns_per_op, throughput,
+                   (i + 1 < results.size()) ? "," : "");
+    }
+    fmt::print(out, "  ]\n}}\n");
+}
+
+} // anonymous namespace
+
+
+int main(int argc, char** argv)
+{
+    std::string_view filter;
+    Nanoseconds min_time = std::chrono::milliseconds{100};
+    const char* out_path = nullptr;
+
+    for (int i = 1; i < argc; ++i) {
+        const std::string_view arg{argv[i]};
+        if (arg.starts_with("--filter=")) {
+            filter = arg.substr(9);
+        } else if (arg.starts_with("--min-time-ms=")) {
+            min_time = std::chrono::milliseconds{std::atoi(argv[i] + 14)};
+        } else if (arg.starts_with("--out=")) {
+            out_path = argv[i] + 6;
+        } else {
+            LOG_ERROR("Usage: jlox_microbench [--filter=substring] [--min-time-ms=100] [--out=results.json]");
+            return 1;
+        }
+    }
+
+    if (built_with_asan()) {
+        LOG_ERROR("Warning: built with WITH_ASAN, numbers are not representative.");
+    }
+
+    std::vector<Result> results;
+    for (const Benchmark& benchmark : all_benchmarks()) {
+        if (benchmark.name.find(filter) == std::string::npos) {
+            continue;
+        }
+        results.push_back(measure(benchmark, min_time));
+        const Result& r = results.back();
+        if (r.bytes_per_op) {
+            fmt::print(stderr, "{:<36} {:>12.1f} ns/op {:>10.1f} MB/s\n", r.name, r.ns_per_op, r.mb_per_s());
+        } else {
+            fmt::print(stderr, "{:<36} {:>12.1f} ns/op\n", r.name, r.ns_per_op);
+        }
+    }
+
+    std::FILE* out = stdout;
+    if (out_path) {
+        out = std::fopen(out_path, "w");
+        if (!out) {
+            LOG_ERROR("Failed to open \"{}\".", out_path);
+            return 1;
+        }
+    }
+    write_json(out, results);
+    if (out != stdout) {
+        std::fclose(out);
+    }
+    return 0;
+}
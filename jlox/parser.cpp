@@ -1,11 +1,15 @@
 #include "parser.hpp"
 
+#include <array>
 #include <cassert>
 #include <cstdint>
+#include <span>
+#include <vector>
 
 #include "tokens.hpp"
 #include "expr.hpp"
 #include "bump_alloc.hpp"
+#include "constant_pool.hpp"
 #include "scanner.hpp"
 #include "log.hpp"
 #include "stmt.hpp"
@@ -61,14 +65,65 @@ int32_t get_binary_prio(TokenType type) noexcept
     return -1;
 }
 
+/**
+ * A section of a scratch stack that collects the children of one node
+ * before they are copied into the arena. Nested nodes push above it and
+ * are popped again before it is used.
+ */
+template <typename T>
+class ScratchFrame
+{
+public:
+    explicit
+    ScratchFrame(std::vector<T>& stack) noexcept
+      : m_stack{stack}
+      , m_base{stack.size()}
+    {}
+
+    ~ScratchFrame()
+    {
+        m_stack.resize(m_base);
+    }
+
+    ScratchFrame(const ScratchFrame&) = delete;
+    ScratchFrame& operator=(const ScratchFrame&) = delete;
+
+    void push_back(T item)
+    {
+        m_stack.push_back(item);
+    }
+
+    std::size_t size() const noexcept
+    {
+        return m_stack.size() - m_base;
+    }
+
+    std::span<T> copy_to(BumpAlloc& alloc) const
+    {
+        return alloc.allocate_span<T>(std::span<const T>{m_stack}.subspan(m_base));
+    }
+
+private:
+    std::vector<T>& m_stack;
+    std::size_t m_base;
+};
+
 class LoxParser
 {
 public:
     LoxParser(BumpAlloc& alloc,
-               const ScannerResult& scanner_result)
+              ConstantPool& constants,
+              const ScannerResult& scanner_result)
       : m_alloc{alloc}
+      , m_constants{constants}
       , m_scanner_result{scanner_result}
       , m_current{0}
+      , m_symbol_token{0}
+      , m_symbol_index{0}
+      , m_stmt_scratch{}
+      , m_expr_scratch{}
+      , m_token_scratch{}
+      , m_symbol_scratch{}
     {
         assert(m_scanner_result.tokens.empty() == false &&
                m_scanner_result.tokens.back().type() == TokenType::END_OF_FILE);
@@ -121,6 +176,25 @@ private:
         return &m_scanner_result.tokens[m_current++];
     }
 
+    /**
+     * The interned name of `identifier`. The scanner only keeps symbols for
+     * identifiers, this counts the identifiers before it, starting where the
+     * previous lookup ended; identifiers are looked up about in order.
+     */
+    SymbolId symbol(const Token* identifier) noexcept
+    {
+        const std::vector<Token>& tokens = m_scanner_result.tokens;
+        const int32_t index = static_cast<int32_t>(identifier - tokens.data());
+        assert(identifier->type() == TokenType::IDENTIFIER);
+        for (; m_symbol_token < index; ++m_symbol_token) {
+            m_symbol_index += tokens[m_symbol_token].type() == TokenType::IDENTIFIER;
+        }
+        for (; m_symbol_token > index; --m_symbol_token) {
+            m_symbol_index -= tokens[m_symbol_token - 1].type() == TokenType::IDENTIFIER;
+        }
+        return m_scanner_result.symbols[m_symbol_index];
+    }
+
     void unadvance() noexcept
     {
         assert(m_current > 0);
@@ -201,8 +275,8 @@ private:
 
             if (op->type() == TokenType::EQUAL) {
                 if (lhs->is_type<VarExpr>()) {
-                    const Token* const identifier = lhs->get_main_token();
-                    lhs = m_alloc.allocate<AssignExpr>(identifier, rhs);
+                    const VarExpr& var_expr = static_cast<const VarExpr&>(*lhs);
+                    lhs = m_alloc.allocate<AssignExpr>(var_expr.identifier, var_expr.symbol, rhs);
                 } else {
                     report_error(op, "Invalid assignment");
                 }
@@ -240,11 +314,15 @@ private:
         case FALSE:
         case STRING:
         case NUMBER:
-            return m_alloc.allocate<LiteralExpr>(token);
+            if (const Value* const constant = m_constants.add(*token, m_scanner_result.source)) {
+                return m_alloc.allocate<LiteralExpr>(token, constant);
+            }
+            report_error(token, "Number \"{}\" is out of range.", token->lexeme(m_scanner_result.source));
+            return nullptr;
 
         case IDENTIFIER:
             {
-                Expr* e = m_alloc.allocate<VarExpr>(token);
+                Expr* e = m_alloc.allocate<VarExpr>(token, symbol(token));
                 if (!e) {
                     return nullptr;
                 }
@@ -279,7 +357,7 @@ private:
         if (!callee) {
             return nullptr;
         }
-        std::vector<Expr*> args;
+        ScratchFrame args{m_expr_scratch};
         if (!check(TokenType::RIGHT_PAREN)) {
             do {
                 const Token* const lookahead = peek();
@@ -297,7 +375,7 @@ private:
         if (!paren) {
             return nullptr;
         }
-        return m_alloc.allocate<CallExpr>(callee, paren, std::move(args));
+        return m_alloc.allocate<CallExpr>(callee, paren, args.copy_to(m_alloc));
     }
 
 
@@ -356,7 +434,7 @@ private:
         }
 
         if (match(TokenType::LEFT_BRACE)) {
-            std::vector<Stmt*> statements;
+            ScratchFrame statements{m_stmt_scratch};
 
             while (!eof() && !check(TokenType::RIGHT_BRACE)) {
                 Stmt* const s = parse_declaration();
@@ -370,7 +448,7 @@ private:
                 return nullptr;
             }
 
-            return m_alloc.allocate<BlockStmt>(std::move(statements));
+            return m_alloc.allocate<BlockStmt>(statements.copy_to(m_alloc));
         }
 
         if (match(TokenType::WHILE)) {
@@ -441,24 +519,24 @@ private:
             }
 
             if (increment) {
-                std::vector<Stmt*> statements{
+                const std::array<Stmt*, 2> statements{
                     body,
                     m_alloc.allocate<ExprStmt>(increment)
                 };
-                body = m_alloc.allocate<BlockStmt>(std::move(statements));
+                body = m_alloc.allocate<BlockStmt>(m_alloc.allocate_span<Stmt*>(statements));
             }
 
             if (!condition) {
-                condition = m_alloc.allocate<LiteralExpr>(&TRUE_TOKEN);
+                condition = m_alloc.allocate<LiteralExpr>(&TRUE_TOKEN, m_constants.add(TRUE_TOKEN, m_scanner_result.source));
             }
             body = m_alloc.allocate<WhileStmt>(condition, body);
 
             if (initializer) {
-                std::vector<Stmt*> statements{
+                const std::array<Stmt*, 2> statements{
                     initializer,
                     body
                 };
-                body = m_alloc.allocate<BlockStmt>(std::move(statements));
+                body = m_alloc.allocate<BlockStmt>(m_alloc.allocate_span<Stmt*>(statements));
             }
 
             return body;
@@ -491,6 +569,7 @@ private:
         if (!identifier) {
             return nullptr;
         }
+        const SymbolId name = symbol(identifier);
 
         Expr* initializer = nullptr;
         if (match(TokenType::EQUAL)) {
@@ -505,7 +584,7 @@ private:
             return nullptr;
         }
 
-        return m_alloc.allocate<VarStmt>(identifier, initializer);
+        return m_alloc.allocate<VarStmt>(identifier, name, initializer);
     }
 
     Stmt* parse_fun_declaration(std::string_view kind)
@@ -514,8 +593,10 @@ private:
         if (!name) {
             return nullptr;
         }
+        const SymbolId name_symbol = symbol(name);
 
-        std::vector<const Token*> params;
+        ScratchFrame params{m_token_scratch};
+        ScratchFrame param_symbols{m_symbol_scratch};
         if (!consume(TokenType::LEFT_PAREN, "Expect '(' after {} name", kind)) {
             return nullptr;
         }
@@ -529,13 +610,14 @@ private:
                     return nullptr;
                 }
                 params.push_back(next);
+                param_symbols.push_back(symbol(next));
             } while (match(TokenType::COMMA));
         }
         if (!consume(TokenType::RIGHT_PAREN, "Expect ')' after parameters.")) {
             return nullptr;
         }
 
-        std::vector<Stmt*> body;
+        ScratchFrame body{m_stmt_scratch};
         if (!consume(TokenType::LEFT_BRACE, "Expect '{' before {} body.", kind)) {
             return nullptr;
         }
@@ -551,7 +633,9 @@ private:
             return nullptr;
         }
 
-        return m_alloc.allocate<FunStmt>(name, std::move(params), std::move(body));
+        return m_alloc.allocate<FunStmt>(name, name_symbol,
+                                         params.copy_to(m_alloc), param_symbols.copy_to(m_alloc),
+                                         body.copy_to(m_alloc));
     }
 
     template <typename Fmt, typename... Args>
@@ -565,8 +649,17 @@ private:
     }
 
     BumpAlloc& m_alloc;
+    ConstantPool& m_constants;
     const ScannerResult& m_scanner_result;
     int32_t m_current;
+    // m_symbol_index identifiers come before token m_symbol_token
+    int32_t m_symbol_token;
+    int32_t m_symbol_index;
+    // child lists under construction, see ScratchFrame
+    std::vector<Stmt*> m_stmt_scratch;
+    std::vector<Expr*> m_expr_scratch;
+    std::vector<const Token*> m_token_scratch;
+    std::vector<SymbolId> m_symbol_scratch;
 };
 
 
@@ -574,9 +667,10 @@ private:
 
 std::vector<Stmt*>
 parse(BumpAlloc& alloc,
+      ConstantPool& constants,
       const ScannerResult& scanner_result)
 {
-    LoxParser parser{alloc, scanner_result};
+    LoxParser parser{alloc, constants, scanner_result};
     return parser.parse();
 }
 
@@ -591,9 +685,10 @@ TEST_CASE("Parser Test")
     CHECK(result.num_errors == 0);
 
     BumpAlloc alloc;
+    ConstantPool constants;
 
     //Expr* const expr = parse(alloc, result);
-    std::vector<Stmt*> statements = parse(alloc, result);
+    std::vector<Stmt*> statements = parse(alloc, constants, result);
     CHECK(statements.empty() == false);
     Stmt* const stmt = statements.front();
     CHECK(stmt->is_type<ExprStmt>());
@@ -5,8 +5,10 @@
 #include <vector>
 
 class BumpAlloc;
+class ConstantPool;
 struct ScannerResult;
 class Expr;
 class Stmt;
 
-std::vector<Stmt*> parse(BumpAlloc& alloc, const ScannerResult& scanner_result);
+//! Literals are decoded into `constants`, which must outlive the tree.
+std::vector<Stmt*> parse(BumpAlloc& alloc, ConstantPool& constants, const ScannerResult& scanner_result);
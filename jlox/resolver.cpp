@@ -0,0 +1,421 @@
+#include "resolver.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <vector>
+
+#include <doctest/doctest.h>
+
+#include "expr.hpp"
+#include "stmt.hpp"
+#include "symbols.hpp"
+
+namespace
+{
+
+class Resolver final : public ExprVisitor
+                     , public StmtVisitor
+{
+public:
+    void resolve(std::span<Stmt* const> statements)
+    {
+        for (Stmt* const stmt : statements) {
+            static_cast<void>(stmt->accept(*this));
+        }
+    }
+
+    void visit(BinaryExpr& binary_expr) override
+    {
+        binary_expr.left->accept(*this);
+        binary_expr.right->accept(*this);
+    }
+
+    void visit(GroupingExpr& grouping_expr) override
+    {
+        grouping_expr.expr->accept(*this);
+    }
+
+    void visit(LiteralExpr& /*literal_expr*/) override
+    {}
+
+    void visit(UnaryExpr& unary_expr) override
+    {
+        unary_expr.right->accept(*this);
+    }
+
+    void visit(VarExpr& var_expr) override
+    {
+        var_expr.resolution = find(var_expr.symbol);
+    }
+
+    void visit(AssignExpr& assign_expr) override
+    {
+        assign_expr.value->accept(*this);
+        assign_expr.resolution = find(assign_expr.symbol);
+    }
+
+    void visit(LogicalExpr& logical_expr) override
+    {
+        logical_expr.left->accept(*this);
+        logical_expr.right->accept(*this);
+    }
+
+    void visit(CallExpr& call_expr) override
+    {
+        call_expr.callee->accept(*this);
+        for (Expr* const arg : call_expr.args) {
+            arg->accept(*this);
+        }
+    }
+
+    void unkown_expr(Expr& /*expr*/) override
+    {
+        assert(false);
+    }
+
+    bool visit(ExprStmt& expr_stmt) override
+    {
+        expr_stmt.expr->accept(*this);
+        return false;
+    }
+
+    bool visit(PrintStmt& print_stmt) override
+    {
+        print_stmt.expr->accept(*this);
+        return false;
+    }
+
+    bool visit(VarStmt& var_stmt) override
+    {
+        // the initializer is evaluated before the variable exists
+        if (var_stmt.initializer) {
+            var_stmt.initializer->accept(*this);
+        }
+        var_stmt.slot = declare(var_stmt.symbol);
+        return false;
+    }
+
+    bool visit(BlockStmt& block_stmt) override
+    {
+        m_scopes.emplace_back();
+        resolve(block_stmt.statements);
+        block_stmt.num_slots = static_cast<int32_t>(m_scopes.back().size());
+        m_scopes.pop_back();
+        return false;
+    }
+
+    bool visit(IfStmt& if_stmt) override
+    {
+        if_stmt.condition->accept(*this);
+        static_cast<void>(if_stmt.then_branch->accept(*this));
+        if (if_stmt.else_branch) {
+            static_cast<void>(if_stmt.else_branch->accept(*this));
+        }
+        return false;
+    }
+
+    bool visit(WhileStmt& while_stmt) override
+    {
+        while_stmt.condition->accept(*this);
+        static_cast<void>(while_stmt.body->accept(*this));
+        return false;
+    }
+
+    bool visit(FunStmt& fun_stmt) override
+    {
+        // declared first, so that the body can call the function
+        fun_stmt.slot = declare(fun_stmt.symbol);
+        // a parameter given twice gets two slots, the last one wins
+        m_scopes.emplace_back(fun_stmt.param_symbols.begin(), fun_stmt.param_symbols.end());
+        resolve(fun_stmt.body);
+        fun_stmt.num_slots = static_cast<int32_t>(m_scopes.back().size());
+        m_scopes.pop_back();
+        return false;
+    }
+
+    bool visit(ReturnStmt& return_stmt) override
+    {
+        if (return_stmt.expr) {
+            return_stmt.expr->accept(*this);
+        }
+        return false;
+    }
+
+    void unkown_stmt(Stmt& /*stmt*/) override
+    {
+        assert(false);
+    }
+
+private:
+    //! Slot of a new variable in the innermost scope, -1 at global scope
+    int32_t declare(const SymbolId symbol)
+    {
+        if (m_scopes.empty()) {
+            return -1;
+        }
+        std::vector<SymbolId>& scope = m_scopes.back();
+        // declaring a name again reuses its slot, like define() did
+        const auto it = std::find(scope.begin(), scope.end(), symbol);
+        if (it != scope.end()) {
+            return static_cast<int32_t>(it - scope.begin());
+        }
+        scope.push_back(symbol);
+        return static_cast<int32_t>(scope.size() - 1);
+    }
+
+    Resolution find(const SymbolId symbol) const noexcept
+    {
+        for (std::size_t depth = 0; depth < m_scopes.size(); ++depth) {
+            const std::vector<SymbolId>& scope = m_scopes[m_scopes.size() - 1 - depth];
+            const auto it = std::find(scope.rbegin(), scope.rend(), symbol);
+            if (it != scope.rend()) {
+                return {static_cast<int32_t>(depth), static_cast<int32_t>(scope.rend() - it - 1)};
+            }
+        }
+        return {};
+    }
+
+    // the names of the enclosing local scopes by slot, innermost last
+    std::vector<std::vector<SymbolId>> m_scopes;
+};
+
+//! Follows the scopes of Resolver to see which references leave a function
+class CaptureAnalysis final : public ExprVisitor
+                            , public StmtVisitor
+{
+public:
+    void analyze(std::span<Stmt* const> statements)
+    {
+        for (Stmt* const stmt : statements) {
+            static_cast<void>(stmt->accept(*this));
+        }
+    }
+
+    CapturedSlots take_captured() noexcept
+    {
+        return std::move(m_captured);
+    }
+
+    void visit(BinaryExpr& binary_expr) override
+    {
+        binary_expr.left->accept(*this);
+        binary_expr.right->accept(*this);
+    }
+
+    void visit(GroupingExpr& grouping_expr) override
+    {
+        grouping_expr.expr->accept(*this);
+    }
+
+    void visit(LiteralExpr& /*literal_expr*/) override
+    {}
+
+    void visit(UnaryExpr& unary_expr) override
+    {
+        unary_expr.right->accept(*this);
+    }
+
+    void visit(VarExpr& var_expr) override
+    {
+        refer(var_expr.resolution);
+    }
+
+    void visit(AssignExpr& assign_expr) override
+    {
+        assign_expr.value->accept(*this);
+        refer(assign_expr.resolution);
+    }
+
+    void visit(LogicalExpr& logical_expr) override
+    {
+        logical_expr.left->accept(*this);
+        logical_expr.right->accept(*this);
+    }
+
+    void visit(CallExpr& call_expr) override
+    {
+        call_expr.callee->accept(*this);
+        for (Expr* const arg : call_expr.args) {
+            arg->accept(*this);
+        }
+    }
+
+    void unkown_expr(Expr& /*expr*/) override
+    {
+        assert(false);
+    }
+
+    bool visit(ExprStmt& expr_stmt) override
+    {
+        expr_stmt.expr->accept(*this);
+        return false;
+    }
+
+    bool visit(PrintStmt& print_stmt) override
+    {
+        print_stmt.expr->accept(*this);
+        return false;
+    }
+
+    bool visit(VarStmt& var_stmt) override
+    {
+        if (var_stmt.initializer) {
+            var_stmt.initializer->accept(*this);
+        }
+        return false;
+    }
+
+    bool visit(BlockStmt& block_stmt) override
+    {
+        m_scopes.push_back({&block_stmt, m_function_level});
+        analyze(block_stmt.statements);
+        m_scopes.pop_back();
+        return false;
+    }
+
+    bool visit(IfStmt& if_stmt) override
+    {
+        if_stmt.condition->accept(*this);
+        static_cast<void>(if_stmt.then_branch->accept(*this));
+        if (if_stmt.else_branch) {
+            static_cast<void>(if_stmt.else_branch->accept(*this));
+        }
+        return false;
+    }
+
+    bool visit(WhileStmt& while_stmt) override
+    {
+        while_stmt.condition->accept(*this);
+        static_cast<void>(while_stmt.body->accept(*this));
+        return false;
+    }
+
+    bool visit(FunStmt& fun_stmt) override
+    {
+        ++m_function_level;
+        m_scopes.push_back({&fun_stmt, m_function_level});
+        analyze(fun_stmt.body);
+        m_scopes.pop_back();
+        --m_function_level;
+        return false;
+    }
+
+    bool visit(ReturnStmt& return_stmt) override
+    {
+        if (return_stmt.expr) {
+            return_stmt.expr->accept(*this);
+        }
+        return false;
+    }
+
+    void unkown_stmt(Stmt& /*stmt*/) override
+    {
+        assert(false);
+    }
+
+private:
+    struct Scope
+    {
+        const void* owner;
+        int32_t function_level;
+    };
+
+    void refer(const Resolution resolution)
+    {
+        if (resolution.depth == GLOBAL_DEPTH) {
+            return;
+        }
+        const Scope& scope = m_scopes[m_scopes.size() - 1 - static_cast<std::size_t>(resolution.depth)];
+        if (scope.function_level == m_function_level) {
+            return;
+        }
+        std::vector<bool>& slots = m_captured[scope.owner];
+        if (slots.size() <= static_cast<std::size_t>(resolution.slot)) {
+            slots.resize(static_cast<std::size_t>(resolution.slot) + 1);
+        }
+        slots[static_cast<std::size_t>(resolution.slot)] = true;
+    }
+
+    std::vector<Scope> m_scopes;
+    int32_t m_function_level{0};
+    CapturedSlots m_captured;
+};
+
+} // anonymous namespace
+
+void resolve(std::span<Stmt* const> statements)
+{
+    Resolver resolver;
+    resolver.resolve(statements);
+}
+
+CapturedSlots find_captured(std::span<Stmt* const> statements)
+{
+    CaptureAnalysis capture_analysis;
+    capture_analysis.analyze(statements);
+    return capture_analysis.take_captured();
+}
+
+
+#include "bump_alloc.hpp"
+#include "constant_pool.hpp"
+#include "parser.hpp"
+#include "scanner.hpp"
+
+TEST_CASE("Resolver")
+{
+    const ScannerResult scanned = scan_tokens("var g = 1;\n"
+                                              "{\n"
+                                              "    var a = g;\n"
+                                              "    var b = a;\n"
+                                              "    fun f(x, y) { var z = x; return y + z + b + g; }\n"
+                                              "    var a = f;\n"
+                                              "}\n");
+    REQUIRE(scanned.num_errors == 0);
+    BumpAlloc alloc;
+    ConstantPool constants;
+    const std::vector<Stmt*> statements = parse(alloc, constants, scanned);
+    REQUIRE(statements.size() == 2);
+    resolve(statements);
+
+    CHECK(static_cast<VarStmt*>(statements[0])->slot == -1);
+
+    const BlockStmt& block = *static_cast<BlockStmt*>(statements[1]);
+    REQUIRE(block.statements.size() == 4);
+    CHECK(block.num_slots == 3);
+
+    const VarStmt& a = *static_cast<VarStmt*>(block.statements[0]);
+    CHECK(a.slot == 0);
+    CHECK(static_cast<VarExpr*>(a.initializer)->resolution.depth == GLOBAL_DEPTH);
+    const VarStmt& b = *static_cast<VarStmt*>(block.statements[1]);
+    CHECK(b.slot == 1);
+    CHECK(static_cast<VarExpr*>(b.initializer)->resolution.depth == 0);
+    CHECK(static_cast<VarExpr*>(b.initializer)->resolution.slot == 0);
+
+    const FunStmt& f = *static_cast<FunStmt*>(block.statements[2]);
+    CHECK(f.slot == 2);
+    CHECK(f.num_slots == 3);
+    const VarStmt& z = *static_cast<VarStmt*>(f.body[0]);
+    CHECK(z.slot == 2);
+    CHECK(static_cast<VarExpr*>(z.initializer)->resolution.slot == 0);
+
+    // ((y + z) + b) + g
+    const BinaryExpr& sum = *static_cast<BinaryExpr*>(static_cast<ReturnStmt*>(f.body[1])->expr);
+    const BinaryExpr& inner = *static_cast<BinaryExpr*>(sum.left);
+    const BinaryExpr& innermost = *static_cast<BinaryExpr*>(inner.left);
+    const Resolution y = static_cast<VarExpr*>(innermost.left)->resolution;
+    const Resolution b_in_f = static_cast<VarExpr*>(inner.right)->resolution;
+    CHECK((y.depth == 0 && y.slot == 1));
+    CHECK((b_in_f.depth == 1 && b_in_f.slot == 1));
+    CHECK(static_cast<VarExpr*>(sum.right)->resolution.depth == GLOBAL_DEPTH);
+
+    // declaring `a` again reuses its slot
+    CHECK(static_cast<VarStmt*>(block.statements[3])->slot == 0);
+
+    // f refers to `b` of the block, its own variables stay in its calls
+    const CapturedSlots captured = find_captured(statements);
+    REQUIRE(captured.contains(&block));
+    CHECK(captured.at(&block) == std::vector<bool>{false, true});
+    CHECK(captured.contains(&f) == false);
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <span>
+#include <vector>
+
+#include <absl/container/flat_hash_map.h>
+
+class Stmt;
+
+/**
+ * Numbers the variables of every local scope in `statements` in order of
+ * declaration and annotates each variable reference, declaration and
+ * function with the scope depth and slot the interpreter finds it in.
+ * Variables declared in no enclosing block or function are globals and
+ * keep being looked up by name. Run it on every tree before it is
+ * executed, including trees inflated from a flat::FlatAst.
+ */
+void resolve(std::span<Stmt* const> statements);
+
+//! For the BlockStmt or FunStmt of each local scope, which of its slots a nested function refers to
+using CapturedSlots = absl::flat_hash_map<const void*, std::vector<bool>>;
+
+/**
+ * Finds the variables of resolved `statements` that a function declared
+ * in their scope refers to. These can outlive the scope, so an engine
+ * keeping locals on a stack must keep them elsewhere.
+ */
+CapturedSlots find_captured(std::span<Stmt* const> statements);
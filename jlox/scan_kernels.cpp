@@ -0,0 +1,393 @@
+#include "scan_kernels.hpp"
+
+#include <algorithm>
+#include <bit>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+
+constexpr
+bool in_range(const char c, const char first, const int32_t count) noexcept
+{
+    return static_cast<uint8_t>(c - first) < static_cast<uint8_t>(count);
+}
+
+CharClassMasks classify_scalar(const char* const block) noexcept
+{
+    CharClassMasks result{};
+    for (int32_t i = 0; i < CLASSIFY_BLOCK_SIZE; ++i) {
+        const char c = block[i];
+        const uint64_t bit = uint64_t{1} << i;
+        if (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+            result.whitespace |= bit;
+        }
+        if (c == '\n') {
+            result.newline |= bit;
+        }
+        if (c == '"' || (static_cast<uint8_t>(c) & 0x80)) {
+            result.string_special |= bit;
+        }
+        if (in_range(static_cast<char>(c | 0x20), 'a', 26) || c == '_') {
+            result.identifier |= bit;
+        }
+        if (in_range(c, '0', 10)) {
+            result.digit |= bit;
+        }
+    }
+    return result;
+}
+
+int64_t count_newlines_scalar(const char* const data, const std::size_t size) noexcept
+{
+    int64_t count{0};
+    for (std::size_t i = 0; i < size; ++i) {
+        count += data[i] == '\n';
+    }
+    return count;
+}
+
+/**
+ * Length of the well-formed sequence at `data[i]`, 0 if there is none.
+ * The range of the second byte depends on the first, see RFC 3629
+ * section 4.
+ */
+std::size_t utf8_sequence_length(const char* const data, const std::size_t size, const std::size_t i) noexcept
+{
+    const uint8_t lead = static_cast<uint8_t>(data[i]);
+    if (lead < 0x80) {
+        return 1;
+    }
+
+    std::size_t length{0};
+    uint8_t min{0x80};
+    uint8_t max{0xbf};
+    if (lead >= 0xc2 && lead <= 0xdf) {
+        length = 2;
+    } else if (lead >= 0xe0 && lead <= 0xef) {
+        length = 3;
+        min = lead == 0xe0 ? 0xa0 : min; // overlong
+        max = lead == 0xed ? 0x9f : max; // surrogates
+    } else if (lead >= 0xf0 && lead <= 0xf4) {
+        length = 4;
+        min = lead == 0xf0 ? 0x90 : min; // overlong
+        max = lead == 0xf4 ? 0x8f : max; // above U+10FFFF
+    } else {
+        return 0;
+    }
+
+    if (size - i < length) {
+        return 0;
+    }
+    const uint8_t second = static_cast<uint8_t>(data[i + 1]);
+    if (second < min || second > max) {
+        return 0;
+    }
+    for (std::size_t k = 2; k < length; ++k) {
+        if ((static_cast<uint8_t>(data[i + k]) & 0xc0) != 0x80) {
+            return 0;
+        }
+    }
+    return length;
+}
+
+bool validate_utf8_scalar(const char* const data, const std::size_t size) noexcept
+{
+    for (std::size_t i = 0; i < size; ) {
+        const std::size_t length = utf8_sequence_length(data, size, i);
+        if (length == 0) {
+            return false;
+        }
+        i += length;
+    }
+    return true;
+}
+
+#if defined(__SSE2__)
+
+inline
+uint64_t to_bits(const __m128i v) noexcept
+{
+    return static_cast<uint32_t>(_mm_movemask_epi8(v));
+}
+
+inline
+__m128i eq(const __m128i v, const char c) noexcept
+{
+    return _mm_cmpeq_epi8(v, _mm_set1_epi8(c));
+}
+
+//! bytes in ['first', 'first' + count), with a signed compare after moving the range to -128
+inline
+__m128i in_range(const __m128i v, const char first, const int32_t count) noexcept
+{
+    const __m128i shifted = _mm_add_epi8(v, _mm_set1_epi8(static_cast<char>(0x80 - first)));
+    return _mm_cmplt_epi8(shifted, _mm_set1_epi8(static_cast<char>(-128 + count)));
+}
+
+CharClassMasks classify_sse2(const char* const block) noexcept
+{
+    CharClassMasks result{};
+    for (int32_t quarter = 0; quarter < 4; ++quarter) {
+        const __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block + 16 * quarter));
+        const int32_t shift = 16 * quarter;
+
+        const __m128i newline = eq(c, '\n');
+        const __m128i whitespace = _mm_or_si128(_mm_or_si128(eq(c, ' '), eq(c, '\t')),
+                                                _mm_or_si128(eq(c, '\r'), newline));
+        const __m128i lower = _mm_or_si128(c, _mm_set1_epi8(0x20));
+        const __m128i identifier = _mm_or_si128(in_range(lower, 'a', 26), eq(c, '_'));
+
+        result.whitespace |= to_bits(whitespace) << shift;
+        result.newline |= to_bits(newline) << shift;
+        // the sign bit of non-ASCII bytes is what movemask extracts anyway
+        result.string_special |= (to_bits(eq(c, '"')) | to_bits(c)) << shift;
+        result.identifier |= to_bits(identifier) << shift;
+        result.digit |= to_bits(in_range(c, '0', 10)) << shift;
+    }
+    return result;
+}
+
+int64_t count_newlines_sse2(const char* const data, const std::size_t size) noexcept
+{
+    const __m128i newline = _mm_set1_epi8('\n');
+    int64_t count{0};
+    std::size_t i{0};
+    while (size - i >= 16) {
+        // the byte counters would overflow after 255 rounds
+        const std::size_t end = i + 16 * std::min<std::size_t>((size - i) / 16, 255);
+        __m128i counters = _mm_setzero_si128();
+        for (; i < end; i += 16) {
+            const __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+            counters = _mm_sub_epi8(counters, _mm_cmpeq_epi8(c, newline));
+        }
+        const __m128i sums = _mm_sad_epu8(counters, _mm_setzero_si128());
+        count += _mm_cvtsi128_si32(sums) + _mm_cvtsi128_si32(_mm_unpackhi_epi64(sums, sums));
+    }
+    return count + count_newlines_scalar(data + i, size - i);
+}
+
+//! Skips ASCII 16 bytes at a time, checks everything else one sequence at a time.
+bool validate_utf8_sse2(const char* const data, const std::size_t size) noexcept
+{
+    std::size_t i{0};
+    while (size - i >= 16) {
+        const uint64_t non_ascii = to_bits(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i)));
+        if (non_ascii == 0) {
+            i += 16;
+            continue;
+        }
+        i += std::countr_zero(non_ascii);
+        const std::size_t length = utf8_sequence_length(data, size, i);
+        if (length == 0) {
+            return false;
+        }
+        i += length;
+    }
+    return validate_utf8_scalar(data + i, size - i);
+}
+
+#endif
+
+} // anonymous namespace
+
+std::string_view simd_level_to_string(const SimdLevel level) noexcept
+{
+    switch (level) {
+    using enum SimdLevel;
+    case SCALAR:
+        return "scalar";
+    case SSE2:
+        return "sse2";
+    case AVX2:
+        return "avx2";
+    }
+    return "<unkown>";
+}
+
+SimdLevel detect_simd_level() noexcept
+{
+#if defined(__x86_64__) || defined(__i386__)
+    if (detail::get_avx2_classifier() && __builtin_cpu_supports("avx2")) {
+        return SimdLevel::AVX2;
+    }
+#endif
+#if defined(__SSE2__)
+    return SimdLevel::SSE2;
+#else
+    return SimdLevel::SCALAR;
+#endif
+}
+
+ClassifyFn get_classifier(const SimdLevel level) noexcept
+{
+    static const SimdLevel supported = detect_simd_level();
+    const SimdLevel effective = std::min(level, supported);
+
+#if defined(__SSE2__)
+    if (effective == SimdLevel::AVX2) {
+        return detail::get_avx2_classifier();
+    }
+    if (effective == SimdLevel::SSE2) {
+        return &classify_sse2;
+    }
+#endif
+    return &classify_scalar;
+}
+
+CountNewlinesFn get_newline_counter(const SimdLevel level) noexcept
+{
+    static const SimdLevel supported = detect_simd_level();
+    const SimdLevel effective = std::min(level, supported);
+
+#if defined(__SSE2__)
+    if (effective == SimdLevel::AVX2) {
+        return detail::get_avx2_newline_counter();
+    }
+    if (effective == SimdLevel::SSE2) {
+        return &count_newlines_sse2;
+    }
+#endif
+    return &count_newlines_scalar;
+}
+
+ValidateUtf8Fn get_utf8_validator(const SimdLevel level) noexcept
+{
+    static const SimdLevel supported = detect_simd_level();
+    const SimdLevel effective = std::min(level, supported);
+
+#if defined(__SSE2__)
+    if (effective == SimdLevel::AVX2) {
+        return detail::get_avx2_utf8_validator();
+    }
+    if (effective == SimdLevel::SSE2) {
+        return &validate_utf8_sse2;
+    }
+#endif
+    return &validate_utf8_scalar;
+}
+
+///////////////////////////////////////////////////////////////
+#include <doctest/doctest.h>
+
+#include <array>
+#include <string>
+
+TEST_CASE("Character classification kernels")
+{
+    // every byte value, twice, at every position within the block
+    std::array<char, 512 + CLASSIFY_BLOCK_SIZE> data{};
+    for (std::size_t i = 0; i < data.size(); ++i) {
+        data[i] = static_cast<char>(i * 7);
+    }
+
+    constexpr std::string_view sample{"\n\t  _Zaz09\"\x80\x7f{@/`:"};
+    std::array<char, CLASSIFY_BLOCK_SIZE> block{};
+    std::copy(sample.begin(), sample.end(), block.begin());
+    const CharClassMasks expected = classify_scalar(block.data());
+    CHECK(expected.whitespace == 0b1111);
+    CHECK(expected.newline == 0b1);
+    CHECK(expected.identifier == 0b1111'0000);
+    CHECK(expected.digit == 0b11'0000'0000);
+    CHECK(expected.string_special == 0b1100'0000'0000);
+
+    for (const SimdLevel level : {SimdLevel::SSE2, SimdLevel::AVX2}) {
+        const ClassifyFn classify = get_classifier(level);
+        int32_t mismatches{0};
+        for (std::size_t offset = 0; offset + CLASSIFY_BLOCK_SIZE <= data.size(); ++offset) {
+            if (classify(data.data() + offset) != classify_scalar(data.data() + offset)) {
+                ++mismatches;
+            }
+        }
+        CHECK(mismatches == 0);
+    }
+}
+
+TEST_CASE("Newline counting kernels")
+{
+    // long enough for the byte counters to be flushed more than once
+    std::string data(20'000, 'x');
+    for (std::size_t i = 0; i < data.size(); ++i) {
+        data[i] = static_cast<char>(i * 7 % 23);
+    }
+    const int64_t expected = std::count(data.begin(), data.end(), '\n');
+    CHECK(count_newlines_scalar(data.data(), data.size()) == expected);
+
+    for (const SimdLevel level : {SimdLevel::SSE2, SimdLevel::AVX2}) {
+        const CountNewlinesFn count_newlines = get_newline_counter(level);
+        CHECK(count_newlines(data.data(), data.size()) == expected);
+
+        int32_t mismatches{0};
+        for (std::size_t offset = 0; offset < 40; ++offset) {
+            for (std::size_t size = 0; size < 100; ++size) {
+                const char* const begin = data.data() + offset;
+                mismatches += count_newlines(begin, size) != std::count(begin, begin + size, '\n');
+            }
+        }
+        CHECK(mismatches == 0);
+    }
+}
+
+TEST_CASE("UTF-8 validation kernels")
+{
+    struct Sample
+    {
+        std::string_view bytes;
+        bool valid;
+    };
+    constexpr Sample samples[]{
+        {"ascii", true},
+        {"\u039b\u03bf", true},
+        {"\xef\xbf\xbf", true},         // U+FFFF
+        {"\xf0\x9f\x98\x80", true},     // U+1F600
+        {"\xf4\x8f\xbf\xbf", true},     // U+10FFFF
+        {"\xc0\x80", false},             // overlong
+        {"\xe0\x9f\xbf", false},         // overlong
+        {"\xf0\x8f\xbf\xbf", false},     // overlong
+        {"\xed\xa0\x80", false},         // surrogate
+        {"\xf4\x90\x80\x80", false},     // above U+10FFFF
+        {"\xf5\x80\x80\x80", false},
+        {"\x80", false},                 // continuation without lead
+        {"\xce", false},                 // truncated
+        {"\xe2\x82", false},             // truncated
+        {"\xce\xce\x9b", false},         // lead followed by lead
+        {"\xce\x9b\x9b", false},         // too many continuations
+    };
+
+    for (const SimdLevel level : {SimdLevel::SCALAR, SimdLevel::SSE2, SimdLevel::AVX2}) {
+        const ValidateUtf8Fn validate = get_utf8_validator(level);
+        int32_t mismatches{0};
+        // at every position relative to 16 and 32 byte blocks, then at the end
+        for (const Sample& sample : samples) {
+            for (std::size_t offset = 0; offset < 70; ++offset) {
+                std::string text(offset, 'x');
+                text.append(sample.bytes).append(70 - offset, 'y');
+                mismatches += validate(text.data(), text.size()) != sample.valid;
+                text.resize(offset + sample.bytes.size());
+                mismatches += validate(text.data(), text.size()) != sample.valid;
+            }
+        }
+        CHECK(mismatches == 0);
+    }
+
+    // every two byte combination, straddling the middle and the end of a 32 byte block
+    const ValidateUtf8Fn validate_sse2 = get_utf8_validator(SimdLevel::SSE2);
+    const ValidateUtf8Fn validate_avx2 = get_utf8_validator(SimdLevel::AVX2);
+    int32_t mismatches{0};
+    for (const std::size_t position : {15, 31}) {
+        std::string text(64, 'x');
+        for (int32_t first = 0; first < 256; ++first) {
+            for (int32_t second = 0; second < 256; ++second) {
+                text[position] = static_cast<char>(first);
+                text[position + 1] = static_cast<char>(second);
+                const bool expected = validate_utf8_scalar(text.data(), text.size());
+                mismatches += validate_sse2(text.data(), text.size()) != expected;
+                mismatches += validate_avx2(text.data(), text.size()) != expected;
+            }
+        }
+    }
+    CHECK(mismatches == 0);
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+/**
+ * Character classes of one 64 byte block of source, bit `i` describes
+ * byte `i`. The scanner finds the end of whitespace, comments, strings,
+ * identifiers and numbers with a count-trailing-zeros on these instead of
+ * looking at every byte.
+ */
+struct CharClassMasks
+{
+    uint64_t whitespace;     // ' ', '\t', '\r', '\n'
+    uint64_t newline;        // '\n'
+    uint64_t string_special; // '"' and non-ASCII bytes
+    uint64_t identifier;     // [A-Za-z_]
+    uint64_t digit;          // [0-9]
+
+    bool operator==(const CharClassMasks&) const = default;
+};
+
+inline constexpr int32_t CLASSIFY_BLOCK_SIZE = 64;
+
+//! `block` must point to CLASSIFY_BLOCK_SIZE readable bytes.
+using ClassifyFn = CharClassMasks (*)(const char* block) noexcept;
+
+//! Number of '\n' in the `size` bytes at `data`.
+using CountNewlinesFn = int64_t (*)(const char* data, std::size_t size) noexcept;
+
+/**
+ * Whether the `size` bytes at `data` are well-formed UTF-8 (RFC 3629): no
+ * overlong encodings, surrogates, code points above U+10FFFF or truncated
+ * sequences.
+ */
+using ValidateUtf8Fn = bool (*)(const char* data, std::size_t size) noexcept;
+
+enum class SimdLevel : uint8_t
+{
+    SCALAR,
+    SSE2,
+    AVX2,
+};
+
+std::string_view simd_level_to_string(SimdLevel level) noexcept;
+
+//! Best level supported by the CPU we are running on
+SimdLevel detect_simd_level() noexcept;
+
+//! Falls back to the next lower level if `level` is not available.
+ClassifyFn get_classifier(SimdLevel level) noexcept;
+CountNewlinesFn get_newline_counter(SimdLevel level) noexcept;
+ValidateUtf8Fn get_utf8_validator(SimdLevel level) noexcept;
+
+namespace detail
+{
+
+// Defined in scan_kernels_avx2.cpp, which is the only file built with AVX2
+// enabled. Return nullptr if the compiler can't target AVX2.
+ClassifyFn get_avx2_classifier() noexcept;
+CountNewlinesFn get_avx2_newline_counter() noexcept;
+ValidateUtf8Fn get_avx2_utf8_validator() noexcept;
+
+} // namespace detail
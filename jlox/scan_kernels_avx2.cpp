@@ -0,0 +1,260 @@
+// This file is compiled with -mavx2. Keep it free of inline functions
+// shared with other translation units (e.g. anything from the standard
+// library), the linker could otherwise pick an AVX2 copy of them for
+// code that runs on CPUs without AVX2.
+
+#include "scan_kernels.hpp"
+
+#if defined(__AVX2__)
+
+#include <immintrin.h>
+
+namespace
+{
+
+inline
+uint64_t to_bits(const __m256i v) noexcept
+{
+    return static_cast<uint32_t>(_mm256_movemask_epi8(v));
+}
+
+inline
+__m256i eq(const __m256i v, const char c) noexcept
+{
+    return _mm256_cmpeq_epi8(v, _mm256_set1_epi8(c));
+}
+
+//! bytes in ['first', 'first' + count), with a signed compare after moving the range to -128
+inline
+__m256i in_range(const __m256i v, const char first, const int32_t count) noexcept
+{
+    const __m256i shifted = _mm256_add_epi8(v, _mm256_set1_epi8(static_cast<char>(0x80 - first)));
+    return _mm256_cmpgt_epi8(_mm256_set1_epi8(static_cast<char>(-128 + count)), shifted);
+}
+
+CharClassMasks classify_avx2(const char* const block) noexcept
+{
+    CharClassMasks result{};
+    for (int32_t half = 0; half < 2; ++half) {
+        const __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block + 32 * half));
+        const int32_t shift = 32 * half;
+
+        const __m256i newline = eq(c, '\n');
+        const __m256i whitespace = _mm256_or_si256(_mm256_or_si256(eq(c, ' '), eq(c, '\t')),
+                                                   _mm256_or_si256(eq(c, '\r'), newline));
+        const __m256i lower = _mm256_or_si256(c, _mm256_set1_epi8(0x20));
+        const __m256i identifier = _mm256_or_si256(in_range(lower, 'a', 26), eq(c, '_'));
+
+        result.whitespace |= to_bits(whitespace) << shift;
+        result.newline |= to_bits(newline) << shift;
+        // the sign bit of non-ASCII bytes is what movemask extracts anyway
+        result.string_special |= (to_bits(eq(c, '"')) | to_bits(c)) << shift;
+        result.identifier |= to_bits(identifier) << shift;
+        result.digit |= to_bits(in_range(c, '0', 10)) << shift;
+    }
+    return result;
+}
+
+int64_t count_newlines_avx2(const char* const data, const std::size_t size) noexcept
+{
+    const __m256i newline = _mm256_set1_epi8('\n');
+    int64_t count{0};
+    std::size_t i{0};
+    while (size - i >= 32) {
+        // the byte counters would overflow after 255 rounds
+        const std::size_t rounds = (size - i) / 32 < 255 ? (size - i) / 32 : 255;
+        const std::size_t end = i + 32 * rounds;
+        __m256i counters = _mm256_setzero_si256();
+        for (; i < end; i += 32) {
+            const __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+            counters = _mm256_sub_epi8(counters, _mm256_cmpeq_epi8(c, newline));
+        }
+        const __m256i sums = _mm256_sad_epu8(counters, _mm256_setzero_si256());
+        const __m128i half = _mm_add_epi64(_mm256_castsi256_si128(sums), _mm256_extracti128_si256(sums, 1));
+        count += _mm_cvtsi128_si32(half) + _mm_cvtsi128_si32(_mm_unpackhi_epi64(half, half));
+    }
+    for (; i < size; ++i) {
+        count += data[i] == '\n';
+    }
+    return count;
+}
+
+/*
+ * UTF-8 validation as in Keiser & Lemire, "Validating UTF-8 In Less Than
+ * One Instruction Per Byte" (2021). Every error shows up in the first two
+ * bytes of a sequence plus whether the byte two or three back starts a
+ * long sequence. Each error class gets one bit; three table lookups on
+ * the nibbles of the previous and the current byte yield the classes that
+ * pair violates.
+ */
+constexpr uint8_t TOO_SHORT = 1 << 0;      // lead byte not followed by a continuation
+constexpr uint8_t TOO_LONG = 1 << 1;       // ASCII followed by a continuation
+constexpr uint8_t OVERLONG_3 = 1 << 2;
+constexpr uint8_t TOO_LARGE = 1 << 3;
+constexpr uint8_t SURROGATE = 1 << 4;
+constexpr uint8_t OVERLONG_2 = 1 << 5;
+constexpr uint8_t TOO_LARGE_1000 = 1 << 6;
+constexpr uint8_t OVERLONG_4 = 1 << 6;
+constexpr uint8_t TWO_CONTS = 1 << 7;      // continuation following a continuation
+constexpr uint8_t CARRY = TOO_SHORT | TOO_LONG | TWO_CONTS;
+
+// indexed by the high nibble of the previous byte
+alignas(16) constexpr uint8_t BYTE_1_HIGH[16]{
+    TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+    TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,
+    TOO_SHORT | OVERLONG_2,
+    TOO_SHORT,
+    TOO_SHORT | OVERLONG_3 | SURROGATE,
+    TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4,
+};
+
+// indexed by the low nibble of the previous byte
+alignas(16) constexpr uint8_t BYTE_1_LOW[16]{
+    CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4,
+    CARRY | OVERLONG_2,
+    CARRY,
+    CARRY,
+    CARRY | TOO_LARGE,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+};
+
+// indexed by the high nibble of the current byte
+alignas(16) constexpr uint8_t BYTE_2_HIGH[16]{
+    TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+    TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4,
+    TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE,
+    TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+    TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+    TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+};
+
+inline
+__m256i lookup(const __m256i nibbles, const uint8_t* const table) noexcept
+{
+    const __m256i lanes = _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i*>(table)));
+    return _mm256_shuffle_epi8(lanes, nibbles);
+}
+
+inline
+__m256i high_nibbles(const __m256i v) noexcept
+{
+    return _mm256_and_si256(_mm256_srli_epi16(v, 4), _mm256_set1_epi8(0x0f));
+}
+
+inline
+__m256i low_nibbles(const __m256i v) noexcept
+{
+    return _mm256_and_si256(v, _mm256_set1_epi8(0x0f));
+}
+
+//! `input` shifted right by N bytes, with the last N bytes of `previous` in front
+template <int N>
+__m256i previous_bytes(const __m256i input, const __m256i previous) noexcept
+{
+    return _mm256_alignr_epi8(input, _mm256_permute2x128_si256(previous, input, 0x21), 16 - N);
+}
+
+__m256i utf8_errors(const __m256i input, const __m256i previous) noexcept
+{
+    const __m256i prev1 = previous_bytes<1>(input, previous);
+    const __m256i special_cases = _mm256_and_si256(
+        _mm256_and_si256(lookup(high_nibbles(prev1), BYTE_1_HIGH),
+                         lookup(low_nibbles(prev1), BYTE_1_LOW)),
+        lookup(high_nibbles(input), BYTE_2_HIGH));
+
+    // A continuation two bytes after a 111_____ or three after a 1111____
+    // lead is expected; there TWO_CONTS must be set and it is flipped off.
+    const __m256i third_byte = _mm256_subs_epu8(previous_bytes<2>(input, previous), _mm256_set1_epi8(static_cast<char>(0xe0 - 0x80)));
+    const __m256i fourth_byte = _mm256_subs_epu8(previous_bytes<3>(input, previous), _mm256_set1_epi8(static_cast<char>(0xf0 - 0x80)));
+    const __m256i must_be_continuation = _mm256_and_si256(_mm256_or_si256(third_byte, fourth_byte),
+                                                          _mm256_set1_epi8(static_cast<char>(0x80)));
+    return _mm256_xor_si256(must_be_continuation, special_cases);
+}
+
+//! Non-zero if the block ends in the middle of a sequence
+__m256i incomplete_at_end(const __m256i input) noexcept
+{
+    const __m256i max = _mm256_setr_epi8(
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        static_cast<char>(0xf0 - 1), static_cast<char>(0xe0 - 1), static_cast<char>(0xc0 - 1));
+    return _mm256_subs_epu8(input, max);
+}
+
+bool validate_utf8_avx2(const char* const data, const std::size_t size) noexcept
+{
+    __m256i errors = _mm256_setzero_si256();
+    __m256i previous = _mm256_setzero_si256();
+    __m256i previous_incomplete = _mm256_setzero_si256();
+
+    auto validate_block = [&] (const __m256i input) {
+        if (_mm256_movemask_epi8(input) == 0) {
+            // ASCII can't finish a sequence the previous block started
+            errors = _mm256_or_si256(errors, previous_incomplete);
+        } else {
+            errors = _mm256_or_si256(errors, utf8_errors(input, previous));
+            previous_incomplete = incomplete_at_end(input);
+        }
+        previous = input;
+    };
+
+    std::size_t i{0};
+    for (; size - i >= 32; i += 32) {
+        validate_block(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i)));
+    }
+    // padded with zeros, which end any incomplete sequence as an error
+    alignas(32) char tail[32]{};
+    for (std::size_t k = 0; i + k < size; ++k) {
+        tail[k] = data[i + k];
+    }
+    validate_block(_mm256_load_si256(reinterpret_cast<const __m256i*>(tail)));
+
+    errors = _mm256_or_si256(errors, previous_incomplete);
+    return _mm256_testz_si256(errors, errors);
+}
+
+} // anonymous namespace
+
+ClassifyFn detail::get_avx2_classifier() noexcept
+{
+    return &classify_avx2;
+}
+
+CountNewlinesFn detail::get_avx2_newline_counter() noexcept
+{
+    return &count_newlines_avx2;
+}
+
+ValidateUtf8Fn detail::get_avx2_utf8_validator() noexcept
+{
+    return &validate_utf8_avx2;
+}
+
+#else
+
+ClassifyFn detail::get_avx2_classifier() noexcept
+{
+    return nullptr;
+}
+
+CountNewlinesFn detail::get_avx2_newline_counter() noexcept
+{
+    return nullptr;
+}
+
+ValidateUtf8Fn detail::get_avx2_utf8_validator() noexcept
+{
+    return nullptr;
+}
+
+#endif
@@ -1,34 +1,34 @@
 #include "scanner.hpp"
 
 #include <algorithm>
+#include <array>
+#include <bit>
 #include <cassert>
 #include <cctype>
+#include <memory>
+#include <optional>
+#include <string>
+#include <thread>
+#include <utility>
+
+#include <absl/container/flat_hash_map.h>
 
 #include <doctest/doctest.h>
 
 #include "log.hpp"
+#include "scan_kernels.hpp"
 #include "utf-8.hpp"
 
-#define STRINGIFY_(x) #x
-#define STRINGIFY(x) STRINGIFY_(x)
-
 namespace
 {
 
-Position offset_to_position(std::span<const int32_t> map, int32_t offset)
-{
-    assert(offset >= 0);
-    assert(map.size() >= 1);
+//! OffsetToLine counts the newlines before every block of this size
+constexpr size_t LINE_INDEX_BLOCK_SIZE = 4096;
 
-    auto it = std::lower_bound(map.begin(), map.end(), offset);
-
-    if (it != map.end() && *it == offset) {
-        const size_t line = std::distance(map.begin(), it) + 1;
-        return {static_cast<int32_t>(line), 1};
-    }
-    --it;
-    const size_t line = std::distance(map.begin(), it) + 1;
-    return {static_cast<int32_t>(line), 1 + (offset - *it)};
+int32_t count_newlines(std::string_view text) noexcept
+{
+    static const CountNewlinesFn count = get_newline_counter(detect_simd_level());
+    return static_cast<int32_t>(count(text.data(), text.size()));
 }
 
 TEST_CASE("Position from offset")
@@ -36,16 +36,44 @@ TEST_CASE("Position from offset")
     // line #1: 12 characters
     // line #2: 10 characters
     // line #3: 26 characters
-    static constexpr int32_t otl[3]{
-        0,
-        12,
-        22
-    };
+    const std::string source = std::string(11, 'a') + '\n'
+        + std::string(9, 'b') + '\n'
+        + std::string(26, 'c');
+    const OffsetToLine otl{source};
+
+    CHECK(otl.num_lines() == 3);
+    CHECK(otl.get_offset(2) == 12);
+    CHECK(otl.get_offset(3) == 22);
+
+    CHECK(otl.get_position(0) == Position{1, 1});
+    CHECK(otl.get_position(11) == Position{1, 12});
+    CHECK(otl.get_position(12) == Position{2, 1});
+    CHECK(otl.get_position(25) == Position{3, 4});
+}
+
+TEST_CASE("Position from offset across index blocks")
+{
+    std::string source;
+    std::vector<int32_t> line_offsets{0};
+    for (int32_t line_length = 1; source.size() < 5 * LINE_INDEX_BLOCK_SIZE; line_length = line_length * 7 % 1000) {
+        source.append(line_length, 'x').append("\n");
+        line_offsets.push_back(static_cast<int32_t>(source.size()));
+    }
+    const OffsetToLine otl{source};
 
-    CHECK(offset_to_position(otl, 0) == Position{1, 1});
-    CHECK(offset_to_position(otl, 11) == Position{1, 12});
-    CHECK(offset_to_position(otl, 12) == Position{2, 1});
-    CHECK(offset_to_position(otl, 25) == Position{3, 4});
+    REQUIRE(otl.num_lines() == static_cast<int32_t>(line_offsets.size()));
+    int32_t mismatches{0};
+    for (int32_t line = 1; line <= otl.num_lines(); ++line) {
+        mismatches += otl.get_offset(line) != line_offsets[line - 1];
+    }
+    int32_t line{1};
+    for (int32_t offset = 0; offset <= static_cast<int32_t>(source.size()); ++offset) {
+        if (line < otl.num_lines() && offset == line_offsets[line]) {
+            ++line;
+        }
+        mismatches += otl.get_position(offset) != Position{line, offset - line_offsets[line - 1] + 1};
+    }
+    CHECK(mismatches == 0);
 }
 
 class Reader
@@ -55,11 +83,10 @@ public:
     Reader(std::string_view source) noexcept
       : m_source{source}
       , m_offset{0}
-      , m_line{1}
-      , m_column{1}
-    {
-        m_offsets.push_back(0);
-    }
+      , m_classify{get_classifier(detect_simd_level())}
+      , m_masks{}
+      , m_block{-1}
+    {}
 
     constexpr
     int32_t offset() const noexcept
@@ -67,18 +94,6 @@ public:
         return m_offset;
     }
 
-    constexpr
-    int32_t line() const noexcept
-    {
-        return m_line;
-    }
-
-    constexpr
-    int32_t column() const noexcept
-    {
-        return m_column;
-    }
-
     constexpr
     bool eof() const noexcept
     {
@@ -105,6 +120,12 @@ public:
         return m_source[m_offset + n];
     }
 
+    constexpr
+    std::string_view source() const noexcept
+    {
+        return m_source;
+    }
+
     constexpr
     std::string_view remaining_source() const noexcept
     {
@@ -120,86 +141,133 @@ public:
         if (eof() || m_source[m_offset] != c) {
             return false;
         }
-        return advance();
+        ++m_offset;
+        return true;
     }
 
     //! Advance position and return previous character.
     char advance() noexcept
     {
         assert(static_cast<size_t>(m_offset) != m_source.size());
-        const char c = m_source[m_offset++];
-        ++m_column;
-        if (c == '\n') {
-            m_offsets.push_back(m_offset);
-            ++m_line;
-            m_column = 1;
-        }
-        return c;
+        return m_source[m_offset++];
     }
 
     char advance(int32_t n) noexcept
     {
         assert(n >= 1);
-        char c{'\0'};
-        while (n-- > 0) {
-            c = advance();
-        }
-        return c;
+        assert(static_cast<size_t>(m_offset + n) <= m_source.size());
+        m_offset += n;
+        return m_source[m_offset - 1];
     }
 
-    std::vector<int32_t>&& get_offsets() && noexcept
+    //! Go back to `offset`, e.g. to the start of a token that is incomplete.
+    void rewind(int32_t offset) noexcept
     {
-        return std::move(m_offsets);
+        assert(offset >= 0 && offset <= m_offset);
+        m_offset = offset;
     }
 
     /**
-     * Extract line.
+     * Continue with `source`, which starts with the source seen so far, but
+     * may live somewhere else.
      */
-    std::string_view get_line(int32_t line) const
+    void extend(std::string_view source) noexcept
     {
-        assert(line > 0 && line <= m_line);
-        assert(static_cast<size_t>(line - 1) < m_offsets.size());
+        assert(source.size() >= m_source.size());
+        m_source = source;
+        // the last block may have been padded
+        m_block = -1;
+    }
 
-        const int32_t offs = m_offsets[static_cast<size_t>(line - 1)];
-        const auto end = m_source.find('\n', offs);
-        if (end == m_source.npos) {
-            return m_source.substr(offs);
-        }
-        return m_source.substr(offs, end - offs);
+    //! Advance to the first character not in `char_class`.
+    void skip_while(uint64_t CharClassMasks::* char_class) noexcept
+    {
+        skip(char_class, ~uint64_t{0});
     }
 
+    //! Advance to the first character in `char_class`.
+    void skip_until(uint64_t CharClassMasks::* char_class) noexcept
+    {
+        skip(char_class, 0);
+    }
 
 private:
-    std::vector<int32_t> m_offsets;
+    void skip(uint64_t CharClassMasks::* char_class, const uint64_t invert) noexcept
+    {
+        const int32_t size = static_cast<int32_t>(m_source.size());
+        while (m_offset < size) {
+            const int32_t block = m_offset / CLASSIFY_BLOCK_SIZE;
+            const uint64_t stop = ((masks(block).*char_class) ^ invert) >> (m_offset % CLASSIFY_BLOCK_SIZE);
+            if (stop) {
+                m_offset += std::countr_zero(stop);
+                break;
+            }
+            m_offset = (block + 1) * CLASSIFY_BLOCK_SIZE;
+        }
+        // the padding after the end of the source is in no class
+        m_offset = std::min(m_offset, size);
+    }
+
+    const CharClassMasks& masks(const int32_t block) noexcept
+    {
+        if (block != m_block) {
+            m_masks = classify(block);
+            m_block = block;
+        }
+        return m_masks;
+    }
+
+    CharClassMasks classify(const int32_t block) const noexcept
+    {
+        const size_t begin = static_cast<size_t>(block) * CLASSIFY_BLOCK_SIZE;
+        if (begin + CLASSIFY_BLOCK_SIZE <= m_source.size()) {
+            return m_classify(m_source.data() + begin);
+        }
+        std::array<char, CLASSIFY_BLOCK_SIZE> padded{};
+        if (begin < m_source.size()) {
+            std::copy(m_source.begin() + begin, m_source.end(), padded.begin());
+        }
+        return m_classify(padded.data());
+    }
+
     std::string_view m_source;
     int32_t m_offset;
-    int32_t m_line;
-    int32_t m_column;
+    ClassifyFn m_classify;
+    CharClassMasks m_masks;
+    int32_t m_block;
 };
 
 /**
- * Parse strings. String may contain UTF-8.
+ * Advance past the closing quote of a string. String may contain UTF-8.
+ * Returns false at the end of the input or on invalid UTF-8, with the
+ * reader at the character that could not be read. If the whole source is
+ * known to be `valid_utf8`, sequences are skipped by their lead byte.
  */
-int32_t parse_string(Reader& reader)
+bool skip_string(Reader& reader, const bool valid_utf8)
 {
     // At this pointe we're at the first character AFTER the
-    // opening quote.
-    int32_t length = 0;
-
-    while (!reader.eof()) {
+    // opening quote, or where an earlier call stopped.
+    while (true) {
+        // only the closing quote and non-ASCII characters need a closer look
+        reader.skip_until(&CharClassMasks::string_special);
+        if (reader.eof()) {
+            return false;
+        }
+        if (reader.peek() == '"') {
+            reader.advance();
+            return true;
+        }
 
+        if (valid_utf8) {
+            reader.advance(std::countl_one(static_cast<uint8_t>(reader.peek())));
+            continue;
+        }
         UTF8Char c = parse_utf8_char(reader.remaining_source());
         if (c.length <= 0) {
-            return -1;
+            return false;
         }
-
         reader.advance(c.length);
-        if (c.c == '"') {
-            return length;
-        }
-        length += c.length;
     }
-    return -1;
 }
 
 /**
@@ -207,31 +275,34 @@ int32_t parse_string(Reader& reader)
  */
 int32_t parse_number(Reader& reader)
 {
-    bool has_dot = false;
-
-    int32_t length = 0;
-    while (!reader.eof()) {
-        const char c = reader.peek();
-        if (c == '.') {
-            if (!std::isdigit(reader.peek(1))) {
-                break;
-            }
-            if (has_dot) {
-                break;
-            }
-            has_dot = true;
-        } else if (!std::isdigit(c)) {
-            break;
-        }
-        ++length;
+    const int32_t begin = reader.offset();
+    reader.skip_while(&CharClassMasks::digit);
+    if (reader.peek() == '.' && std::isdigit(reader.peek(1))) {
         reader.advance();
+        reader.skip_while(&CharClassMasks::digit);
     }
-    return length;
+    return reader.offset() - begin;
 }
 
-bool is_alpha(char c)
+/**
+ * After a leading '0', parse the 'x' or 'b' and the hexadecimal or binary
+ * digits of an integer. Returns 0 if there is no such prefix.
+ */
+int32_t parse_prefixed_integer(Reader& reader)
 {
-    return std::isalpha(c) || c == '_';
+    const char prefix = static_cast<char>(reader.peek() | 0x20);
+    const auto is_digit = [prefix] (const char c) noexcept {
+        return prefix == 'x' ? std::isxdigit(static_cast<unsigned char>(c)) != 0 : c == '0' || c == '1';
+    };
+    if ((prefix != 'x' && prefix != 'b') || !is_digit(reader.peek(1))) {
+        return 0;
+    }
+    const int32_t begin = reader.offset();
+    reader.advance();
+    while (is_digit(reader.peek())) {
+        reader.advance();
+    }
+    return reader.offset() - begin;
 }
 
 /**
@@ -239,208 +310,606 @@ bool is_alpha(char c)
  */
 int32_t parse_identifier(Reader& reader)
 {
-    int32_t length = 0;
-    while (!reader.eof()) {
-        const char c = reader.peek();
-        if (!is_alpha(c)) {
-            break;
+    const int32_t begin = reader.offset();
+    reader.skip_while(&CharClassMasks::identifier);
+    return reader.offset() - begin;
+}
+
+/**
+ * What the main loop of scan_tokens does with the first character of a
+ * token. Lox's only multi-character operators are `X=` pairs, so the
+ * operator automaton is fully described by the token types for the
+ * character alone and for the character followed by '='.
+ */
+enum class CharClass : uint8_t
+{
+    INVALID,
+    WHITESPACE,
+    SINGLE,     // always a one character token
+    OPERATOR,   // one character token, or two if followed by '='
+    SLASH,      // division or start of a comment
+    QUOTE,
+    DIGIT,
+    ALPHA,
+};
+
+struct CharEntry
+{
+    CharClass cls{CharClass::INVALID};
+    TokenType type{};
+    TokenType type_with_equal{};
+};
+
+constexpr
+std::array<CharEntry, 256> make_char_table()
+{
+    using enum TokenType;
+    std::array<CharEntry, 256> table{};
+    auto set = [&table] (char c, CharClass cls, TokenType type = {}, TokenType type_with_equal = {}) {
+        table[static_cast<uint8_t>(c)] = {cls, type, type_with_equal};
+    };
+
+    for (const char c : {' ', '\r', '\t', '\n'}) {
+        set(c, CharClass::WHITESPACE);
+    }
+    for (char c = '0'; c <= '9'; ++c) {
+        set(c, CharClass::DIGIT);
+    }
+    for (char c = 'a'; c <= 'z'; ++c) {
+        set(c, CharClass::ALPHA);
+        set(static_cast<char>(c - 'a' + 'A'), CharClass::ALPHA);
+    }
+    set('_', CharClass::ALPHA);
+
+    set('(', CharClass::SINGLE, LEFT_PAREN);
+    set(')', CharClass::SINGLE, RIGHT_PAREN);
+    set('{', CharClass::SINGLE, LEFT_BRACE);
+    set('}', CharClass::SINGLE, RIGHT_BRACE);
+    set(',', CharClass::SINGLE, COMMA);
+    set('.', CharClass::SINGLE, DOT);
+    set('-', CharClass::SINGLE, MINUS);
+    set('+', CharClass::SINGLE, PLUS);
+    set(';', CharClass::SINGLE, SEMICOLON);
+    set('*', CharClass::SINGLE, STAR);
+
+    set('!', CharClass::OPERATOR, BANG, BANG_EQUAL);
+    set('=', CharClass::OPERATOR, EQUAL, EQUAL_EQUAL);
+    set('<', CharClass::OPERATOR, LESS, LESS_EQUAL);
+    set('>', CharClass::OPERATOR, GREATER, GREATER_EQUAL);
+
+    set('/', CharClass::SLASH, SLASH);
+    set('"', CharClass::QUOTE, STRING);
+    return table;
+}
+
+constexpr std::array<CharEntry, 256> CHAR_TABLE = make_char_table();
+
+struct Keyword
+{
+    std::string_view text;
+    TokenType type;
+};
+
+constexpr std::array<Keyword, 16> KEYWORDS{{
+    {"and", TokenType::AND},       {"class", TokenType::CLASS},   {"else", TokenType::ELSE},
+    {"false", TokenType::FALSE},   {"for", TokenType::FOR},       {"fun", TokenType::FUN},
+    {"if", TokenType::IF},         {"nil", TokenType::NIL},       {"or", TokenType::OR},
+    {"print", TokenType::PRINT},   {"return", TokenType::RETURN}, {"super", TokenType::SUPER},
+    {"this", TokenType::THIS},     {"true", TokenType::TRUE},     {"var", TokenType::VAR},
+    {"while", TokenType::WHILE},
+}};
+
+constexpr int32_t KEYWORD_TABLE_BITS = 5;
+
+/**
+ * No two keywords share their first two characters, so a multiplicative
+ * hash of those is enough; `seed` is searched for at compile time.
+ * Requires `word.size() >= 2`.
+ */
+constexpr
+uint32_t keyword_hash(const std::string_view word, const uint32_t seed) noexcept
+{
+    const uint32_t key = static_cast<uint8_t>(word[0]) * seed + static_cast<uint8_t>(word[1]);
+    return (key * 0x9e3779b1u) >> (32 - KEYWORD_TABLE_BITS);
+}
+
+constexpr
+uint32_t find_keyword_seed()
+{
+    for (uint32_t seed = 1; seed < 10'000; ++seed) {
+        std::array<bool, 1 << KEYWORD_TABLE_BITS> used{};
+        bool collision = false;
+        for (const Keyword& keyword : KEYWORDS) {
+            const uint32_t slot = keyword_hash(keyword.text, seed);
+            collision = collision || used[slot];
+            used[slot] = true;
+        }
+        if (!collision) {
+            return seed;
         }
-        ++length;
-        reader.advance();
     }
-    return length;
+    return 0;
 }
 
-TokenType get_type_of_identifier(std::string_view source,
-                                 int32_t offset,
-                                 int32_t length)
+constexpr uint32_t KEYWORD_SEED = find_keyword_seed();
+static_assert(KEYWORD_SEED != 0, "no perfect hash for the keyword set");
+
+constexpr
+std::array<Keyword, 1 << KEYWORD_TABLE_BITS> make_keyword_table()
 {
-    using enum TokenType;
-    assert(offset >= 0 && length > 0);
-    assert(static_cast<size_t>(offset + length) <= source.size());
-    std::string_view tok = source.substr(offset, length);
-#define CHK_KEYWRD(str, type) if (STRINGIFY(str) == tok) { return type; }
-    CHK_KEYWRD(and, AND);
-    CHK_KEYWRD(class, CLASS);
-    CHK_KEYWRD(else, ELSE);
-    CHK_KEYWRD(false, FALSE);
-    CHK_KEYWRD(for, FOR);
-    CHK_KEYWRD(fun, FUN);
-    CHK_KEYWRD(if, IF);
-    CHK_KEYWRD(nil, NIL);
-    CHK_KEYWRD(or, OR);
-    CHK_KEYWRD(print, PRINT);
-    CHK_KEYWRD(return, RETURN);
-    CHK_KEYWRD(super, SUPER);
-    CHK_KEYWRD(this, THIS);
-    CHK_KEYWRD(true, TRUE);
-    CHK_KEYWRD(var, VAR);
-    CHK_KEYWRD(while, WHILE);
-#undef CHK_KEYWRD
-    return IDENTIFIER;
+    std::array<Keyword, 1 << KEYWORD_TABLE_BITS> table{};
+    table.fill({"", TokenType::IDENTIFIER});
+    for (const Keyword& keyword : KEYWORDS) {
+        table[keyword_hash(keyword.text, KEYWORD_SEED)] = keyword;
+    }
+    return table;
 }
 
-} // anonymous namespace
+constexpr std::array<Keyword, 1 << KEYWORD_TABLE_BITS> KEYWORD_TABLE = make_keyword_table();
 
+constexpr
+TokenType get_type_of_identifier(const std::string_view word) noexcept
+{
+    if (word.size() < 2) {
+        return TokenType::IDENTIFIER;
+    }
+    const Keyword& candidate = KEYWORD_TABLE[keyword_hash(word, KEYWORD_SEED)];
+    return candidate.text == word ? candidate.type : TokenType::IDENTIFIER;
+}
 
-ScannerResult scan_tokens(std::string_view source)
+static_assert(get_type_of_identifier("while") == TokenType::WHILE);
+static_assert(get_type_of_identifier("whale") == TokenType::IDENTIFIER);
+
+struct ScanError
 {
-    int32_t num_errors{0};
+    int32_t offset;
+    std::string message;
+};
 
+/**
+ * Errors are reported once scanning is done, only then is the line table
+ * available.
+ */
+void report_scan_errors(const ScannerResult& result, std::span<const ScanError> errors)
+{
+    for (const ScanError& error : errors) {
+        const Position pos = result.offsets.get_position(error.offset);
+        report_error(pos.line,
+                     pos.column,
+                     get_line_from_offset(result.source, result.offsets.get_offset(pos.line)),
+                     "{}",
+                     error.message);
+    }
+}
+
+//! Tokens and errors of one piece of a source scanned in parallel
+struct ChunkResult
+{
     std::vector<Token> tokens;
-    auto add_token = [&] (TokenType type, int32_t offset, int32_t length) {
-        tokens.emplace_back(type, offset, length);
-    };
+    std::vector<SymbolId> symbols;
+    std::vector<ScanError> errors;
+    // Start of a string that is still open at the end of the chunk
+    std::optional<int32_t> open_string;
+};
 
-    Reader reader{source};
-    while (!reader.eof()) {
-        using enum TokenType;
-        const size_t offset = reader.offset();
-        const int32_t column = reader.column();
-        const int32_t line = reader.line();
-        const char c = reader.advance();
-
-        switch (c) {
-        case '(':
-            add_token(LEFT_PAREN, offset, 1);
-            break;
+/**
+ * The scan loop, for a source that is either complete or still growing,
+ * or for a chunk of a larger source.
+ */
+class TokenScanner
+{
+public:
+    /**
+     * Scan `source`, or a chunk of it which starts `base` bytes into it.
+     * `valid_utf8` if the whole source has been validated up front.
+     */
+    explicit
+    TokenScanner(std::string_view source, bool valid_utf8 = false, int32_t base = 0)
+      : m_reader{source}
+      , m_base{base}
+      , m_valid_utf8{valid_utf8}
+      , m_pending{CharClass::INVALID}
+      , m_pending_begin{0}
+    {
+        // Typical code has about one token per three bytes, growing the
+        // vector would copy every token and touch twice the memory.
+        m_tokens.reserve(source.size() / 3 + 1);
+        // and about one identifier per 16 bytes
+        m_symbols.reserve(source.size() / 16 + 1);
+    }
 
-        case ')':
-            add_token(RIGHT_PAREN, offset, 1);
-            break;
+    //! The chunk starts inside a string that begins at `begin`.
+    void resume_string(int32_t begin) noexcept
+    {
+        assert(begin < m_base);
+        m_pending = CharClass::QUOTE;
+        m_pending_begin = begin - m_base;
+    }
 
-        case '{':
-            add_token(LEFT_BRACE, offset, 1);
-            break;
+    void extend(std::string_view source) noexcept
+    {
+        m_reader.extend(source);
+    }
 
-        case '}':
-            add_token(RIGHT_BRACE, offset, 1);
-            break;
+    /**
+     * Scan up to the end of the source seen so far. Unless `final`, stop
+     * in front of a token that could continue in the next chunk; strings
+     * and comments remember where they stopped instead.
+     */
+    void scan(bool final);
 
-        case ',':
-            add_token(COMMA, offset, 1);
-            break;
+    const std::vector<Token>& tokens() const noexcept
+    {
+        return m_tokens;
+    }
 
-        case '.':
-            add_token(DOT, offset, 1);
-            break;
+    /**
+     * Unless it's the `last` chunk, a chunk ends after a newline, where
+     * only a string can continue.
+     */
+    ChunkResult finish_chunk(bool last) &&;
 
-        case '-':
-            add_token(MINUS, offset, 1);
-            break;
+    ScannerResult finish(std::string_view source) &&
+    {
+        m_reader.extend(source);
+        scan(true);
+        m_tokens.emplace_back(TokenType::END_OF_FILE, source.size(), 0);
+
+        ScannerResult result{source,
+                                   std::move(m_tokens),
+                                   std::move(m_symbols),
+                                   OffsetToLine{source},
+                                   static_cast<int32_t>(m_errors.size()),
+                                   nullptr};
+        report_scan_errors(result, m_errors);
+        return result;
+    }
 
-        case '+':
-            add_token(PLUS, offset, 1);
-            break;
+private:
+    void add_token(TokenType type, int32_t offset, int32_t length)
+    {
+        if (length > Token::MAX_LENGTH) {
+            report_error_at(offset, fmt::format("Token is longer than {} bytes.", Token::MAX_LENGTH));
+            return;
+        }
+        m_tokens.emplace_back(type, m_base + offset, length);
+        if (type == TokenType::IDENTIFIER) {
+            m_symbols.push_back(intern(m_reader.source().substr(offset, length)));
+        }
+    }
 
-        case ';':
-            add_token(SEMICOLON, offset, 1);
-            break;
+    /**
+     * intern_symbol() behind two caches that take no lock. Most identifiers
+     * are one of a few names used over and over, those hit a direct mapped
+     * table indexed by length and first and last letter, no hashing needed.
+     */
+    SymbolId intern(std::string_view name)
+    {
+        RecentSymbol& recent = m_recent_symbols[(name.size() * 31 + static_cast<unsigned char>(name.front()) * 7
+                                                 + static_cast<unsigned char>(name.back())) % m_recent_symbols.size()];
+        if (recent.name == name) {
+            return recent.symbol;
+        }
+        SymbolId symbol{NO_SYMBOL};
+        if (const auto it = m_symbol_cache.find(name); it != m_symbol_cache.end()) {
+            symbol = it->second;
+        } else {
+            symbol = intern_symbol(name);
+            m_symbol_cache.emplace(symbol_name(symbol), symbol);
+        }
+        // the source may move while streaming, the interned name doesn't
+        recent = {symbol_name(symbol), symbol};
+        return symbol;
+    }
 
-        case '*':
-            add_token(STAR, offset, 1);
-            break;
+    //! Less than one byte of lookahead left before more input arrives.
+    bool needs_more_input(bool final) const noexcept
+    {
+        return !final && m_reader.remaining_source().size() <= 1;
+    }
 
-        case '!':
-            if (reader.match('=')) {
-                add_token(BANG_EQUAL, offset, 2);
-            } else {
-                add_token(BANG, offset, 1);
-            }
-            break;
+    void scan_string(int32_t begin, bool final);
+    void scan_comment(int32_t begin, bool final);
 
-        case '=':
-            if (reader.match('=')) {
-                add_token(EQUAL_EQUAL, offset, 2);
-            } else {
-                add_token(EQUAL, offset, 1);
-            }
+    void report_error_at(int32_t offset, std::string message)
+    {
+        m_errors.push_back({m_base + offset, std::move(message)});
+    }
+
+    Reader m_reader;
+    std::vector<Token> m_tokens;
+    std::vector<SymbolId> m_symbols;
+    struct RecentSymbol
+    {
+        std::string_view name;
+        SymbolId symbol{NO_SYMBOL};
+    };
+    std::array<RecentSymbol, 256> m_recent_symbols{};
+    absl::flat_hash_map<std::string_view, SymbolId> m_symbol_cache;
+    int32_t m_base;
+    bool m_valid_utf8;
+    std::vector<ScanError> m_errors;
+    // A string or comment cut off by the end of the input so far,
+    // CharClass::INVALID if none.
+    CharClass m_pending;
+    int32_t m_pending_begin;
+};
+
+void TokenScanner::scan_string(const int32_t begin, const bool final)
+{
+    if (skip_string(m_reader, m_valid_utf8)) {
+        add_token(TokenType::STRING, begin, m_reader.offset() - begin);
+    } else if (!final && m_reader.remaining_source().size() < 4) {
+        // end of input, or a UTF-8 sequence that is not complete yet
+        m_pending = CharClass::QUOTE;
+        m_pending_begin = begin;
+    } else {
+        report_error_at(begin, "Unterminated string.");
+    }
+}
+
+void TokenScanner::scan_comment(const int32_t begin, const bool final)
+{
+    m_reader.skip_until(&CharClassMasks::newline);
+    if (!final && m_reader.eof()) {
+        m_pending = CharClass::SLASH;
+        m_pending_begin = begin;
+    }
+}
+
+void TokenScanner::scan(const bool final)
+{
+    switch (std::exchange(m_pending, CharClass::INVALID)) {
+    case CharClass::QUOTE:
+        scan_string(m_pending_begin, final);
+        break;
+    case CharClass::SLASH:
+        scan_comment(m_pending_begin, final);
+        break;
+    default:
+        break;
+    }
+    if (m_pending != CharClass::INVALID) {
+        return;
+    }
+
+    while (!m_reader.eof()) {
+        const int32_t offset = m_reader.offset();
+        const char c = m_reader.advance();
+        const CharEntry& entry = CHAR_TABLE[static_cast<uint8_t>(c)];
+
+        switch (entry.cls) {
+        using enum CharClass;
+        case SINGLE:
+            add_token(entry.type, offset, 1);
             break;
 
-        case '<':
-            if (reader.match('=')) {
-                add_token(LESS_EQUAL, offset, 2);
+        case OPERATOR:
+            if (needs_more_input(final)) {
+                m_reader.rewind(offset);
+                return;
+            }
+            if (m_reader.match('=')) {
+                add_token(entry.type_with_equal, offset, 2);
             } else {
-                add_token(LESS, offset, 1);
+                add_token(entry.type, offset, 1);
             }
             break;
 
-        case '>':
-            if (reader.match('=')) {
-                add_token(GREATER_EQUAL, offset, 2);
+        case SLASH:
+            if (m_reader.match('/')) {
+                scan_comment(offset, final);
+                if (m_pending != INVALID) {
+                    return;
+                }
+            } else if (needs_more_input(final)) {
+                m_reader.rewind(offset);
+                return;
             } else {
-                add_token(GREATER, offset, 1);
+                add_token(entry.type, offset, 1);
             }
             break;
 
-        case '/':
-            if (reader.match('/')) {
-                while (!reader.eof() && reader.peek() != '\n') {
-                    reader.advance();
-                }
-            } else {
-                add_token(SLASH, offset, 1);
+        case QUOTE:
+            scan_string(offset, final);
+            if (m_pending != INVALID) {
+                return;
             }
             break;
 
-        case '"':
+        // TODO: Handle 0711, 1.500000E+07
+        case DIGIT:
             {
-                const int32_t str_length = parse_string(reader);
-                if (str_length < 0) {
-                    num_errors++;
-                    report_error(line,
-                                 column,
-                                 reader.get_line(line),
-                                 "Unterminated string.");
-                } else {
-                    add_token(STRING, offset, str_length + 2);
+                int32_t length = c == '0' ? 1 + parse_prefixed_integer(m_reader) : 1;
+                if (length == 1) {
+                    length += parse_number(m_reader);
                 }
+                // "12." needs two characters of lookahead
+                if (!final && m_reader.remaining_source().size() <= 2) {
+                    m_reader.rewind(offset);
+                    return;
+                }
+                add_token(TokenType::NUMBER, offset, length);
             }
             break;
 
-        // TODO: Handle 0xaf, 0b101, 0711, 1.500000E+07
-        case '0':
-        case '1':
-        case '2':
-        case '3':
-        case '4':
-        case '5':
-        case '6':
-        case '7':
-        case '8':
-        case '9':
+        case WHITESPACE:
+            m_reader.skip_while(&CharClassMasks::whitespace);
+            break;
+
+        case ALPHA:
             {
-                add_token(NUMBER, offset, 1 + parse_number(reader));
+                const int32_t length = 1 + parse_identifier(m_reader);
+                if (needs_more_input(final)) {
+                    m_reader.rewind(offset);
+                    return;
+                }
+                const std::string_view word = m_reader.source().substr(offset, length);
+                add_token(get_type_of_identifier(word), offset, length);
             }
             break;
 
-        case ' ':
-        case '\r':
-        case '\t':
-        case '\n':
+        case INVALID:
+            report_error_at(offset, fmt::format("Unexpected character: \"{}\"", c));
             break;
+        }
+    }
+}
 
-        default:
-            if (is_alpha(c)) {
-                const int32_t l = parse_identifier(reader);
-                const TokenType type = get_type_of_identifier(source, offset, 1 + l);
-                add_token(type, offset, 1 + l);
-            } else {
-                ++num_errors;
-                report_error(line,
-                             column,
-                             reader.get_line(line), "Unexpected character: \"{}\"", c);
-            }
+ChunkResult TokenScanner::finish_chunk(const bool last) &&
+{
+    scan(false);
+    std::optional<int32_t> open_string;
+    if (!last && m_pending == CharClass::QUOTE && m_reader.eof()) {
+        open_string = m_base + m_pending_begin;
+    } else {
+        // tokens waiting for lookahead, a newline is all they get
+        scan(true);
+    }
+    return {std::move(m_tokens), std::move(m_symbols), std::move(m_errors), open_string};
+}
+
+ChunkResult scan_chunk(std::string_view source,
+                       const int32_t begin,
+                       const int32_t end,
+                       const std::optional<int32_t> open_string,
+                       const bool last,
+                       const bool valid_utf8)
+{
+    TokenScanner scanner{source.substr(begin, end - begin), valid_utf8, begin};
+    if (open_string) {
+        scanner.resume_string(*open_string);
+    }
+    return std::move(scanner).finish_chunk(last);
+}
+
+/**
+ * Scan `source` in `num_chunks` pieces at the same time. Pieces end after
+ * a newline, so the only thing a piece can start in the middle of is a
+ * string. Each is scanned as if it didn't; if the piece before it turns
+ * out to end in an open string, it is scanned again.
+ */
+ScannerResult scan_tokens_in_chunks(std::string_view source, const int32_t num_chunks, const bool valid_utf8)
+{
+    const int32_t size = static_cast<int32_t>(source.size());
+    std::vector<int32_t> bounds{0};
+    for (int32_t i = 1; i < num_chunks; ++i) {
+        const size_t split = std::max(static_cast<int64_t>(size) * i / num_chunks, int64_t{bounds.back()});
+        const size_t newline = source.find('\n', split);
+        if (newline == source.npos || static_cast<int32_t>(newline) + 1 >= size) {
             break;
         }
+        bounds.push_back(static_cast<int32_t>(newline) + 1);
     }
+    bounds.push_back(size);
+    const size_t count = bounds.size() - 1;
 
-    add_token(TokenType::END_OF_FILE, source.size(), 0);
+    std::vector<ChunkResult> chunks(count);
+    {
+        std::vector<std::thread> threads;
+        threads.reserve(count - 1);
+        for (size_t i = 1; i < count; ++i) {
+            threads.emplace_back([&, i] {
+                chunks[i] = scan_chunk(source, bounds[i], bounds[i + 1], std::nullopt, i + 1 == count, valid_utf8);
+            });
+        }
+        chunks[0] = scan_chunk(source, bounds[0], bounds[1], std::nullopt, count == 1, valid_utf8);
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+    }
+    for (size_t i = 1; i < count; ++i) {
+        if (chunks[i - 1].open_string) {
+            chunks[i] = scan_chunk(source, bounds[i], bounds[i + 1], chunks[i - 1].open_string, i + 1 == count, valid_utf8);
+        }
+    }
 
-    return {source,
-            std::move(tokens),
-            OffsetToLine{std::move(reader).get_offsets()},
-            num_errors};
+    size_t num_tokens{1};
+    size_t num_symbols{0};
+    size_t num_errors{0};
+    for (const ChunkResult& chunk : chunks) {
+        num_tokens += chunk.tokens.size();
+        num_symbols += chunk.symbols.size();
+        num_errors += chunk.errors.size();
+    }
+    std::vector<Token> tokens;
+    std::vector<SymbolId> symbols;
+    tokens.reserve(num_tokens);
+    symbols.reserve(num_symbols);
+    for (const ChunkResult& chunk : chunks) {
+        tokens.insert(tokens.end(), chunk.tokens.begin(), chunk.tokens.end());
+        symbols.insert(symbols.end(), chunk.symbols.begin(), chunk.symbols.end());
+    }
+    tokens.emplace_back(TokenType::END_OF_FILE, size, 0);
+
+    ScannerResult result{source,
+                               std::move(tokens),
+                               std::move(symbols),
+                               OffsetToLine{source},
+                               static_cast<int32_t>(num_errors),
+                               nullptr};
+    for (const ChunkResult& chunk : chunks) {
+        report_scan_errors(result, chunk.errors);
+    }
+    return result;
+}
+
+} // anonymous namespace
+
+
+struct StreamingScanner::State
+{
+    std::string buffer;
+    TokenScanner scanner{buffer};
+};
+
+StreamingScanner::StreamingScanner()
+  : m_state{std::make_unique<State>()}
+{}
+
+StreamingScanner::~StreamingScanner() = default;
+
+StreamingScanner::StreamingScanner(StreamingScanner&&) noexcept = default;
+
+StreamingScanner& StreamingScanner::operator=(StreamingScanner&&) noexcept = default;
+
+std::span<const Token> StreamingScanner::feed(std::string_view chunk)
+{
+    assert(m_state);
+    const size_t num_tokens = m_state->scanner.tokens().size();
+    m_state->buffer.append(chunk);
+    m_state->scanner.extend(m_state->buffer);
+    m_state->scanner.scan(false);
+    return std::span{m_state->scanner.tokens()}.subspan(num_tokens);
+}
+
+ScannerResult StreamingScanner::finish() &&
+{
+    assert(m_state);
+    const std::unique_ptr<State> state = std::move(m_state);
+    // moving a short string moves its characters, so take the view afterwards
+    auto storage = std::make_shared<const std::string>(std::move(state->buffer));
+    ScannerResult result = std::move(state->scanner).finish(*storage);
+    result.source_storage = std::move(storage);
+    return result;
+}
+
+ScannerResult scan_tokens(std::string_view source, const int32_t num_threads)
+{
+    assert(num_threads >= 1);
+    // One pass over the whole source, so strings don't need to decode
+    // their characters. A streamed source is never complete up front.
+    const bool valid_utf8 = is_valid_utf8(source);
+    const int64_t num_chunks = std::min<int64_t>(num_threads, source.size() / PARALLEL_SCAN_MIN_CHUNK_SIZE);
+    if (num_chunks <= 1) {
+        return TokenScanner{source, valid_utf8}.finish(source);
+    }
+    return scan_tokens_in_chunks(source, static_cast<int32_t>(num_chunks), valid_utf8);
+}
+
+ScannerResult scan_tokens(std::string_view source)
+{
+    return scan_tokens(source, static_cast<int32_t>(std::max(std::thread::hardware_concurrency(), 1u)));
 }
 
 TEST_CASE("scanner")
@@ -488,6 +957,18 @@ TEST_CASE("scanner")
         CHECK(result.tokens[0].offset() == 3);
     }
 
+    SUBCASE("Strings with validated and invalid UTF-8") {
+        const std::string_view valid = "\"λ€\U0001f600\"";
+        auto result = scan_tokens(valid);
+        CHECK(result.num_errors == 0);
+        REQUIRE(result.tokens.size() == 2);
+        CHECK(result.tokens[0].type() == TokenType::STRING);
+        CHECK(result.tokens[0].length() == static_cast<int32_t>(valid.size()));
+
+        // decoded character by character, and still an error
+        CHECK(scan_tokens("\"λ€\xff\"").num_errors > 0);
+    }
+
     SUBCASE("Numbers") {
         std::string_view source = " 12\n"
                                   "  092.2 \n"
@@ -521,6 +1002,52 @@ TEST_CASE("scanner")
         CHECK(result.tokens[4].offset() == 17);
     }
 
+    SUBCASE("Hexadecimal and binary numbers") {
+        std::string_view source = "0xfF 0B101 0x 0b2 0x1.5";
+
+        auto result = scan_tokens(source);
+        CHECK(result.num_errors == 0);
+
+        constexpr std::array<std::string_view, 11> expected{
+            "0xfF", "0B101", "0", "x", "0", "b", "2", "0x1", ".", "5", ""};
+        REQUIRE(result.tokens.size() == expected.size());
+        for (size_t i = 0; i < expected.size(); ++i) {
+            CHECK(result.tokens[i].lexeme(source) == expected[i]);
+        }
+    }
+
+    SUBCASE("Runs crossing block boundaries") {
+        std::string source;
+        source += std::string(100, ' ') + "\n";
+        source += "// ";
+        source.append(150, 'c').append("\n\"");
+        source.append(70, 's').append("\nΛ").append(60, 's').append("\"");
+        source += std::string(3, '\n') + std::string(130, 'x') + " 1234567890123.25";
+
+        auto result = scan_tokens(source);
+        CHECK(result.num_errors == 0);
+
+        REQUIRE(result.tokens.size() == 4);
+        CHECK(result.tokens[0].type() == TokenType::STRING);
+        CHECK(result.tokens[0].offset() == static_cast<int32_t>(source.find('"')));
+        CHECK(result.tokens[0].length() == 70 + 1 + 2 + 60 + 2);
+        CHECK(result.tokens[1].type() == TokenType::IDENTIFIER);
+        CHECK(result.tokens[1].length() == 130);
+        CHECK(result.tokens[2].type() == TokenType::NUMBER);
+        CHECK(result.tokens[2].length() == 16);
+
+        std::vector<int32_t> expected_offsets{0};
+        for (size_t i = 0; i < source.size(); ++i) {
+            if (source[i] == '\n') {
+                expected_offsets.push_back(static_cast<int32_t>(i + 1));
+            }
+        }
+        REQUIRE(result.offsets.num_lines() == static_cast<int32_t>(expected_offsets.size()));
+        for (int32_t line = 1; line <= result.offsets.num_lines(); ++line) {
+            CHECK(result.offsets.get_offset(line) == expected_offsets[line - 1]);
+        }
+    }
+
     SUBCASE("Identifiers and keywords") {
         std::string_view source = " var \n"
                                   " true \n"
@@ -544,20 +1071,167 @@ TEST_CASE("scanner")
         CHECK(result.tokens[2].type() == TokenType::IDENTIFIER);
         CHECK(result.tokens[2].length() == 4);
         CHECK(result.tokens[2].offset() == 14);
+
+        REQUIRE(result.symbols.size() == 1);
+        CHECK(symbol_name(result.symbols[0]) == "TRUE");
+    }
+
+    SUBCASE("All keywords") {
+        std::string source;
+        for (const Keyword& keyword : KEYWORDS) {
+            source += fmt::format("{0} {0}_ _{0} {1} ", keyword.text, keyword.text.substr(0, 2));
+        }
+
+        auto result = scan_tokens(source);
+        CHECK(result.num_errors == 0);
+        REQUIRE(result.tokens.size() == 4 * KEYWORDS.size() + 1);
+
+        int32_t wrong_types{0};
+        for (size_t i = 0; i < KEYWORDS.size(); ++i) {
+            const bool two_letter = KEYWORDS[i].text.size() == 2;
+            wrong_types += result.tokens[4 * i].type() != KEYWORDS[i].type;
+            wrong_types += result.tokens[4 * i + 1].type() != TokenType::IDENTIFIER;
+            wrong_types += result.tokens[4 * i + 2].type() != TokenType::IDENTIFIER;
+            wrong_types += result.tokens[4 * i + 3].type() != (two_letter ? KEYWORDS[i].type : TokenType::IDENTIFIER);
+        }
+        CHECK(wrong_types == 0);
+    }
+
+    SUBCASE("Parallel chunks") {
+        std::string source;
+        for (int32_t i = 0; i < 20; ++i) {
+            source += "var x = 12.5; // \"comment\"\n"
+                      "print \"a str\u00efng\nacross // lines\n\" + x;\n";
+            if (i == 10) {
+                // long enough to span several chunks
+                source += "\"";
+                for (int32_t line = 0; line < 40; ++line) {
+                    source += "var in_string = 1;\n";
+                }
+                source += "\";\n";
+            }
+        }
+        source += "fun f(a, b) { return a/b; }";
+        const ScannerResult expected = scan_tokens(source, 1);
+        REQUIRE(expected.num_errors == 0);
+
+        for (const int32_t num_chunks : {2, 3, 7, 16, 64}) {
+            const ScannerResult result = scan_tokens_in_chunks(source, num_chunks, true);
+            CHECK(result.num_errors == 0);
+
+            REQUIRE(result.tokens.size() == expected.tokens.size());
+            int32_t mismatches{0};
+            for (size_t i = 0; i < result.tokens.size(); ++i) {
+                mismatches += result.tokens[i].type() != expected.tokens[i].type()
+                    || result.tokens[i].offset() != expected.tokens[i].offset()
+                    || result.tokens[i].length() != expected.tokens[i].length();
+            }
+            CHECK(mismatches == 0);
+            CHECK(result.symbols == expected.symbols);
+
+            REQUIRE(result.offsets.num_lines() == expected.offsets.num_lines());
+            for (int32_t line = 1; line <= result.offsets.num_lines(); ++line) {
+                mismatches += result.offsets.get_offset(line) != expected.offsets.get_offset(line);
+            }
+            CHECK(mismatches == 0);
+        }
+    }
+
+    SUBCASE("Streaming in chunks") {
+        std::string source = "var x = 12.5; // comment\n"
+                             "print \"ΛΛΛ\" != nil or x >= 3.;\r\n"
+                             "fun f(a, b) { return a/b; }\n";
+        source.append("\"").append(150, 's').append("\" // ").append(150, 'c').append("\n12");
+        const ScannerResult expected = scan_tokens(source);
+        REQUIRE(expected.num_errors == 0);
+
+        for (const size_t chunk_size : {1, 2, 3, 7, 64, 65, 1000}) {
+            StreamingScanner scanner;
+            size_t num_fed_tokens{0};
+            for (size_t begin = 0; begin < source.size(); begin += chunk_size) {
+                num_fed_tokens += scanner.feed(std::string_view{source}.substr(begin, chunk_size)).size();
+            }
+            const ScannerResult result = std::move(scanner).finish();
+            CHECK(result.source == source);
+            CHECK(result.num_errors == 0);
+            // the last number and END_OF_FILE wait for finish()
+            CHECK(num_fed_tokens + 2 == result.tokens.size());
+
+            REQUIRE(result.tokens.size() == expected.tokens.size());
+            int32_t mismatches{0};
+            for (size_t i = 0; i < result.tokens.size(); ++i) {
+                mismatches += result.tokens[i].type() != expected.tokens[i].type()
+                    || result.tokens[i].offset() != expected.tokens[i].offset()
+                    || result.tokens[i].length() != expected.tokens[i].length();
+            }
+            CHECK(mismatches == 0);
+            CHECK(result.symbols == expected.symbols);
+
+            REQUIRE(result.offsets.num_lines() == expected.offsets.num_lines());
+            for (int32_t line = 1; line <= result.offsets.num_lines(); ++line) {
+                mismatches += result.offsets.get_offset(line) != expected.offsets.get_offset(line);
+            }
+            CHECK(mismatches == 0);
+        }
     }
 }
 
 
+const std::vector<int32_t>& OffsetToLine::index() const noexcept
+{
+    if (m_newlines_before.empty()) {
+        m_newlines_before.reserve(m_source.size() / LINE_INDEX_BLOCK_SIZE + 2);
+        m_newlines_before.push_back(0);
+        for (size_t begin = 0; begin < m_source.size(); begin += LINE_INDEX_BLOCK_SIZE) {
+            const int32_t newlines = count_newlines(m_source.substr(begin, LINE_INDEX_BLOCK_SIZE));
+            m_newlines_before.push_back(m_newlines_before.back() + newlines);
+        }
+    }
+    return m_newlines_before;
+}
+
 Position OffsetToLine::get_position(const int32_t offset) const noexcept
 {
-    return offset_to_position(m_offsets, offset);
+    assert(offset >= 0 && static_cast<size_t>(offset) <= m_source.size());
+
+    const size_t block = static_cast<size_t>(offset) / LINE_INDEX_BLOCK_SIZE;
+    const size_t block_begin = block * LINE_INDEX_BLOCK_SIZE;
+    const int32_t newlines = index()[block] + count_newlines(m_source.substr(block_begin, offset - block_begin));
+
+    const size_t previous_newline = offset == 0 ? m_source.npos : m_source.rfind('\n', offset - 1);
+    const int32_t column = previous_newline == m_source.npos
+        ? offset + 1
+        : offset - static_cast<int32_t>(previous_newline);
+    return {newlines + 1, column};
+}
+
+int32_t OffsetToLine::num_lines() const noexcept
+{
+    return index().back() + 1;
 }
 
 int32_t OffsetToLine::get_offset(const int32_t line) const noexcept
 {
-    assert(line > 0 && static_cast<size_t>(line) <= m_offsets.size());
+    assert(line > 0 && line <= num_lines());
+    if (line == 1) {
+        return 0;
+    }
 
-    return m_offsets[static_cast<size_t>(line - 1)];
+    // the line starts after newline number `line - 1`, in the first block
+    // that ends with at least that many
+    const std::vector<int32_t>& newlines_before = index();
+    const auto block_end = std::lower_bound(newlines_before.begin() + 1, newlines_before.end(), line - 1);
+    const size_t block = static_cast<size_t>(block_end - newlines_before.begin()) - 1;
+
+    size_t newline = block * LINE_INDEX_BLOCK_SIZE;
+    for (int32_t remaining = line - 1 - newlines_before[block]; ; --remaining) {
+        newline = m_source.find('\n', newline);
+        assert(newline != m_source.npos);
+        if (remaining == 1) {
+            return static_cast<int32_t>(newline) + 1;
+        }
+        ++newline;
+    }
 }
 
 
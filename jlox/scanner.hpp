@@ -1,9 +1,12 @@
 #pragma once
 
+#include <memory>
 #include <vector>
+#include <string>
 #include <string_view>
 #include <span>
 
+#include "symbols.hpp"
 #include "tokens.hpp"
 
 struct Position
@@ -14,35 +17,87 @@ struct Position
     auto operator<=>(const Position&) const = default;
 };
 
+/**
+ * Line and column of an offset into the source. This is only needed for
+ * error messages, so nothing is computed until the first query, and then
+ * only the number of newlines before every few kilobytes; a query counts
+ * the rest in one of those blocks.
+ *
+ * Queries fill in that index, don't share one between threads without
+ * making a query first.
+ */
 class OffsetToLine
 {
 public:
     explicit
-    OffsetToLine(std::vector<int32_t> offsets) noexcept
-      : m_offsets{std::move(offsets)}
+    OffsetToLine(std::string_view source) noexcept
+      : m_source{source}
     {}
 
     Position get_position(int32_t offset) const noexcept;
 
-    int32_t num_lines() const noexcept
-    {
-        return static_cast<int32_t>(m_offsets.size());
-    }
+    int32_t num_lines() const noexcept;
 
+    //! Offset of the first character of `line`
     int32_t get_offset(int32_t line) const noexcept;
 
 private:
-    std::vector<int32_t> m_offsets;
+    const std::vector<int32_t>& index() const noexcept;
+
+    std::string_view m_source;
+    // newlines before each block and in total, empty until needed
+    mutable std::vector<int32_t> m_newlines_before;
 };
 
 struct ScannerResult
 {
     std::string_view source;
     std::vector<Token> tokens;
+    //! Interned names of the IDENTIFIER tokens, in order
+    std::vector<SymbolId> symbols;
     OffsetToLine offsets;
     int32_t num_errors{0};
+    // Keeps `source` alive if it isn't owned by the caller, e.g. the
+    // buffer of a StreamingScanner or a MappedFile.
+    std::shared_ptr<const void> source_storage;
 };
 
 std::string_view get_line_from_offset(std::string_view source, int32_t offset);
 
+//! Sources are split into chunks of at least this size to be scanned in parallel
+inline constexpr int32_t PARALLEL_SCAN_MIN_CHUNK_SIZE = 1024 * 1024;
+
+//! Scans on up to `num_threads` threads, one per PARALLEL_SCAN_MIN_CHUNK_SIZE.
+ScannerResult scan_tokens(std::string_view source, int32_t num_threads);
+
+//! Scans on as many threads as the hardware has.
 ScannerResult scan_tokens(std::string_view source);
+
+/**
+ * Scans input that arrives in chunks, e.g. from a pipe, so lexing can
+ * overlap with reading. Tokens and the line table grow as complete tokens
+ * become available; the result is the same as scan_tokens() on the
+ * concatenated chunks.
+ */
+class StreamingScanner
+{
+public:
+    StreamingScanner();
+    ~StreamingScanner();
+
+    StreamingScanner(StreamingScanner&&) noexcept;
+    StreamingScanner& operator=(StreamingScanner&&) noexcept;
+
+    /**
+     * Append `chunk` and scan it. Returns the tokens completed by it, the
+     * span is valid until the next call.
+     */
+    std::span<const Token> feed(std::string_view chunk);
+
+    //! Scan whatever is left, the result owns the source.
+    ScannerResult finish() &&;
+
+private:
+    struct State;
+    std::unique_ptr<State> m_state;
+};
@@ -1,7 +1,8 @@
 #pragma once
 
 #include <cassert>
-#include <vector>
+#include <span>
+#include "symbols.hpp"
 #include "tokens.hpp"
 
 class Expr;
@@ -118,24 +119,32 @@ struct PrintStmt : StmtCRTC<PrintStmt>
 struct VarStmt : StmtCRTC<VarStmt>
 {
     constexpr
-    VarStmt(const Token* identifier, Expr* initializer) noexcept
+    VarStmt(const Token* identifier, SymbolId symbol, Expr* initializer) noexcept
       : identifier{identifier}
+      , symbol{symbol}
       , initializer{initializer}
     {
         assert(identifier && identifier->type() == TokenType::IDENTIFIER);
+        assert(symbol != NO_SYMBOL);
     }
 
     const Token* identifier{nullptr};
+    SymbolId symbol{NO_SYMBOL};
     Expr* initializer{nullptr};
+    //! In the current scope, -1 for a global; see resolve()
+    int32_t slot{-1};
 };
 
 struct BlockStmt : StmtCRTC<BlockStmt>
 {
-    BlockStmt(std::vector<Stmt*> statements) noexcept
-      : statements{std::move(statements)}
+    constexpr
+    BlockStmt(std::span<Stmt*> statements) noexcept
+      : statements{statements}
     {}
 
-    std::vector<Stmt*> statements;
+    std::span<Stmt*> statements;
+    //! Number of variables declared directly in the block; see resolve()
+    int32_t num_slots{0};
 };
 
 struct IfStmt : StmtCRTC<IfStmt>
@@ -176,18 +185,30 @@ struct WhileStmt : StmtCRTC<WhileStmt>
 
 struct FunStmt : StmtCRTC<FunStmt>
 {
-    FunStmt(const Token* name, std::vector<const Token*> params,
-            std::vector<Stmt*> body) noexcept
+    constexpr
+    FunStmt(const Token* name, SymbolId symbol,
+            std::span<const Token*> params, std::span<SymbolId> param_symbols,
+            std::span<Stmt*> body) noexcept
       : name{name}
-      , params{std::move(params)}
-      , body{std::move(body)}
+      , symbol{symbol}
+      , params{params}
+      , param_symbols{param_symbols}
+      , body{body}
     {
         assert(name);
+        assert(symbol != NO_SYMBOL);
+        assert(params.size() == param_symbols.size());
     }
 
     const Token* name;
-    std::vector<const Token*> params;
-    std::vector<Stmt*> body;
+    SymbolId symbol;
+    std::span<const Token*> params;
+    std::span<SymbolId> param_symbols;
+    std::span<Stmt*> body;
+    // Filled in by resolve(). The function's own scope has the parameters
+    // in the first slots, followed by the variables its body declares.
+    int32_t slot{-1};
+    int32_t num_slots{0};
 };
 
 struct ReturnStmt : StmtCRTC<ReturnStmt>
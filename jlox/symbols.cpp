@@ -0,0 +1,84 @@
+#include "symbols.hpp"
+
+#include <cassert>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <absl/container/flat_hash_map.h>
+
+#include <doctest/doctest.h>
+
+namespace
+{
+
+class SymbolTable
+{
+public:
+    SymbolId intern(std::string_view name)
+    {
+        const std::lock_guard lock{m_mutex};
+        if (const auto it = m_ids.find(name); it != m_ids.end()) {
+            return it->second;
+        }
+        const SymbolId symbol = static_cast<SymbolId>(m_names.size());
+        // the deque never moves its strings, so the key stays valid
+        m_ids.emplace(m_names.emplace_back(name), symbol);
+        return symbol;
+    }
+
+    std::string_view name(const SymbolId symbol) const noexcept
+    {
+        const std::lock_guard lock{m_mutex};
+        assert(symbol >= 0 && static_cast<std::size_t>(symbol) < m_names.size());
+        return m_names[symbol];
+    }
+
+private:
+    mutable std::mutex m_mutex;
+    std::deque<std::string> m_names;
+    absl::flat_hash_map<std::string_view, SymbolId> m_ids;
+};
+
+SymbolTable& get_symbol_table() noexcept
+{
+    static SymbolTable table;
+    return table;
+}
+
+} // anonymous namespace
+
+SymbolId intern_symbol(std::string_view name)
+{
+    return get_symbol_table().intern(name);
+}
+
+std::string_view symbol_name(const SymbolId symbol) noexcept
+{
+    return get_symbol_table().name(symbol);
+}
+
+
+TEST_CASE("Symbols")
+{
+    const SymbolId first = intern_symbol("symbols_test_first");
+    const SymbolId second = intern_symbol("symbols_test_second");
+    CHECK(first != second);
+    CHECK(intern_symbol(std::string{"symbols_test_"}.append("first")) == first);
+    CHECK(symbol_name(second) == "symbols_test_second");
+
+    // every thread gets the same ids
+    std::vector<SymbolId> ids(4);
+    std::vector<std::thread> threads;
+    for (std::size_t i = 0; i < ids.size(); ++i) {
+        threads.emplace_back([&ids, i] { ids[i] = intern_symbol("symbols_test_threads"); });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    for (const SymbolId id : ids) {
+        CHECK(id == ids.front());
+    }
+}
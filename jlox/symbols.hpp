@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+
+/**
+ * Dense id of an identifier. Ids are handed out in order of first use and
+ * are the same for equal names in every source of the process, so scopes
+ * from one REPL line still find the names of the next.
+ */
+using SymbolId = int32_t;
+
+//! No symbol, e.g. an empty cache slot
+inline constexpr SymbolId NO_SYMBOL = -1;
+
+//! Id of `name`, a new one if it hasn't been seen before. Thread-safe.
+SymbolId intern_symbol(std::string_view name);
+
+//! The name of `symbol`, valid until the end of the process. Thread-safe.
+std::string_view symbol_name(SymbolId symbol) noexcept;
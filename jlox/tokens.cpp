@@ -1,5 +1,8 @@
 #include "tokens.hpp"
 
+static_assert(Token{TokenType::END_OF_FILE, 7, Token::MAX_LENGTH}.type() == TokenType::END_OF_FILE);
+static_assert(Token{TokenType::END_OF_FILE, 7, Token::MAX_LENGTH}.length() == Token::MAX_LENGTH);
+
 std::string_view token_to_string(const TokenType token_type) noexcept
 {
     std::string_view name = "<unkown>";
@@ -38,22 +38,27 @@ struct fmt::formatter<TokenType> : formatter<std::string_view>
 };
 
 
+/**
+ * Eight bytes: the type shares a word with the length, so tokens longer
+ * than MAX_LENGTH can't be represented.
+ */
 class Token
 {
 public:
+    inline static constexpr int32_t MAX_LENGTH = (1 << 24) - 1;
+
     constexpr
     Token(TokenType token_type, int32_t offset, int32_t length)
       : m_offset{offset}
-      , m_length{length}
-      , m_type{token_type}
+      , m_length_and_type{(static_cast<uint32_t>(length) << 8) | static_cast<uint8_t>(token_type)}
     {
-        assert(offset >= 0 && length >= 0);
+        assert(offset >= 0 && length >= 0 && length <= MAX_LENGTH);
     }
 
     constexpr
     TokenType type() const noexcept
     {
-        return m_type;
+        return static_cast<TokenType>(m_length_and_type & 0xff);
     }
 
     constexpr
@@ -65,22 +70,23 @@ public:
     constexpr
     int32_t length() const noexcept
     {
-        return m_length;
+        return static_cast<int32_t>(m_length_and_type >> 8);
     }
 
     constexpr
     std::string_view lexeme(std::string_view source) const
     {
-        assert(static_cast<size_t>(m_offset + m_length) <= source.size());
-        return source.substr(m_offset, m_length);
+        assert(static_cast<size_t>(m_offset + length()) <= source.size());
+        return source.substr(m_offset, length());
     }
 
 private:
     int32_t m_offset;
-    int32_t m_length;
-    TokenType m_type;
+    uint32_t m_length_and_type;
     // TODO: literal
 };
 
+static_assert(sizeof(Token) == 8);
+
 inline constexpr Token TRUE_TOKEN{TokenType::TRUE, 0, 0};
 inline constexpr Token FALSE_TOKEN{TokenType::FALSE, 0, 0};
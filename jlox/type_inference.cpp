@@ -0,0 +1,329 @@
+#include "type_inference.hpp"
+
+#include <cassert>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include <absl/container/flat_hash_map.h>
+#include <doctest/doctest.h>
+
+#include "expr.hpp"
+#include "stmt.hpp"
+#include "value.hpp"
+
+namespace
+{
+
+//! The types a value may have, one bit per alternative of Value
+using Types = uint32_t;
+
+constexpr Types NIL = 1u << value_index<Nil>;
+constexpr Types BOOLEAN = 1u << value_index<bool>;
+constexpr Types STRING = 1u << value_index<std::string>;
+constexpr Types NUMBER = 1u << value_index<double>;
+constexpr Types CALLABLE = 1u << value_index<Callable>;
+constexpr Types ANY = (1u << std::variant_size_v<Value>) - 1;
+
+/*
+ * Follows the scopes of Resolver. Every declaration and assignment adds
+ * the types of its value to those of its slot, until no slot gains a
+ * type. An expression that always fails adds none.
+ */
+class TypeInference final : public ExprVisitor
+                          , public StmtVisitor
+{
+public:
+    void infer(std::span<Stmt* const> statements)
+    {
+        do {
+            m_changed = false;
+            infer_all(statements);
+        } while (m_changed);
+
+        m_mark = true;
+        infer_all(statements);
+    }
+
+    void visit(BinaryExpr& binary_expr) override
+    {
+        const Types left = infer(*binary_expr.left);
+        const Types right = infer(*binary_expr.right);
+        if (m_mark && left == NUMBER && right == NUMBER) {
+            binary_expr.mark_check_free();
+        }
+
+        switch (binary_expr.op->type()) {
+        case TokenType::PLUS:
+            m_types = (left & right & NUMBER) | (left & right & STRING);
+            break;
+        case TokenType::MINUS:
+        case TokenType::SLASH:
+        case TokenType::STAR:
+            m_types = NUMBER;
+            break;
+        default:
+            m_types = BOOLEAN;
+            break;
+        }
+    }
+
+    void visit(GroupingExpr& grouping_expr) override
+    {
+        m_types = infer(*grouping_expr.expr);
+    }
+
+    void visit(LiteralExpr& literal_expr) override
+    {
+        m_types = 1u << literal_expr.constant->index();
+    }
+
+    void visit(UnaryExpr& unary_expr) override
+    {
+        const Types operand = infer(*unary_expr.right);
+        if (unary_expr.op->type() == TokenType::BANG) {
+            m_types = BOOLEAN;
+            return;
+        }
+        if (m_mark && operand == NUMBER) {
+            unary_expr.mark_check_free();
+        }
+        m_types = NUMBER;
+    }
+
+    void visit(VarExpr& var_expr) override
+    {
+        const Resolution resolution = var_expr.resolution;
+        m_types = resolution.depth == GLOBAL_DEPTH ? ANY : m_slots[slot(resolution)];
+    }
+
+    void visit(AssignExpr& assign_expr) override
+    {
+        const Types value = infer(*assign_expr.value);
+        const Resolution resolution = assign_expr.resolution;
+        if (resolution.depth != GLOBAL_DEPTH) {
+            add(slot(resolution), value);
+        }
+        m_types = value;
+    }
+
+    void visit(LogicalExpr& logical_expr) override
+    {
+        // The Interpreter gives the truth of the operand, not the operand
+        infer(*logical_expr.left);
+        infer(*logical_expr.right);
+        m_types = BOOLEAN;
+    }
+
+    void visit(CallExpr& call_expr) override
+    {
+        infer(*call_expr.callee);
+        for (Expr* const arg : call_expr.args) {
+            infer(*arg);
+        }
+        m_types = ANY;
+    }
+
+    void unkown_expr(Expr& /*expr*/) override
+    {
+        assert(false);
+    }
+
+    bool visit(ExprStmt& expr_stmt) override
+    {
+        infer(*expr_stmt.expr);
+        return false;
+    }
+
+    bool visit(PrintStmt& print_stmt) override
+    {
+        infer(*print_stmt.expr);
+        return false;
+    }
+
+    bool visit(VarStmt& var_stmt) override
+    {
+        const Types value = var_stmt.initializer ? infer(*var_stmt.initializer) : NIL;
+        if (var_stmt.slot != -1) {
+            add({m_scopes.back(), var_stmt.slot}, value);
+        }
+        return false;
+    }
+
+    bool visit(BlockStmt& block_stmt) override
+    {
+        m_scopes.push_back(&block_stmt);
+        infer_all(block_stmt.statements);
+        m_scopes.pop_back();
+        return false;
+    }
+
+    bool visit(IfStmt& if_stmt) override
+    {
+        infer(*if_stmt.condition);
+        static_cast<void>(if_stmt.then_branch->accept(*this));
+        if (if_stmt.else_branch) {
+            static_cast<void>(if_stmt.else_branch->accept(*this));
+        }
+        return false;
+    }
+
+    bool visit(WhileStmt& while_stmt) override
+    {
+        infer(*while_stmt.condition);
+        static_cast<void>(while_stmt.body->accept(*this));
+        return false;
+    }
+
+    bool visit(FunStmt& fun_stmt) override
+    {
+        if (fun_stmt.slot != -1) {
+            add({m_scopes.back(), fun_stmt.slot}, CALLABLE);
+        }
+        m_scopes.push_back(&fun_stmt);
+        for (std::size_t param = 0; param < fun_stmt.params.size(); ++param) {
+            add({&fun_stmt, static_cast<int32_t>(param)}, ANY);
+        }
+        infer_all(fun_stmt.body);
+        m_scopes.pop_back();
+        return false;
+    }
+
+    bool visit(ReturnStmt& return_stmt) override
+    {
+        if (return_stmt.expr) {
+            infer(*return_stmt.expr);
+        }
+        return false;
+    }
+
+    void unkown_stmt(Stmt& /*stmt*/) override
+    {
+        assert(false);
+    }
+
+private:
+    //! A local variable: the BlockStmt or FunStmt of its scope, and its slot there
+    using Slot = std::pair<const void*, int32_t>;
+
+    void infer_all(std::span<Stmt* const> statements)
+    {
+        for (Stmt* const stmt : statements) {
+            static_cast<void>(stmt->accept(*this));
+        }
+    }
+
+    Types infer(Expr& expr)
+    {
+        expr.accept(*this);
+        return m_types;
+    }
+
+    Slot slot(const Resolution resolution) const noexcept
+    {
+        assert(resolution.depth != GLOBAL_DEPTH);
+        return {m_scopes[m_scopes.size() - 1 - static_cast<std::size_t>(resolution.depth)], resolution.slot};
+    }
+
+    void add(const Slot& slot, const Types types)
+    {
+        Types& slot_types = m_slots[slot];
+        if ((slot_types | types) != slot_types) {
+            slot_types |= types;
+            m_changed = true;
+        }
+    }
+
+    // the owners of the enclosing local scopes, innermost last
+    std::vector<const void*> m_scopes;
+    absl::flat_hash_map<Slot, Types> m_slots;
+    //! Of the last expression inferred
+    Types m_types{ANY};
+    bool m_changed{false};
+    bool m_mark{false};
+};
+
+} // anonymous namespace
+
+
+void infer_types(std::span<Stmt* const> statements)
+{
+    TypeInference{}.infer(statements);
+}
+
+
+#include "bump_alloc.hpp"
+#include "constant_pool.hpp"
+#include "parser.hpp"
+#include "resolver.hpp"
+#include "scanner.hpp"
+
+TEST_CASE("Type inference")
+{
+    //! Which visit an expression's accept() calls
+    struct Visitor final : ExprVisitor
+    {
+        void visit(BinaryExpr&) override { is_check_free = false; }
+        void visit(GroupingExpr&) override {}
+        void visit(LiteralExpr&) override {}
+        void visit(UnaryExpr&) override { is_check_free = false; }
+        void visit(VarExpr&) override {}
+        void visit(AssignExpr&) override {}
+        void visit(LogicalExpr&) override {}
+        void visit(CallExpr&) override {}
+        void unkown_expr(Expr&) override {}
+        void visit_check_free(BinaryExpr&) override { is_check_free = true; }
+        void visit_check_free(UnaryExpr&) override { is_check_free = true; }
+
+        bool is_check_free{false};
+    };
+
+    const ScannerResult scanned = scan_tokens(
+        "var g = 1;\n"
+        "{\n"
+        "    var i = 0;\n"
+        "    var s = \"a\";\n"
+        "    while (i < 10) i = -i + i * 2 + 1;\n"
+        "    s = s + \"b\";\n"
+        "    var m = 1;\n"
+        "    m = s;\n"
+        "    m - 1;\n"
+        "    g - 1;\n"
+        "    fun f(p) { return p * i; }\n"
+        "}\n");
+    REQUIRE(scanned.num_errors == 0);
+    BumpAlloc alloc;
+    ConstantPool constants;
+    const std::vector<Stmt*> statements = parse(alloc, constants, scanned);
+    REQUIRE(statements.size() == 2);
+    resolve(statements);
+    infer_types(statements);
+
+    const BlockStmt& block = *static_cast<BlockStmt*>(statements[1]);
+    REQUIRE(block.statements.size() == 9);
+    Visitor visitor;
+    const auto is_check_free = [&] (Expr& expr) {
+        visitor.is_check_free = false;
+        expr.accept(visitor);
+        return visitor.is_check_free;
+    };
+
+    // i is only ever a number, also where the loop assigns it
+    const WhileStmt& loop = *static_cast<WhileStmt*>(block.statements[2]);
+    CHECK(is_check_free(*loop.condition));
+    const AssignExpr& step = *static_cast<AssignExpr*>(static_cast<ExprStmt*>(loop.body)->expr);
+    BinaryExpr& plus_one = *static_cast<BinaryExpr*>(step.value);
+    BinaryExpr& sum = *static_cast<BinaryExpr*>(plus_one.left);
+    CHECK(is_check_free(plus_one));
+    CHECK(is_check_free(sum));
+    CHECK(is_check_free(*sum.left));
+    CHECK(is_check_free(*sum.right));
+
+    // strings, a variable that was both, globals and parameters keep their checks
+    const AssignExpr& concat = *static_cast<AssignExpr*>(static_cast<ExprStmt*>(block.statements[3])->expr);
+    CHECK(is_check_free(*concat.value) == false);
+    CHECK(is_check_free(*static_cast<ExprStmt*>(block.statements[6])->expr) == false);
+    CHECK(is_check_free(*static_cast<ExprStmt*>(block.statements[7])->expr) == false);
+    const FunStmt& f = *static_cast<FunStmt*>(block.statements[8]);
+    CHECK(is_check_free(*static_cast<ReturnStmt*>(f.body[0])->expr) == false);
+}
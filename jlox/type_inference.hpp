@@ -0,0 +1,15 @@
+#pragma once
+
+#include <span>
+
+class Stmt;
+
+/**
+ * Proves which operands of resolved `statements` can only be numbers:
+ * number literals, results of arithmetic, and locals that every
+ * declaration and assignment gives a number. Binary and unary operations
+ * on such operands are marked check free, and the Interpreter skips the
+ * type checks there. Parameters, globals and call results are never
+ * proven, anything can pass or assign them.
+ */
+void infer_types(std::span<Stmt* const> statements);
@@ -2,16 +2,18 @@
 
 #include <doctest/doctest.h>
 
+#include "scan_kernels.hpp"
+
 static
 UTF8Char utf8decodewide(const uint32_t initial, const int8_t count, std::string_view text)
 {
     uint32_t acc = initial;
-    if (static_cast<size_t>(count) >= text.size()) {
+    if (static_cast<size_t>(count) > text.size()) {
         return {'\0', -1};
     }
 
     for (int8_t i = 1; i < count; ++i) {
-        const uint8_t c = static_cast<uint8_t>(text[1]);
+        const uint8_t c = static_cast<uint8_t>(text[i]);
         if ((c & 0b11000000) != 0b10000000) {
             return {'\0', 1};
         }
@@ -47,6 +49,12 @@ UTF8Char parse_utf8_char(std::string_view text) noexcept
     return {'\0', -1};
 }
 
+bool is_valid_utf8(std::string_view text) noexcept
+{
+    static const ValidateUtf8Fn validate = get_utf8_validator(detect_simd_level());
+    return validate(text.data(), text.size());
+}
+
 
 TEST_CASE("UTF-8 decode")
 {
@@ -70,5 +78,12 @@ TEST_CASE("UTF-8 decode")
         CHECK(c.c == 'b');
         lorem_ipsum.remove_prefix(c.length);
     }
+    {
+        // the last character of the text, and a bad third byte
+        CHECK(parse_utf8_char("\u20ac").c == 0x20ac);
+        CHECK(parse_utf8_char("\u20ac").length == 3);
+        CHECK(parse_utf8_char("\xe2\x82").length < 0);
+        CHECK(parse_utf8_char("\xe2\x82x").c == '\0');
+    }
 
 }
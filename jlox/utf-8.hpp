@@ -13,3 +13,9 @@ struct UTF8Char
  * Parse utf-8 character
  */
 UTF8Char parse_utf8_char(std::string_view text) noexcept;
+
+/**
+ * Whether all of `text` is well-formed UTF-8, checked a block at a time
+ * with the best SIMD level the CPU supports.
+ */
+bool is_valid_utf8(std::string_view text) noexcept;
@@ -0,0 +1,65 @@
+#include "value.hpp"
+
+#include <cstdlib>
+
+#include <fmt/format.h>
+
+bool is_truthy(const Value& value) noexcept
+{
+    if (const bool* const b = std::get_if<bool>(&value)) {
+        return *b;
+    }
+    if (const std::string* const s = std::get_if<std::string>(&value)) {
+        return s->empty() == false;
+    }
+    if (const double* const d = std::get_if<double>(&value)) {
+        return *d != 0.;
+    }
+    if (std::get_if<Nil>(&value)) {
+        return false;
+    }
+    std::abort();
+}
+
+bool is_equal(const Value& lhs, const Value& rhs) noexcept
+{
+#define CHECK(Type) if (const Type* const l = std::get_if<Type>(&lhs), * const r = std::get_if<Type>(&rhs); l && r) { return *l == *r; }
+    CHECK(Nil)
+    CHECK(bool)
+    CHECK(std::string)
+    CHECK(double)
+#undef CHECK
+    return false;
+}
+
+std::string_view type_name(const Value& value) noexcept
+{
+    if (std::get_if<std::string>(&value)) {
+        return type_name<std::string>();
+    }
+    if (std::get_if<double>(&value)) {
+        return type_name<double>();
+    }
+    if (std::get_if<bool>(&value)) {
+        return type_name<bool>();
+    }
+    if (std::get_if<Nil>(&value)) {
+        return type_name<Nil>();
+    }
+    std::abort();
+}
+
+std::string stringify(const Value& value)
+{
+    if (std::get_if<Nil>(&value)) {
+        return "nil";
+    } else if (const double* const d = std::get_if<double>(&value)) {
+        return fmt::to_string(*d);
+    } else if (const std::string* const s = std::get_if<std::string>(&value)) {
+        return *s;
+    } else if (const bool* const b = std::get_if<bool>(&value)) {
+        return (*b ? "true\n" : "false\n");
+    } else {
+        std::abort();
+    }
+}
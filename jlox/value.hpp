@@ -3,7 +3,10 @@
 #include <variant>
 #include <span>
 #include <cassert>
+#include <cstddef>
 #include <string>
+#include <type_traits>
+#include <string_view>
 #include <functional>
 
 #include "garbage_collected_heap.hpp"
@@ -13,6 +16,11 @@ class Interpreter;
 class Callable;
 class Environment;
 
+namespace bytecode
+{
+struct Function;
+} // namespace bytecode
+
 
 struct Nil
 {
@@ -25,6 +33,27 @@ inline constexpr Nil nil;
 
 using Value = std::variant<Nil, bool, std::string, double, Callable>;
 
+namespace detail
+{
+
+template <typename T, typename... Ts>
+constexpr
+std::size_t value_index(std::variant<Ts...>*) noexcept
+{
+    constexpr bool matches[]{std::is_same_v<T, Ts>...};
+    std::size_t index{0};
+    while (index < sizeof...(Ts) && !matches[index]) {
+        ++index;
+    }
+    return index;
+}
+
+} // namespace detail
+
+//! Of T among the alternatives of Value, as Value::index() reports it
+template <typename T>
+inline constexpr std::size_t value_index = detail::value_index<T>(static_cast<Value*>(nullptr));
+
 class Callable
 {
 public:
@@ -37,7 +66,7 @@ public:
     {
         m_env = std::move(environment);
         m_arity = sizeof...(Args);
-        m_f = [fptr=fptr] (Interpreter&, const HeapPtr<Environment>&, std::span<const Value> args) -> Value {
+        m_f = [fptr=fptr] (Interpreter*, const HeapPtr<Environment>&, std::span<const Value> args) -> Value {
             return invoke(fptr, args, std::make_index_sequence<sizeof...(Args)>{});
         };
     }
@@ -50,13 +79,33 @@ public:
       , m_arity{arity}
     {}
 
+    //! A function compiled to bytecode, the Vm runs it instead of calling it
+    explicit
+    Callable(const bytecode::Function* function, int32_t arity, HeapPtr<Environment> environment)
+      : m_env{std::move(environment)}
+      , m_function{function}
+      , m_arity{arity}
+    {}
+
     int32_t arity() const noexcept
     {
         return m_arity;
     }
 
-    Value call(Interpreter& interpreter, std::span<const Value> args)
+    const bytecode::Function* function() const noexcept
+    {
+        return m_function;
+    }
+
+    const HeapPtr<Environment>& environment() const noexcept
     {
+        return m_env;
+    }
+
+    //! `interpreter` is null outside the Interpreter, which only its own functions use
+    Value call(Interpreter* interpreter, std::span<const Value> args)
+    {
+        assert(m_f);
         return m_f(interpreter, m_env, args);
     }
 
@@ -72,6 +121,50 @@ private:
     }
 
     HeapPtr<Environment> m_env;
-    std::function<Value(Interpreter&, const HeapPtr<Environment>&, std::span<const Value>)> m_f;
+    std::function<Value(Interpreter*, const HeapPtr<Environment>&, std::span<const Value>)> m_f;
+    const bytecode::Function* m_function{nullptr};
     int32_t m_arity{-1};
 };
+
+
+bool is_truthy(const Value& value) noexcept;
+
+//! Values of different types are never equal, nor are two functions
+bool is_equal(const Value& lhs, const Value& rhs) noexcept;
+
+template <typename T>
+constexpr
+std::string_view type_name() noexcept;
+
+template <>
+constexpr
+std::string_view type_name<double>() noexcept
+{
+    return "number";
+}
+
+template <>
+constexpr
+std::string_view type_name<std::string>() noexcept
+{
+    return "string";
+}
+
+template <>
+constexpr
+std::string_view type_name<Nil>() noexcept
+{
+    return "nil";
+}
+
+template <>
+constexpr
+std::string_view type_name<bool>() noexcept
+{
+    return "boolean";
+}
+
+std::string_view type_name(const Value& value) noexcept;
+
+//! How print shows `value`
+std::string stringify(const Value& value);
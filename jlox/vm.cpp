@@ -0,0 +1,454 @@
+#include "vm.hpp"
+
+#include <cassert>
+#include <cstdlib>
+#include <memory>
+#include <span>
+#include <string>
+
+#include <fmt/format.h>
+
+#include "log.hpp"
+#include "scanner.hpp"
+
+// GCC and Clang can jump to the address of a label. Each instruction then
+// ends in its own indirect jump to the next one, which predicts better than
+// the single jump of a switch.
+#if defined(__GNUC__)
+#define JLOX_COMPUTED_GOTO 1
+#else
+#define JLOX_COMPUTED_GOTO 0
+#endif
+
+namespace
+{
+
+inline
+uint16_t read_operand(const uint8_t*& ip) noexcept
+{
+    const uint16_t operand = static_cast<uint16_t>(ip[0] | (ip[1] << 8));
+    ip += 2;
+    return operand;
+}
+
+} // anonymous namespace
+
+void Vm::StackDeleter::operator()(Value* const stack) const noexcept
+{
+    std::allocator<Value>{}.deallocate(stack, STACK_SIZE);
+}
+
+Vm::~Vm() = default;
+
+Vm::Vm(const ScannerResult& scanner_result, Globals& globals)
+  : m_stack{std::allocator<Value>{}.allocate(STACK_SIZE)}
+  , m_frames{}
+  , m_environment{}
+  , m_scanner_result{scanner_result}
+  , m_globals{globals}
+{
+    define_natives(*m_globals.global_environment());
+}
+
+bool Vm::execute(const bytecode::Function& statement)
+{
+    assert(m_frames.empty());
+    assert(statement.arity == 0 && statement.max_stack < STACK_SIZE);
+    // the slot of the callee
+    Value* const slots = std::construct_at(m_stack.get(), nil) + 1;
+    m_frames.push_back({&statement, statement.code.data(), slots, nullptr});
+    return run();
+}
+
+void Vm::unwind(Value* const sp) noexcept
+{
+    std::destroy(m_stack.get(), sp);
+    m_frames.clear();
+    m_environment.reset();
+}
+
+bool Vm::run()
+{
+    using bytecode::OpCode;
+
+    Frame* frame = &m_frames.back();
+    const bytecode::Function* function = frame->function;
+    const uint8_t* ip = frame->ip;
+    Value* slots = frame->slots;
+    Value* sp = slots + function->arity;
+    Value* const stack_end = m_stack.get() + STACK_SIZE;
+    Environment& globals = *m_globals.global_environment();
+
+    const auto error_site = [&] () -> const bytecode::ErrorSite& {
+        return function->error_site(static_cast<int32_t>(ip - function->code.data()));
+    };
+
+    const auto report_not_a_number = [&] (const Value& value, const Token* token) {
+        report_error(m_scanner_result, *token, "Expected operand of type {}, got {}.",
+                     type_name<double>(), type_name(value));
+    };
+
+#if JLOX_COMPUTED_GOTO
+    static const void* const DISPATCH_TABLE[]{
+#define JLOX_LABEL_ADDRESS(name) &&op_##name,
+        JLOX_OPCODES(JLOX_LABEL_ADDRESS)
+#undef JLOX_LABEL_ADDRESS
+    };
+#define DISPATCH() goto *DISPATCH_TABLE[*ip++]
+#define TARGET(name) case OpCode::name: op_##name
+#else
+#define DISPATCH() continue
+#define TARGET(name) case OpCode::name
+#endif
+
+    // Both operands are numbers, so the one popped needs no destructor.
+#define NUMBER_OPERATOR(name, op) \
+    TARGET(name): { \
+        const double* const lhs = std::get_if<double>(sp - 2); \
+        const double* const rhs = std::get_if<double>(sp - 1); \
+        if (!lhs || !rhs) [[unlikely]] { \
+            const bytecode::ErrorSite& site = error_site(); \
+            report_not_a_number(lhs ? sp[-1] : sp[-2], lhs ? site.right : site.token); \
+            goto error; \
+        } \
+        sp[-2] = *lhs op *rhs; \
+        --sp; \
+        DISPATCH(); \
+    }
+
+    try {
+        for (;;) {
+#if JLOX_COMPUTED_GOTO
+            DISPATCH();
+#endif
+            switch (static_cast<OpCode>(*ip++)) {
+            TARGET(CONSTANT):
+                std::construct_at(sp++, function->constants[read_operand(ip)]);
+                DISPATCH();
+
+            TARGET(NIL):
+                std::construct_at(sp++, nil);
+                DISPATCH();
+
+            TARGET(TRUE):
+                std::construct_at(sp++, true);
+                DISPATCH();
+
+            TARGET(FALSE):
+                std::construct_at(sp++, false);
+                DISPATCH();
+
+            TARGET(POP):
+                std::destroy_at(--sp);
+                DISPATCH();
+
+            TARGET(POP_N): {
+                const uint16_t count = read_operand(ip);
+                std::destroy(sp - count, sp);
+                sp -= count;
+                DISPATCH();
+            }
+
+            TARGET(GET_LOCAL):
+                std::construct_at(sp, slots[read_operand(ip)]);
+                ++sp;
+                DISPATCH();
+
+            TARGET(SET_LOCAL):
+                slots[read_operand(ip)] = sp[-1];
+                DISPATCH();
+
+            TARGET(GET_CAPTURED): {
+                const uint16_t depth = read_operand(ip);
+                const uint16_t slot = read_operand(ip);
+                std::construct_at(sp++, m_environment->slot(depth, slot));
+                DISPATCH();
+            }
+
+            TARGET(SET_CAPTURED): {
+                const uint16_t depth = read_operand(ip);
+                const uint16_t slot = read_operand(ip);
+                m_environment->slot(depth, slot) = sp[-1];
+                DISPATCH();
+            }
+
+            TARGET(DEFINE_CAPTURED): {
+                const uint16_t slot = read_operand(ip);
+                const SymbolId symbol = function->symbols[read_operand(ip)];
+                m_environment->define_slot(slot, symbol, std::move(sp[-1]));
+                std::destroy_at(--sp);
+                DISPATCH();
+            }
+
+            TARGET(GET_GLOBAL): {
+                const Value* const value = globals.get(function->symbols[read_operand(ip)]);
+                if (!value) [[unlikely]] {
+                    report_error(m_scanner_result, *error_site().token, "Identifier not found");
+                    goto error;
+                }
+                std::construct_at(sp++, *value);
+                DISPATCH();
+            }
+
+            TARGET(SET_GLOBAL):
+                if (!globals.assign(function->symbols[read_operand(ip)], sp[-1])) [[unlikely]] {
+                    const Token* const token = error_site().token;
+                    report_error(m_scanner_result, *token, "Undefined variable '{}'.",
+                                 token->lexeme(m_scanner_result.source));
+                    goto error;
+                }
+                DISPATCH();
+
+            TARGET(DEFINE_GLOBAL):
+                globals.define(function->symbols[read_operand(ip)], std::move(sp[-1]));
+                std::destroy_at(--sp);
+                DISPATCH();
+
+            TARGET(EQUAL): {
+                const bool equal = is_equal(sp[-2], sp[-1]);
+                std::destroy_at(--sp);
+                sp[-1] = equal;
+                DISPATCH();
+            }
+
+            TARGET(NOT_EQUAL): {
+                const bool equal = is_equal(sp[-2], sp[-1]);
+                std::destroy_at(--sp);
+                sp[-1] = !equal;
+                DISPATCH();
+            }
+
+            NUMBER_OPERATOR(GREATER, >)
+            NUMBER_OPERATOR(GREATER_EQUAL, >=)
+            NUMBER_OPERATOR(LESS, <)
+            NUMBER_OPERATOR(LESS_EQUAL, <=)
+            NUMBER_OPERATOR(SUBTRACT, -)
+            NUMBER_OPERATOR(MULTIPLY, *)
+            NUMBER_OPERATOR(DIVIDE, /)
+
+            TARGET(ADD): {
+                if (double* const lhs = std::get_if<double>(sp - 2)) {
+                    if (const double* const rhs = std::get_if<double>(sp - 1)) {
+                        *lhs += *rhs;
+                        --sp;
+                        DISPATCH();
+                    }
+                } else if (std::string* const lhs = std::get_if<std::string>(sp - 2)) {
+                    if (const std::string* const rhs = std::get_if<std::string>(sp - 1)) {
+                        *lhs += *rhs;
+                        std::destroy_at(--sp);
+                        DISPATCH();
+                    }
+                }
+                report_error(m_scanner_result, *error_site().token,
+                             "Operands to (+) must be two numbers or two strings. Got {} and {}.",
+                             type_name(sp[-2]), type_name(sp[-1]));
+                goto error;
+            }
+
+            TARGET(NOT):
+                sp[-1] = !is_truthy(sp[-1]);
+                DISPATCH();
+
+            TARGET(NEGATE): {
+                double* const value = std::get_if<double>(sp - 1);
+                if (!value) [[unlikely]] {
+                    report_not_a_number(sp[-1], error_site().token);
+                    goto error;
+                }
+                *value = -*value;
+                DISPATCH();
+            }
+
+            TARGET(TO_BOOL):
+                sp[-1] = is_truthy(sp[-1]);
+                DISPATCH();
+
+            TARGET(PRINT):
+                if (const std::string* const s = std::get_if<std::string>(sp - 1)) {
+                    fmt::print(" :: {}\n", *s);
+                } else {
+                    fmt::print(" :: {}\n", stringify(sp[-1]));
+                }
+                std::destroy_at(--sp);
+                DISPATCH();
+
+            TARGET(JUMP): {
+                const uint16_t offset = read_operand(ip);
+                ip += offset;
+                DISPATCH();
+            }
+
+            TARGET(JUMP_IF_FALSE): {
+                const uint16_t offset = read_operand(ip);
+                const bool condition = is_truthy(sp[-1]);
+                std::destroy_at(--sp);
+                if (!condition) {
+                    ip += offset;
+                }
+                DISPATCH();
+            }
+
+            TARGET(LOOP): {
+                const uint16_t offset = read_operand(ip);
+                ip -= offset;
+                DISPATCH();
+            }
+
+            TARGET(CALL): {
+                const uint16_t num_args = read_operand(ip);
+                Value* const callee = sp - num_args - 1;
+                Callable* const callable = std::get_if<Callable>(callee);
+                if (!callable) [[unlikely]] {
+                    report_error(m_scanner_result, *error_site().token, "Value not callable");
+                    goto error;
+                }
+                if (num_args != callable->arity()) [[unlikely]] {
+                    report_error(m_scanner_result, *error_site().token, "Expected {} arguments but got {}.",
+                                 callable->arity(), num_args);
+                    goto error;
+                }
+
+                if (const bytecode::Function* const called = callable->function()) {
+                    if (stack_end - (sp - num_args) < called->max_stack) [[unlikely]] {
+                        report_error(m_scanner_result, *error_site().token, "Stack overflow.");
+                        goto error;
+                    }
+                    frame->ip = ip;
+                    m_frames.push_back({called, nullptr, sp - num_args, std::move(m_environment)});
+                    m_environment = callable->environment();
+                    frame = &m_frames.back();
+                    function = called;
+                    ip = called->code.data();
+                    slots = frame->slots;
+                    DISPATCH();
+                }
+
+                Value result = callable->call(nullptr, std::span<const Value>{sp - num_args, num_args});
+                std::destroy(callee, sp);
+                sp = callee;
+                std::construct_at(sp++, std::move(result));
+                DISPATCH();
+            }
+
+            TARGET(CLOSURE): {
+                const bytecode::Function* const closure = function->functions[read_operand(ip)];
+                std::construct_at(sp++, std::in_place_type<Callable>, closure, closure->arity, m_environment);
+                DISPATCH();
+            }
+
+            TARGET(OPEN_SCOPE): {
+                const uint16_t num_slots = read_operand(ip);
+                HeapPtr<Environment> environment = Heap::allocate<Environment>(m_environment);
+                // not in the constructor, the heap can't allocate while it constructs
+                environment->reserve(num_slots);
+                m_environment = std::move(environment);
+                DISPATCH();
+            }
+
+            TARGET(CLOSE_SCOPE):
+                m_environment = m_environment->parent();
+                DISPATCH();
+
+            TARGET(RETURN): {
+                Value result{std::move(sp[-1])};
+                // including the callee
+                std::destroy(slots - 1, sp);
+                sp = slots - 1;
+                m_environment = std::move(frame->caller_environment);
+                m_frames.pop_back();
+                if (m_frames.empty()) {
+                    return true;
+                }
+                std::construct_at(sp++, std::move(result));
+                frame = &m_frames.back();
+                function = frame->function;
+                ip = frame->ip;
+                slots = frame->slots;
+                DISPATCH();
+            }
+            }
+            std::abort();
+        }
+    } catch (...) {
+        unwind(sp);
+        throw;
+    }
+
+error:
+    unwind(sp);
+    return false;
+
+#undef NUMBER_OPERATOR
+#undef TARGET
+#undef DISPATCH
+}
+
+
+#include <doctest/doctest.h>
+
+#include "bump_alloc.hpp"
+#include "constant_pool.hpp"
+#include "parser.hpp"
+#include "resolver.hpp"
+
+TEST_CASE("Vm")
+{
+    const ScannerResult scanned = scan_tokens(
+        "fun fib(n) { if (n < 2) return n; return fib(n - 1) + fib(n - 2); }\n"
+        "var vm_fib = fib(15);\n"
+        "fun make_counter() { var i = 0; fun count() { i = i + 1; return i; } return count; }\n"
+        "var counter = make_counter();\n"
+        "counter();\n"
+        "var vm_count = counter();\n"
+        "var vm_sum = 0;\n"
+        "{\n"
+        "    var a = 1;\n"
+        "    var a = 2;\n"
+        "    for (var i = 0; i < 4; i = i + 1) { var half = i / 2; vm_sum = vm_sum + half + a; }\n"
+        "}\n"
+        "var vm_first;\n"
+        "var vm_second;\n"
+        "for (var i = 1; i < 3; i = i + 1) {\n"
+        "    var j = i;\n"
+        "    fun get() { return j; }\n"
+        "    if (j == 1) vm_first = get; else vm_second = get;\n"
+        "}\n"
+        "var vm_captured = vm_first() * 10 + vm_second();\n"
+        "var vm_string = \"\";\n"
+        "{ var s = \"x\"; fun add(t) { s = s + t; vm_string = s; } add(\"y\"); add(\"z\"); }\n"
+        "var vm_logic = (1 and nil) or \"yes\";\n"
+        "vm_missing;\n"
+        "var vm_after_error = -vm_fib;\n");
+    REQUIRE(scanned.num_errors == 0);
+    BumpAlloc alloc;
+    ConstantPool constants;
+    const std::vector<Stmt*> statements = parse(alloc, constants, scanned);
+    REQUIRE(statements.empty() == false);
+    resolve(statements);
+    const std::optional<bytecode::Program> program = bytecode::compile(scanned, statements);
+    REQUIRE(program.has_value());
+    REQUIRE(program->statements.size() == statements.size());
+
+    Globals globals;
+    Vm vm{scanned, globals};
+    int32_t num_errors{0};
+    for (const bytecode::Function* const statement : program->statements) {
+        num_errors += !vm.execute(*statement);
+    }
+    CHECK(num_errors == 1);
+
+    const Environment& env = *globals.global_environment();
+    const auto global = [&] (std::string_view name) {
+        const Value* const value = env.get(intern_symbol(name));
+        REQUIRE(value != nullptr);
+        return *value;
+    };
+    CHECK(std::get<double>(global("vm_fib")) == 610.);
+    CHECK(std::get<double>(global("vm_count")) == 2.);
+    CHECK(std::get<double>(global("vm_sum")) == 11.);
+    CHECK(std::get<double>(global("vm_captured")) == 12.);
+    CHECK(std::get<std::string>(global("vm_string")) == "xyz");
+    CHECK(std::get<bool>(global("vm_logic")) == true);
+    CHECK(std::get<double>(global("vm_after_error")) == -610.);
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "bytecode.hpp"
+#include "environment.hpp"
+#include "value.hpp"
+
+struct ScannerResult;
+
+/**
+ * Runs the bytecode of bytecode::compile() on a stack of values, an
+ * alternative to the Interpreter with the same globals and output.
+ */
+class Vm
+{
+public:
+    Vm(const ScannerResult& scanner_result, Globals& globals);
+    ~Vm();
+
+    Vm(const Vm&) = delete;
+    Vm& operator=(const Vm&) = delete;
+
+    //! Runs one statement of a Program, false after a runtime error
+    [[nodiscard]]
+    bool execute(const bytecode::Function& statement);
+
+private:
+    //! Values on the stack, for all frames together
+    inline static constexpr std::ptrdiff_t STACK_SIZE = 1 << 16;
+
+    struct Frame
+    {
+        const bytecode::Function* function;
+        //! Where the frame continues after a call returns
+        const uint8_t* ip;
+        //! The arguments, followed by the local variables
+        Value* slots;
+        HeapPtr<Environment> caller_environment;
+    };
+
+    struct StackDeleter
+    {
+        void operator()(Value* stack) const noexcept;
+    };
+
+    [[nodiscard]]
+    bool run();
+
+    void unwind(Value* sp) noexcept;
+
+    // uninitialized beyond the top
+    std::unique_ptr<Value, StackDeleter> m_stack;
+    std::vector<Frame> m_frames;
+    //! Of the innermost scope with captured variables, null at top level
+    HeapPtr<Environment> m_environment;
+    const ScannerResult& m_scanner_result;
+    Globals& m_globals;
+};